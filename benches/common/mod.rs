@@ -0,0 +1,180 @@
+//! 基准测试共用的数据集、ground truth 与统计
+//!
+//! 数据集来源:
+//! - 默认: 固定种子生成的聚类向量 (归一化，内积相似度)，规模由 BENCH_ITEMS / BENCH_QUERIES / BENCH_DIM 控制
+//! - `BENCH_DATASET=<dir>`: ann-benchmarks 风格的数据集，目录中为 `base.fvecs` 与 `query.fvecs`
+//!   (texmex 格式: 每行 `u32 维度 + dim 个 f32`，HDF5 文件需先导出为该格式)。
+//!   向量在加载时归一化，因此 angular 数据集 (如 glove) 与内积索引的结果一致；
+//!   ground truth 总是在归一化后的向量上重新精确计算
+
+use crate::ffi::{recommend_recall_batch, EmbeddingStore};
+use std::collections::HashSet;
+use std::path::Path;
+use std::time::Duration;
+
+pub const DEFAULT_DIM: usize = 384;
+
+pub struct Dataset {
+    pub name: String,
+    pub dim: usize,
+    /// n x dim，第 i 行的 id 为 i
+    pub base: Vec<f32>,
+    /// nq x dim
+    pub queries: Vec<f32>,
+}
+
+impl Dataset {
+    /// 按环境变量选择数据集 (见模块文档)
+    pub fn from_env() -> Self {
+        match std::env::var("BENCH_DATASET") {
+            Ok(dir) => Self::load_fvecs(Path::new(&dir)).unwrap_or_else(|e| panic!("BENCH_DATASET={}: {}", dir, e)),
+            Err(_) => Self::synthetic(
+                env_usize("BENCH_ITEMS", 20_000),
+                env_usize("BENCH_QUERIES", 500),
+                env_usize("BENCH_DIM", DEFAULT_DIM),
+            ),
+        }
+    }
+
+    /// n 个物品与 nq 个查询，来自同一组 64 个聚类中心
+    pub fn synthetic(n: usize, nq: usize, dim: usize) -> Self {
+        let mut rng = SplitMix64(42);
+        let centers: Vec<f32> = (0..64 * dim).map(|_| rng.normal()).collect();
+        let mut rows = Vec::with_capacity((n + nq) * dim);
+        for _ in 0..n + nq {
+            let center = &centers[(rng.next() % 64) as usize * dim..][..dim];
+            let start = rows.len();
+            rows.extend(center.iter().map(|&c| c + 0.5 * rng.normal()));
+            normalize(&mut rows[start..]);
+        }
+        let queries = rows.split_off(n * dim);
+        Self { name: format!("synthetic-{}x{}", n, dim), dim, base: rows, queries }
+    }
+
+    pub fn load_fvecs(dir: &Path) -> Result<Self, String> {
+        let (dim, base) = read_fvecs(&dir.join("base.fvecs"))?;
+        let (query_dim, queries) = read_fvecs(&dir.join("query.fvecs"))?;
+        if dim != query_dim {
+            return Err(format!("base has dimension {}, queries have {}", dim, query_dim));
+        }
+        let name = dir.file_name().map_or_else(|| "dataset".to_string(), |n| n.to_string_lossy().into_owned());
+        Ok(Self { name, dim, base, queries })
+    }
+
+    pub fn len(&self) -> usize {
+        self.base.len() / self.dim
+    }
+
+    pub fn num_queries(&self) -> usize {
+        self.queries.len() / self.dim
+    }
+
+    pub fn ids(&self) -> Vec<u64> {
+        (0..self.len() as u64).collect()
+    }
+
+    pub fn query(&self, i: usize) -> &[f32] {
+        &self.queries[i * self.dim..][..self.dim]
+    }
+
+    pub fn store(&self) -> EmbeddingStore {
+        let mut store = EmbeddingStore::new(self.dim, self.len()).expect("embedding store");
+        for (id, row) in self.base.chunks_exact(self.dim).enumerate() {
+            store.put(id as u64, row).expect("embedding store put");
+        }
+        store
+    }
+
+    /// 每个查询的精确 Top-K (与 search_top_k 相同的 C++ 精确搜索内核)
+    pub fn ground_truth(&self, store: &EmbeddingStore, k: usize) -> Vec<Vec<u64>> {
+        recommend_recall_batch(&self.queries, store, k)
+            .into_iter()
+            .map(|hits| hits.into_iter().map(|(id, _)| id).collect())
+            .collect()
+    }
+}
+
+/// recall@k: 结果中落在精确 Top-K 内的比例
+pub fn recall(results: &[Vec<(u64, f32)>], truth: &[Vec<u64>], k: usize) -> f64 {
+    let mut hits = 0;
+    let mut total = 0;
+    for (result, expected) in results.iter().zip(truth) {
+        let expected: HashSet<u64> = expected.iter().take(k).copied().collect();
+        hits += result.iter().take(k).filter(|(id, _)| expected.contains(id)).count();
+        total += expected.len();
+    }
+    hits as f64 / total.max(1) as f64
+}
+
+/// 第 p 分位 (0..=1) 的延迟
+pub fn percentile(samples: &mut [Duration], p: f64) -> Duration {
+    if samples.is_empty() {
+        return Duration::ZERO;
+    }
+    let rank = ((samples.len() as f64 * p) as usize).min(samples.len() - 1);
+    *samples.select_nth_unstable(rank).1
+}
+
+pub fn env_usize(name: &str, default: usize) -> usize {
+    std::env::var(name).ok().and_then(|v| v.parse().ok()).unwrap_or(default)
+}
+
+/// 逗号分隔的列表，如 `BENCH_EF=16,64,256`
+pub fn env_list(name: &str, default: &[usize]) -> Vec<usize> {
+    match std::env::var(name) {
+        Ok(v) => v.split(',').filter_map(|s| s.trim().parse().ok()).collect(),
+        Err(_) => default.to_vec(),
+    }
+}
+
+fn normalize(v: &mut [f32]) {
+    let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+    if norm > 0.0 {
+        v.iter_mut().for_each(|x| *x /= norm);
+    }
+}
+
+fn read_fvecs(path: &Path) -> Result<(usize, Vec<f32>), String> {
+    let bytes = std::fs::read(path).map_err(|e| format!("{}: {}", path.display(), e))?;
+    let read_u32 = |at: usize| u32::from_le_bytes([bytes[at], bytes[at + 1], bytes[at + 2], bytes[at + 3]]);
+    if bytes.len() < 4 {
+        return Err(format!("{}: empty file", path.display()));
+    }
+    let dim = read_u32(0) as usize;
+    let row_bytes = 4 + dim * 4;
+    if dim == 0 || bytes.len() % row_bytes != 0 {
+        return Err(format!("{}: not an fvecs file", path.display()));
+    }
+
+    let mut out = Vec::with_capacity(bytes.len() / row_bytes * dim);
+    for row in bytes.chunks_exact(row_bytes) {
+        let start = out.len();
+        out.extend(row[4..].chunks_exact(4).map(|b| f32::from_le_bytes([b[0], b[1], b[2], b[3]])));
+        normalize(&mut out[start..]);
+    }
+    Ok((dim, out))
+}
+
+/// 固定种子的伪随机数 (不依赖 rand 的版本，保证不同机器上生成同一份数据)
+struct SplitMix64(u64);
+
+impl SplitMix64 {
+    fn next(&mut self) -> u64 {
+        self.0 = self.0.wrapping_add(0x9E37_79B9_7F4A_7C15);
+        let mut z = self.0;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58_476D_1CE4_E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D0_49BB_1331_11EB);
+        z ^ (z >> 31)
+    }
+
+    fn uniform(&mut self) -> f32 {
+        (self.next() >> 40) as f32 / (1u64 << 24) as f32
+    }
+
+    /// Box-Muller
+    fn normal(&mut self) -> f32 {
+        let u1 = self.uniform().max(f32::MIN_POSITIVE);
+        let u2 = self.uniform();
+        (-2.0 * u1.ln()).sqrt() * (2.0 * std::f32::consts::PI * u2).cos()
+    }
+}
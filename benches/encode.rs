@@ -0,0 +1,70 @@
+//! 文本编码的 criterion 基准: 单条编码 (在线 /search 的延迟) 与批量编码 (启动与批量导入的吞吐)
+//!
+//!   cargo bench --bench encode
+//!
+//! 需要 models/ 下的 ONNX 模型与 tokenizer；未找到模型时跳过所有基准。
+//! 文本取自 assets/products.json 的商品名，与线上的句子长度分布一致。
+
+#![allow(dead_code)]
+
+#[path = "../src/embedding.rs"]
+mod embedding;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use embedding::EmbeddingModel;
+use std::hint::black_box;
+
+/// 没有商品文件时使用的句子
+const FALLBACK_TEXTS: &[&str] = &[
+    "wireless noise cancelling headphones",
+    "stainless steel kitchen knife set with wooden block",
+    "science fiction novel paperback",
+    "men's cotton crew neck t-shirt",
+];
+
+fn product_names() -> Vec<String> {
+    let names: Option<Vec<String>> = std::fs::read_to_string("assets/products.json").ok().and_then(|json| {
+        let items: Vec<serde_json::Value> = serde_json::from_str(&json).ok()?;
+        Some(items.iter().filter_map(|item| item["title"].as_str().map(str::to_string)).collect())
+    });
+    match names {
+        Some(names) if !names.is_empty() => names,
+        _ => FALLBACK_TEXTS.iter().map(|s| s.to_string()).collect(),
+    }
+}
+
+fn bench_encode(c: &mut Criterion) {
+    let model = match EmbeddingModel::new() {
+        Ok(model) => model,
+        Err(e) => {
+            eprintln!("skipping encode benchmarks: {}", e);
+            return;
+        }
+    };
+    let names = product_names();
+
+    let mut group = c.benchmark_group("encode");
+    group.throughput(Throughput::Elements(1));
+    let mut i = 0;
+    group.bench_function("single", |b| {
+        b.iter(|| {
+            i = (i + 1) % names.len();
+            black_box(model.encode(&names[i]).expect("encode"))
+        })
+    });
+    group.finish();
+
+    let mut group = c.benchmark_group("encode_batch");
+    group.sample_size(10);
+    for batch in [8, 32, 256] {
+        let texts: Vec<&str> = names.iter().cycle().take(batch).map(String::as_str).collect();
+        group.throughput(Throughput::Elements(batch as u64));
+        group.bench_with_input(BenchmarkId::from_parameter(batch), &texts, |b, texts| {
+            b.iter(|| black_box(model.encode_batch(texts).expect("encode batch")))
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_encode);
+criterion_main!(benches);
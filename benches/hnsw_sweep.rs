@@ -0,0 +1,124 @@
+//! HNSW 参数扫描: 对每组 (M, ef_construction) 建一次索引，再对每个 ef 报告
+//! recall@k (相对精确搜索)、单线程 p50 / p99 延迟与 1..N 线程的 QPS，以及建索引耗时和索引内存
+//!
+//!   cargo bench --bench hnsw_sweep
+//!   BENCH_M=16,32 BENCH_EF_CONSTRUCTION=200 BENCH_EF=50,100,200 cargo bench --bench hnsw_sweep
+//!   BENCH_DATASET=data/glove-100 cargo bench --bench hnsw_sweep
+//!
+//! 其余环境变量: BENCH_ITEMS / BENCH_QUERIES / BENCH_DIM (合成数据集)、BENCH_K、BENCH_THREADS
+
+#![allow(dead_code)]
+
+#[path = "../src/ffi.rs"]
+mod ffi;
+#[path = "../src/model.rs"]
+mod model;
+mod common;
+
+use common::{env_list, env_usize, percentile, recall, Dataset};
+use ffi::{HnswConfig, HnswIndex};
+use std::time::{Duration, Instant};
+
+fn main() {
+    // cargo bench 会给 harness = false 的目标传入 --bench，cargo test 时传入的参数里没有它
+    if !std::env::args().any(|arg| arg == "--bench") {
+        return;
+    }
+
+    let data = Dataset::from_env();
+    let k = env_usize("BENCH_K", 10);
+    let max_threads = env_usize(
+        "BENCH_THREADS",
+        std::thread::available_parallelism().map_or(1, |n| n.get()),
+    );
+    let ms = env_list("BENCH_M", &[8, 16, 32]);
+    let ef_constructions = env_list("BENCH_EF_CONSTRUCTION", &[100, 200]);
+    let efs = env_list("BENCH_EF", &[16, 32, 64, 128, 256]);
+
+    println!("dataset {}: {} x {}, {} queries, k = {}", data.name, data.len(), data.dim, data.num_queries(), k);
+    let store = data.store();
+    let start = Instant::now();
+    let truth = data.ground_truth(&store, k);
+    println!("exact search: {:.1} ms for all queries\n", ms_f64(start.elapsed()));
+
+    println!(
+        "{:>4} {:>6} {:>9} {:>9} {:>5} {:>9} {:>9} {:>9}  QPS by threads",
+        "M", "ef_c", "build (s)", "mem (MB)", "ef", "recall", "p50 (us)", "p99 (us)"
+    );
+    let ids = data.ids();
+    for &m in &ms {
+        for &ef_construction in &ef_constructions {
+            let config = HnswConfig {
+                dim: data.dim,
+                max_elements: data.len(),
+                m,
+                ef_construction,
+                ..Default::default()
+            };
+            let index = HnswIndex::new(&config).expect("create index");
+            let start = Instant::now();
+            index.add_items_batch(&ids, &data.base, |_, _| {}).expect("build index");
+            let build = start.elapsed();
+            let memory_mb = index.stats().memory_bytes as f64 / (1 << 20) as f64;
+
+            for &ef in &efs {
+                let mut latencies = Vec::with_capacity(data.num_queries());
+                let results: Vec<Vec<(u64, f32)>> = (0..data.num_queries())
+                    .map(|i| {
+                        let start = Instant::now();
+                        let hits = index.search_with_ef(data.query(i), k, ef);
+                        latencies.push(start.elapsed());
+                        hits
+                    })
+                    .collect();
+
+                let qps: Vec<String> = thread_counts(max_threads)
+                    .map(|threads| format!("{}t={:.0}", threads, measure_qps(&index, &data, k, ef, threads)))
+                    .collect();
+                println!(
+                    "{:>4} {:>6} {:>9.2} {:>9.1} {:>5} {:>9.4} {:>9.0} {:>9.0}  {}",
+                    m,
+                    ef_construction,
+                    build.as_secs_f64(),
+                    memory_mb,
+                    ef,
+                    recall(&results, &truth, k),
+                    us_f64(percentile(&mut latencies, 0.50)),
+                    us_f64(percentile(&mut latencies, 0.99)),
+                    qps.join(" ")
+                );
+            }
+        }
+    }
+}
+
+/// 1, 2, 4, ... 直到 max (最后一项总是 max)
+fn thread_counts(max: usize) -> impl Iterator<Item = usize> {
+    let mut counts: Vec<usize> = std::iter::successors(Some(1), |&n| Some(n * 2)).take_while(|&n| n < max).collect();
+    counts.push(max.max(1));
+    counts.into_iter()
+}
+
+/// threads 个线程共同把全部查询跑两遍 (HnswIndex 的搜索只持有 C++ 侧的读锁)
+fn measure_qps(index: &HnswIndex, data: &Dataset, k: usize, ef: usize, threads: usize) -> f64 {
+    let total = data.num_queries() * 2;
+    let start = Instant::now();
+    std::thread::scope(|scope| {
+        for t in 0..threads {
+            scope.spawn(move || {
+                for q in (t..total).step_by(threads) {
+                    std::hint::black_box(index.search_with_ef(data.query(q % data.num_queries()), k, ef));
+                }
+            });
+        }
+    });
+    total as f64 / start.elapsed().as_secs_f64()
+}
+
+fn ms_f64(d: Duration) -> f64 {
+    d.as_secs_f64() * 1e3
+}
+
+fn us_f64(d: Duration) -> f64 {
+    d.as_secs_f64() * 1e6
+}
@@ -0,0 +1,125 @@
+//! 搜索路径的 criterion 基准: HNSW 近似搜索、精确召回、多兴趣召回与多路融合
+//!
+//!   cargo bench --bench search
+//!   cargo bench --bench search -- hnsw_search      # 只跑一组
+//!
+//! 数据集见 common/mod.rs (默认 2 万个 384 维合成向量)。hnsw_search 每个 ef 的 recall@10
+//! 在测量前打印一次，召回率下降与延迟上升可以在同一次运行中对照。
+
+#![allow(dead_code)]
+
+#[path = "../src/ffi.rs"]
+mod ffi;
+#[path = "../src/hybrid.rs"]
+mod hybrid;
+#[path = "../src/model.rs"]
+mod model;
+mod common;
+
+use common::{recall, Dataset};
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+use ffi::{recommend_recall, EmbeddingStore, HnswConfig, HnswIndex};
+use hybrid::{fuse_top_k, Fusion, Stream};
+use std::hint::black_box;
+use std::sync::OnceLock;
+
+const K: usize = 10;
+
+struct Fixture {
+    data: Dataset,
+    store: EmbeddingStore,
+    index: HnswIndex,
+    truth: Vec<Vec<u64>>,
+}
+
+/// 数据集与索引只构建一次，所有基准组共用
+fn fixture() -> &'static Fixture {
+    static FIXTURE: OnceLock<Fixture> = OnceLock::new();
+    FIXTURE.get_or_init(|| {
+        let data = Dataset::from_env();
+        let store = data.store();
+        let config = HnswConfig { dim: data.dim, max_elements: data.len(), ..Default::default() };
+        let index = HnswIndex::new(&config).expect("create index");
+        index.add_items_batch(&data.ids(), &data.base, |_, _| {}).expect("build index");
+        let truth = data.ground_truth(&store, K);
+        Fixture { data, store, index, truth }
+    })
+}
+
+fn bench_hnsw_search(c: &mut Criterion) {
+    let f = fixture();
+    let mut group = c.benchmark_group("hnsw_search");
+    group.throughput(Throughput::Elements(1));
+    for ef in [16, 50, 100, 200] {
+        let results: Vec<_> = (0..f.data.num_queries()).map(|i| f.index.search_with_ef(f.data.query(i), K, ef)).collect();
+        println!("hnsw_search/{}: recall@{} = {:.4}", ef, K, recall(&results, &f.truth, K));
+
+        let mut q = 0;
+        group.bench_with_input(BenchmarkId::from_parameter(ef), &ef, |b, &ef| {
+            b.iter(|| {
+                q = (q + 1) % f.data.num_queries();
+                black_box(f.index.search_with_ef(f.data.query(q), K, ef))
+            })
+        });
+    }
+    group.finish();
+}
+
+fn bench_recommend_recall(c: &mut Criterion) {
+    let f = fixture();
+    let mut group = c.benchmark_group("recommend_recall");
+    group.throughput(Throughput::Elements(1));
+    for k in [10, 100] {
+        let mut q = 0;
+        group.bench_with_input(BenchmarkId::new("exact", k), &k, |b, &k| {
+            b.iter(|| {
+                q = (q + 1) % f.data.num_queries();
+                black_box(recommend_recall(f.data.query(q), &f.store, k))
+            })
+        });
+    }
+    group.finish();
+}
+
+/// /recommend 的召回: 4 个兴趣向量一次 search_multi，对比逐个兴趣搜索再合并
+fn bench_search_multi(c: &mut Criterion) {
+    let f = fixture();
+    let interests = 4.min(f.data.num_queries());
+    let queries = &f.data.queries[..interests * f.data.dim];
+    let mut group = c.benchmark_group("search_multi");
+    group.bench_function("multi", |b| b.iter(|| black_box(f.index.search_multi(queries, 100, 200, |_| true))));
+    group.bench_function("per_interest", |b| {
+        b.iter(|| {
+            let mut merged: Vec<(u64, f32)> = (0..interests)
+                .flat_map(|i| f.index.search_with_ef(f.data.query(i), 100, 200))
+                .collect();
+            merged.sort_unstable_by(|a, b| a.0.cmp(&b.0).then(b.1.total_cmp(&a.1)));
+            merged.dedup_by_key(|hit| hit.0);
+            merged.sort_unstable_by(|a, b| b.1.total_cmp(&a.1));
+            merged.truncate(100);
+            black_box(merged)
+        })
+    });
+    group.finish();
+}
+
+/// /search 的融合: 向量召回 (带分数) 与关键词召回 (只有排名) 各 50 个，取前 20
+fn bench_fuse_top_k(c: &mut Criterion) {
+    let f = fixture();
+    let vector_hits: Vec<(u32, f32)> = f.index.search_with_ef(f.data.query(0), 50, 80)
+        .into_iter()
+        .map(|(id, score)| (id as u32, score))
+        .collect();
+    // 关键词结果与向量结果部分重叠
+    let keyword_hits: Vec<u32> = vector_hits.iter().step_by(2).map(|&(id, _)| id).chain(100_000..100_025).collect();
+    let streams = [Stream::scored(&vector_hits, 1.0), Stream::ranked(&keyword_hits, 1.0)];
+
+    let mut group = c.benchmark_group("fuse_top_k");
+    for (name, fusion) in [("rrf", Fusion::Rrf), ("linear", Fusion::Linear)] {
+        group.bench_function(name, |b| b.iter(|| black_box(fuse_top_k(&streams, fusion, 20))));
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_hnsw_search, bench_recommend_recall, bench_search_multi, bench_fuse_top_k);
+criterion_main!(benches);
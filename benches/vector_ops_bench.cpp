@@ -0,0 +1,206 @@
+// vector_ops_bench.cpp - vector_ops.cpp 的独立微基准 (不经过 Rust / FFI)
+//
+// 测量:
+// - dot_product 内核的吞吐 (当前 CPU 上选用的 SIMD 实现)
+// - search_top_k_batch 精确搜索的吞吐，同时作为召回率的 ground truth
+// - 对 M / ef_construction / ef 的扫描: 建索引耗时、索引内存、recall@k、
+//   单线程 p50 / p99 延迟，以及 1..N 个线程并发查询的 QPS
+//
+// 构建与运行 (在仓库根目录):
+//   g++ -std=c++17 -O3 -march=native -pthread -Icpp -Icpp/hnswlib
+//       benches/vector_ops_bench.cpp cpp/vector_ops.cpp -o target/vector_ops_bench
+//   target/vector_ops_bench [n=20000] [queries=1000] [dim=384] [k=10] [threads=nproc]
+//
+// 数据为固定种子生成的聚类向量 (归一化，内积相似度)，同一台机器上多次运行结果可比较。
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "vector_ops.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double seconds_since(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// 围绕 clusters 个中心的高斯噪声，接近文本 embedding 的分布 (比均匀随机向量更难搜索)
+std::vector<float> clustered_vectors(int n, int dim, int clusters, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    std::vector<float> centers(static_cast<size_t>(clusters) * dim);
+    for (float& x : centers) {
+        x = normal(rng);
+    }
+
+    std::vector<float> out(static_cast<size_t>(n) * dim);
+    std::uniform_int_distribution<int> pick(0, clusters - 1);
+    for (int i = 0; i < n; i++) {
+        const float* center = &centers[static_cast<size_t>(pick(rng)) * dim];
+        float* row = &out[static_cast<size_t>(i) * dim];
+        float norm = 0.0f;
+        for (int d = 0; d < dim; d++) {
+            row[d] = center[d] + 0.5f * normal(rng);
+            norm += row[d] * row[d];
+        }
+        norm = std::sqrt(norm);
+        for (int d = 0; d < dim; d++) {
+            row[d] /= norm;
+        }
+    }
+    return out;
+}
+
+double percentile(std::vector<double> samples, double p) {
+    if (samples.empty()) {
+        return 0.0;
+    }
+    size_t rank = std::min(samples.size() - 1, static_cast<size_t>(p * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    return samples[rank];
+}
+
+struct Dataset {
+    int n, nq, dim, k;
+    std::vector<float> base, queries;
+    std::vector<int> ids;
+    std::vector<int> truth;  // nq x k
+};
+
+void bench_dot_product(const Dataset& data) {
+    const int rounds = 20;
+    volatile float sink = 0.0f;
+    auto start = Clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < data.n; i++) {
+            sink = sink + dot_product(&data.base[static_cast<size_t>(i) * data.dim], data.queries.data(), data.dim);
+        }
+    }
+    double elapsed = seconds_since(start);
+    double flops = 2.0 * rounds * data.n * data.dim;
+    std::printf("dot_product [%s]: %.1f ns/call, %.2f GFLOP/s\n",
+                vector_ops_simd_backend(), elapsed * 1e9 / (static_cast<double>(rounds) * data.n),
+                flops / elapsed / 1e9);
+}
+
+void compute_ground_truth(Dataset& data) {
+    data.truth.assign(static_cast<size_t>(data.nq) * data.k, -1);
+    std::vector<float> scores(data.truth.size());
+    std::vector<int> counts(data.nq);
+    auto start = Clock::now();
+    search_top_k_batch(data.queries.data(), data.nq, data.base.data(), data.ids.data(), data.n, data.dim, data.k,
+                       data.truth.data(), scores.data(), counts.data());
+    double elapsed = seconds_since(start);
+    std::printf("search_top_k_batch: %d queries x %d items in %.1f ms (%.0f QPS)\n\n",
+                data.nq, data.n, elapsed * 1e3, data.nq / elapsed);
+}
+
+// 每个线程独立地轮流查询整组 queries，总共 rounds 遍
+double measure_qps(const hnsw_index_t* index, const Dataset& data, int ef, int threads, int rounds) {
+    std::vector<std::thread> workers;
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::vector<int> ids(data.k);
+            std::vector<float> scores(data.k);
+            for (int q = t; q < data.nq * rounds; q += threads) {
+                const float* query = &data.queries[static_cast<size_t>(q % data.nq) * data.dim];
+                hnsw_index_search_knn_ef(index, query, data.k, ef, ids.data(), scores.data());
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return static_cast<double>(data.nq) * rounds / seconds_since(start);
+}
+
+void bench_config(const Dataset& data, int m, int ef_construction, const std::vector<int>& efs, int max_threads) {
+    hnsw_index_t* index = hnsw_index_new(data.dim, data.n, m, ef_construction);
+    if (index == nullptr) {
+        std::fprintf(stderr, "failed to create index (M=%d, ef_construction=%d)\n", m, ef_construction);
+        return;
+    }
+
+    auto start = Clock::now();
+    int added = hnsw_index_add_items_batch(index, data.ids.data(), data.base.data(), data.n, nullptr, nullptr);
+    double build_s = seconds_since(start);
+    hnsw_index_stats_t stats{};
+    hnsw_index_get_stats(index, &stats);
+    std::printf("M=%d ef_construction=%d: built %d items in %.2fs (%.0f items/s), %.1f MB\n",
+                m, ef_construction, added, build_s, added / build_s, stats.memory_bytes / 1048576.0);
+
+    for (int ef : efs) {
+        std::vector<int> ids(data.k);
+        std::vector<float> scores(data.k);
+        std::vector<double> latencies_us;
+        latencies_us.reserve(data.nq);
+        size_t hits = 0;
+        for (int q = 0; q < data.nq; q++) {
+            const float* query = &data.queries[static_cast<size_t>(q) * data.dim];
+            auto t0 = Clock::now();
+            int count = hnsw_index_search_knn_ef(index, query, data.k, ef, ids.data(), scores.data());
+            latencies_us.push_back(seconds_since(t0) * 1e6);
+
+            const int* truth = &data.truth[static_cast<size_t>(q) * data.k];
+            std::unordered_set<int> expected(truth, truth + data.k);
+            for (int i = 0; i < count; i++) {
+                hits += expected.count(ids[i]);
+            }
+        }
+
+        std::printf("  ef=%-4d recall@%d=%.4f  p50=%.0fus p99=%.0fus  QPS:", ef, data.k,
+                    static_cast<double>(hits) / (static_cast<size_t>(data.nq) * data.k),
+                    percentile(latencies_us, 0.50), percentile(latencies_us, 0.99));
+        for (int threads = 1; threads <= max_threads; threads *= 2) {
+            std::printf(" %dt=%.0f", threads, measure_qps(index, data, ef, threads, 2));
+        }
+        std::printf("\n");
+    }
+    hnsw_index_free(index);
+}
+
+int arg_or(int argc, char** argv, int i, int fallback) {
+    return argc > i ? std::atoi(argv[i]) : fallback;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Dataset data;
+    data.n = arg_or(argc, argv, 1, 20000);
+    data.nq = arg_or(argc, argv, 2, 1000);
+    data.dim = arg_or(argc, argv, 3, 384);
+    data.k = arg_or(argc, argv, 4, 10);
+    int max_threads = arg_or(argc, argv, 5, static_cast<int>(std::max(1u, std::thread::hardware_concurrency())));
+
+    // 查询与物品来自同一组中心 (同一分布)，取生成结果的末尾 nq 行
+    data.base = clustered_vectors(data.n + data.nq, data.dim, 64, 42);
+    data.queries.assign(data.base.begin() + static_cast<size_t>(data.n) * data.dim, data.base.end());
+    data.base.resize(static_cast<size_t>(data.n) * data.dim);
+    data.ids.resize(data.n);
+    for (int i = 0; i < data.n; i++) {
+        data.ids[i] = i;
+    }
+    std::printf("dataset: %d x %d (clustered, normalized), %d queries, k=%d\n\n", data.n, data.dim, data.nq, data.k);
+
+    bench_dot_product(data);
+    compute_ground_truth(data);
+
+    const std::vector<int> efs = {16, 32, 64, 128, 256};
+    for (int m : {8, 16, 32}) {
+        for (int ef_construction : {100, 200}) {
+            bench_config(data, m, ef_construction, efs, max_threads);
+        }
+    }
+    return 0;
+}
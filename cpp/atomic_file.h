@@ -0,0 +1,92 @@
+// atomic_file.h - 崩溃一致的文件替换 (写临时文件 -> fsync -> rename -> fsync 目录)
+//
+// 任何时刻崩溃 (包括 SIGKILL 和断电)，目标路径上要么是完整的旧文件，要么是完整的新文件:
+// - 数据先写入同目录下的 <path>.tmp 并 fsync，保证 rename 之前内容已落盘
+// - rename 在同一文件系统内是原子的，正在映射旧文件的进程不受影响 (旧 inode 仍然有效)
+// - 最后 fsync 所在目录，保证 rename 本身也已持久化
+// 未 commit 就析构 (例如写入中途抛出异常) 时删除临时文件。
+
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace vecops {
+
+class AtomicFileWriter {
+ public:
+    explicit AtomicFileWriter(const std::string& path) : path_(path), tmp_path_(path + ".tmp") {
+        fd_ = open(tmp_path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw std::runtime_error("cannot open file for writing: " + tmp_path_);
+    }
+
+    AtomicFileWriter(const AtomicFileWriter&) = delete;
+    AtomicFileWriter& operator=(const AtomicFileWriter&) = delete;
+
+    ~AtomicFileWriter() {
+        if (fd_ >= 0) {
+            close(fd_);
+            std::remove(tmp_path_.c_str());
+        }
+    }
+
+    /// 在 offset 处写入 bytes 字节 (中间的空隙由文件系统补 0)
+    void write_at(uint64_t offset, const void* data, size_t bytes) {
+        const char* p = static_cast<const char*>(data);
+        while (bytes > 0) {
+            ssize_t written = pwrite(fd_, p, bytes, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                throw std::runtime_error("failed to write file: " + tmp_path_);
+            }
+            p += written;
+            offset += static_cast<uint64_t>(written);
+            bytes -= static_cast<size_t>(written);
+        }
+    }
+
+    /// 让文件长度至少为 size (末尾的空隙补 0)
+    void extend_to(uint64_t size) {
+        if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("failed to size file: " + tmp_path_);
+        }
+    }
+
+    /// 落盘并原子地替换目标文件
+    void commit() {
+        if (fsync(fd_) != 0) throw std::runtime_error("fsync failed: " + tmp_path_);
+        close(fd_);
+        fd_ = -1;
+        if (std::rename(tmp_path_.c_str(), path_.c_str()) != 0) {
+            std::remove(tmp_path_.c_str());
+            throw std::runtime_error("failed to replace file: " + path_);
+        }
+        sync_parent_directory();
+    }
+
+ private:
+    void sync_parent_directory() const {
+        const size_t slash = path_.find_last_of('/');
+        const std::string dir = slash == std::string::npos ? "." : (slash == 0 ? "/" : path_.substr(0, slash));
+        int dir_fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) return;  // 目录无法打开时 rename 依然有效，只是持久化时机由文件系统决定
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    std::string path_;
+    std::string tmp_path_;
+    int fd_ = -1;
+};
+
+}  // namespace vecops
+
+#endif  // ATOMIC_FILE_H
@@ -0,0 +1,212 @@
+// attribute_index.h - 物品属性 (类别 / 价格) 的紧凑列式索引
+//
+// 为带属性过滤的向量搜索提供两类能力:
+// 1. O(1) 判定: 按 label 下标存放的属性列 (category_ / price_)，
+//    供 HNSW 图遍历中的 BaseFilterFunctor 逐个判定候选
+// 2. 候选枚举与基数估计: 每个类别一张 label 位图 + 按价格排序的数组，
+//    用于估算过滤条件的选择性，并在条件非常严格时直接枚举全部满足条件的物品
+//
+// 假设 label (即物品 id) 是稠密的非负整数，各属性列按最大 label 扩容。
+// 线程安全由调用方保证 (vector_ops.cpp 中由句柄的 attr_lock 保护)。
+
+#ifndef ATTRIBUTE_INDEX_H
+#define ATTRIBUTE_INDEX_H
+
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace vecops {
+
+/// 一次查询的属性过滤条件
+/// - categories 为空表示不限类别
+/// - 价格区间为 [min_price, max_price)，不限时使用 +/-inf
+struct AttributeQuery {
+    std::vector<int> categories;
+    float min_price = -INFINITY;
+    float max_price = INFINITY;
+
+    bool has_price_range() const {
+        return std::isfinite(min_price) || std::isfinite(max_price);
+    }
+};
+
+class AttributeIndex {
+ public:
+    static constexpr int kNoCategory = -1;
+
+    /// 设置 (或更新) 一个物品的属性
+    void set(hnswlib::labeltype label, int category, float price) {
+        if (label >= category_.size()) {
+            category_.resize(label + 1, kNoCategory);
+            price_.resize(label + 1, 0.0f);
+        }
+
+        int old_category = category_[label];
+        if (old_category != kNoCategory) {
+            clear_bit(category_bits_[old_category], label);
+            category_count_[old_category]--;
+        }
+
+        if (category >= 0) {
+            if (static_cast<size_t>(category) >= category_bits_.size()) {
+                category_bits_.resize(category + 1);
+                category_count_.resize(category + 1, 0);
+            }
+            set_bit(category_bits_[category], label);
+            category_count_[category]++;
+        }
+
+        category_[label] = category >= 0 ? category : kNoCategory;
+        price_[label] = price;
+        price_dirty_ = true;
+    }
+
+    /// 清除一个物品的属性 (之后任何带属性条件的查询都不会返回它)
+    void clear(hnswlib::labeltype label) {
+        if (label >= category_.size() || category_[label] == kNoCategory) return;
+        clear_bit(category_bits_[category_[label]], label);
+        category_count_[category_[label]]--;
+        category_[label] = kNoCategory;
+        price_dirty_ = true;
+    }
+
+    bool price_sorted_dirty() const { return price_dirty_; }
+
+    /// 由属性列重建按价格排序的数组 (写入后惰性执行，需要独占访问)
+    ///
+    /// 排序数组只是属性列的派生缓存，因此允许在 const 对象上重建。
+    void rebuild_price_order() const {
+        price_sorted_.clear();
+        for (size_t label = 0; label < category_.size(); ++label) {
+            if (category_[label] != kNoCategory) {
+                price_sorted_.emplace_back(price_[label], label);
+            }
+        }
+        std::sort(price_sorted_.begin(), price_sorted_.end());
+        price_dirty_ = false;
+    }
+
+    /// O(1) 判定某个 label 是否满足条件 (未设置属性的物品一律不满足)
+    bool matches(hnswlib::labeltype label, const AttributeQuery& q, const std::vector<char>& selected) const {
+        if (label >= category_.size()) return false;
+        int c = category_[label];
+        if (c == kNoCategory) return false;
+        if (!q.categories.empty() && (static_cast<size_t>(c) >= selected.size() || !selected[c])) return false;
+        float p = price_[label];
+        return p >= q.min_price && p < q.max_price;
+    }
+
+    /// 将查询的类别列表展开为按类别下标的选择表，供 matches 使用
+    std::vector<char> selection(const AttributeQuery& q) const {
+        std::vector<char> selected(category_bits_.size(), 0);
+        for (int c : q.categories) {
+            if (c >= 0 && static_cast<size_t>(c) < selected.size()) selected[c] = 1;
+        }
+        return selected;
+    }
+
+    /// 满足条件的物品数量上界 (取类别位图计数与价格区间长度中较小者)
+    size_t estimate(const AttributeQuery& q, const std::vector<char>& selected) const {
+        size_t by_category = SIZE_MAX;
+        if (!q.categories.empty()) {
+            by_category = 0;
+            for (size_t c = 0; c < selected.size(); ++c) {
+                if (selected[c]) by_category += category_count_[c];
+            }
+        }
+        size_t by_price = SIZE_MAX;
+        if (q.has_price_range()) {
+            auto range = price_range(q);
+            by_price = range.second - range.first;
+        }
+        if (by_category == SIZE_MAX && by_price == SIZE_MAX) return price_sorted_.size();
+        return std::min(by_category, by_price);
+    }
+
+    /// 枚举所有满足条件的 label: 从类别位图和价格区间中选较小的一侧遍历，再用属性列复核
+    template<typename F>
+    void for_each_match(const AttributeQuery& q, const std::vector<char>& selected, F&& fn) const {
+        size_t by_category = SIZE_MAX;
+        if (!q.categories.empty()) {
+            by_category = 0;
+            for (size_t c = 0; c < selected.size(); ++c) {
+                if (selected[c]) by_category += category_count_[c];
+            }
+        }
+
+        if (q.has_price_range()) {
+            auto range = price_range(q);
+            if (range.second - range.first <= by_category) {
+                for (size_t i = range.first; i < range.second; ++i) {
+                    hnswlib::labeltype label = price_sorted_[i].second;
+                    if (matches(label, q, selected)) fn(label);
+                }
+                return;
+            }
+        }
+
+        if (by_category == SIZE_MAX) {
+            // 既无类别也无价格条件: 所有设置了属性的物品都满足
+            for (const auto& entry : price_sorted_) {
+                if (matches(entry.second, q, selected)) fn(entry.second);
+            }
+            return;
+        }
+
+        for (size_t c = 0; c < selected.size(); ++c) {
+            if (!selected[c]) continue;
+            const auto& bits = category_bits_[c];
+            for (size_t w = 0; w < bits.size(); ++w) {
+                uint64_t word = bits[w];
+                while (word != 0) {
+                    hnswlib::labeltype label = w * 64 + static_cast<size_t>(__builtin_ctzll(word));
+                    word &= word - 1;
+                    if (matches(label, q, selected)) fn(label);
+                }
+            }
+        }
+    }
+
+ private:
+    static void set_bit(std::vector<uint64_t>& bits, hnswlib::labeltype label) {
+        size_t word = label / 64;
+        if (word >= bits.size()) bits.resize(word + 1, 0);
+        bits[word] |= (uint64_t{1} << (label % 64));
+    }
+
+    static void clear_bit(std::vector<uint64_t>& bits, hnswlib::labeltype label) {
+        size_t word = label / 64;
+        if (word < bits.size()) bits[word] &= ~(uint64_t{1} << (label % 64));
+    }
+
+    // price_sorted_ 中落在 [min_price, max_price) 的下标区间
+    std::pair<size_t, size_t> price_range(const AttributeQuery& q) const {
+        auto lo = std::lower_bound(
+            price_sorted_.begin(), price_sorted_.end(), q.min_price,
+            [](const std::pair<float, hnswlib::labeltype>& e, float v) { return e.first < v; });
+        auto hi = std::lower_bound(
+            lo, price_sorted_.end(), q.max_price,
+            [](const std::pair<float, hnswlib::labeltype>& e, float v) { return e.first < v; });
+        return {static_cast<size_t>(lo - price_sorted_.begin()), static_cast<size_t>(hi - price_sorted_.begin())};
+    }
+
+    // 按 label 下标的属性列
+    std::vector<int> category_;
+    std::vector<float> price_;
+
+    // 每个类别一张 label 位图，及其中置位的数量
+    std::vector<std::vector<uint64_t>> category_bits_;
+    std::vector<size_t> category_count_;
+
+    // (price, label) 按价格升序，写入后标记为脏，查询前惰性重建
+    mutable std::vector<std::pair<float, hnswlib::labeltype>> price_sorted_;
+    mutable bool price_dirty_ = false;
+};
+
+}  // namespace vecops
+
+#endif  // ATTRIBUTE_INDEX_H
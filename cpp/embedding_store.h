@@ -0,0 +1,125 @@
+// embedding_store.h - 常驻内存的连续物品向量矩阵
+//
+// 物品向量在启动时一次性注册到这里，之后暴力搜索 / 重排序内核直接读取，
+// 不再每次调用都从 Rust 侧的 Vec<Vec<f32>> 拼接矩阵。
+//
+// 布局 (structure of arrays):
+// - data_: rows x stride 的行优先矩阵，基址 64 字节对齐；
+//   stride 向上取整到 16 个 float (64 字节)，因此每一行都从缓存行边界开始，填充部分恒为 0
+// - ids_:  每行对应的物品 id，与 data_ 按行号一一对应
+// - row_of_: id -> 行号
+//
+// 删除采用 swap-remove (最后一行搬到空位)，行号不稳定，外部只应通过 id 访问。
+// 本类不做内部加锁: 多个线程可以并发读，写操作需要调用方保证独占
+// (Rust 侧通过 &mut self 约束)。
+
+#ifndef EMBEDDING_STORE_H
+#define EMBEDDING_STORE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace vecops {
+
+class EmbeddingStore {
+ public:
+    static constexpr size_t kAlignment = 64;
+    static constexpr size_t kFloatsPerLine = kAlignment / sizeof(float);
+
+    EmbeddingStore(size_t dim, size_t capacity)
+        : dim_(dim), stride_((dim + kFloatsPerLine - 1) / kFloatsPerLine * kFloatsPerLine) {
+        if (dim == 0) throw std::invalid_argument("dim must be positive");
+        reserve(std::max<size_t>(capacity, 1));
+    }
+
+    ~EmbeddingStore() { release(data_); }
+
+    EmbeddingStore(const EmbeddingStore&) = delete;
+    EmbeddingStore& operator=(const EmbeddingStore&) = delete;
+
+    size_t dim() const { return dim_; }
+    size_t stride() const { return stride_; }
+    size_t size() const { return ids_.size(); }
+    const float* data() const { return data_; }
+    const int* ids() const { return ids_.data(); }
+
+    /// 第 row 行的向量 (行号范围 [0, size()))
+    const float* row(size_t row) const { return data_ + row * stride_; }
+
+    /// 按 id 查找向量，不存在时返回 nullptr
+    const float* find(int id) const {
+        auto it = row_of_.find(id);
+        return it == row_of_.end() ? nullptr : row(it->second);
+    }
+
+    /// 插入或覆盖一个物品的向量，容量不足时按 2 倍扩容
+    void put(int id, const float* vec) {
+        auto it = row_of_.find(id);
+        size_t r;
+        if (it != row_of_.end()) {
+            r = it->second;
+        } else {
+            if (ids_.size() == capacity_) reserve(capacity_ * 2);
+            r = ids_.size();
+            ids_.push_back(id);
+            row_of_.emplace(id, r);
+        }
+        std::memcpy(data_ + r * stride_, vec, dim_ * sizeof(float));
+    }
+
+    /// 删除一个物品，返回是否存在
+    bool remove(int id) {
+        auto it = row_of_.find(id);
+        if (it == row_of_.end()) return false;
+
+        size_t r = it->second;
+        size_t last = ids_.size() - 1;
+        row_of_.erase(it);
+        if (r != last) {
+            std::memcpy(data_ + r * stride_, data_ + last * stride_, stride_ * sizeof(float));
+            ids_[r] = ids_[last];
+            row_of_[ids_[r]] = r;
+        }
+        ids_.pop_back();
+        std::memset(data_ + last * stride_, 0, stride_ * sizeof(float));
+        return true;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= capacity_) return;
+
+        size_t bytes = capacity * stride_ * sizeof(float);
+        float* grown = static_cast<float*>(::operator new(bytes, std::align_val_t(kAlignment)));
+        // 填充列必须为 0: SIMD 内核可能按对齐宽度读取整行
+        std::memset(grown, 0, bytes);
+        if (data_ != nullptr) {
+            std::memcpy(grown, data_, ids_.size() * stride_ * sizeof(float));
+            release(data_);
+        }
+        data_ = grown;
+        capacity_ = capacity;
+        ids_.reserve(capacity);
+        row_of_.reserve(capacity);
+    }
+
+ private:
+    static void release(float* p) {
+        if (p != nullptr) ::operator delete(p, std::align_val_t(kAlignment));
+    }
+
+    size_t dim_;
+    size_t stride_;
+    size_t capacity_ = 0;
+    float* data_ = nullptr;
+    std::vector<int> ids_;
+    std::unordered_map<int, size_t> row_of_;
+};
+
+}  // namespace vecops
+
+#endif  // EMBEDDING_STORE_H
@@ -0,0 +1,170 @@
+// exact_search.h - 分块、多线程的精确 Top-K 内积搜索 (暴力搜索)
+//
+// 用于召回率审计 (作为 HNSW 结果的 ground truth) 和小规模物品库:
+// - 打分使用 simd_kernels.h 中运行时选择的内核，每次 4 个查询共享一次行读取
+// - 行按 L2 大小分块 (row tile)，一个查询块内的全部查询依次扫过同一块，块只从内存读一次
+// - 每个 (查询, 行分片) 维护一个容量为 k 的小顶堆，不再为每一行保存分数后整体排序
+// - (查询块 x 行分片) 网格在共享线程池上并行执行，最后按查询合并各分片的堆
+
+#ifndef EXACT_SEARCH_H
+#define EXACT_SEARCH_H
+
+#include "simd_kernels.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace vecops {
+
+/// 容量固定为 k 的 Top-K 收集器 (按分数保留最大的 k 个)
+class TopK {
+ public:
+    explicit TopK(size_t k = 0) : k_(k) { heap_.reserve(k); }
+
+    void push(float score, int id) {
+        if (heap_.size() < k_) {
+            heap_.emplace_back(score, id);
+            std::push_heap(heap_.begin(), heap_.end(), std::greater<>());
+        } else if (k_ > 0 && score > heap_.front().first) {
+            // 堆顶是当前第 k 大的分数，只有更大的分数才需要入堆
+            std::pop_heap(heap_.begin(), heap_.end(), std::greater<>());
+            heap_.back() = {score, id};
+            std::push_heap(heap_.begin(), heap_.end(), std::greater<>());
+        }
+    }
+
+    void merge(const TopK& other) {
+        for (const auto& entry : other.heap_) push(entry.first, entry.second);
+    }
+
+    /// 按分数降序输出，返回写入的数量 (堆在输出后被清空)
+    size_t drain_sorted(int* out_ids, float* out_scores) {
+        std::sort(heap_.begin(), heap_.end(), std::greater<>());
+        size_t count = heap_.size();
+        for (size_t i = 0; i < count; ++i) {
+            out_ids[i] = heap_[i].second;
+            out_scores[i] = heap_[i].first;
+        }
+        heap_.clear();
+        return count;
+    }
+
+ private:
+    size_t k_;
+    std::vector<std::pair<float, int>> heap_;  // 小顶堆
+};
+
+/// 精确 Top-K 搜索的输入描述
+struct ExactSearchInput {
+    const float* queries = nullptr;  // nq x dim，行优先
+    size_t num_queries = 0;
+    const float* matrix = nullptr;   // rows 行，每行起始间隔 row_stride 个 float
+    size_t row_stride = 0;
+    const int* ids = nullptr;        // 每行对应的 id；为 nullptr 时使用行号
+    size_t rows = 0;
+    size_t dim = 0;
+};
+
+// 行分块大小: 一块约 128KB，可同时驻留在 L2 中
+static constexpr size_t kExactRowTileBytes = 128 * 1024;
+// 一个任务处理的查询数: 行块载入后被这么多查询复用
+static constexpr size_t kExactQueryBlock = 32;
+// 总计算量 (nq * rows * dim) 低于该值时直接在调用线程上执行
+static constexpr size_t kExactParallelThreshold = 1 << 20;
+// 每个行分片至少包含的行数，避免分片过碎导致合并开销超过收益
+static constexpr size_t kExactMinRowsPerChunk = 1024;
+
+/// 对每个查询求内积最大的 k 行
+///
+/// 第 q 个查询的结果写入 out_ids/out_scores 的 [q*k, q*k + out_counts[q]) 区间，
+/// 按分数降序排列；不足 k 个的剩余槽位填 id = -1, score = 0。
+inline void exact_top_k(const ExactSearchInput& in, size_t k, int* out_ids, float* out_scores, int* out_counts) {
+    const size_t nq = in.num_queries;
+    if (nq == 0 || k == 0) return;
+
+    const simd::Kernels& kernels = simd::kernels();
+    ThreadPool& pool = ThreadPool::shared();
+
+    const size_t tile_rows = std::max<size_t>(16, kExactRowTileBytes / (std::max<size_t>(in.dim, 1) * sizeof(float)));
+    const size_t num_qblocks = (nq + kExactQueryBlock - 1) / kExactQueryBlock;
+
+    // 查询块数量不足以占满线程池时，再沿行方向切分
+    size_t num_chunks = 1;
+    if (nq * in.rows * in.dim >= kExactParallelThreshold) {
+        size_t threads = pool.size() + 1;
+        size_t wanted = (threads + num_qblocks - 1) / num_qblocks;
+        size_t max_chunks = std::max<size_t>(1, in.rows / kExactMinRowsPerChunk);
+        num_chunks = std::max<size_t>(1, std::min(wanted, max_chunks));
+    }
+    const size_t chunk_rows = (in.rows + num_chunks - 1) / std::max<size_t>(num_chunks, 1);
+
+    // partial[c * nq + q]: 第 c 个行分片上第 q 个查询的局部 Top-K，每个只由一个任务写入
+    std::vector<TopK> partial(num_chunks * nq, TopK(k));
+
+    auto run_task = [&](size_t task) {
+        const size_t qb = task / num_chunks;
+        const size_t c = task % num_chunks;
+        const size_t q_begin = qb * kExactQueryBlock;
+        const size_t q_end = std::min(nq, q_begin + kExactQueryBlock);
+        const size_t r_begin = c * chunk_rows;
+        const size_t r_end = std::min(in.rows, r_begin + chunk_rows);
+        TopK* heaps = partial.data() + c * nq;
+
+        for (size_t tile = r_begin; tile < r_end; tile += tile_rows) {
+            const size_t tile_end = std::min(r_end, tile + tile_rows);
+
+            size_t q = q_begin;
+            for (; q + 4 <= q_end; q += 4) {
+                const float* group[4] = {
+                    in.queries + q * in.dim,
+                    in.queries + (q + 1) * in.dim,
+                    in.queries + (q + 2) * in.dim,
+                    in.queries + (q + 3) * in.dim,
+                };
+                float scores[4];
+                for (size_t r = tile; r < tile_end; ++r) {
+                    kernels.dot4(group, in.matrix + r * in.row_stride, in.dim, scores);
+                    int id = in.ids ? in.ids[r] : static_cast<int>(r);
+                    heaps[q].push(scores[0], id);
+                    heaps[q + 1].push(scores[1], id);
+                    heaps[q + 2].push(scores[2], id);
+                    heaps[q + 3].push(scores[3], id);
+                }
+            }
+            for (; q < q_end; ++q) {
+                const float* query = in.queries + q * in.dim;
+                for (size_t r = tile; r < tile_end; ++r) {
+                    float score = kernels.dot(query, in.matrix + r * in.row_stride, in.dim);
+                    heaps[q].push(score, in.ids ? in.ids[r] : static_cast<int>(r));
+                }
+            }
+        }
+    };
+
+    const size_t num_tasks = num_qblocks * num_chunks;
+    if (num_tasks == 1) {
+        run_task(0);
+    } else {
+        pool.parallel_for(num_tasks, run_task);
+    }
+
+    for (size_t q = 0; q < nq; ++q) {
+        TopK& merged = partial[q];
+        for (size_t c = 1; c < num_chunks; ++c) merged.merge(partial[c * nq + q]);
+
+        int* ids = out_ids + q * k;
+        float* scores = out_scores + q * k;
+        size_t count = merged.drain_sorted(ids, scores);
+        for (size_t i = count; i < k; ++i) {
+            ids[i] = -1;
+            scores[i] = 0.0f;
+        }
+        if (out_counts != nullptr) out_counts[q] = static_cast<int>(count);
+    }
+}
+
+}  // namespace vecops
+
+#endif  // EXACT_SEARCH_H
@@ -51,9 +51,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     char **linkLists_{nullptr};
     std::vector<int> element_levels_;  // keeps level of each element
 
+    // Memory owned by someone else (e.g. a memory-mapped index file). clear() and resizeIndex() never
+    // free or realloc it; link lists allocated later by addPoint lie outside the range and are freed as usual.
+    bool external_level0_{false};
+    const char *external_links_begin_{nullptr};
+    const char *external_links_end_{nullptr};
+
+    bool isExternalLinkList(const char *p) const {
+        return p >= external_links_begin_ && p < external_links_end_;
+    }
+
     size_t data_size_{0};
 
     DISTFUNC<dist_t> fstdistfunc_;
+    BATCHDISTFUNC<dist_t> fstbatchdistfunc_{nullptr};  // optional, see SpaceInterface::get_batch_dist_func
     void *dist_func_param_{nullptr};
 
     mutable std::mutex label_lookup_lock;  // lock for label_lookup_
@@ -71,7 +82,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     std::unordered_set<tableint> deleted_elements;  // contains internal ids of deleted elements
 
 
-    HierarchicalNSW(SpaceInterface<dist_t> *s) {
+    HierarchicalNSW(SpaceInterface<dist_t> * /*s*/) {
     }
 
 
@@ -101,6 +112,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         num_deleted_ = 0;
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstbatchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
         if ( M <= 10000 ) {
             M_ = M;
@@ -149,10 +161,12 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
     void clear() {
-        free(data_level0_memory_);
+        if (!external_level0_)
+            free(data_level0_memory_);
         data_level0_memory_ = nullptr;
+        external_level0_ = false;
         for (tableint i = 0; i < cur_element_count; i++) {
-            if (element_levels_[i] > 0)
+            if (element_levels_[i] > 0 && !isExternalLinkList(linkLists_[i]))
                 free(linkLists_[i]);
         }
         free(linkLists_);
@@ -305,8 +319,10 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
     }
 
 
-    // bare_bone_search means there is no check for deletions and stop condition is ignored in return of extra performance
-    template <bool bare_bone_search = true, bool collect_metrics = false>
+    // bare_bone_search means there is no check for deletions and stop condition is ignored in return of extra performance.
+    // batch_distances scores all unvisited neighbors of a node with one fstbatchdistfunc_ call (must be non-null)
+    // and then considers them in list order, so the result is identical to the one-at-a-time loop.
+    template <bool bare_bone_search = true, bool collect_metrics = false, bool batch_distances = false>
     std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst>
     searchBaseLayerST(
         tableint ep_id,
@@ -317,6 +333,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         VisitedList *vl = visited_list_pool_->getFreeVisitedList();
         vl_type *visited_array = vl->mass;
         vl_type visited_array_tag = vl->curV;
+        SearchMetrics& metrics = thread_search_metrics();
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> candidate_set;
@@ -339,6 +356,57 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         visited_array[ep_id] = visited_array_tag;
 
+        auto consider_candidate = [&](tableint candidate_id, const void *currObj1, dist_t dist) {
+            bool flag_consider_candidate;
+            if (!bare_bone_search && stop_condition) {
+                flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+            } else {
+                flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+            }
+
+            if (flag_consider_candidate) {
+                candidate_set.emplace(-dist, candidate_id);
+#ifdef USE_SSE
+                _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
+                                offsetLevel0_,  ///////////
+                                _MM_HINT_T0);  ////////////////////////
+#endif
+
+                if (bare_bone_search || 
+                    (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
+                    top_candidates.emplace(dist, candidate_id);
+                    if (!bare_bone_search && stop_condition) {
+                        stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
+                    }
+                }
+
+                bool flag_remove_extra = false;
+                if (!bare_bone_search && stop_condition) {
+                    flag_remove_extra = stop_condition->should_remove_extra();
+                } else {
+                    flag_remove_extra = top_candidates.size() > ef;
+                }
+                while (flag_remove_extra) {
+                    tableint id = top_candidates.top().second;
+                    top_candidates.pop();
+                    if (!bare_bone_search && stop_condition) {
+                        stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
+                        flag_remove_extra = stop_condition->should_remove_extra();
+                    } else {
+                        flag_remove_extra = top_candidates.size() > ef;
+                    }
+                }
+
+                if (!top_candidates.empty())
+                    lowerBound = top_candidates.top().first;
+            }
+        };
+
+        // Scratch buffers for batch_distances, sized for the longest level-0 neighbor list
+        std::vector<tableint> batch_ids(batch_distances ? maxM0_ : 0);
+        std::vector<const void *> batch_points(batch_distances ? maxM0_ : 0);
+        std::vector<dist_t> batch_dists(batch_distances ? maxM0_ : 0);
+
         while (!candidate_set.empty()) {
             std::pair<dist_t, tableint> current_node_pair = candidate_set.top();
             dist_t candidate_dist = -current_node_pair.first;
@@ -363,8 +431,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             size_t size = getListCount((linklistsizeint*)data);
 //                bool cur_node_deleted = isMarkedDeleted(current_node_id);
             if (collect_metrics) {
-                metric_hops++;
-                metric_distance_computations+=size;
+                metrics.hops++;
+                metrics.distance_computations += size;
             }
 
 #ifdef USE_SSE
@@ -374,6 +442,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
             _mm_prefetch((char *) (data + 2), _MM_HINT_T0);
 #endif
 
+            size_t batch = 0;
             for (size_t j = 1; j <= size; j++) {
                 int candidate_id = *(data + j);
 //                    if (candidate_id == 0) continue;
@@ -386,51 +455,20 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
                     visited_array[candidate_id] = visited_array_tag;
 
                     char *currObj1 = (getDataByInternalId(candidate_id));
-                    dist_t dist = fstdistfunc_(data_point, currObj1, dist_func_param_);
-
-                    bool flag_consider_candidate;
-                    if (!bare_bone_search && stop_condition) {
-                        flag_consider_candidate = stop_condition->should_consider_candidate(dist, lowerBound);
+                    if (batch_distances) {
+                        batch_ids[batch] = candidate_id;
+                        batch_points[batch] = currObj1;
+                        batch++;
                     } else {
-                        flag_consider_candidate = top_candidates.size() < ef || lowerBound > dist;
+                        consider_candidate(candidate_id, currObj1, fstdistfunc_(data_point, currObj1, dist_func_param_));
                     }
+                }
+            }
 
-                    if (flag_consider_candidate) {
-                        candidate_set.emplace(-dist, candidate_id);
-#ifdef USE_SSE
-                        _mm_prefetch(data_level0_memory_ + candidate_set.top().second * size_data_per_element_ +
-                                        offsetLevel0_,  ///////////
-                                        _MM_HINT_T0);  ////////////////////////
-#endif
-
-                        if (bare_bone_search || 
-                            (!isMarkedDeleted(candidate_id) && ((!isIdAllowed) || (*isIdAllowed)(getExternalLabel(candidate_id))))) {
-                            top_candidates.emplace(dist, candidate_id);
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->add_point_to_result(getExternalLabel(candidate_id), currObj1, dist);
-                            }
-                        }
-
-                        bool flag_remove_extra = false;
-                        if (!bare_bone_search && stop_condition) {
-                            flag_remove_extra = stop_condition->should_remove_extra();
-                        } else {
-                            flag_remove_extra = top_candidates.size() > ef;
-                        }
-                        while (flag_remove_extra) {
-                            tableint id = top_candidates.top().second;
-                            top_candidates.pop();
-                            if (!bare_bone_search && stop_condition) {
-                                stop_condition->remove_point_from_result(getExternalLabel(id), getDataByInternalId(id), dist);
-                                flag_remove_extra = stop_condition->should_remove_extra();
-                            } else {
-                                flag_remove_extra = top_candidates.size() > ef;
-                            }
-                        }
-
-                        if (!top_candidates.empty())
-                            lowerBound = top_candidates.top().first;
-                    }
+            if (batch_distances && batch > 0) {
+                fstbatchdistfunc_(data_point, batch_points.data(), batch, dist_func_param_, batch_dists.data());
+                for (size_t b = 0; b < batch; b++) {
+                    consider_candidate(batch_ids[b], batch_points[b], batch_dists[b]);
                 }
             }
         }
@@ -641,10 +679,19 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         std::vector<std::mutex>(new_max_elements).swap(link_list_locks_);
 
         // Reallocate base layer
-        char * data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        char * data_level0_memory_new;
+        if (external_level0_) {
+            // externally owned memory cannot be realloc'ed: copy it into a heap block we own
+            data_level0_memory_new = (char *) malloc(new_max_elements * size_data_per_element_);
+            if (data_level0_memory_new != nullptr)
+                memcpy(data_level0_memory_new, data_level0_memory_, cur_element_count * size_data_per_element_);
+        } else {
+            data_level0_memory_new = (char *) realloc(data_level0_memory_, new_max_elements * size_data_per_element_);
+        }
         if (data_level0_memory_new == nullptr)
             throw std::runtime_error("Not enough memory: resizeIndex failed to allocate base layer");
         data_level0_memory_ = data_level0_memory_new;
+        external_level0_ = false;
 
         // Reallocate all other layers
         char ** linkLists_new = (char **) realloc(linkLists_, sizeof(void *) * new_max_elements);
@@ -747,6 +794,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         data_size_ = s->get_data_size();
         fstdistfunc_ = s->get_dist_func();
+        fstbatchdistfunc_ = s->get_batch_dist_func();
         dist_func_param_ = s->get_dist_func_param();
 
         auto pos = input.tellg();
@@ -1269,11 +1317,22 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
     std::priority_queue<std::pair<dist_t, labeltype >>
     searchKnn(const void *query_data, size_t k, BaseFilterFunctor* isIdAllowed = nullptr) const {
+        return searchKnnWithEf(query_data, k, ef_, isIdAllowed);
+    }
+
+
+    /*
+    * Same as searchKnn, but the size of the dynamic candidate list is passed per call instead of being read
+    * from ef_, so concurrent queries can use different recall/latency trade-offs without mutating the index.
+    */
+    std::priority_queue<std::pair<dist_t, labeltype >>
+    searchKnnWithEf(const void *query_data, size_t k, size_t ef, BaseFilterFunctor* isIdAllowed = nullptr) const {
         std::priority_queue<std::pair<dist_t, labeltype >> result;
         if (cur_element_count == 0) return result;
 
         tableint currObj = enterpoint_node_;
         dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        SearchMetrics& metrics = thread_search_metrics();
 
         for (int level = maxlevel_; level > 0; level--) {
             bool changed = true;
@@ -1283,8 +1342,8 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data = (unsigned int *) get_linklist(currObj, level);
                 int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+                metrics.hops++;
+                metrics.distance_computations += size;
 
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
@@ -1304,12 +1363,18 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
         bool bare_bone_search = !num_deleted_ && !isIdAllowed;
-        if (bare_bone_search) {
-            top_candidates = searchBaseLayerST<true>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+        if (bare_bone_search && fstbatchdistfunc_) {
+            top_candidates = searchBaseLayerST<true, true, true>(
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
+        } else if (bare_bone_search) {
+            top_candidates = searchBaseLayerST<true, true>(
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
+        } else if (fstbatchdistfunc_) {
+            top_candidates = searchBaseLayerST<false, true, true>(
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         } else {
-            top_candidates = searchBaseLayerST<false>(
-                    currObj, query_data, std::max(ef_, k), isIdAllowed);
+            top_candidates = searchBaseLayerST<false, true>(
+                    currObj, query_data, std::max(ef, k), isIdAllowed);
         }
 
         while (top_candidates.size() > k) {
@@ -1334,6 +1399,7 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
         tableint currObj = enterpoint_node_;
         dist_t curdist = fstdistfunc_(query_data, getDataByInternalId(enterpoint_node_), dist_func_param_);
+        SearchMetrics& metrics = thread_search_metrics();
 
         for (int level = maxlevel_; level > 0; level--) {
             bool changed = true;
@@ -1343,13 +1409,13 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
 
                 data = (unsigned int *) get_linklist(currObj, level);
                 int size = getListCount(data);
-                metric_hops++;
-                metric_distance_computations+=size;
+                metrics.hops++;
+                metrics.distance_computations += size;
 
                 tableint *datal = (tableint *) (data + 1);
                 for (int i = 0; i < size; i++) {
                     tableint cand = datal[i];
-                    if (cand < 0 || cand > max_elements_)
+                    if (cand > max_elements_)  // tableint is unsigned, no lower bound check needed
                         throw std::runtime_error("cand error");
                     dist_t d = fstdistfunc_(query_data, getDataByInternalId(cand), dist_func_param_);
 
@@ -1363,7 +1429,11 @@ class HierarchicalNSW : public AlgorithmInterface<dist_t> {
         }
 
         std::priority_queue<std::pair<dist_t, tableint>, std::vector<std::pair<dist_t, tableint>>, CompareByFirst> top_candidates;
-        top_candidates = searchBaseLayerST<false>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        if (fstbatchdistfunc_) {
+            top_candidates = searchBaseLayerST<false, true, true>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        } else {
+            top_candidates = searchBaseLayerST<false, true>(currObj, query_data, 0, isIdAllowed, &stop_condition);
+        }
 
         size_t sz = top_candidates.size();
         result.resize(sz);
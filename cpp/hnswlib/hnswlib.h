@@ -122,6 +122,22 @@ static bool AVX512Capable() {
 #include <string.h>
 
 namespace hnswlib {
+
+/*
+* Per-thread search counters. Searches update plain thread-local integers instead of the shared
+* atomics in HierarchicalNSW (metric_hops / metric_distance_computations), so they cost a few
+* register increments per hop and can stay enabled in production. Callers read the counters
+* before and after a search on the same thread to get per-query values.
+*/
+struct SearchMetrics {
+    size_t hops = 0;
+    size_t distance_computations = 0;
+};
+
+inline SearchMetrics& thread_search_metrics() {
+    static thread_local SearchMetrics metrics;
+    return metrics;
+}
 typedef size_t labeltype;
 
 // This can be extended to store state for filtering (e.g. from a std::set)
@@ -170,6 +186,10 @@ static void readBinaryPOD(std::istream &in, T &podRef) {
 template<typename MTYPE>
 using DISTFUNC = MTYPE(*)(const void *, const void *, const void *);
 
+// Distances from one query to n points in a single call: out[i] = dist(query, points[i])
+template<typename MTYPE>
+using BATCHDISTFUNC = void(*)(const void *query, const void *const *points, size_t n, const void *param, MTYPE *out);
+
 template<typename MTYPE>
 class SpaceInterface {
  public:
@@ -180,6 +200,10 @@ class SpaceInterface {
 
     virtual void *get_dist_func_param() = 0;
 
+    // Optional batched variant of get_dist_func(), used by the base-layer search to score
+    // a node's whole neighbor list at once. Must agree with get_dist_func() element-wise.
+    virtual BATCHDISTFUNC<MTYPE> get_batch_dist_func() { return nullptr; }
+
     virtual ~SpaceInterface() {}
 };
 
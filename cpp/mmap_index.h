@@ -0,0 +1,321 @@
+// mmap_index.h - 可直接 mmap 使用的 HNSW 索引文件格式
+//
+// hnswlib 自带的 loadIndex 用 ifstream 逐段解析: 先完整扫描一遍校验，
+// 再为 level-0 和每个元素的上层链表分别 malloc 并拷贝。启动耗时与索引大小成正比。
+//
+// 本格式按 "映射后原地使用" 设计:
+//   [Header]                        固定大小，记录 hnswlib 的全部标量参数和各段偏移
+//   [level-0 块]                    按 kBlockAlignment 对齐，与内存中的 data_level0_memory_ 逐字节相同
+//   [labels]  uint64 x n            每个元素的 label，建立 label_lookup_ 时不必触碰 level-0 页
+//   [levels]  int32  x n            每个元素的层数
+//   [link offsets] uint64 x n       每个元素上层链表相对 links 段的偏移 (层数为 0 时忽略)
+//   [links]                         全部上层链表首尾相接
+//
+// 加载时 level-0 块和上层链表直接指向映射内存 (MAP_PRIVATE: 只读页在同一主机的多个进程间
+// 共享 page cache，写入时按页写时复制)，只有 label 表和层数表需要读取，
+// 启动耗时主要是首次访问时的缺页，而不是解析和拷贝。
+//
+// level-0 映射在一段 max_elements 大小的匿名预留区间上覆盖，之后新增的元素落在匿名页中，
+// 无需扩容即可继续插入。
+
+#ifndef MMAP_INDEX_H
+#define MMAP_INDEX_H
+
+#include "atomic_file.h"
+#include "hnswlib/hnswlib.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vecops {
+
+class MappedIndexFile {
+ public:
+    static constexpr uint64_t kMagic = 0x50414d4d57534e48ULL;  // "HNSWMMAP"
+    static constexpr uint32_t kVersion = 1;
+    // level-0 块的文件偏移对齐: 覆盖 4K / 16K / 64K 页大小的平台
+    static constexpr size_t kBlockAlignment = 64 * 1024;
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t reserved;
+        uint64_t element_count;
+        uint64_t num_deleted;
+        uint64_t size_data_per_element;
+        uint64_t size_links_per_element;
+        uint64_t size_links_level0;
+        uint64_t offset_level0;
+        uint64_t offset_data;
+        uint64_t label_offset;
+        uint64_t data_size;
+        uint64_t max_m;
+        uint64_t max_m0;
+        uint64_t m;
+        uint64_t ef_construction;
+        int64_t max_level;
+        uint64_t enterpoint_node;
+        double mult;
+        uint64_t level0_offset;
+        uint64_t labels_offset;
+        uint64_t levels_offset;
+        uint64_t link_offsets_offset;
+        uint64_t links_offset;
+        uint64_t file_size;
+    };
+
+    MappedIndexFile(const MappedIndexFile&) = delete;
+    MappedIndexFile& operator=(const MappedIndexFile&) = delete;
+
+    ~MappedIndexFile() {
+        if (level0_ != nullptr) munmap(level0_, level0_size_);
+        if (file_ != nullptr) munmap(file_, file_size_);
+    }
+
+    /// 索引在某一时刻的完整拷贝 (已按文件格式排好)，可以在不持有任何锁的情况下写出
+    struct Snapshot {
+        Header header{};
+        std::vector<char> level0;
+        std::vector<uint64_t> labels;
+        std::vector<int32_t> levels;
+        std::vector<uint64_t> link_offsets;
+        std::vector<char> links;
+    };
+
+    /// 按索引当前大小 (加上 slack 个元素的余量) 预先分配并触碰快照的 level-0 缓冲区
+    ///
+    /// 在暂停写者之前调用: 新分配的大块内存首次写入时逐页缺页，
+    /// 提前触碰后 capture 中的拷贝只剩内存带宽开销。
+    static void reserve(const hnswlib::HierarchicalNSW<float>& index, size_t slack, Snapshot& snap) {
+        snap.level0.assign((index.cur_element_count + slack) * index.size_data_per_element_, 0);
+        snap.level0.clear();  // 保留已触碰的容量
+    }
+
+    /// 拷贝索引的当前状态到 snap (调用方保证拷贝期间索引不被修改，搜索可以并发进行)
+    ///
+    /// 只有内存拷贝，没有 I/O: 写者只需在这段时间内暂停，耗时远小于写文件与 fsync。
+    static void capture(const hnswlib::HierarchicalNSW<float>& index, Snapshot& snap) {
+        const size_t n = index.cur_element_count;
+
+        Header& h = snap.header;
+        h = Header{};
+        h.magic = kMagic;
+        h.version = kVersion;
+        h.element_count = n;
+        h.num_deleted = index.num_deleted_;
+        h.size_data_per_element = index.size_data_per_element_;
+        h.size_links_per_element = index.size_links_per_element_;
+        h.size_links_level0 = index.size_links_level0_;
+        h.offset_level0 = index.offsetLevel0_;
+        h.offset_data = index.offsetData_;
+        h.label_offset = index.label_offset_;
+        h.data_size = index.data_size_;
+        h.max_m = index.maxM_;
+        h.max_m0 = index.maxM0_;
+        h.m = index.M_;
+        h.ef_construction = index.ef_construction_;
+        h.max_level = index.maxlevel_;
+        h.enterpoint_node = index.enterpoint_node_;
+        h.mult = index.mult_;
+
+        snap.level0.assign(index.data_level0_memory_, index.data_level0_memory_ + n * h.size_data_per_element);
+        snap.labels.resize(n);
+        snap.levels.resize(n);
+        snap.link_offsets.assign(n, 0);
+        uint64_t links_bytes = 0;
+        for (size_t i = 0; i < n; ++i) {
+            snap.labels[i] = index.getExternalLabel(static_cast<hnswlib::tableint>(i));
+            snap.levels[i] = index.element_levels_[i];
+            if (snap.levels[i] > 0) {
+                snap.link_offsets[i] = links_bytes;
+                links_bytes += index.size_links_per_element_ * static_cast<size_t>(snap.levels[i]);
+            }
+        }
+        snap.links.resize(links_bytes);
+        for (size_t i = 0; i < n; ++i) {
+            if (snap.levels[i] > 0) {
+                std::memcpy(snap.links.data() + snap.link_offsets[i], index.linkLists_[i],
+                            index.size_links_per_element_ * static_cast<size_t>(snap.levels[i]));
+            }
+        }
+
+        h.level0_offset = align_up(sizeof(Header), kBlockAlignment);
+        h.labels_offset = align_up(h.level0_offset + n * h.size_data_per_element, 8);
+        h.levels_offset = h.labels_offset + n * sizeof(uint64_t);
+        h.link_offsets_offset = align_up(h.levels_offset + n * sizeof(int32_t), 8);
+        h.links_offset = h.link_offsets_offset + n * sizeof(uint64_t);
+        h.file_size = h.links_offset + links_bytes;
+    }
+
+    /// 把快照崩溃一致地写到 path (临时文件 + fsync + rename，见 atomic_file.h)
+    ///
+    /// 不能原地截断目标文件: 它可能正被本进程或其他进程映射，
+    /// 截断会让映射中尚未复制的页失效 (访问时 SIGBUS)，rename 后旧映射仍指向旧文件。
+    static void write(const Snapshot& snap, const std::string& path) {
+        const Header& h = snap.header;
+        AtomicFileWriter out(path);
+        out.write_at(0, &h, sizeof(h));
+        out.write_at(h.level0_offset, snap.level0.data(), snap.level0.size());
+        out.write_at(h.labels_offset, snap.labels.data(), snap.labels.size() * sizeof(uint64_t));
+        out.write_at(h.levels_offset, snap.levels.data(), snap.levels.size() * sizeof(int32_t));
+        out.write_at(h.link_offsets_offset, snap.link_offsets.data(), snap.link_offsets.size() * sizeof(uint64_t));
+        out.write_at(h.links_offset, snap.links.data(), snap.links.size());
+        out.extend_to(h.file_size);  // 空索引时文件末尾是对齐产生的空隙
+        out.commit();
+    }
+
+    /// 按本格式写出索引 (调用方保证写出期间索引不被修改)
+    static void save(const hnswlib::HierarchicalNSW<float>& index, const std::string& path) {
+        Snapshot snap;
+        capture(index, snap);
+        write(snap, path);
+    }
+
+    /// 映射索引文件并让 index (由 HierarchicalNSW(space) 构造的空对象) 直接使用映射内存
+    ///
+    /// 返回的对象持有映射，必须比 index 存活更久。
+    /// 格式、版本或元素大小与 space 不一致时抛出异常。
+    static std::unique_ptr<MappedIndexFile> load(
+        const std::string& path,
+        hnswlib::SpaceInterface<float>* space,
+        size_t max_elements,
+        hnswlib::HierarchicalNSW<float>& index
+    ) {
+        std::unique_ptr<MappedIndexFile> mapped(new MappedIndexFile());
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("cannot open index file: " + path);
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+            close(fd);
+            throw std::runtime_error("index file too small: " + path);
+        }
+
+        mapped->file_size_ = static_cast<size_t>(st.st_size);
+        void* file = mmap(nullptr, mapped->file_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (file == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("mmap failed: " + path);
+        }
+        mapped->file_ = static_cast<char*>(file);
+
+        Header h;
+        std::memcpy(&h, mapped->file_, sizeof(h));
+        const size_t n = h.element_count;
+        if (h.magic != kMagic || h.version != kVersion || h.file_size != mapped->file_size_ ||
+            h.data_size != space->get_data_size() || h.label_offset - h.offset_data != h.data_size ||
+            h.level0_offset % kBlockAlignment != 0 ||
+            h.level0_offset + n * h.size_data_per_element > h.labels_offset ||
+            h.levels_offset + n * sizeof(int32_t) > h.link_offsets_offset ||
+            h.links_offset > h.file_size || h.link_offsets_offset + n * sizeof(uint64_t) > h.links_offset) {
+            close(fd);
+            throw std::runtime_error("index file is not a compatible mmap index: " + path);
+        }
+
+        // level-0: 先预留 max_elements 个元素的匿名区间，再把文件中的已有元素覆盖映射到开头
+        const size_t capacity = std::max<size_t>({max_elements, n, 1});
+        mapped->level0_size_ = capacity * h.size_data_per_element;
+        void* level0 = mmap(nullptr, mapped->level0_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (level0 == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("cannot reserve level-0 memory");
+        }
+        mapped->level0_ = static_cast<char*>(level0);
+        if (n > 0) {
+            void* overlay = mmap(mapped->level0_, n * h.size_data_per_element, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_FIXED, fd, static_cast<off_t>(h.level0_offset));
+            if (overlay == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("mmap of level-0 block failed: " + path);
+            }
+        }
+        close(fd);  // 映射在关闭文件描述符后依然有效
+
+        const uint64_t* labels = reinterpret_cast<const uint64_t*>(mapped->file_ + h.labels_offset);
+        const int32_t* levels = reinterpret_cast<const int32_t*>(mapped->file_ + h.levels_offset);
+        const uint64_t* link_offsets = reinterpret_cast<const uint64_t*>(mapped->file_ + h.link_offsets_offset);
+        char* links = mapped->file_ + h.links_offset;
+        const uint64_t links_bytes = h.file_size - h.links_offset;
+
+        // cur_element_count 最后才设置: 中途抛出异常时 clear() 不会访问尚未建立的链表
+        index.max_elements_ = capacity;
+        index.num_deleted_ = h.num_deleted;
+        index.size_data_per_element_ = h.size_data_per_element;
+        index.size_links_per_element_ = h.size_links_per_element;
+        index.size_links_level0_ = h.size_links_level0;
+        index.offsetLevel0_ = h.offset_level0;
+        index.offsetData_ = h.offset_data;
+        index.label_offset_ = h.label_offset;
+        index.data_size_ = h.data_size;
+        index.maxM_ = h.max_m;
+        index.maxM0_ = h.max_m0;
+        index.M_ = h.m;
+        index.ef_construction_ = h.ef_construction;
+        index.ef_ = 10;
+        index.maxlevel_ = static_cast<int>(h.max_level);
+        index.enterpoint_node_ = static_cast<hnswlib::tableint>(h.enterpoint_node);
+        index.mult_ = h.mult;
+        index.revSize_ = 1.0 / h.mult;
+        index.fstdistfunc_ = space->get_dist_func();
+        index.fstbatchdistfunc_ = space->get_batch_dist_func();
+        index.dist_func_param_ = space->get_dist_func_param();
+
+        index.data_level0_memory_ = mapped->level0_;
+        index.external_level0_ = true;
+        index.external_links_begin_ = links;
+        index.external_links_end_ = links + links_bytes;
+
+        index.linkLists_ = static_cast<char**>(malloc(sizeof(void*) * capacity));
+        if (index.linkLists_ == nullptr) throw std::runtime_error("Not enough memory: failed to allocate linklists");
+        index.element_levels_.assign(capacity, 0);
+        index.label_lookup_.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            const int level = levels[i];
+            index.element_levels_[i] = level;
+            index.linkLists_[i] = nullptr;
+            if (level > 0) {
+                const uint64_t bytes = h.size_links_per_element * static_cast<uint64_t>(level);
+                if (link_offsets[i] + bytes > links_bytes) {
+                    throw std::runtime_error("index file link table is corrupted: " + path);
+                }
+                index.linkLists_[i] = links + link_offsets[i];
+            }
+            index.label_lookup_[labels[i]] = static_cast<hnswlib::tableint>(i);
+        }
+
+        std::vector<std::mutex>(capacity).swap(index.link_list_locks_);
+        std::vector<std::mutex>(hnswlib::HierarchicalNSW<float>::MAX_LABEL_OPERATION_LOCKS).swap(index.label_op_locks_);
+        index.visited_list_pool_.reset(new hnswlib::VisitedListPool(1, capacity));
+        // 与 hnswlib 默认构造一致的随机种子 (只影响之后插入元素的层数)
+        index.level_generator_.seed(100);
+        index.update_probability_generator_.seed(101);
+        index.cur_element_count = n;
+        return mapped;
+    }
+
+ private:
+    MappedIndexFile() = default;
+
+    static uint64_t align_up(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    char* file_ = nullptr;
+    size_t file_size_ = 0;
+    char* level0_ = nullptr;
+    size_t level0_size_ = 0;
+};
+
+}  // namespace vecops
+
+#endif  // MMAP_INDEX_H
@@ -0,0 +1,299 @@
+// mutation_log.h - 向量索引的预写日志 (write-ahead log)
+//
+// 记录两次快照之间对索引的每一次修改，启动时在加载的快照上重放即可恢复到最新状态，
+// 不需要重新计算物品向量 (冷启动最贵的一步)。
+//
+// 文件格式:
+//   [magic u32][dim u32]                              文件头
+//   [payload 字节数 u32][crc32(payload) u32][payload] 记录，重复
+//   payload: [op u8][label u64][dim 个 float，仅 upsert]
+//
+// 持久性:
+// - append 在返回前已 write(2) 进页缓存，进程崩溃 (包括 SIGKILL) 不丢记录
+// - fsync 由后台线程每 kSyncInterval 批量执行一次，断电最多丢失这段时间内的记录
+// - 断电可能在文件末尾留下写了一半的记录，重放时按长度 + crc 识别并截掉
+//
+// 记录只表达 "label 的最终值" (写入向量 / 删除)，按顺序重放是幂等的:
+// 在包含了部分记录的快照上重放整个日志，结果与只重放其后的记录相同。
+// 快照写完之后用 drop_prefix 丢弃快照已包含的部分，日志长度与两次快照之间的修改数成正比。
+
+#ifndef MUTATION_LOG_H
+#define MUTATION_LOG_H
+
+#include "atomic_file.h"
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace vecops {
+
+class MutationLog {
+ public:
+    enum Op : uint8_t { kUpsert = 1, kDelete = 2 };
+
+    static constexpr std::chrono::milliseconds kSyncInterval{20};
+
+    /// 打开 (不存在时创建) 日志并准备追加；已有内容必须先经过 replay (截掉不完整的尾部)
+    MutationLog(const std::string& path, size_t dim) : path_(path), dim_(dim) {
+        struct stat st;
+        if (stat(path_.c_str(), &st) != 0 || st.st_size == 0) {
+            write_header(path_, dim_);
+        }
+        open_for_append();
+        syncer_ = std::thread([this] { sync_loop(); });
+    }
+
+    MutationLog(const MutationLog&) = delete;
+    MutationLog& operator=(const MutationLog&) = delete;
+
+    ~MutationLog() {
+        {
+            std::lock_guard<std::mutex> lock(append_lock_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        syncer_.join();
+        fdatasync(fd_);
+        close(fd_);
+    }
+
+    void append_upsert(uint64_t label, const float* vec) {
+        append(kUpsert, label, vec);
+    }
+
+    void append_delete(uint64_t label) {
+        append(kDelete, label, nullptr);
+    }
+
+    /// 当前文件长度 (字节)，作为 drop_prefix 的切分点
+    uint64_t size() const {
+        std::lock_guard<std::mutex> lock(append_lock_);
+        return size_;
+    }
+
+    /// 丢弃 [文件头, offset) 之间的记录 (它们已包含在刚写完的快照中)。
+    /// offset 之后追加的记录原样保留，整个替换过程对崩溃是原子的
+    void drop_prefix(uint64_t offset) {
+        std::lock_guard<std::mutex> rotating(rotate_lock_);
+        std::lock_guard<std::mutex> lock(append_lock_);
+        if (offset < kHeaderBytes || offset > size_) {
+            throw std::invalid_argument("mutation log offset out of range");
+        }
+
+        std::vector<char> tail(static_cast<size_t>(size_ - offset));
+        read_exact(fd_, offset, tail.data(), tail.size(), path_);
+        {
+            AtomicFileWriter out(path_);
+            const uint32_t header[2] = {kMagic, static_cast<uint32_t>(dim_)};
+            out.write_at(0, header, sizeof(header));
+            out.write_at(kHeaderBytes, tail.data(), tail.size());
+            out.commit();
+        }
+        close(fd_);
+        open_for_append();
+        dirty_ = false;
+    }
+
+    /// 依次回调日志中的完整记录，返回记录数。末尾不完整或校验失败的记录被截掉。
+    /// 文件不存在时返回 0；维度与 dim 不一致时抛出异常
+    template <typename UpsertFn, typename DeleteFn>
+    static size_t replay(const std::string& path, size_t dim, UpsertFn on_upsert, DeleteFn on_delete) {
+        int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) return 0;
+            throw std::runtime_error("cannot open mutation log: " + path);
+        }
+        struct FdGuard {
+            int fd;
+            ~FdGuard() { close(fd); }
+        } guard{fd};
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) throw std::runtime_error("cannot stat mutation log: " + path);
+        const uint64_t file_size = static_cast<uint64_t>(st.st_size);
+        if (file_size == 0) return 0;
+
+        uint32_t header[2] = {0, 0};
+        if (file_size < kHeaderBytes) throw std::runtime_error("truncated mutation log header: " + path);
+        read_exact(fd, 0, header, sizeof(header), path);
+        if (header[0] != kMagic || header[1] != dim) {
+            throw std::runtime_error("mutation log does not match index dimension: " + path);
+        }
+
+        const size_t max_payload = payload_bytes(kUpsert, dim);
+        std::vector<char> payload(max_payload);
+        std::vector<float> vec(dim);
+        uint64_t offset = kHeaderBytes;
+        size_t records = 0;
+        while (offset + kRecordHeaderBytes <= file_size) {
+            uint32_t rec[2];
+            read_exact(fd, offset, rec, sizeof(rec), path);
+            const uint32_t length = rec[0];
+            if (length < 1 + sizeof(uint64_t) || length > max_payload ||
+                offset + kRecordHeaderBytes + length > file_size) {
+                break;
+            }
+            read_exact(fd, offset + kRecordHeaderBytes, payload.data(), length, path);
+            if (crc32(payload.data(), length) != rec[1]) {
+                break;
+            }
+            const uint8_t op = static_cast<uint8_t>(payload[0]);
+            uint64_t label;
+            std::memcpy(&label, payload.data() + 1, sizeof(label));
+            if (op == kUpsert && length == max_payload) {
+                std::memcpy(vec.data(), payload.data() + 1 + sizeof(label), dim * sizeof(float));
+                on_upsert(label, vec.data());
+            } else if (op == kDelete && length == payload_bytes(kDelete, dim)) {
+                on_delete(label);
+            } else {
+                break;
+            }
+            offset += kRecordHeaderBytes + length;
+            ++records;
+        }
+
+        if (offset < file_size) {
+            // 最后一次写入没有完整落盘，之后追加的记录必须紧接在最后一条完整记录之后
+            if (ftruncate(fd, static_cast<off_t>(offset)) != 0 || fsync(fd) != 0) {
+                throw std::runtime_error("cannot truncate mutation log: " + path);
+            }
+        }
+        return records;
+    }
+
+ private:
+    static constexpr uint32_t kMagic = 0x31474f4c;  // "LOG1"
+    static constexpr uint64_t kHeaderBytes = 2 * sizeof(uint32_t);
+    static constexpr uint64_t kRecordHeaderBytes = 2 * sizeof(uint32_t);
+
+    static size_t payload_bytes(uint8_t op, size_t dim) {
+        return 1 + sizeof(uint64_t) + (op == kUpsert ? dim * sizeof(float) : 0);
+    }
+
+    static uint32_t crc32(const char* data, size_t bytes) {
+        static const std::vector<uint32_t> table = [] {
+            std::vector<uint32_t> t(256);
+            for (uint32_t i = 0; i < 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                t[i] = c;
+            }
+            return t;
+        }();
+        uint32_t c = 0xffffffffu;
+        for (size_t i = 0; i < bytes; ++i) {
+            c = table[(c ^ static_cast<uint8_t>(data[i])) & 0xff] ^ (c >> 8);
+        }
+        return c ^ 0xffffffffu;
+    }
+
+    static void read_exact(int fd, uint64_t offset, void* out, size_t bytes, const std::string& path) {
+        char* p = static_cast<char*>(out);
+        while (bytes > 0) {
+            ssize_t got = pread(fd, p, bytes, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR) continue;
+            if (got <= 0) throw std::runtime_error("failed to read mutation log: " + path);
+            p += got;
+            offset += static_cast<uint64_t>(got);
+            bytes -= static_cast<size_t>(got);
+        }
+    }
+
+    static void write_header(const std::string& path, size_t dim) {
+        AtomicFileWriter out(path);
+        const uint32_t header[2] = {kMagic, static_cast<uint32_t>(dim)};
+        out.write_at(0, header, sizeof(header));
+        out.commit();
+    }
+
+    // 读写打开: drop_prefix 通过同一个 fd 读出切分点之后的记录 (O_APPEND 只影响 write，不影响 pread)
+    void open_for_append() {
+        fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0) throw std::runtime_error("cannot open mutation log: " + path_);
+        struct stat st;
+        if (fstat(fd_, &st) != 0) {
+            close(fd_);
+            throw std::runtime_error("cannot stat mutation log: " + path_);
+        }
+        size_ = static_cast<uint64_t>(st.st_size);
+    }
+
+    void append(uint8_t op, uint64_t label, const float* vec) {
+        // 整条记录先在本地拼好，一次 write 追加，并发的 append 之间不会交错
+        const size_t length = payload_bytes(op, dim_);
+        std::vector<char> record(kRecordHeaderBytes + length);
+        char* payload = record.data() + kRecordHeaderBytes;
+        payload[0] = static_cast<char>(op);
+        std::memcpy(payload + 1, &label, sizeof(label));
+        if (op == kUpsert) {
+            std::memcpy(payload + 1 + sizeof(label), vec, dim_ * sizeof(float));
+        }
+        const uint32_t rec[2] = {static_cast<uint32_t>(length), crc32(payload, length)};
+        std::memcpy(record.data(), rec, sizeof(rec));
+
+        std::lock_guard<std::mutex> lock(append_lock_);
+        const char* p = record.data();
+        size_t remaining = record.size();
+        while (remaining > 0) {
+            ssize_t written = ::write(fd_, p, remaining);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                // 部分写入的记录会在重放时被识别并截掉
+                throw std::runtime_error("failed to append to mutation log: " + path_);
+            }
+            p += written;
+            remaining -= static_cast<size_t>(written);
+        }
+        size_ += record.size();
+        dirty_ = true;
+    }
+
+    // fsync 不持有 append_lock_，追加不会被磁盘刷写阻塞；
+    // rotate_lock_ 保证 fsync 期间 drop_prefix 不会关闭 fd
+    void sync_loop() {
+        std::unique_lock<std::mutex> lock(append_lock_);
+        while (!stopping_) {
+            wake_.wait_for(lock, kSyncInterval, [this] { return stopping_; });
+            if (stopping_ || !dirty_) continue;
+            lock.unlock();
+            {
+                std::lock_guard<std::mutex> rotating(rotate_lock_);
+                int fd;
+                {
+                    std::lock_guard<std::mutex> relock(append_lock_);
+                    fd = fd_;
+                    dirty_ = false;
+                }
+                fdatasync(fd);
+            }
+            lock.lock();
+        }
+    }
+
+    std::string path_;
+    size_t dim_;
+    int fd_ = -1;
+    uint64_t size_ = 0;
+    bool dirty_ = false;     // 有尚未 fsync 的记录
+    bool stopping_ = false;
+
+    mutable std::mutex append_lock_;  // 保护 fd_ / size_ / dirty_ / stopping_
+    std::mutex rotate_lock_;          // 串行化 fsync 与 drop_prefix 的文件替换
+    std::condition_variable wake_;
+    std::thread syncer_;
+};
+
+}  // namespace vecops
+
+#endif  // MUTATION_LOG_H
@@ -0,0 +1,234 @@
+// product_quantizer.h - 乘积量化 (Product Quantization) 码本
+//
+// 把 dim 维向量切成 m 个连续子空间 (每个 dsub = dim / m 维)，每个子空间用 k-means
+// 学习 256 个中心，一个向量编码为 m 个字节 (每个子空间最近中心的编号)。
+//
+// 内积的两种近似计算:
+// - 非对称 (ADC, 查询 vs 编码): 查询时先算查找表 lut[j][c] = <q_j, centroid_j[c]>，
+//   之后每个编码的内积只需 m 次查表求和。表大小 m * 256 * 4 字节
+//   (m = 32 时 32KB，可常驻 L1)，同一查询的所有距离计算共享这张表
+// - 对称 (SDC, 编码 vs 编码): 用于建图时两个已入库元素之间的比较，
+//   直接在中心向量上求子空间内积之和
+//
+// 码本训练后只读，可被多个线程并发使用。
+
+#ifndef PRODUCT_QUANTIZER_H
+#define PRODUCT_QUANTIZER_H
+
+#include "atomic_file.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vecops {
+
+class ProductQuantizer {
+ public:
+    static constexpr size_t kCentroids = 256;
+    // 每个子空间参与 k-means 的最大样本数，超出部分随机抽样 (训练耗时与样本数成正比)
+    static constexpr size_t kMaxTrainPoints = kCentroids * 32;
+    static constexpr size_t kTrainIterations = 12;
+
+    ProductQuantizer(size_t dim, size_t m) : dim_(dim), m_(m), dsub_(m > 0 ? dim / m : 0) {
+        if (m == 0 || dim == 0 || dim % m != 0) {
+            throw std::invalid_argument("dim must be a positive multiple of the number of subspaces");
+        }
+        centroids_.assign(m_ * kCentroids * dsub_, 0.0f);
+    }
+
+    size_t dim() const { return dim_; }
+    size_t subspaces() const { return m_; }
+    size_t code_size() const { return m_; }
+    size_t lut_size() const { return m_ * kCentroids; }
+
+    /// 用 n 个样本 (行优先 n x dim) 训练码本，n 至少为 kCentroids
+    void train(const float* x, size_t n, uint32_t seed = 42) {
+        if (n < kCentroids) {
+            throw std::invalid_argument("PQ training needs at least 256 samples");
+        }
+
+        std::vector<size_t> sample(n);
+        std::iota(sample.begin(), sample.end(), size_t{0});
+        std::mt19937 rng(seed);
+        if (n > kMaxTrainPoints) {
+            std::shuffle(sample.begin(), sample.end(), rng);
+            sample.resize(kMaxTrainPoints);
+        }
+
+        // 各子空间的 k-means 相互独立，在共享线程池上并行
+        ThreadPool::shared().parallel_for(m_, [&](size_t j) {
+            train_subspace(j, x, sample, seed + static_cast<uint32_t>(j));
+        });
+    }
+
+    /// 编码一个向量，code 至少 code_size() 字节
+    void encode(const float* x, uint8_t* code) const {
+        for (size_t j = 0; j < m_; ++j) {
+            code[j] = static_cast<uint8_t>(nearest(j, x + j * dsub_));
+        }
+    }
+
+    /// 把编码还原为近似向量 (诊断 / 测试用)
+    void decode(const uint8_t* code, float* out) const {
+        for (size_t j = 0; j < m_; ++j) {
+            std::memcpy(out + j * dsub_, centroid(j, code[j]), dsub_ * sizeof(float));
+        }
+    }
+
+    /// 计算查询的内积查找表，lut 至少 lut_size() 个 float
+    void compute_lut(const float* q, float* lut) const {
+        for (size_t j = 0; j < m_; ++j) {
+            const float* qj = q + j * dsub_;
+            float* row = lut + j * kCentroids;
+            for (size_t c = 0; c < kCentroids; ++c) {
+                row[c] = dot(qj, centroid(j, c), dsub_);
+            }
+        }
+    }
+
+    /// 非对称内积: 查找表 vs 编码
+    float lut_dot(const float* lut, const uint8_t* code) const {
+        // 四路独立累加，打断查表求和的依赖链
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        size_t j = 0;
+        for (; j + 4 <= m_; j += 4) {
+            s0 += lut[(j + 0) * kCentroids + code[j + 0]];
+            s1 += lut[(j + 1) * kCentroids + code[j + 1]];
+            s2 += lut[(j + 2) * kCentroids + code[j + 2]];
+            s3 += lut[(j + 3) * kCentroids + code[j + 3]];
+        }
+        for (; j < m_; ++j) s0 += lut[j * kCentroids + code[j]];
+        return (s0 + s1) + (s2 + s3);
+    }
+
+    /// 对称内积: 编码 vs 编码
+    float code_dot(const uint8_t* a, const uint8_t* b) const {
+        float sum = 0.0f;
+        for (size_t j = 0; j < m_; ++j) {
+            sum += dot(centroid(j, a[j]), centroid(j, b[j]), dsub_);
+        }
+        return sum;
+    }
+
+    /// 写出码本 (魔数 + dim + m + 中心向量)，崩溃时不会留下写了一半的文件
+    void save(const std::string& path) const {
+        AtomicFileWriter out(path);
+        uint32_t header[3] = {kMagic, static_cast<uint32_t>(dim_), static_cast<uint32_t>(m_)};
+        out.write_at(0, header, sizeof(header));
+        out.write_at(sizeof(header), centroids_.data(), centroids_.size() * sizeof(float));
+        out.commit();
+    }
+
+    /// 读取码本，文件维度与 dim 不一致时抛出异常
+    static ProductQuantizer load(const std::string& path, size_t dim) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) throw std::runtime_error("cannot open PQ codebook: " + path);
+        uint32_t header[3] = {0, 0, 0};
+        in.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!in || header[0] != kMagic || header[1] != dim) {
+            throw std::runtime_error("PQ codebook does not match index dimension: " + path);
+        }
+        ProductQuantizer pq(dim, header[2]);
+        in.read(reinterpret_cast<char*>(pq.centroids_.data()), pq.centroids_.size() * sizeof(float));
+        if (!in) throw std::runtime_error("truncated PQ codebook: " + path);
+        return pq;
+    }
+
+ private:
+    static constexpr uint32_t kMagic = 0x31305150;  // "PQ01"
+
+    static float dot(const float* a, const float* b, size_t n) {
+        float sum = 0.0f;
+        for (size_t i = 0; i < n; ++i) sum += a[i] * b[i];
+        return sum;
+    }
+
+    const float* centroid(size_t j, size_t c) const {
+        return centroids_.data() + (j * kCentroids + c) * dsub_;
+    }
+
+    float* centroid(size_t j, size_t c) {
+        return centroids_.data() + (j * kCentroids + c) * dsub_;
+    }
+
+    // 子空间 j 中与 x (dsub 维) 欧氏距离最近的中心
+    size_t nearest(size_t j, const float* x) const {
+        size_t best = 0;
+        float best_dist = std::numeric_limits<float>::max();
+        for (size_t c = 0; c < kCentroids; ++c) {
+            const float* cen = centroid(j, c);
+            float dist = 0.0f;
+            for (size_t i = 0; i < dsub_; ++i) {
+                float d = x[i] - cen[i];
+                dist += d * d;
+            }
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = c;
+            }
+        }
+        return best;
+    }
+
+    void train_subspace(size_t j, const float* x, const std::vector<size_t>& sample, uint32_t seed) {
+        const size_t n = sample.size();
+        auto point = [&](size_t i) { return x + sample[i] * dim_ + j * dsub_; };
+
+        // 初始中心: 随机选取 256 个不同样本
+        std::mt19937 rng(seed);
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), size_t{0});
+        std::shuffle(order.begin(), order.end(), rng);
+        for (size_t c = 0; c < kCentroids; ++c) {
+            std::memcpy(centroid(j, c), point(order[c]), dsub_ * sizeof(float));
+        }
+
+        std::vector<uint32_t> assign(n);
+        std::vector<float> sums(kCentroids * dsub_);
+        std::vector<size_t> counts(kCentroids);
+        std::uniform_int_distribution<size_t> pick(0, n - 1);
+
+        for (size_t iter = 0; iter < kTrainIterations; ++iter) {
+            for (size_t i = 0; i < n; ++i) {
+                assign[i] = static_cast<uint32_t>(nearest(j, point(i)));
+            }
+
+            std::fill(sums.begin(), sums.end(), 0.0f);
+            std::fill(counts.begin(), counts.end(), 0);
+            for (size_t i = 0; i < n; ++i) {
+                const float* p = point(i);
+                float* s = sums.data() + assign[i] * dsub_;
+                for (size_t d = 0; d < dsub_; ++d) s[d] += p[d];
+                counts[assign[i]]++;
+            }
+
+            for (size_t c = 0; c < kCentroids; ++c) {
+                float* cen = centroid(j, c);
+                if (counts[c] == 0) {
+                    // 空簇: 重新放到一个随机样本上，避免浪费码字
+                    std::memcpy(cen, point(pick(rng)), dsub_ * sizeof(float));
+                    continue;
+                }
+                const float inv = 1.0f / static_cast<float>(counts[c]);
+                for (size_t d = 0; d < dsub_; ++d) cen[d] = sums[c * dsub_ + d] * inv;
+            }
+        }
+    }
+
+    size_t dim_;
+    size_t m_;
+    size_t dsub_;
+    std::vector<float> centroids_;  // m x 256 x dsub
+};
+
+}  // namespace vecops
+
+#endif  // PRODUCT_QUANTIZER_H
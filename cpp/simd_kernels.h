@@ -0,0 +1,345 @@
+// simd_kernels.h - 运行时分派的内积 SIMD 内核
+//
+// hnswlib 的 space_ip.h 只在编译期开启 -mavx / -mavx512f 时才编译对应内核，
+// 而 build.rs 使用默认编译选项 (x86-64 只有 SSE2)。这里改用函数级的 target 属性
+// 单独编译 AVX2 / AVX-512 版本，并在首次使用时按 CPU 实际支持的指令集选择一次:
+// - x86-64: AVX-512F > AVX2+FMA > 标量
+// - AArch64: NEON (ARMv8 必备，无需运行时检测)
+//
+// 除单向量内积外还提供 "4 个查询 x 1 行" 的内核: 行数据只从内存读取一次，
+// 同时与 4 个查询累加，供暴力搜索按块批量打分；以及 int8 量化向量的整数内积。
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define VECOPS_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#define VECOPS_NEON
+#include <arm_neon.h>
+#endif
+
+namespace vecops {
+namespace simd {
+
+/// 单向量内积: sum(a[i] * b[i])
+using DotFn = float (*)(const float* a, const float* b, size_t n);
+
+/// 4 个查询与同一行的内积: out[j] = dot(q[j], row)
+using Dot4Fn = void (*)(const float* const* q, const float* row, size_t n, float* out);
+
+/// int8 向量的整数内积 (int32 累加，n < 2^17 时不会溢出)
+using DotI8Fn = int32_t (*)(const int8_t* a, const int8_t* b, size_t n);
+
+struct Kernels {
+    DotFn dot;
+    Dot4Fn dot4;
+    DotI8Fn dot_i8;
+    const char* name;
+};
+
+// ----------------------------------------------------------------------------
+// 标量实现 (兜底)
+// ----------------------------------------------------------------------------
+
+inline float dot_scalar(const float* a, const float* b, size_t n) {
+    // 4 路独立累加，打断加法依赖链，编译器也更容易自动向量化
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i) s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+inline void dot4_scalar(const float* const* q, const float* row, size_t n, float* out) {
+    float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        float r = row[i];
+        s0 += q[0][i] * r;
+        s1 += q[1][i] * r;
+        s2 += q[2][i] * r;
+        s3 += q[3][i] * r;
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+inline int32_t dot_i8_scalar(const int8_t* a, const int8_t* b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) sum += static_cast<int32_t>(a[i]) * b[i];
+    return sum;
+}
+
+// ----------------------------------------------------------------------------
+// x86-64: AVX2 + FMA / AVX-512F / AVX-512BW
+// ----------------------------------------------------------------------------
+
+#if defined(VECOPS_X86_DISPATCH)
+
+__attribute__((target("avx2,fma"))) inline float hsum_avx(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x1));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma"))) inline float dot_avx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    float sum = hsum_avx(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+__attribute__((target("avx2,fma"))) inline void dot4_avx2(
+    const float* const* q, const float* row, size_t n, float* out
+) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 r = _mm256_loadu_ps(row + i);
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(q[0] + i), r, acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(q[1] + i), r, acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(q[2] + i), r, acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(q[3] + i), r, acc3);
+    }
+    out[0] = hsum_avx(acc0);
+    out[1] = hsum_avx(acc1);
+    out[2] = hsum_avx(acc2);
+    out[3] = hsum_avx(acc3);
+    for (; i < n; ++i) {
+        float r = row[i];
+        out[0] += q[0][i] * r;
+        out[1] += q[1][i] * r;
+        out[2] += q[2][i] * r;
+        out[3] += q[3][i] * r;
+    }
+}
+
+__attribute__((target("avx512f"))) inline float hsum_avx512(__m512 v) {
+    // 不用 _mm512_reduce_add_ps 或 512->256 位的 cast/shuffle:
+    // GCC 12 的头文件实现在 target 属性下会触发 -Wuninitialized 误报。
+    // 写回栈上再求和的开销相对整段内积可以忽略
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float sum = 0.0f;
+    for (int i = 0; i < 16; ++i) sum += lanes[i];
+    return sum;
+}
+
+__attribute__((target("avx512f"))) inline float dot_avx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+    }
+    if (i < n) {
+        // 尾部用掩码加载，越界部分读为 0，不会访问缓冲区之外的内存
+        __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i), _mm512_maskz_loadu_ps(mask, b + i), acc1);
+    }
+    return hsum_avx512(_mm512_add_ps(acc0, acc1));
+}
+
+__attribute__((target("avx512f"))) inline void dot4_avx512(
+    const float* const* q, const float* row, size_t n, float* out
+) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512 r = _mm512_loadu_ps(row + i);
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(q[0] + i), r, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(q[1] + i), r, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_loadu_ps(q[2] + i), r, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_loadu_ps(q[3] + i), r, acc3);
+    }
+    if (i < n) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 r = _mm512_maskz_loadu_ps(mask, row + i);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q[0] + i), r, acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q[1] + i), r, acc1);
+        acc2 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q[2] + i), r, acc2);
+        acc3 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, q[3] + i), r, acc3);
+    }
+    out[0] = hsum_avx512(acc0);
+    out[1] = hsum_avx512(acc1);
+    out[2] = hsum_avx512(acc2);
+    out[3] = hsum_avx512(acc3);
+}
+
+// int8 内积: 符号扩展到 int16 后用 madd 两两相乘相加到 int32
+__attribute__((target("avx2"))) inline int32_t dot_i8_avx2(const int8_t* a, const int8_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+    int32_t result = _mm_cvtsi128_si32(sum);
+    for (; i < n; ++i) result += static_cast<int32_t>(a[i]) * b[i];
+    return result;
+}
+
+__attribute__((target("avx512bw"))) inline int32_t dot_i8_avx512(const int8_t* a, const int8_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i va = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        __m512i vb = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vb));
+    }
+    // 与 hsum_avx512 相同，避免 512 位归约 intrinsic 在 GCC 12 下的误报
+    alignas(64) int32_t lanes[16];
+    _mm512_store_si512(lanes, acc);
+    int32_t result = 0;
+    for (int j = 0; j < 16; ++j) result += lanes[j];
+    for (; i < n; ++i) result += static_cast<int32_t>(a[i]) * b[i];
+    return result;
+}
+
+#endif  // VECOPS_X86_DISPATCH
+
+// ----------------------------------------------------------------------------
+// AArch64: NEON
+// ----------------------------------------------------------------------------
+
+#if defined(VECOPS_NEON)
+
+inline float dot_neon(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc2 = vfmaq_f32(acc2, vld1q_f32(a + i + 8), vld1q_f32(b + i + 8));
+        acc3 = vfmaq_f32(acc3, vld1q_f32(a + i + 12), vld1q_f32(b + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    float sum = vaddvq_f32(vaddq_f32(vaddq_f32(acc0, acc1), vaddq_f32(acc2, acc3)));
+    for (; i < n; ++i) sum += a[i] * b[i];
+    return sum;
+}
+
+inline void dot4_neon(const float* const* q, const float* row, size_t n, float* out) {
+    float32x4_t acc0 = vdupq_n_f32(0.0f);
+    float32x4_t acc1 = vdupq_n_f32(0.0f);
+    float32x4_t acc2 = vdupq_n_f32(0.0f);
+    float32x4_t acc3 = vdupq_n_f32(0.0f);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t r = vld1q_f32(row + i);
+        acc0 = vfmaq_f32(acc0, vld1q_f32(q[0] + i), r);
+        acc1 = vfmaq_f32(acc1, vld1q_f32(q[1] + i), r);
+        acc2 = vfmaq_f32(acc2, vld1q_f32(q[2] + i), r);
+        acc3 = vfmaq_f32(acc3, vld1q_f32(q[3] + i), r);
+    }
+    out[0] = vaddvq_f32(acc0);
+    out[1] = vaddvq_f32(acc1);
+    out[2] = vaddvq_f32(acc2);
+    out[3] = vaddvq_f32(acc3);
+    for (; i < n; ++i) {
+        float r = row[i];
+        out[0] += q[0][i] * r;
+        out[1] += q[1][i] * r;
+        out[2] += q[2][i] * r;
+        out[3] += q[3][i] * r;
+    }
+}
+
+inline int32_t dot_i8_neon(const int8_t* a, const int8_t* b, size_t n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int8x16_t va = vld1q_s8(a + i);
+        int8x16_t vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_high_s8(va, vb));
+    }
+    int32_t result = vaddvq_s32(acc);
+    for (; i < n; ++i) result += static_cast<int32_t>(a[i]) * b[i];
+    return result;
+}
+
+#endif  // VECOPS_NEON
+
+// ----------------------------------------------------------------------------
+// 运行时分派
+// ----------------------------------------------------------------------------
+
+inline Kernels select_kernels() {
+    Kernels selected = {dot_scalar, dot4_scalar, dot_i8_scalar, "scalar"};
+#if defined(VECOPS_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected = {dot_avx2, dot4_avx2, dot_i8_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        selected.dot = dot_avx512;
+        selected.dot4 = dot4_avx512;
+        selected.name = "avx512";
+        // 512 位 int8 -> int16 扩展属于 AVX-512BW
+        if (__builtin_cpu_supports("avx512bw")) selected.dot_i8 = dot_i8_avx512;
+    }
+#elif defined(VECOPS_NEON)
+    selected = {dot_neon, dot4_neon, dot_i8_neon, "neon"};
+#endif
+    return selected;
+}
+
+/// 当前 CPU 上选用的内核 (首次调用时检测，之后直接返回缓存结果)
+inline const Kernels& kernels() {
+    static const Kernels selected = select_kernels();
+    return selected;
+}
+
+}  // namespace simd
+}  // namespace vecops
+
+#endif  // SIMD_KERNELS_H
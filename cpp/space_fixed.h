@@ -0,0 +1,228 @@
+// space_fixed.h - 编译期固定维度的 float32 内积空间 (hnswlib SpaceInterface)
+//
+// hnswlib 的 InnerProductSpace 在构造时按 dim 选择带余数处理的 SSE 内核 (build.rs 没有开启 -mavx)，
+// 每次距离计算都从 dist_func_param_ 读取维度。这里把维度作为模板参数:
+// - 循环次数是编译期常量，AVX2 / AVX-512 内核完全展开、没有尾部处理，构造时按 CPU 选择一次
+//   (与 simd_kernels.h 相同的函数级 target 属性 + 运行时检测)
+// - 批量距离函数一次算出查询到一个节点全部邻居的距离 (hnswalg.h 中 batch_distances 的
+//   searchBaseLayerST 实例)，查询向量的每个分块只加载一次，同时与多行累加
+//   (AVX-512 每趟 4 行，AVX2 寄存器较少、每趟 2 行)
+//
+// 距离定义与 InnerProductSpace 相同 (1 - dot)，向量按原样存储，已保存的索引无需重建。
+// 只实例化常见的嵌入维度，其余维度由 make_fixed_ip_space 返回 nullptr，调用方回退到 InnerProductSpace。
+
+#ifndef SPACE_FIXED_H
+#define SPACE_FIXED_H
+
+#include "hnswlib/hnswlib.h"
+#include "simd_kernels.h"
+#include <cstddef>
+#include <memory>
+
+namespace vecops {
+namespace fixed {
+
+// ----------------------------------------------------------------------------
+// 标量实现 (兜底): 常量长度，编译器可按 SSE2 自动向量化
+// ----------------------------------------------------------------------------
+
+template <size_t Dim>
+inline float dot_scalar(const float* a, const float* b) {
+    // 8 路独立累加 (两个 SSE 寄存器宽)，没有尾部循环
+    float acc[8] = {};
+    for (size_t i = 0; i < Dim; i += 8) {
+        for (size_t j = 0; j < 8; ++j) acc[j] += a[i + j] * b[i + j];
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) + ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+template <size_t Dim>
+inline void dot_rows4_scalar(const float* q, const void* const* rows, float* out) {
+    for (int j = 0; j < 4; ++j) out[j] = dot_scalar<Dim>(q, static_cast<const float*>(rows[j]));
+}
+
+// ----------------------------------------------------------------------------
+// x86-64: AVX2 + FMA / AVX-512F
+// ----------------------------------------------------------------------------
+
+#if defined(VECOPS_X86_DISPATCH)
+
+template <size_t Dim>
+__attribute__((target("avx2,fma"))) inline float dot_avx2(const float* a, const float* b) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+#pragma GCC unroll 64
+    for (size_t i = 0; i < Dim; i += 32) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+        acc2 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 16), _mm256_loadu_ps(b + i + 16), acc2);
+        acc3 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 24), _mm256_loadu_ps(b + i + 24), acc3);
+    }
+    return simd::hsum_avx(_mm256_add_ps(_mm256_add_ps(acc0, acc1), _mm256_add_ps(acc2, acc3)));
+}
+
+// 1 个查询 x 2 行: 查询的每个分块加载一次，供两行共用。
+// 每行的累加器布局 (4 个累加器、步长 32) 与归约顺序和 dot_avx2 完全相同，批量距离与逐个计算的距离逐位一致；
+// 8 个累加器 + 查询分块 + 行分块正好放进 16 个 ymm 寄存器 (4 行同时计算需要 16 个累加器，会溢出到栈上)
+template <size_t Dim>
+__attribute__((target("avx2,fma"))) inline void dot_rows2_avx2(const float* q, const float* r0, const float* r1, float* out) {
+    __m256 a0 = _mm256_setzero_ps(), b0 = _mm256_setzero_ps();
+    __m256 a1 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+    __m256 a2 = _mm256_setzero_ps(), b2 = _mm256_setzero_ps();
+    __m256 a3 = _mm256_setzero_ps(), b3 = _mm256_setzero_ps();
+#pragma GCC unroll 64
+    for (size_t i = 0; i < Dim; i += 32) {
+        __m256 q0 = _mm256_loadu_ps(q + i);
+        a0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(r0 + i), a0);
+        b0 = _mm256_fmadd_ps(q0, _mm256_loadu_ps(r1 + i), b0);
+        __m256 q1 = _mm256_loadu_ps(q + i + 8);
+        a1 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(r0 + i + 8), a1);
+        b1 = _mm256_fmadd_ps(q1, _mm256_loadu_ps(r1 + i + 8), b1);
+        __m256 q2 = _mm256_loadu_ps(q + i + 16);
+        a2 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(r0 + i + 16), a2);
+        b2 = _mm256_fmadd_ps(q2, _mm256_loadu_ps(r1 + i + 16), b2);
+        __m256 q3 = _mm256_loadu_ps(q + i + 24);
+        a3 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(r0 + i + 24), a3);
+        b3 = _mm256_fmadd_ps(q3, _mm256_loadu_ps(r1 + i + 24), b3);
+    }
+    out[0] = simd::hsum_avx(_mm256_add_ps(_mm256_add_ps(a0, a1), _mm256_add_ps(a2, a3)));
+    out[1] = simd::hsum_avx(_mm256_add_ps(_mm256_add_ps(b0, b1), _mm256_add_ps(b2, b3)));
+}
+
+// 1 个查询 x 4 行: 分两趟，每趟 2 行
+template <size_t Dim>
+__attribute__((target("avx2,fma"))) inline void dot_rows4_avx2(const float* q, const void* const* rows, float* out) {
+    dot_rows2_avx2<Dim>(q, static_cast<const float*>(rows[0]), static_cast<const float*>(rows[1]), out);
+    dot_rows2_avx2<Dim>(q, static_cast<const float*>(rows[2]), static_cast<const float*>(rows[3]), out + 2);
+}
+
+template <size_t Dim>
+__attribute__((target("avx512f"))) inline float dot_avx512(const float* a, const float* b) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+#pragma GCC unroll 64
+    for (size_t i = 0; i < Dim; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    return simd::hsum_avx512(_mm512_add_ps(acc0, acc1));
+}
+
+template <size_t Dim>
+__attribute__((target("avx512f"))) inline void dot_rows4_avx512(const float* q, const void* const* rows, float* out) {
+    const float* r0 = static_cast<const float*>(rows[0]);
+    const float* r1 = static_cast<const float*>(rows[1]);
+    const float* r2 = static_cast<const float*>(rows[2]);
+    const float* r3 = static_cast<const float*>(rows[3]);
+    __m512 a0 = _mm512_setzero_ps(), b0 = _mm512_setzero_ps();
+    __m512 a1 = _mm512_setzero_ps(), b1 = _mm512_setzero_ps();
+    __m512 a2 = _mm512_setzero_ps(), b2 = _mm512_setzero_ps();
+    __m512 a3 = _mm512_setzero_ps(), b3 = _mm512_setzero_ps();
+#pragma GCC unroll 64
+    for (size_t i = 0; i < Dim; i += 32) {
+        __m512 qa = _mm512_loadu_ps(q + i);
+        __m512 qb = _mm512_loadu_ps(q + i + 16);
+        a0 = _mm512_fmadd_ps(_mm512_loadu_ps(r0 + i), qa, a0);
+        b0 = _mm512_fmadd_ps(_mm512_loadu_ps(r0 + i + 16), qb, b0);
+        a1 = _mm512_fmadd_ps(_mm512_loadu_ps(r1 + i), qa, a1);
+        b1 = _mm512_fmadd_ps(_mm512_loadu_ps(r1 + i + 16), qb, b1);
+        a2 = _mm512_fmadd_ps(_mm512_loadu_ps(r2 + i), qa, a2);
+        b2 = _mm512_fmadd_ps(_mm512_loadu_ps(r2 + i + 16), qb, b2);
+        a3 = _mm512_fmadd_ps(_mm512_loadu_ps(r3 + i), qa, a3);
+        b3 = _mm512_fmadd_ps(_mm512_loadu_ps(r3 + i + 16), qb, b3);
+    }
+    out[0] = simd::hsum_avx512(_mm512_add_ps(a0, b0));
+    out[1] = simd::hsum_avx512(_mm512_add_ps(a1, b1));
+    out[2] = simd::hsum_avx512(_mm512_add_ps(a2, b2));
+    out[3] = simd::hsum_avx512(_mm512_add_ps(a3, b3));
+}
+
+#endif  // VECOPS_X86_DISPATCH
+
+// ----------------------------------------------------------------------------
+// hnswlib 距离函数: 每个指令集一份，内积内核内联进距离函数本身，
+// 搜索循环里只剩下一次间接调用 (批量版本每个节点一次)
+// ----------------------------------------------------------------------------
+
+#define VECOPS_FIXED_DISTANCES(SUFFIX, TARGET)                                                            \
+    template <size_t Dim>                                                                                 \
+    TARGET float distance_##SUFFIX(const void* a, const void* b, const void*) {                           \
+        return 1.0f - dot_##SUFFIX<Dim>(static_cast<const float*>(a), static_cast<const float*>(b));      \
+    }                                                                                                     \
+    template <size_t Dim>                                                                                 \
+    TARGET void batch_distance_##SUFFIX(                                                                  \
+        const void* query, const void* const* points, size_t n, const void*, float* out) {                \
+        const float* q = static_cast<const float*>(query);                                                \
+        size_t i = 0;                                                                                     \
+        for (; i + 4 <= n; i += 4) {                                                                      \
+            dot_rows4_##SUFFIX<Dim>(q, points + i, out + i);                                              \
+            for (size_t j = i; j < i + 4; ++j) out[j] = 1.0f - out[j];                                    \
+        }                                                                                                 \
+        for (; i < n; ++i) out[i] = 1.0f - dot_##SUFFIX<Dim>(q, static_cast<const float*>(points[i]));    \
+    }
+
+VECOPS_FIXED_DISTANCES(scalar, )
+#if defined(VECOPS_X86_DISPATCH)
+VECOPS_FIXED_DISTANCES(avx2, __attribute__((target("avx2,fma"))))
+VECOPS_FIXED_DISTANCES(avx512, __attribute__((target("avx512f"))))
+#endif
+
+#undef VECOPS_FIXED_DISTANCES
+
+}  // namespace fixed
+
+template <size_t Dim>
+class InnerProductSpaceFixed : public hnswlib::SpaceInterface<float> {
+    static_assert(Dim > 0 && Dim % 32 == 0, "fixed kernels are unrolled in blocks of 32 floats");
+
+ public:
+    InnerProductSpaceFixed() : dim_(Dim), distance_(fixed::distance_scalar<Dim>), batch_(fixed::batch_distance_scalar<Dim>) {
+#if defined(VECOPS_X86_DISPATCH)
+        // 与 simd::kernels() 的选择保持一致，暴力搜索与图搜索在同一台机器上使用同一档指令集
+        const simd::Kernels& kernels = simd::kernels();
+        if (kernels.dot == simd::dot_avx512) {
+            distance_ = fixed::distance_avx512<Dim>;
+            batch_ = fixed::batch_distance_avx512<Dim>;
+        } else if (kernels.dot == simd::dot_avx2) {
+            distance_ = fixed::distance_avx2<Dim>;
+            batch_ = fixed::batch_distance_avx2<Dim>;
+        }
+#endif
+    }
+
+    size_t get_data_size() override { return Dim * sizeof(float); }
+
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance_; }
+
+    hnswlib::BATCHDISTFUNC<float> get_batch_dist_func() override { return batch_; }
+
+    // hnswlib 的 getDataByLabel 从参数的第一个 size_t 读取维度，距离函数本身不使用参数
+    void* get_dist_func_param() override { return &dim_; }
+
+ private:
+    size_t dim_;
+    hnswlib::DISTFUNC<float> distance_;
+    hnswlib::BATCHDISTFUNC<float> batch_;
+};
+
+/// 为常见的嵌入维度创建固定维度的内积空间，其余维度返回 nullptr
+inline std::unique_ptr<hnswlib::SpaceInterface<float>> make_fixed_ip_space(int dim) {
+    switch (dim) {
+        case 128:
+            return std::make_unique<InnerProductSpaceFixed<128>>();
+        case 256:
+            return std::make_unique<InnerProductSpaceFixed<256>>();
+        case 384:
+            return std::make_unique<InnerProductSpaceFixed<384>>();
+        case 768:
+            return std::make_unique<InnerProductSpaceFixed<768>>();
+        default:
+            return nullptr;
+    }
+}
+
+}  // namespace vecops
+
+#endif  // SPACE_FIXED_H
@@ -0,0 +1,85 @@
+// space_int8.h - int8 标量量化的内积空间 (hnswlib SpaceInterface)
+//
+// 每个向量编码为 dim 个 int8 分量 + 1 个 float 缩放因子 (共 dim + 4 字节，float32 为 4 * dim 字节):
+//   scale = max|x_i| / 127,  code_i = round(x_i / scale)
+//   dot(a, b) ~= scale_a * scale_b * sum(code_a_i * code_b_i)
+//
+// 按向量各自取缩放因子，不需要训练全局码本，新增物品可以直接编码插入。
+// 插入和查询都必须先用 encode() 编码 (对称量化)，距离定义与 InnerProductSpace 一致: 1 - dot。
+//
+// 放在 hnswlib 目录之外，以便复用 simd_kernels.h 中运行时选择的 int8 内核，
+// 也保持 vendored 的 hnswlib 可以原样升级。
+
+#ifndef SPACE_INT8_H
+#define SPACE_INT8_H
+
+#include "hnswlib/hnswlib.h"
+#include "simd_kernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace vecops {
+
+class InnerProductInt8Space : public hnswlib::SpaceInterface<float> {
+ public:
+    explicit InnerProductInt8Space(size_t dim)
+        : param_{dim, simd::kernels().dot_i8}, data_size_(code_size(dim)) {}
+
+    /// 单个向量编码后的字节数
+    static size_t code_size(size_t dim) { return dim + sizeof(float); }
+
+    /// 把 float 向量编码为 int8 + 缩放因子，out 至少 code_size(dim) 字节
+    static void encode(const float* x, size_t dim, void* out) {
+        float max_abs = 0.0f;
+        for (size_t i = 0; i < dim; ++i) max_abs = std::max(max_abs, std::fabs(x[i]));
+
+        float scale = max_abs / 127.0f;
+        float inv = scale > 0.0f ? 1.0f / scale : 0.0f;
+        int8_t* codes = static_cast<int8_t*>(out);
+        for (size_t i = 0; i < dim; ++i) {
+            float q = std::nearbyint(x[i] * inv);
+            codes[i] = static_cast<int8_t>(std::min(127.0f, std::max(-127.0f, q)));
+        }
+        std::memcpy(codes + dim, &scale, sizeof(float));
+    }
+
+    /// 解码回近似的 float 向量 (诊断 / 测试用)
+    static void decode(const void* code, size_t dim, float* out) {
+        const int8_t* codes = static_cast<const int8_t*>(code);
+        float scale;
+        std::memcpy(&scale, codes + dim, sizeof(float));
+        for (size_t i = 0; i < dim; ++i) out[i] = codes[i] * scale;
+    }
+
+    size_t get_data_size() override { return data_size_; }
+
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance; }
+
+    void* get_dist_func_param() override { return &param_; }
+
+ private:
+    struct Param {
+        size_t dim;
+        simd::DotI8Fn dot;
+    };
+
+    static float distance(const void* a, const void* b, const void* param) {
+        const Param* p = static_cast<const Param*>(param);
+        const int8_t* ca = static_cast<const int8_t*>(a);
+        const int8_t* cb = static_cast<const int8_t*>(b);
+        float sa, sb;
+        // 缩放因子紧跟在 dim 个分量之后，不保证 4 字节对齐
+        std::memcpy(&sa, ca + p->dim, sizeof(float));
+        std::memcpy(&sb, cb + p->dim, sizeof(float));
+        return 1.0f - sa * sb * static_cast<float>(p->dot(ca, cb, p->dim));
+    }
+
+    Param param_;
+    size_t data_size_;
+};
+
+}  // namespace vecops
+
+#endif  // SPACE_INT8_H
@@ -0,0 +1,68 @@
+// space_pq.h - 乘积量化的内积空间 (hnswlib SpaceInterface)
+//
+// hnswlib 的距离函数只接收两个裸指针，无法区分 "查询 vs 元素" 和 "元素 vs 元素"。
+// 因此两种缓冲区的首字节带一个标记:
+//   元素 (入库编码): [kCodeTag][m 字节 PQ 编码]                 共 m + 1 字节 (get_data_size)
+//   查询:            [kQueryTag][3 字节填充][m * 256 个 float 查找表]
+// hnswlib 调用距离函数时第一个参数是查询 (或待插入元素)，第二个参数总是已入库的元素，
+// 因此只需检查第一个参数的标记:
+// - 搜索时传入查询缓冲区，走非对称距离 (查表)
+// - 插入和建图裁边时两侧都是编码，走对称距离
+// 查询缓冲区从不被 hnswlib 拷贝进索引，查找表不会进入 level-0 存储。
+
+#ifndef SPACE_PQ_H
+#define SPACE_PQ_H
+
+#include "hnswlib/hnswlib.h"
+#include "product_quantizer.h"
+#include <cstdint>
+#include <vector>
+
+namespace vecops {
+
+class ProductQuantizerSpace : public hnswlib::SpaceInterface<float> {
+ public:
+    static constexpr uint8_t kCodeTag = 0;
+    static constexpr uint8_t kQueryTag = 1;
+
+    /// pq 必须比空间 (及使用它的索引) 存活更久
+    explicit ProductQuantizerSpace(const ProductQuantizer* pq) : pq_(pq), data_size_(pq->code_size() + 1) {}
+
+    /// 编码一个待插入的元素，out 至少 get_data_size() 字节
+    void encode_item(const float* x, std::vector<char>& out) const {
+        out.resize(data_size_);
+        out[0] = static_cast<char>(kCodeTag);
+        pq_->encode(x, reinterpret_cast<uint8_t*>(out.data() + 1));
+    }
+
+    /// 构造查询缓冲区 (标记 + 查找表)，以 float 为单位分配以保证查找表 4 字节对齐
+    void encode_query(const float* q, std::vector<float>& out) const {
+        out.resize(1 + pq_->lut_size());
+        reinterpret_cast<uint8_t*>(out.data())[0] = kQueryTag;
+        pq_->compute_lut(q, out.data() + 1);
+    }
+
+    size_t get_data_size() override { return data_size_; }
+
+    hnswlib::DISTFUNC<float> get_dist_func() override { return distance; }
+
+    void* get_dist_func_param() override { return const_cast<ProductQuantizer*>(pq_); }
+
+ private:
+    static float distance(const void* a, const void* b, const void* param) {
+        const ProductQuantizer* pq = static_cast<const ProductQuantizer*>(param);
+        const uint8_t* lhs = static_cast<const uint8_t*>(a);
+        const uint8_t* code = static_cast<const uint8_t*>(b) + 1;
+        if (lhs[0] == kQueryTag) {
+            return 1.0f - pq->lut_dot(static_cast<const float*>(a) + 1, code);
+        }
+        return 1.0f - pq->code_dot(lhs + 1, code);
+    }
+
+    const ProductQuantizer* pq_;
+    size_t data_size_;
+};
+
+}  // namespace vecops
+
+#endif  // SPACE_PQ_H
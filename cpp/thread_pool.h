@@ -0,0 +1,151 @@
+// thread_pool.h - 进程内共享的固定大小工作线程池
+//
+// 用于把一批相互独立的任务 (例如一批查询向量) 分摊到多个 CPU 核上:
+// - 工作线程在进程生命周期内常驻，避免每次调用都创建/销毁线程
+// - parallel_for 的调用线程本身也参与执行，因此即使在工作线程内部嵌套调用也不会死锁
+// - 任务通过一个原子计数器动态领取 (work stealing 的最简形式)，自动平衡负载
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace vecops {
+
+class ThreadPool {
+ public:
+    explicit ThreadPool(size_t num_threads) {
+        num_threads = std::max<size_t>(1, num_threads);
+        workers_.reserve(num_threads);
+        for (size_t i = 0; i < num_threads; ++i) {
+            workers_.emplace_back([this] { worker_loop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    /// 在 [0, n) 上并行执行 fn(i)，阻塞直到全部完成
+    ///
+    /// @param max_parallelism  最多同时执行的线程数 (含调用线程)，0 表示不限制
+    ///
+    /// 若某个任务抛出异常，剩余任务不再领取，第一个异常会在调用线程重新抛出。
+    void parallel_for(size_t n, const std::function<void(size_t)>& fn, size_t max_parallelism = 0) {
+        if (n == 0) return;
+
+        size_t parallelism = std::min(n, workers_.size() + 1);
+        if (max_parallelism > 0) parallelism = std::min(parallelism, max_parallelism);
+        if (parallelism <= 1) {
+            for (size_t i = 0; i < n; ++i) fn(i);
+            return;
+        }
+
+        // Job 由调用线程和所有帮手任务共享。
+        // 帮手任务可能在调用线程返回之后才被调度到，此时计数器已耗尽，不会再触碰 fn。
+        auto job = std::make_shared<Job>(n, fn);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t i = 0; i + 1 < parallelism; ++i) {
+                tasks_.emplace_back([job] { job->run(); });
+            }
+        }
+        cv_.notify_all();
+
+        job->run();
+        job->wait();
+        if (job->error) {
+            std::rethrow_exception(job->error);
+        }
+    }
+
+    /// 进程级共享线程池，线程数等于硬件并发数
+    static ThreadPool& shared() {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+ private:
+    struct Job {
+        Job(size_t n, std::function<void(size_t)> f) : total(n), fn(std::move(f)) {}
+
+        void run() {
+            for (;;) {
+                size_t i = next.fetch_add(1);
+                if (i >= total) return;
+                if (!failed.load(std::memory_order_relaxed)) {
+                    try {
+                        fn(i);
+                    } catch (...) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (!error) error = std::current_exception();
+                        failed = true;
+                    }
+                }
+                if (done.fetch_add(1) + 1 == total) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    cv.notify_all();
+                }
+            }
+        }
+
+        void wait() {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return done.load() == total; });
+        }
+
+        const size_t total;
+        std::function<void(size_t)> fn;
+        std::atomic<size_t> next{0};
+        std::atomic<size_t> done{0};
+        std::atomic<bool> failed{false};
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+
+    void worker_loop() {
+        for (;;) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (stopping_ && tasks_.empty()) return;
+                task = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
+
+}  // namespace vecops
+
+#endif  // THREAD_POOL_H
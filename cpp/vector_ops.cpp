@@ -8,211 +8,1773 @@
 #include "vector_ops.h"
 #include "hnswlib/hnswlib.h"
 #include "hnswlib/space_ip.h"  // InnerProductSpace (内积空间)
+#include "attribute_index.h"
+#include "embedding_store.h"
+#include "exact_search.h"
+#include "mmap_index.h"
+#include "mutation_log.h"
+#include "product_quantizer.h"
+#include "simd_kernels.h"
+#include "space_fixed.h"
+#include "space_int8.h"
+#include "space_pq.h"
+#include "thread_pool.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
 #include <vector>
 #include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
 
 // ============================================================================
-// 全局 HNSW 索引
+// 基础向量运算实现
 // ============================================================================
 
-// 索引指针 - 使用内积空间 (Inner Product Space)
-// 内积空间适合归一化向量的相似度计算: distance = 1 - dot_product
-static hnswlib::HierarchicalNSW<float>* g_hnsw_index = nullptr;
-static hnswlib::InnerProductSpace* g_space = nullptr;
-static int g_dim = 0;
-static std::mutex g_mutex;  // 线程安全
+extern "C" int cpp_add(int a, int b) {
+    return a + b;
+}
+
+extern "C" float dot_product(const float* vec_a, const float* vec_b, int len) {
+    if (len <= 0) return 0.0f;
+    return vecops::simd::kernels().dot(vec_a, vec_b, static_cast<size_t>(len));
+}
+
+extern "C" const char* vector_ops_simd_backend(void) {
+    return vecops::simd::kernels().name;
+}
+
+// 用一组伪随机向量比较 batch(query, rows) 与逐行 single(query, row) 的结果，返回不逐位相等的个数。
+// 7 行同时覆盖 4 行一组的内核与尾部的单行路径
+template <size_t Dim>
+static int fixed_kernel_mismatches(hnswlib::DISTFUNC<float> single, hnswlib::BATCHDISTFUNC<float> batch) {
+    const size_t rows = 7;
+    std::vector<float> data((rows + 1) * Dim);
+    uint32_t seed = 12345;
+    for (float& x : data) {
+        seed = seed * 1664525u + 1013904223u;
+        x = static_cast<float>(seed >> 8) / static_cast<float>(1u << 24) - 0.5f;
+    }
+    const float* query = data.data() + rows * Dim;
+    const void* points[rows];
+    for (size_t i = 0; i < rows; ++i) points[i] = data.data() + i * Dim;
+
+    float batched[rows];
+    batch(query, points, rows, nullptr, batched);
+    int mismatches = 0;
+    for (size_t i = 0; i < rows; ++i) {
+        const float expected = single(query, points[i], nullptr);
+        mismatches += std::memcmp(&expected, &batched[i], sizeof(float)) != 0;
+    }
+    return mismatches;
+}
+
+template <size_t Dim>
+static int fixed_space_mismatches() {
+    namespace fixed = vecops::fixed;
+    int mismatches = fixed_kernel_mismatches<Dim>(fixed::distance_scalar<Dim>, fixed::batch_distance_scalar<Dim>);
+#if defined(VECOPS_X86_DISPATCH)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        mismatches += fixed_kernel_mismatches<Dim>(fixed::distance_avx2<Dim>, fixed::batch_distance_avx2<Dim>);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        mismatches += fixed_kernel_mismatches<Dim>(fixed::distance_avx512<Dim>, fixed::batch_distance_avx512<Dim>);
+    }
+#endif
+    return mismatches;
+}
+
+extern "C" int vector_ops_fixed_kernel_mismatches(void) {
+    try {
+        return fixed_space_mismatches<128>() + fixed_space_mismatches<256>() +
+               fixed_space_mismatches<384>() + fixed_space_mismatches<768>();
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 两轮 "追加 -> 取切分点 -> 继续追加 -> drop_prefix"，模拟写负载下的快照截断；
+// 第二轮作用在 drop_prefix 重新打开的 fd 上。重放结果必须恰好是最后一轮切分点之后的记录
+extern "C" int vector_ops_mutation_log_check(const char* path) {
+    if (path == nullptr) {
+        return -1;
+    }
+    try {
+        const size_t dim = 4;
+        std::remove(path);
+        std::vector<std::pair<uint64_t, bool>> expected;  // (label, 是否为 upsert)
+        {
+            vecops::MutationLog log(path, dim);
+            uint64_t label = 0;
+            for (int round = 0; round < 2; ++round) {
+                for (int i = 0; i < 10; ++i, ++label) {
+                    const std::vector<float> vec(dim, static_cast<float>(label));
+                    log.append_upsert(label, vec.data());
+                }
+                const uint64_t cut = log.size();
+                expected.clear();
+                for (int i = 0; i < 5; ++i, ++label) {
+                    const std::vector<float> vec(dim, static_cast<float>(label));
+                    log.append_upsert(label, vec.data());
+                    expected.emplace_back(label, true);
+                }
+                log.append_delete(label - 1);
+                expected.emplace_back(label - 1, false);
+                log.drop_prefix(cut);
+            }
+        }
+
+        std::vector<std::pair<uint64_t, bool>> replayed;
+        bool vectors_ok = true;
+        const size_t records = vecops::MutationLog::replay(std::string(path), dim,
+            [&](uint64_t label, const float* vec) {
+                vectors_ok = vectors_ok && vec[0] == static_cast<float>(label) && vec[dim - 1] == static_cast<float>(label);
+                replayed.emplace_back(label, true);
+            },
+            [&](uint64_t label) { replayed.emplace_back(label, false); });
+        std::remove(path);
+        return vectors_ok && replayed == expected ? static_cast<int>(records) : -1;
+    } catch (...) {
+        std::remove(path);
+        return -1;
+    }
+}
+
+// ============================================================================
+// HNSW 索引句柄
+// ============================================================================
+
+// 索引句柄的实际定义 (对 C/Rust 侧不透明)
+//
+// 锁策略 (读写锁):
+// - shared_lock: searchKnn / addPoint —— hnswlib 内部用 link_list_locks_ 和
+//   label_op_locks_ 保证并发安全，这里只需防止索引整体状态被改写
+// - unique_lock: saveIndex / resizeIndex —— 需要整张图在写出或搬迁期间保持静止
+//
+// 另有 mutation_lock 把写者与快照隔开 (加锁顺序: mutation_lock 在 rw_lock 之前):
+// - 插入 / 删除持有它的 shared_lock
+// - mmap 快照持有 unique_lock 拷贝整张图，此时搜索照常进行 (只持有 rw_lock 的读锁)，
+//   只有写者暂停；写文件和 fsync 在释放所有锁之后进行
+// 开启预写日志后，写者在持有 mutation_lock 期间修改索引、成功之后再追加日志 (返回调用方之前)，
+// 因此快照暂停写者时记下的日志长度恰好对应快照包含的修改，失败的修改也不会被重放出来。
+//
+// 默认 ef 不使用 hnswlib 的 ef_ 字段 (普通 size_t，运行时修改会与搜索产生数据竞争)，
+// 而是保存在原子变量中，每次查询通过 searchKnnWithEf 显式传入。
+struct hnsw_index {
+    // 注意声明顺序: 成员按声明的逆序析构，index 必须先于 mapping / space 销毁，space 先于 pq 销毁
+    std::unique_ptr<vecops::ProductQuantizer> pq;  // 仅 PQ 存储使用
+    std::unique_ptr<hnswlib::SpaceInterface<float>> space;
+    std::unique_ptr<vecops::MappedIndexFile> mapping;  // 仅 mmap 加载的索引使用，持有 index 引用的映射内存
+    std::unique_ptr<hnswlib::HierarchicalNSW<float>> index;
+    int dim = 0;
+    int storage = HNSW_STORAGE_FLOAT32;
+    std::atomic<size_t> default_ef{10};
+    mutable std::shared_mutex rw_lock;
+    std::mutex slot_lock;  // 串行化涉及已删除槽位的插入与删除，见 upsert_point
+    std::shared_mutex mutation_lock;
+    std::mutex snapshot_lock;  // 同一时刻只有一个快照在写临时文件
+    std::atomic<uint64_t> mutations{0};  // 成功的插入 / 更新 / 删除总数
+    // 预写日志 (hnsw_index_open_log 开启，之后直到句柄释放都不再替换)
+    std::unique_ptr<vecops::MutationLog> log;
+
+    // mmap 快照的统计
+    std::atomic<uint64_t> snapshot_count{0};
+    std::atomic<uint64_t> snapshot_pause_us{0};  // 最近一次快照暂停写者的时间
+    std::atomic<uint64_t> snapshot_write_us{0};  // 最近一次快照写文件 + fsync 的时间
+    std::atomic<uint64_t> log_trim_failures{0};  // 快照已落盘但截断日志失败的次数
+
+    // 自动扩容的统计 (扩容期间持有写锁，搜索与插入都会等待)
+    std::atomic<uint64_t> resize_count{0};
+    std::atomic<uint64_t> resize_total_us{0};
+    std::atomic<uint64_t> resize_max_us{0};
+
+    // 物品属性 (类别 / 价格)，由独立的读写锁保护，设置属性不会阻塞向量搜索
+    vecops::AttributeIndex attrs;
+    mutable std::shared_mutex attr_lock;
+};
+
+// 当前线程在搜索读锁上的等待 (见 hnsw_thread_search_metrics)
+struct LockWaitMetrics {
+    uint64_t waits = 0;
+    uint64_t wait_ns = 0;
+};
+
+static LockWaitMetrics& thread_lock_wait_metrics() {
+    static thread_local LockWaitMetrics metrics;
+    return metrics;
+}
+
+// 搜索使用的读锁: 先 try_lock，只有拿不到 (写者正在扩容 / 保存) 时才计时等待，
+// 无竞争的查询不读时钟
+static std::shared_lock<std::shared_mutex> lock_for_search(const hnsw_index_t* index) {
+    std::shared_lock<std::shared_mutex> lock(index->rw_lock, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        auto waited = std::chrono::steady_clock::now() - start;
+        LockWaitMetrics& metrics = thread_lock_wait_metrics();
+        metrics.waits++;
+        metrics.wait_ns += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(waited).count());
+    }
+    return lock;
+}
+
+static std::unique_ptr<hnswlib::SpaceInterface<float>> make_space(
+    int dim, int storage, const vecops::ProductQuantizer* pq
+) {
+    switch (storage) {
+        case HNSW_STORAGE_FLOAT32:
+            // 使用内积空间 (Inner Product Space)
+            // 对于归一化向量: distance = 1 - inner_product
+            // 所以 distance 越小 = similarity 越高
+            // 常见维度 (如 384) 使用固定维度的空间: 完全展开的 AVX2 / AVX-512 内核 + 按邻居表批量计算距离
+            if (auto fixed = vecops::make_fixed_ip_space(dim)) {
+                return fixed;
+            }
+            return std::make_unique<hnswlib::InnerProductSpace>(dim);
+        case HNSW_STORAGE_INT8:
+            return std::make_unique<vecops::InnerProductInt8Space>(dim);
+        case HNSW_STORAGE_PQ:
+            if (pq == nullptr) return nullptr;
+            return std::make_unique<vecops::ProductQuantizerSpace>(pq);
+        default:
+            return nullptr;
+    }
+}
+
+static const vecops::ProductQuantizerSpace* pq_space(const hnsw_index_t* index) {
+    return static_cast<const vecops::ProductQuantizerSpace*>(index->space.get());
+}
+
+// 把待插入的 float 向量转换为索引的存储格式:
+// float32 存储直接返回原指针，量化存储编码到 buf 后返回 buf
+static const void* encode_vector(const hnsw_index_t* index, const float* vec, std::vector<char>& buf) {
+    const size_t dim = static_cast<size_t>(index->dim);
+    switch (index->storage) {
+        case HNSW_STORAGE_INT8:
+            buf.resize(vecops::InnerProductInt8Space::code_size(dim));
+            vecops::InnerProductInt8Space::encode(vec, dim, buf.data());
+            return buf.data();
+        case HNSW_STORAGE_PQ:
+            pq_space(index)->encode_item(vec, buf);
+            return buf.data();
+        default:
+            return vec;
+    }
+}
+
+// 把查询向量转换为距离函数的查询格式:
+// PQ 存储构造查找表 (与入库编码格式不同)，其余格式与 encode_vector 相同。
+// buf 以 float 为单位，保证查找表对齐
+static const void* encode_query(const hnsw_index_t* index, const float* query, std::vector<float>& buf) {
+    const size_t dim = static_cast<size_t>(index->dim);
+    switch (index->storage) {
+        case HNSW_STORAGE_INT8:
+            buf.resize((vecops::InnerProductInt8Space::code_size(dim) + sizeof(float) - 1) / sizeof(float));
+            vecops::InnerProductInt8Space::encode(query, dim, buf.data());
+            return buf.data();
+        case HNSW_STORAGE_PQ:
+            pq_space(index)->encode_query(query, buf);
+            return buf.data();
+        default:
+            return query;
+    }
+}
+
+// 开启已删除槽位的复用 (新建或加载索引之后调用)
+// 原生格式加载时 hnswlib 只在构造时开启的情况下登记已删除元素，mmap 加载则完全不登记，这里统一补上。
+// 没有已删除元素时跳过扫描，避免为此读入 mmap 索引的整个 level-0 块
+static void enable_slot_reuse(hnswlib::HierarchicalNSW<float>& hnsw) {
+    hnsw.allow_replace_deleted_ = true;
+    if (hnsw.num_deleted_.load() == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(hnsw.deleted_elements_lock);
+    hnsw.deleted_elements.clear();
+    for (hnswlib::tableint i = 0; i < hnsw.cur_element_count; ++i) {
+        if (hnsw.isMarkedDeleted(i)) {
+            hnsw.deleted_elements.insert(i);
+        }
+    }
+}
+
+// 插入或更新一个已编码的元素 (调用方持有 rw_lock)
+//
+// hnswlib 的槽位复用 (addPoint 的 replace_deleted) 要求被复用的元素上没有并发操作，
+// 且不能用于已存在的 label，否则同一 label 会占据两个槽位。因此存在已删除元素时，
+// 插入与删除经由 slot_lock 串行执行并先判断 label 的状态；
+// 没有已删除元素时直接走 hnswlib 自身的并发插入 / 更新。
+// 检查之后并发的删除可能恰好删掉同一 label，hnswlib 会拒绝原地更新已删除元素 (抛出异常、不修改索引)，
+// 此时已删除元素数不再为 0，改走 slot_lock 下的慢路径重试
+static void upsert_point(hnsw_index_t* index, const void* data, hnswlib::labeltype label) {
+    hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+    if (hnsw.num_deleted_.load() == 0) {
+        try {
+            hnsw.addPoint(data, label);
+            return;
+        } catch (...) {
+            if (hnsw.num_deleted_.load() == 0) {
+                throw;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(index->slot_lock);
+    bool exists = false;
+    bool deleted = false;
+    {
+        std::lock_guard<std::mutex> lookup(hnsw.label_lookup_lock);
+        auto it = hnsw.label_lookup_.find(label);
+        exists = it != hnsw.label_lookup_.end();
+        deleted = exists && hnsw.isMarkedDeleted(it->second);
+    }
+    if (deleted) {
+        // 被删除的 label 重新出现: 恢复它原来的槽位再原地更新
+        hnsw.unmarkDelete(label);
+    }
+    hnsw.addPoint(data, label, !exists);
+}
+
+// 修改成功之后追加到预写日志 (未开启日志时什么也不做)，调用方持有 mutation_lock 的读锁
+static void log_upsert(hnsw_index_t* index, int id, const float* vec) {
+    if (index->log != nullptr) {
+        index->log->append_upsert(static_cast<hnswlib::labeltype>(id), vec);
+    }
+}
+
+static void log_delete(hnsw_index_t* index, hnswlib::labeltype label) {
+    if (index->log != nullptr) {
+        index->log->append_delete(label);
+    }
+}
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+// 容量不足时按几何级数扩容: 每次扩大到至少 1.5 倍 (且至少多 1024 个槽位)，
+// 摊还下来每个元素只被搬迁常数次，扩容 (以及期间的写锁) 的次数是 O(log n)
+static const double kGrowthFactor = 1.5;
+static const size_t kMinGrowth = 1024;
+
+static bool index_full(const hnswlib::HierarchicalNSW<float>& hnsw) {
+    return hnsw.cur_element_count >= hnsw.max_elements_;
+}
+
+// 把容量扩大到至少 required (调用方持有 rw_lock 的写锁)
+static void grow_locked(hnsw_index_t* index, size_t required) {
+    hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+    const size_t capacity = hnsw.max_elements_;
+    if (required <= capacity) {
+        return;
+    }
+    const size_t target = std::max({
+        required, capacity + kMinGrowth, static_cast<size_t>(static_cast<double>(capacity) * kGrowthFactor)});
+
+    const auto start = std::chrono::steady_clock::now();
+    // level-0 块用 realloc 扩大 (大块内存由 glibc 通过 mremap 重映射，通常不需要逐字节拷贝)
+    hnsw.resizeIndex(target);
+    const uint64_t us = elapsed_us(start);
+
+    index->resize_count.fetch_add(1, std::memory_order_relaxed);
+    index->resize_total_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t prev = index->resize_max_us.load(std::memory_order_relaxed);
+    while (us > prev && !index->resize_max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed)) {
+    }
+}
+
+// 保证在当前元素之外还能再放下 incoming 个新元素
+static void ensure_capacity(hnsw_index_t* index, size_t incoming) {
+    {
+        std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+        if (index->index->cur_element_count + incoming <= index->index->max_elements_) {
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> lock(index->rw_lock);
+    grow_locked(index, index->index->cur_element_count + incoming);
+}
+
+// ids 中当前不在索引里的 label 个数 (即需要新槽位的元素数上界，不计已删除槽位的复用)
+template <typename IdFn>
+static size_t count_new_labels(const hnswlib::HierarchicalNSW<float>& hnsw, size_t n, IdFn id_at) {
+    std::lock_guard<std::mutex> lock(hnsw.label_lookup_lock);
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (hnsw.label_lookup_.find(static_cast<hnswlib::labeltype>(id_at(i))) == hnsw.label_lookup_.end()) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// 解析单次查询的 ef: <= 0 表示使用句柄的默认 ef
+static size_t resolve_ef(const hnsw_index_t* index, int ef) {
+    return ef > 0 ? static_cast<size_t>(ef) : index->default_ef.load(std::memory_order_relaxed);
+}
+
+// 将 searchKnn 返回的大顶堆 (距离最大者在堆顶) 直接从后往前写入输出缓冲区，
+// 省去中间 vector 和 std::reverse，写完后 out[0] 即为最相似的结果
+static int write_knn_results(
+    std::priority_queue<std::pair<float, hnswlib::labeltype>>& result,
+    int* out_ids,
+    float* out_scores
+) {
+    int count = static_cast<int>(result.size());
+    for (int i = count - 1; i >= 0; --i) {
+        const auto& item = result.top();
+        // 对于内积空间: distance = 1 - inner_product
+        // 所以 similarity = 1 - distance = inner_product
+        out_scores[i] = 1.0f - item.first;
+        out_ids[i] = static_cast<int>(item.second);
+        result.pop();
+    }
+    return count;
+}
+
+extern "C" hnsw_index_t* hnsw_index_new_pq(
+    int dim, int max_elements, int M, int ef_construction, int pq_m, const float* train, int num_train
+) {
+    if (dim <= 0 || max_elements <= 0 || pq_m <= 0 || train == nullptr || num_train <= 0) {
+        return nullptr;
+    }
+
+    try {
+        auto handle = std::make_unique<hnsw_index>();
+        handle->dim = dim;
+        handle->storage = HNSW_STORAGE_PQ;
+        handle->pq = std::make_unique<vecops::ProductQuantizer>(static_cast<size_t>(dim), static_cast<size_t>(pq_m));
+        handle->pq->train(train, static_cast<size_t>(num_train));
+        handle->space = make_space(dim, HNSW_STORAGE_PQ, handle->pq.get());
+        handle->index = std::make_unique<hnswlib::HierarchicalNSW<float>>(
+            handle->space.get(),
+            max_elements,
+            M,
+            ef_construction
+        );
+        enable_slot_reuse(*handle->index);
+        return handle.release();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" hnsw_index_t* hnsw_index_new(int dim, int max_elements, int M, int ef_construction) {
+    return hnsw_index_new_with_storage(dim, max_elements, M, ef_construction, HNSW_STORAGE_FLOAT32);
+}
+
+extern "C" hnsw_index_t* hnsw_index_new_with_storage(
+    int dim, int max_elements, int M, int ef_construction, int storage
+) {
+    if (dim <= 0 || max_elements <= 0) {
+        return nullptr;
+    }
+
+    try {
+        auto handle = std::make_unique<hnsw_index>();
+        handle->dim = dim;
+        handle->storage = storage;
+        handle->space = make_space(dim, storage, nullptr);
+        if (handle->space == nullptr) {
+            return nullptr;
+        }
+
+        // 创建 HNSW 索引
+        // M: 每层的最大连接数 (影响图的密度)
+        // ef_construction: 构建时的动态列表大小 (影响索引质量)
+        handle->index = std::make_unique<hnswlib::HierarchicalNSW<float>>(
+            handle->space.get(),
+            max_elements,
+            M,
+            ef_construction
+        );
+        enable_slot_reuse(*handle->index);
+        return handle.release();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+extern "C" int hnsw_index_load(const char* path, int dim, int max_elements, hnsw_index_t** out_index) {
+    return hnsw_index_load_with_storage(path, dim, max_elements, HNSW_STORAGE_FLOAT32, out_index);
+}
+
+// hnsw_index_load_with_storage / hnsw_index_load_mmap 的共同实现，
+// use_mmap 决定按 hnswlib 原生格式解析还是按 mmap_index.h 的格式映射
+static int load_index_file(
+    const char* path, int dim, int max_elements, int storage, bool use_mmap, hnsw_index_t** out_index
+) {
+    if (path == nullptr || out_index == nullptr || dim <= 0) {
+        return -1;
+    }
+
+    try {
+        auto handle = std::make_unique<hnsw_index>();
+        handle->dim = dim;
+        handle->storage = storage;
+
+        // 尝试从文件加载
+        FILE* f = fopen(path, "rb");
+        const bool exists = f != nullptr;
+        if (f != nullptr) {
+            fclose(f);
+        }
+
+        if (storage == HNSW_STORAGE_PQ) {
+            // PQ 索引离不开训练好的码本，文件不存在时无法在这里新建
+            if (!exists) {
+                return -1;
+            }
+            handle->pq = std::make_unique<vecops::ProductQuantizer>(
+                vecops::ProductQuantizer::load(std::string(path) + ".pq", static_cast<size_t>(dim)));
+        }
+        handle->space = make_space(dim, storage, handle->pq.get());
+        if (handle->space == nullptr) {
+            return -1;
+        }
+
+        int status;
+        if (exists && use_mmap) {
+            // 元素大小与存储格式的一致性在 MappedIndexFile::load 中校验
+            handle->index = std::make_unique<hnswlib::HierarchicalNSW<float>>(handle->space.get());
+            handle->mapping = vecops::MappedIndexFile::load(
+                std::string(path), handle->space.get(), static_cast<size_t>(std::max(max_elements, 0)), *handle->index);
+            status = 0;
+        } else if (exists) {
+            // 文件存在，加载索引
+            handle->index = std::make_unique<hnswlib::HierarchicalNSW<float>>(
+                handle->space.get(), std::string(path));
+            // 文件中每个元素的向量字节数必须与当前存储格式一致，
+            // 否则是用另一种格式 (或维度) 保存的索引，不能按当前格式解释
+            const auto* hnsw = handle->index.get();
+            if (hnsw->label_offset_ - hnsw->offsetData_ != handle->space->get_data_size()) {
+                return -1;
+            }
+            status = 0;  // 成功加载
+        } else {
+            // 文件不存在，创建新索引
+            handle->index = std::make_unique<hnswlib::HierarchicalNSW<float>>(
+                handle->space.get(), max_elements, 16, 200);
+            status = 1;  // 创建了新索引
+        }
+        enable_slot_reuse(*handle->index);
+
+        *out_index = handle.release();
+        return status;
+    } catch (...) {
+        return -1;  // 失败
+    }
+}
+
+extern "C" int hnsw_index_load_with_storage(
+    const char* path, int dim, int max_elements, int storage, hnsw_index_t** out_index
+) {
+    return load_index_file(path, dim, max_elements, storage, false, out_index);
+}
+
+extern "C" int hnsw_index_load_mmap(
+    const char* path, int dim, int max_elements, int storage, hnsw_index_t** out_index
+) {
+    return load_index_file(path, dim, max_elements, storage, true, out_index);
+}
+
+extern "C" void hnsw_index_free(hnsw_index_t* index) {
+    delete index;
+}
+
+extern "C" int hnsw_index_add_item(hnsw_index_t* index, int id, const float* vector) {
+    if (index == nullptr || vector == nullptr) {
+        return -1;
+    }
+
+    try {
+        // 添加向量到索引
+        // label 使用 id 作为标识符
+        std::vector<char> code;
+        const void* data = encode_vector(index, vector, code);
+        std::shared_lock<std::shared_mutex> mutating(index->mutation_lock);
+        for (;;) {
+            {
+                std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+                bool inserted = false;
+                try {
+                    upsert_point(index, data, static_cast<hnswlib::labeltype>(id));
+                    inserted = true;
+                } catch (...) {
+                    // 只有容量已满才扩容后重试，其他错误直接返回
+                    if (!index_full(*index->index)) {
+                        return -1;
+                    }
+                }
+                if (inserted) {
+                    // 日志写入失败由外层返回 -1 (不会触发扩容重试)
+                    log_upsert(index, id, vector);
+                    index->mutations.fetch_add(1, std::memory_order_relaxed);
+                    return 0;
+                }
+            }
+            std::unique_lock<std::shared_mutex> lock(index->rw_lock);
+            grow_locked(index, index->index->cur_element_count + 1);
+        }
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 清除已删除物品的属性: 不再计入属性过滤的基数估计，也不会被价格范围扫描选中。
+// 调用方持有 rw_lock (与属性搜索相同的加锁顺序: rw_lock -> attr_lock)
+template <typename Labels>
+static void clear_attributes(hnsw_index_t* index, const Labels& labels) {
+    std::unique_lock<std::shared_mutex> attr_write(index->attr_lock);
+    for (hnswlib::labeltype label : labels) {
+        index->attrs.clear(label);
+    }
+}
+
+extern "C" int hnsw_index_mark_deleted(hnsw_index_t* index, int id) {
+    if (index == nullptr) {
+        return -1;
+    }
+
+    std::shared_lock<std::shared_mutex> mutating(index->mutation_lock);
+    std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+    try {
+        std::lock_guard<std::mutex> guard(index->slot_lock);
+        hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+        const hnswlib::labeltype label = static_cast<hnswlib::labeltype>(id);
+        {
+            // id 不存在或已删除时不写日志，直接失败
+            std::lock_guard<std::mutex> lookup(hnsw.label_lookup_lock);
+            auto it = hnsw.label_lookup_.find(label);
+            if (it == hnsw.label_lookup_.end() || hnsw.isMarkedDeleted(it->second)) {
+                return -1;
+            }
+        }
+        hnsw.markDelete(label);
+        log_delete(index, label);
+        const hnswlib::labeltype removed[] = {label};
+        clear_attributes(index, removed);
+        index->mutations.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 带进度回调的批量插入每个阶段至少处理这么多个元素 (同时不少于总数的 1%)
+static const size_t kBatchProgressMinChunk = 1024;
+
+// 并行插入 n 个元素，row(i) 返回第 i 个元素的 (id, 向量)。调用方负责持有 rw_lock
+template <typename RowFn>
+static int insert_parallel(hnsw_index_t* index, size_t n, RowFn row, hnsw_progress_fn progress, void* ctx) {
+    std::atomic<int> inserted{0};
+
+    // 按阶段推进: 每个阶段在线程池上并行插入，阶段之间在调用线程上报告进度，
+    // 这样回调不会从 worker 线程并发进入
+    const size_t chunk = progress != nullptr ? std::max(kBatchProgressMinChunk, (n + 99) / 100) : n;
+    for (size_t begin = 0; begin < n; begin += chunk) {
+        const size_t end = std::min(n, begin + chunk);
+        vecops::ThreadPool::shared().parallel_for(end - begin, [&](size_t offset) {
+            const std::pair<int, const float*> item = row(begin + offset);
+            std::vector<char> code;
+            try {
+                upsert_point(index, encode_vector(index, item.second, code), static_cast<hnswlib::labeltype>(item.first));
+                log_upsert(index, item.first, item.second);
+                inserted.fetch_add(1, std::memory_order_relaxed);
+            } catch (...) {
+                // 单个元素失败 (如超出容量) 不中止整个批次
+            }
+        });
+        if (progress != nullptr) {
+            progress(static_cast<int>(end), static_cast<int>(n), ctx);
+        }
+    }
+    return inserted.load();
+}
+
+// 批量插入的共同实现: 第 i 个向量位于 vectors + i * row_stride
+static int add_items_parallel(
+    hnsw_index_t* index,
+    const int* ids,
+    const float* vectors,
+    size_t row_stride,
+    size_t n,
+    hnsw_progress_fn progress,
+    void* ctx
+) {
+    // 先一次性扩容到足够大，插入阶段只持有读锁
+    // (与并发的单条插入竞争到最后几个槽位时，失败的元素不计入返回值)
+    std::shared_lock<std::shared_mutex> mutating(index->mutation_lock);
+    ensure_capacity(index, count_new_labels(*index->index, n, [&](size_t i) { return ids[i]; }));
+
+    std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+    int inserted = insert_parallel(index, n, [&](size_t i) {
+        return std::make_pair(ids[i], vectors + i * row_stride);
+    }, progress, ctx);
+    index->mutations.fetch_add(static_cast<uint64_t>(inserted), std::memory_order_relaxed);
+    return inserted;
+}
+
+extern "C" int hnsw_index_add_items_batch(
+    hnsw_index_t* index,
+    const int* ids,
+    const float* vectors,
+    int n,
+    hnsw_progress_fn progress,
+    void* ctx
+) {
+    if (index == nullptr || n < 0 || (n > 0 && (ids == nullptr || vectors == nullptr))) {
+        return -1;
+    }
+    try {
+        return add_items_parallel(
+            index, ids, vectors, static_cast<size_t>(index->dim), static_cast<size_t>(n), progress, ctx);
+    } catch (...) {
+        return -1;
+    }
+}
+
+extern "C" void hnsw_index_set_ef(hnsw_index_t* index, int ef) {
+    if (index == nullptr || ef <= 0) {
+        return;
+    }
+
+    // ef: 查询时的动态列表大小
+    // 更高的 ef = 更好的召回率，但查询更慢
+    index->default_ef.store(static_cast<size_t>(ef), std::memory_order_relaxed);
+}
+
+extern "C" int hnsw_index_search_knn(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int* out_ids,
+    float* out_scores
+) {
+    return hnsw_index_search_knn_ef(index, query, k, 0, out_ids, out_scores);
+}
+
+extern "C" int hnsw_index_search_knn_ef(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores
+) {
+    if (index == nullptr || query == nullptr || k <= 0) {
+        return -1;
+    }
+
+    std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
+    try {
+        // 搜索 K 个最近邻
+        // 返回 priority_queue<pair<distance, label>>
+        std::vector<float> encoded;
+        auto result = index->index->searchKnnWithEf(encode_query(index, query, encoded), k, resolve_ef(index, ef));
+        return write_knn_results(result, out_ids, out_scores);
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 把 C 回调适配为 hnswlib 的过滤器接口
+class CallbackFilter : public hnswlib::BaseFilterFunctor {
+ public:
+    CallbackFilter(hnsw_filter_fn fn, void* ctx) : fn_(fn), ctx_(ctx) {}
+
+    bool operator()(hnswlib::labeltype id) override {
+        return fn_(static_cast<int>(id), ctx_) != 0;
+    }
+
+ private:
+    hnsw_filter_fn fn_;
+    void* ctx_;
+};
+
+extern "C" int hnsw_index_search_knn_filtered(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    hnsw_filter_fn filter,
+    void* ctx,
+    int* out_ids,
+    float* out_scores
+) {
+    if (index == nullptr || query == nullptr || k <= 0) {
+        return -1;
+    }
+
+    std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
+    try {
+        CallbackFilter functor(filter, ctx);
+        std::vector<float> encoded;
+        auto result = index->index->searchKnnWithEf(
+            encode_query(index, query, encoded), k, resolve_ef(index, ef), filter != nullptr ? &functor : nullptr);
+        return write_knn_results(result, out_ids, out_scores);
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 多兴趣召回的过滤器: 同一物品在多次遍历中只询问一次底层回调，
+// 保持 "每个候选 id 最多被询问一次" 的约定，也省去重复的 Bloom Filter 查询
+class MemoizedFilter : public hnswlib::BaseFilterFunctor {
+ public:
+    explicit MemoizedFilter(hnswlib::BaseFilterFunctor* inner) : inner_(inner) {}
+
+    bool operator()(hnswlib::labeltype id) override {
+        auto it = verdicts_.find(id);
+        if (it != verdicts_.end()) {
+            return it->second;
+        }
+        bool allowed = (*inner_)(id);
+        verdicts_.emplace(id, allowed);
+        return allowed;
+    }
+
+ private:
+    hnswlib::BaseFilterFunctor* inner_;
+    std::unordered_map<hnswlib::labeltype, bool> verdicts_;
+};
+
+// 多兴趣召回中单个兴趣向量的遍历终止条件
+//
+// 行为与 hnswlib 默认的 ef 搜索一致，结果集填满 ef 之前不会停止。
+// 不能用此前各兴趣合并后的第 k 名距离截断遍历: 入口点比它远的兴趣会立即结束，
+// 而一两跳之外可能就有更近的物品
+class InterestStopCondition : public hnswlib::BaseSearchStopCondition<float> {
+ public:
+    explicit InterestStopCondition(size_t ef) : ef_(ef) {}
+
+    void add_point_to_result(hnswlib::labeltype label, const void*, float dist) override {
+        results_.emplace(dist, label);
+    }
+
+    // hnswlib 总是移除结果堆中距离最大的点，传入的 dist 并不是被移除点的距离
+    void remove_point_from_result(hnswlib::labeltype, const void*, float) override {
+        results_.pop();
+    }
+
+    bool should_stop_search(float candidate_dist, float lower_bound) override {
+        return candidate_dist > lower_bound && results_.size() >= ef_;
+    }
+
+    bool should_consider_candidate(float candidate_dist, float lower_bound) override {
+        return results_.size() < ef_ || lower_bound > candidate_dist;
+    }
+
+    bool should_remove_extra() override {
+        return results_.size() > ef_;
+    }
+
+    // 结果从 results() 取，带 label 的大顶堆，不依赖 searchStopConditionClosest 的返回值
+    void filter_results(std::vector<std::pair<float, hnswlib::labeltype>>&) override {}
+
+    std::priority_queue<std::pair<float, hnswlib::labeltype>>& results() {
+        return results_;
+    }
+
+ private:
+    size_t ef_;
+    std::priority_queue<std::pair<float, hnswlib::labeltype>> results_;
+};
+
+extern "C" int hnsw_index_search_knn_multi(
+    const hnsw_index_t* index,
+    const float* queries,
+    int n_queries,
+    int k,
+    int ef,
+    hnsw_filter_fn filter,
+    void* ctx,
+    int* out_ids,
+    float* out_scores
+) {
+    if (index == nullptr || queries == nullptr || n_queries <= 0 || k <= 0) {
+        return -1;
+    }
+
+    // 所有兴趣向量在同一把读锁下遍历，看到的是同一个版本的索引
+    std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
+    try {
+        CallbackFilter callback(filter, ctx);
+        MemoizedFilter memoized(&callback);
+        hnswlib::BaseFilterFunctor* allow = filter != nullptr ? &memoized : nullptr;
+
+        const size_t dim = static_cast<size_t>(index->dim);
+        const size_t top_k = static_cast<size_t>(k);
+        const size_t query_ef = std::max(resolve_ef(index, ef), top_k);
+
+        // 物品 -> 所有兴趣向量下的最小距离 (即最大相似度)，按物品去重
+        std::unordered_map<hnswlib::labeltype, float> best;
+        std::vector<float> distances;
+        std::vector<float> encoded;
+        float bound = std::numeric_limits<float>::max();
+
+        for (int q = 0; q < n_queries; ++q) {
+            InterestStopCondition stop(query_ef);
+            index->index->searchStopConditionClosest(encode_query(index, queries + q * dim, encoded), stop, allow);
+            // bound 只用于裁剪合并: 比此前合并的第 k 名更远的新物品不可能进入最终的 Top-K
+            for (auto& found = stop.results(); !found.empty(); found.pop()) {
+                const float dist = found.top().first;
+                auto it = best.find(found.top().second);
+                if (it != best.end()) {
+                    it->second = std::min(it->second, dist);
+                } else if (dist <= bound) {
+                    best.emplace(found.top().second, dist);
+                }
+            }
+
+            if (best.size() >= top_k) {
+                distances.clear();
+                for (const auto& entry : best) {
+                    distances.push_back(entry.second);
+                }
+                std::nth_element(distances.begin(), distances.begin() + (top_k - 1), distances.end());
+                bound = distances[top_k - 1];
+            }
+        }
+
+        std::vector<std::pair<float, hnswlib::labeltype>> merged;
+        merged.reserve(best.size());
+        for (const auto& entry : best) {
+            merged.emplace_back(entry.second, entry.first);
+        }
+        const size_t count = std::min(top_k, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + count, merged.end());
+        for (size_t i = 0; i < count; ++i) {
+            out_scores[i] = 1.0f - merged[i].first;
+            out_ids[i] = static_cast<int>(merged[i].second);
+        }
+        return static_cast<int>(count);
+    } catch (...) {
+        return -1;
+    }
+}
+
+extern "C" int hnsw_index_set_attributes(hnsw_index_t* index, int id, int category, float price) {
+    if (index == nullptr || id < 0 || category < 0) {
+        return -1;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(index->attr_lock);
+    try {
+        index->attrs.set(static_cast<hnswlib::labeltype>(id), category, price);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+// 满足条件的候选不超过该数量，或不超过索引规模的 1/kBruteForceSelectivity 时，
+// 改为精确枚举: 此时 HNSW 过滤遍历需要访问的节点数远多于候选本身
+static const size_t kBruteForceMaxCandidates = 4096;
+static const size_t kBruteForceSelectivity = 100;
+
+// 把属性条件适配为 hnswlib 的过滤器接口
+class AttributeFilter : public hnswlib::BaseFilterFunctor {
+ public:
+    AttributeFilter(const vecops::AttributeIndex& attrs, const vecops::AttributeQuery& query)
+        : attrs_(attrs), query_(query), selected_(attrs.selection(query)) {}
+
+    bool operator()(hnswlib::labeltype id) override {
+        return attrs_.matches(id, query_, selected_);
+    }
+
+ private:
+    const vecops::AttributeIndex& attrs_;
+    const vecops::AttributeQuery& query_;
+    std::vector<char> selected_;
+};
+
+// 对满足属性条件的全部物品做精确 Top-K (在 HNSW 自身的 level-0 存储上计算距离)
+static std::priority_queue<std::pair<float, hnswlib::labeltype>> search_attr_exact(
+    const hnsw_index_t* index,
+    const void* query,
+    size_t k,
+    const vecops::AttributeQuery& attr_query,
+    const std::vector<char>& selected
+) {
+    const auto* hnsw = index->index.get();
+
+    // 先在 label_lookup_lock 下把 label 解析为内部 id，再在锁外计算距离
+    std::vector<hnswlib::tableint> internal_ids;
+    {
+        std::lock_guard<std::mutex> lookup_lock(hnsw->label_lookup_lock);
+        index->attrs.for_each_match(attr_query, selected, [&](hnswlib::labeltype label) {
+            auto it = hnsw->label_lookup_.find(label);
+            if (it != hnsw->label_lookup_.end()) internal_ids.push_back(it->second);
+        });
+    }
+
+    // 大顶堆: 堆顶是当前 Top-K 中距离最大的
+    std::priority_queue<std::pair<float, hnswlib::labeltype>> top;
+    for (hnswlib::tableint id : internal_ids) {
+        if (hnsw->isMarkedDeleted(id)) continue;
+        float dist = hnsw->fstdistfunc_(query, hnsw->getDataByInternalId(id), hnsw->dist_func_param_);
+        if (top.size() < k) {
+            top.emplace(dist, hnsw->getExternalLabel(id));
+        } else if (dist < top.top().first) {
+            top.pop();
+            top.emplace(dist, hnsw->getExternalLabel(id));
+        }
+    }
+    return top;
+}
+
+extern "C" int hnsw_index_search_knn_attr(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    const hnsw_attr_filter_t* filter,
+    int* out_ids,
+    float* out_scores
+) {
+    if (index == nullptr || query == nullptr || filter == nullptr || k <= 0) {
+        return -1;
+    }
+
+    try {
+        vecops::AttributeQuery attr_query;
+        if (filter->categories != nullptr && filter->num_categories > 0) {
+            attr_query.categories.assign(filter->categories, filter->categories + filter->num_categories);
+        }
+        attr_query.min_price = filter->min_price;
+        attr_query.max_price = filter->max_price;
+
+        std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
+        std::shared_lock<std::shared_mutex> attr_read(index->attr_lock);
+
+        // 价格有序数组在写入后惰性重建 (需要短暂的独占锁)。重建后回到读锁重新检查，
+        // 直到读锁下看到的有序数组是最新的，检查与下面的枚举在同一个读锁区间内，
+        // 中间插入的 set_attributes 不会让新设置价格的物品被漏掉
+        while (index->attrs.price_sorted_dirty()) {
+            attr_read.unlock();
+            {
+                std::unique_lock<std::shared_mutex> attr_write(index->attr_lock);
+                if (index->attrs.price_sorted_dirty()) {
+                    index->attrs.rebuild_price_order();
+                }
+            }
+            attr_read.lock();
+        }
+
+        std::vector<char> selected = index->attrs.selection(attr_query);
+        size_t estimate = index->attrs.estimate(attr_query, selected);
+        size_t total = index->index->cur_element_count.load();
+
+        std::vector<float> query_buf;
+        const void* encoded = encode_query(index, query, query_buf);
+
+        std::priority_queue<std::pair<float, hnswlib::labeltype>> result;
+        if (estimate <= kBruteForceMaxCandidates || estimate * kBruteForceSelectivity <= total) {
+            result = search_attr_exact(index, encoded, static_cast<size_t>(k), attr_query, selected);
+        } else {
+            AttributeFilter functor(index->attrs, attr_query);
+            result = index->index->searchKnnWithEf(encoded, k, resolve_ef(index, ef), &functor);
+        }
+        return write_knn_results(result, out_ids, out_scores);
+    } catch (...) {
+        return -1;
+    }
+}
+
+extern "C" int hnsw_index_search_knn_batch(
+    const hnsw_index_t* index,
+    const float* queries,
+    int n,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+) {
+    if (index == nullptr || k <= 0 || n < 0) {
+        return -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    if (queries == nullptr || out_ids == nullptr || out_scores == nullptr || out_counts == nullptr) {
+        return -1;
+    }
+
+    // 整个批次只加一次读锁；worker 线程在此锁的保护下直接访问索引
+    std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
+    const auto* hnsw = index->index.get();
+    const size_t dim = static_cast<size_t>(index->dim);
+    const size_t row = static_cast<size_t>(k);
+    const size_t query_ef = resolve_ef(index, ef);
 
-// ============================================================================
-// 基础向量运算实现
-// ============================================================================
+    try {
+        vecops::ThreadPool::shared().parallel_for(static_cast<size_t>(n), [&](size_t i) {
+            std::vector<float> encoded;
+            auto result = hnsw->searchKnnWithEf(encode_query(index, queries + i * dim, encoded), row, query_ef);
+            int* ids = out_ids + i * row;
+            float* scores = out_scores + i * row;
+            int count = write_knn_results(result, ids, scores);
+            std::fill(ids + count, ids + row, -1);
+            std::fill(scores + count, scores + row, 0.0f);
+            out_counts[i] = count;
+        });
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
 
-extern "C" int cpp_add(int a, int b) {
-    return a + b;
+extern "C" int hnsw_index_search_knn_sharded(
+    const hnsw_index_t* const* shards,
+    int n_shards,
+    const float* query,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores
+) {
+    if (shards == nullptr || n_shards <= 0 || query == nullptr || k <= 0 ||
+        out_ids == nullptr || out_scores == nullptr) {
+        return -1;
+    }
+    for (int s = 0; s < n_shards; ++s) {
+        if (shards[s] == nullptr || shards[s]->dim != shards[0]->dim) {
+            return -1;
+        }
+    }
+
+    using Candidate = std::pair<float, hnswlib::labeltype>;
+    const size_t top_k = static_cast<size_t>(k);
+    try {
+        // scatter: 每个分片各自加读锁取 top-k，一个分片在扩容或保存时不阻塞其他分片的搜索。
+        // partial[s] 按距离从大到小排列 (即 searchKnn 大顶堆的出堆顺序)
+        std::vector<std::vector<Candidate>> partial(static_cast<size_t>(n_shards));
+        vecops::ThreadPool::shared().parallel_for(partial.size(), [&](size_t s) {
+            const hnsw_index_t* shard = shards[s];
+            std::shared_lock<std::shared_mutex> lock = lock_for_search(shard);
+            std::vector<float> encoded;
+            auto result = shard->index->searchKnnWithEf(
+                encode_query(shard, query, encoded), top_k, resolve_ef(shard, ef));
+            partial[s].reserve(result.size());
+            while (!result.empty()) {
+                partial[s].push_back(result.top());
+                result.pop();
+            }
+        });
+
+        // gather: 容量为 k 的大顶堆 (堆顶是当前第 k 近的候选)。
+        // 各分片的 id 互不重叠，无需去重；每个分片从最近的候选开始合并，一旦不优于堆顶即可跳过其余候选
+        std::priority_queue<Candidate> top;
+        for (const auto& candidates : partial) {
+            for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+                if (top.size() < top_k) {
+                    top.push(*it);
+                } else if (it->first < top.top().first) {
+                    top.pop();
+                    top.push(*it);
+                } else {
+                    break;
+                }
+            }
+        }
+        return write_knn_results(top, out_ids, out_scores);
+    } catch (...) {
+        return -1;
+    }
 }
 
-extern "C" float dot_product(const float* vec_a, const float* vec_b, int len) {
-    float result = 0.0f;
-    for (int i = 0; i < len; ++i) {
-        result += vec_a[i] * vec_b[i];
+extern "C" int hnsw_index_get_count(const hnsw_index_t* index) {
+    if (index == nullptr) {
+        return 0;
+    }
+    // cur_element_count 与 num_deleted_ 都是 atomic，无需加锁
+    return static_cast<int>(index->index->cur_element_count.load() - index->index->num_deleted_.load());
+}
+
+extern "C" int hnsw_index_get_stats(const hnsw_index_t* index, hnsw_index_stats_t* out_stats) {
+    if (index == nullptr || out_stats == nullptr) {
+        return -1;
+    }
+
+    std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+    const hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+    out_stats->count = static_cast<int>(hnsw.cur_element_count - hnsw.num_deleted_);
+    out_stats->deleted = static_cast<int>(hnsw.num_deleted_);
+    out_stats->capacity = static_cast<int>(hnsw.max_elements_);
+    out_stats->resizes = static_cast<int>(index->resize_count.load(std::memory_order_relaxed));
+    out_stats->resize_total_ms = static_cast<double>(index->resize_total_us.load(std::memory_order_relaxed)) / 1000.0;
+    out_stats->resize_max_ms = static_cast<double>(index->resize_max_us.load(std::memory_order_relaxed)) / 1000.0;
+    out_stats->mutations = static_cast<long long>(index->mutations.load(std::memory_order_relaxed));
+    out_stats->snapshots = static_cast<int>(index->snapshot_count.load(std::memory_order_relaxed));
+    out_stats->snapshot_pause_ms = static_cast<double>(index->snapshot_pause_us.load(std::memory_order_relaxed)) / 1000.0;
+    out_stats->snapshot_write_ms = static_cast<double>(index->snapshot_write_us.load(std::memory_order_relaxed)) / 1000.0;
+    out_stats->log_trim_failures = static_cast<int>(index->log_trim_failures.load(std::memory_order_relaxed));
+
+    // level-0 按容量整块分配，上层链表按元素的层数分配；
+    // 每个槽位另有层号、链表锁与上层链表指针，每个元素一条 label 映射
+    size_t upper_links = 0;
+    for (size_t i = 0; i < hnsw.cur_element_count; i++) {
+        upper_links += static_cast<size_t>(hnsw.element_levels_[i]) * hnsw.size_links_per_element_;
+    }
+    size_t per_slot = sizeof(int) + sizeof(std::mutex) + sizeof(char*);
+    size_t per_label = sizeof(std::pair<const hnswlib::labeltype, hnswlib::tableint>) + 2 * sizeof(void*);
+    out_stats->memory_bytes = static_cast<long long>(
+        hnsw.max_elements_ * (hnsw.size_data_per_element_ + per_slot) + upper_links + hnsw.label_lookup_.size() * per_label);
+    return 0;
+}
+
+extern "C" void hnsw_thread_search_metrics(hnsw_search_metrics_t* out_metrics) {
+    if (out_metrics == nullptr) {
+        return;
+    }
+    const hnswlib::SearchMetrics& search = hnswlib::thread_search_metrics();
+    const LockWaitMetrics& lock = thread_lock_wait_metrics();
+    out_metrics->hops = static_cast<long long>(search.hops);
+    out_metrics->distance_computations = static_cast<long long>(search.distance_computations);
+    out_metrics->lock_waits = static_cast<long long>(lock.waits);
+    out_metrics->lock_wait_ms = static_cast<double>(lock.wait_ns) / 1e6;
+}
+
+extern "C" int hnsw_index_save_mmap(hnsw_index_t* index, const char* path) {
+    if (index == nullptr || path == nullptr) {
+        return -1;
+    }
+
+    try {
+        std::lock_guard<std::mutex> single_writer(index->snapshot_lock);
+
+        // 1. 暂停写者，拷贝整张图 (搜索不受影响)；缓冲区在暂停之前分配好
+        vecops::MappedIndexFile::Snapshot snapshot;
+        {
+            std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+            vecops::MappedIndexFile::reserve(*index->index, kMinGrowth, snapshot);
+        }
+        auto start = std::chrono::steady_clock::now();
+        vecops::MutationLog* log = nullptr;
+        uint64_t log_cut = 0;
+        {
+            std::unique_lock<std::shared_mutex> paused(index->mutation_lock);
+            std::shared_lock<std::shared_mutex> lock(index->rw_lock);
+            vecops::MappedIndexFile::capture(*index->index, snapshot);
+            log = index->log.get();
+            if (log != nullptr) {
+                log_cut = log->size();
+            }
+        }
+        const uint64_t pause_us = elapsed_us(start);
+
+        // 2. 不持有索引的锁，写临时文件 + fsync + rename (码本训练后不变，无需暂停)
+        start = std::chrono::steady_clock::now();
+        if (index->pq != nullptr) {
+            index->pq->save(std::string(path) + ".pq");
+        }
+        vecops::MappedIndexFile::write(snapshot, std::string(path));
+        index->snapshot_count.fetch_add(1, std::memory_order_relaxed);
+        index->snapshot_pause_us.store(pause_us, std::memory_order_relaxed);
+        index->snapshot_write_us.store(elapsed_us(start), std::memory_order_relaxed);
+
+        // 3. 快照已落盘，丢弃它包含的日志记录 (暂停之后追加的记录保留)。
+        // 截断失败不影响已提交的快照: 日志保持原样 (在新快照上重放是幂等的)，
+        // 下一次快照的切分点不早于这一次，会把这部分一并截掉
+        if (log != nullptr) {
+            try {
+                log->drop_prefix(log_cut);
+            } catch (...) {
+                index->log_trim_failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        return 0;
+    } catch (...) {
+        return -1;
+    }
+}
+
+extern "C" int hnsw_index_save(hnsw_index_t* index, const char* path) {
+    if (index == nullptr || path == nullptr) {
+        return -1;
+    }
+
+    // 保存期间禁止插入，保证写出的是一致的快照
+    std::unique_lock<std::shared_mutex> lock(index->rw_lock);
+    try {
+        if (index->pq != nullptr) {
+            index->pq->save(std::string(path) + ".pq");
+        }
+        index->index->saveIndex(std::string(path));
+        return 0;
+    } catch (...) {
+        return -1;
     }
-    return result;
 }
 
 // ============================================================================
-// HNSW 索引实现
+// 全局 HNSW 索引 (旧版全局接口，内部委托给一个默认句柄)
 // ============================================================================
 
+// g_default_lock 只保护 g_default_index 指针本身:
+// - 搜索/插入/计数持有读锁，因此彼此之间不再串行
+// - init/load/destroy 会替换指针，持有写锁
+static hnsw_index_t* g_default_index = nullptr;
+static std::shared_mutex g_default_lock;
+
 extern "C" int hnsw_init(int dim, int max_elements, int M, int ef_construction) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
+    return hnsw_init_with_storage(dim, max_elements, M, ef_construction, HNSW_STORAGE_FLOAT32);
+}
+
+extern "C" int hnsw_init_with_storage(int dim, int max_elements, int M, int ef_construction, int storage) {
+    std::unique_lock<std::shared_mutex> lock(g_default_lock);
+
     // 清理旧索引
-    if (g_hnsw_index != nullptr) {
-        delete g_hnsw_index;
-        g_hnsw_index = nullptr;
+    hnsw_index_free(g_default_index);
+    g_default_index = hnsw_index_new_with_storage(dim, max_elements, M, ef_construction, storage);
+    return g_default_index != nullptr ? 0 : -1;
+}
+
+extern "C" int hnsw_add_item(int id, const float* vector) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;  // 索引未初始化
+    }
+    return hnsw_index_add_item(g_default_index, id, vector);
+}
+
+extern "C" int hnsw_add_items_batch(const int* ids, const float* vectors, int n) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;  // 索引未初始化
+    }
+    return hnsw_index_add_items_batch(g_default_index, ids, vectors, n, nullptr, nullptr);
+}
+
+extern "C" void hnsw_set_ef(int ef) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    hnsw_index_set_ef(g_default_index, ef);
+}
+
+extern "C" int hnsw_search_knn(const float* query, int k, int* out_ids, float* out_scores) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;
+    }
+    return hnsw_index_search_knn(g_default_index, query, k, out_ids, out_scores);
+}
+
+extern "C" int hnsw_search_knn_ef(const float* query, int k, int ef, int* out_ids, float* out_scores) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;
+    }
+    return hnsw_index_search_knn_ef(g_default_index, query, k, ef, out_ids, out_scores);
+}
+
+extern "C" void hnsw_destroy() {
+    std::unique_lock<std::shared_mutex> lock(g_default_lock);
+    hnsw_index_free(g_default_index);
+    g_default_index = nullptr;
+}
+
+extern "C" int hnsw_get_count() {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    return hnsw_index_get_count(g_default_index);
+}
+
+extern "C" int hnsw_save_index(const char* path) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;  // 索引未初始化
+    }
+    return hnsw_index_save(g_default_index, path);
+}
+
+extern "C" int hnsw_save_index_mmap(const char* path) {
+    std::shared_lock<std::shared_mutex> lock(g_default_lock);
+    if (g_default_index == nullptr) {
+        return -1;  // 索引未初始化
     }
-    if (g_space != nullptr) {
-        delete g_space;
-        g_space = nullptr;
+    return hnsw_index_save_mmap(g_default_index, path);
+}
+
+extern "C" int hnsw_load_index_mmap(const char* path, int dim, int max_elements) {
+    std::unique_lock<std::shared_mutex> lock(g_default_lock);
+
+    // 清理旧索引
+    hnsw_index_free(g_default_index);
+    g_default_index = nullptr;
+    return hnsw_index_load_mmap(path, dim, max_elements, HNSW_STORAGE_FLOAT32, &g_default_index);
+}
+
+extern "C" int hnsw_load_index(const char* path, int dim, int max_elements) {
+    return hnsw_load_index_with_storage(path, dim, max_elements, HNSW_STORAGE_FLOAT32);
+}
+
+extern "C" int hnsw_load_index_with_storage(const char* path, int dim, int max_elements, int storage) {
+    std::unique_lock<std::shared_mutex> lock(g_default_lock);
+
+    // 清理旧索引
+    hnsw_index_free(g_default_index);
+    g_default_index = nullptr;
+    return hnsw_index_load_with_storage(path, dim, max_elements, storage, &g_default_index);
+}
+
+// ============================================================================
+// 物品向量存储 (Embedding Store)
+// ============================================================================
+
+struct embedding_store {
+    embedding_store(size_t dim, size_t capacity) : store(dim, capacity) {}
+    vecops::EmbeddingStore store;
+};
+
+extern "C" embedding_store_t* embedding_store_new(int dim, int capacity) {
+    if (dim <= 0 || capacity < 0) {
+        return nullptr;
     }
-    
     try {
-        g_dim = dim;
-        // 使用内积空间 (Inner Product Space)
-        // 对于归一化向量: distance = 1 - inner_product
-        // 所以 distance 越小 = similarity 越高
-        g_space = new hnswlib::InnerProductSpace(dim);
-        
-        // 创建 HNSW 索引
-        // M: 每层的最大连接数 (影响图的密度)
-        // ef_construction: 构建时的动态列表大小 (影响索引质量)
-        g_hnsw_index = new hnswlib::HierarchicalNSW<float>(
-            g_space, 
-            max_elements, 
-            M, 
-            ef_construction
-        );
-        
-        return 0;  // 成功
+        return new embedding_store(static_cast<size_t>(dim), static_cast<size_t>(capacity));
     } catch (...) {
-        return -1;  // 失败
+        return nullptr;
     }
 }
 
-extern "C" int hnsw_add_item(int id, const float* vector) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index == nullptr) {
-        return -1;  // 索引未初始化
+extern "C" void embedding_store_free(embedding_store_t* store) {
+    delete store;
+}
+
+extern "C" int embedding_store_put(embedding_store_t* store, int id, const float* vector) {
+    if (store == nullptr || vector == nullptr) {
+        return -1;
     }
-    
     try {
-        // 添加向量到索引
-        // label 使用 id 作为标识符
-        g_hnsw_index->addPoint(vector, static_cast<hnswlib::labeltype>(id));
+        store->store.put(id, vector);
         return 0;
     } catch (...) {
         return -1;
     }
 }
 
-extern "C" void hnsw_set_ef(int ef) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index != nullptr) {
-        // ef: 查询时的动态列表大小
-        // 更高的 ef = 更好的召回率，但查询更慢
-        g_hnsw_index->setEf(ef);
+extern "C" int embedding_store_remove(embedding_store_t* store, int id) {
+    if (store == nullptr) {
+        return -1;
     }
+    return store->store.remove(id) ? 0 : -1;
 }
 
-extern "C" int hnsw_search_knn(const float* query, int k, int* out_ids, float* out_scores) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index == nullptr) {
+extern "C" int embedding_store_count(const embedding_store_t* store) {
+    if (store == nullptr) {
+        return 0;
+    }
+    return static_cast<int>(store->store.size());
+}
+
+extern "C" int embedding_store_id_at(const embedding_store_t* store, int row) {
+    if (store == nullptr || row < 0 || static_cast<size_t>(row) >= store->store.size()) {
+        return -1;
+    }
+    return store->store.ids()[row];
+}
+
+extern "C" const float* embedding_store_row_at(const embedding_store_t* store, int row) {
+    if (store == nullptr || row < 0 || static_cast<size_t>(row) >= store->store.size()) {
+        return nullptr;
+    }
+    return store->store.row(static_cast<size_t>(row));
+}
+
+extern "C" const float* embedding_store_find(const embedding_store_t* store, int id) {
+    if (store == nullptr) {
+        return nullptr;
+    }
+    return store->store.find(id);
+}
+
+extern "C" int embedding_store_search_top_k_batch(
+    const embedding_store_t* store,
+    const float* queries,
+    int num_queries,
+    int k,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+) {
+    if (store == nullptr || queries == nullptr || num_queries <= 0 || k <= 0 ||
+        out_ids == nullptr || out_scores == nullptr || out_counts == nullptr) {
         return -1;
     }
-    
+
     try {
-        // 搜索 K 个最近邻
-        // 返回 priority_queue<pair<distance, label>>
-        auto result = g_hnsw_index->searchKnn(query, k);
-        
-        int count = 0;
-        // 结果按距离从大到小排列，我们需要反转
-        std::vector<std::pair<float, hnswlib::labeltype>> results;
-        while (!result.empty()) {
-            results.push_back(result.top());
-            result.pop();
-        }
-        
-        // 反转得到从小到大 (最相似在前)
-        std::reverse(results.begin(), results.end());
-        
-        for (const auto& item : results) {
-            // 对于内积空间: distance = 1 - inner_product
-            // 所以 similarity = 1 - distance = inner_product
-            float similarity = 1.0f - item.first;
-            out_scores[count] = similarity;
-            out_ids[count] = static_cast<int>(item.second);
-            count++;
-        }
-        
-        return count;
+        const vecops::EmbeddingStore& es = store->store;
+        vecops::ExactSearchInput input;
+        input.queries = queries;
+        input.num_queries = static_cast<size_t>(num_queries);
+        input.matrix = es.data();
+        input.row_stride = es.stride();
+        input.ids = es.ids();
+        input.rows = es.size();
+        input.dim = es.dim();
+        vecops::exact_top_k(input, static_cast<size_t>(k), out_ids, out_scores, out_counts);
+        return 0;
     } catch (...) {
         return -1;
     }
 }
 
-extern "C" void hnsw_destroy() {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index != nullptr) {
-        delete g_hnsw_index;
-        g_hnsw_index = nullptr;
+extern "C" int embedding_store_search_top_k(
+    const embedding_store_t* store,
+    const float* query,
+    int k,
+    int* out_ids,
+    float* out_scores
+) {
+    int count = 0;
+    if (embedding_store_search_top_k_batch(store, query, 1, k, out_ids, out_scores, &count) != 0) {
+        return -1;
     }
-    if (g_space != nullptr) {
-        delete g_space;
-        g_space = nullptr;
+    return count;
+}
+
+extern "C" int embedding_store_score(
+    const embedding_store_t* store,
+    const float* query,
+    const int* ids,
+    int n,
+    float* out_scores
+) {
+    if (store == nullptr || query == nullptr || n < 0 || (n > 0 && (ids == nullptr || out_scores == nullptr))) {
+        return -1;
+    }
+
+    const vecops::simd::Kernels& kernels = vecops::simd::kernels();
+    const size_t dim = store->store.dim();
+    int found = 0;
+    for (int i = 0; i < n; ++i) {
+        const float* vec = store->store.find(ids[i]);
+        if (vec == nullptr) {
+            out_scores[i] = -INFINITY;
+            continue;
+        }
+        out_scores[i] = kernels.dot(query, vec, dim);
+        ++found;
     }
-    g_dim = 0;
+    return found;
 }
 
-extern "C" int hnsw_get_count() {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index == nullptr) {
-        return 0;
+// ============================================================================
+// 索引与向量存储之间的操作 (批量插入 / 量化索引的精确重排序)
+// ============================================================================
+
+extern "C" int hnsw_index_add_items_from_store(
+    hnsw_index_t* index,
+    const embedding_store_t* store,
+    hnsw_progress_fn progress,
+    void* ctx
+) {
+    if (index == nullptr || store == nullptr || store->store.dim() != static_cast<size_t>(index->dim)) {
+        return -1;
+    }
+    try {
+        const vecops::EmbeddingStore& es = store->store;
+        return add_items_parallel(index, es.ids(), es.data(), es.stride(), es.size(), progress, ctx);
+    } catch (...) {
+        return -1;
     }
-    return static_cast<int>(g_hnsw_index->getCurrentElementCount());
 }
 
-extern "C" int hnsw_save_index(const char* path) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    if (g_hnsw_index == nullptr) {
-        return -1;  // 索引未初始化
+extern "C" int hnsw_index_reconcile_with_store(
+    hnsw_index_t* index,
+    const embedding_store_t* store,
+    hnsw_progress_fn progress,
+    void* ctx,
+    hnsw_reconcile_stats_t* out_stats
+) {
+    if (index == nullptr || store == nullptr || store->store.dim() != static_cast<size_t>(index->dim)) {
+        return -1;
     }
-    
+
+    // 写锁: 对比阶段直接读取 label_lookup_ 和 level-0 数据，不能有其他插入
+    std::unique_lock<std::shared_mutex> lock(index->rw_lock);
     try {
-        g_hnsw_index->saveIndex(std::string(path));
+        const vecops::EmbeddingStore& es = store->store;
+        hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+        const size_t data_size = index->space->get_data_size();
+        hnsw_reconcile_stats_t stats = {0, 0, 0, 0, 0};
+
+        // 1. 索引中多余的元素: 标记删除
+        std::vector<hnswlib::labeltype> stale;
+        for (const auto& entry : hnsw.label_lookup_) {
+            if (!hnsw.isMarkedDeleted(entry.second) && es.find(static_cast<int>(entry.first)) == nullptr) {
+                stale.push_back(entry.first);
+            }
+        }
+        for (hnswlib::labeltype label : stale) {
+            hnsw.markDelete(label);
+            log_delete(index, label);
+        }
+        clear_attributes(index, stale);
+        stats.deleted = static_cast<int>(stale.size());
+
+        // 2. 逐行分类 (量化存储的编码开销不小，并行执行；只读 label_lookup_，不需要 label_lookup_lock)
+        enum : uint8_t { kUnchanged = 0, kMissing = 1, kChanged = 2 };
+        std::vector<uint8_t> state(es.size());
+        vecops::ThreadPool::shared().parallel_for(es.size(), [&](size_t row) {
+            auto it = hnsw.label_lookup_.find(static_cast<hnswlib::labeltype>(es.ids()[row]));
+            if (it == hnsw.label_lookup_.end() || hnsw.isMarkedDeleted(it->second)) {
+                state[row] = kMissing;
+                return;
+            }
+            std::vector<char> code;
+            const void* expected = encode_vector(index, es.row(row), code);
+            state[row] = std::memcmp(hnsw.getDataByInternalId(it->second), expected, data_size) == 0 ? kUnchanged : kChanged;
+        });
+
+        std::vector<size_t> pending;
+        size_t new_labels = 0;
+        for (size_t row = 0; row < es.size(); ++row) {
+            if (state[row] == kMissing && hnsw.label_lookup_.count(static_cast<hnswlib::labeltype>(es.ids()[row])) == 0) {
+                ++new_labels;
+            }
+            switch (state[row]) {
+                case kMissing: stats.added++; pending.push_back(row); break;
+                case kChanged: stats.updated++; pending.push_back(row); break;
+                default: stats.unchanged++; break;
+            }
+        }
+
+        // 3. 插入缺失元素 (复用第 1 步腾出的槽位)、原地更新变化的元素
+        grow_locked(index, hnsw.cur_element_count + new_labels);
+        int done = insert_parallel(index, pending.size(), [&](size_t i) {
+            return std::make_pair(es.ids()[pending[i]], es.row(pending[i]));
+        }, progress, ctx);
+        stats.failed = static_cast<int>(pending.size()) - done;
+        index->mutations.fetch_add(static_cast<uint64_t>(stats.deleted + done), std::memory_order_relaxed);
+
+        if (out_stats != nullptr) {
+            *out_stats = stats;
+        }
         return 0;
     } catch (...) {
         return -1;
     }
 }
 
-extern "C" int hnsw_load_index(const char* path, int dim, int max_elements) {
-    std::lock_guard<std::mutex> lock(g_mutex);
-    
-    // 清理旧索引
-    if (g_hnsw_index != nullptr) {
-        delete g_hnsw_index;
-        g_hnsw_index = nullptr;
+extern "C" int hnsw_index_open_log(hnsw_index_t* index, const char* path) {
+    if (index == nullptr || path == nullptr) {
+        return -1;
+    }
+
+    // 重放期间不能有其他写者或快照
+    std::unique_lock<std::shared_mutex> mutating(index->mutation_lock);
+    std::unique_lock<std::shared_mutex> lock(index->rw_lock);
+    try {
+        if (index->log != nullptr) {
+            return -1;
+        }
+        hnswlib::HierarchicalNSW<float>& hnsw = *index->index;
+        const size_t dim = static_cast<size_t>(index->dim);
+
+        // 1. 只保留每个 label 的最后一次操作: 不同 label 之间互不影响，可以并行应用
+        static const size_t kDeleted = static_cast<size_t>(-1);
+        std::unordered_map<hnswlib::labeltype, size_t> latest;  // label -> 向量行号，kDeleted 表示删除
+        std::vector<int> ids;
+        std::vector<float> vectors;
+        const size_t records = vecops::MutationLog::replay(std::string(path), dim,
+            [&](uint64_t label, const float* vec) {
+                auto it = latest.find(label);
+                if (it != latest.end() && it->second != kDeleted) {
+                    std::memcpy(vectors.data() + it->second * dim, vec, dim * sizeof(float));
+                    return;
+                }
+                latest[label] = ids.size();
+                ids.push_back(static_cast<int>(label));
+                vectors.insert(vectors.end(), vec, vec + dim);
+            },
+            [&](uint64_t label) { latest[label] = kDeleted; });
+
+        // 2. 先删除，腾出的槽位可被随后的插入复用
+        size_t applied = 0;
+        std::vector<size_t> pending;
+        std::vector<hnswlib::labeltype> deleted;
+        size_t new_labels = 0;
+        for (const auto& entry : latest) {
+            auto it = hnsw.label_lookup_.find(entry.first);
+            const bool live = it != hnsw.label_lookup_.end() && !hnsw.isMarkedDeleted(it->second);
+            if (entry.second == kDeleted) {
+                if (live) {
+                    hnsw.markDelete(entry.first);
+                    deleted.push_back(entry.first);
+                    ++applied;
+                }
+                continue;
+            }
+            if (it == hnsw.label_lookup_.end()) {
+                ++new_labels;
+            }
+            pending.push_back(entry.second);
+        }
+        clear_attributes(index, deleted);
+
+        // 3. 写入每个 label 的最终向量 (此时日志尚未开启，重放本身不会再次写日志)
+        grow_locked(index, hnsw.cur_element_count + new_labels);
+        applied += static_cast<size_t>(insert_parallel(index, pending.size(), [&](size_t i) {
+            return std::make_pair(ids[pending[i]], vectors.data() + pending[i] * dim);
+        }, nullptr, nullptr));
+        index->mutations.fetch_add(static_cast<uint64_t>(applied), std::memory_order_relaxed);
+
+        index->log = std::make_unique<vecops::MutationLog>(std::string(path), dim);
+        return static_cast<int>(records);
+    } catch (...) {
+        return -1;
     }
-    if (g_space != nullptr) {
-        delete g_space;
-        g_space = nullptr;
+}
+
+extern "C" int hnsw_index_search_knn_rescore(
+    const hnsw_index_t* index,
+    const embedding_store_t* store,
+    const float* query,
+    int k,
+    int ef,
+    int num_candidates,
+    int* out_ids,
+    float* out_scores
+) {
+    if (index == nullptr || store == nullptr || query == nullptr || k <= 0 ||
+        store->store.dim() != static_cast<size_t>(index->dim)) {
+        return -1;
     }
-    
+
+    const size_t candidates = static_cast<size_t>(std::max(k, num_candidates));
+    const vecops::simd::Kernels& kernels = vecops::simd::kernels();
+    const size_t dim = static_cast<size_t>(index->dim);
+
+    std::shared_lock<std::shared_mutex> lock = lock_for_search(index);
     try {
-        g_dim = dim;
-        g_space = new hnswlib::InnerProductSpace(dim);
-        
-        // 尝试从文件加载
-        FILE* f = fopen(path, "rb");
-        if (f != nullptr) {
-            fclose(f);
-            // 文件存在，加载索引
-            g_hnsw_index = new hnswlib::HierarchicalNSW<float>(g_space, std::string(path));
-            return 0;  // 成功加载
-        } else {
-            // 文件不存在，创建新索引
-            g_hnsw_index = new hnswlib::HierarchicalNSW<float>(g_space, max_elements, 16, 200);
-            return 1;  // 创建了新索引
+        std::vector<float> encoded;
+        auto result = index->index->searchKnnWithEf(
+            encode_query(index, query, encoded), candidates, resolve_ef(index, ef));
+
+        // 候选在原始 float 向量上重新打分；不在存储中的候选保留近似分数
+        vecops::TopK top(static_cast<size_t>(k));
+        while (!result.empty()) {
+            const auto& item = result.top();
+            int id = static_cast<int>(item.second);
+            const float* vec = store->store.find(id);
+            top.push(vec != nullptr ? kernels.dot(query, vec, dim) : 1.0f - item.first, id);
+            result.pop();
         }
+        return static_cast<int>(top.drain_sorted(out_ids, out_scores));
     } catch (...) {
-        return -1;  // 失败
+        return -1;
     }
 }
 
@@ -231,28 +1793,45 @@ extern "C" int search_top_k(
     float* out_scores
 ) {
     if (rows <= 0 || k <= 0) return 0;
-    
+
     int actual_k = std::min(k, rows);
-    
-    std::vector<std::pair<float, int>> scores(rows);
-    
-    for (int i = 0; i < rows; ++i) {
-        const float* row_ptr = item_matrix + i * cols;
-        float score = dot_product(query_vec, row_ptr, cols);
-        scores[i] = {score, item_ids[i]};
-    }
-    
-    std::partial_sort(
-        scores.begin(),
-        scores.begin() + actual_k,
-        scores.end(),
-        [](const auto& a, const auto& b) { return a.first > b.first; }
-    );
-    
-    for (int i = 0; i < actual_k; ++i) {
-        out_ids[i] = scores[i].second;
-        out_scores[i] = scores[i].first;
-    }
-    
-    return actual_k;
+    int count = 0;
+    if (search_top_k_batch(query_vec, 1, item_matrix, item_ids, rows, cols, actual_k,
+                           out_ids, out_scores, &count) != 0) {
+        return -1;
+    }
+    return count;
+}
+
+extern "C" int search_top_k_batch(
+    const float* queries,
+    int num_queries,
+    const float* item_matrix,
+    const int* item_ids,
+    int rows,
+    int cols,
+    int k,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+) {
+    if (queries == nullptr || item_matrix == nullptr || num_queries <= 0 || rows < 0 || cols <= 0 || k <= 0 ||
+        out_ids == nullptr || out_scores == nullptr || out_counts == nullptr) {
+        return -1;
+    }
+
+    try {
+        vecops::ExactSearchInput input;
+        input.queries = queries;
+        input.num_queries = static_cast<size_t>(num_queries);
+        input.matrix = item_matrix;
+        input.row_stride = static_cast<size_t>(cols);
+        input.ids = item_ids;
+        input.rows = static_cast<size_t>(rows);
+        input.dim = static_cast<size_t>(cols);
+        vecops::exact_top_k(input, static_cast<size_t>(k), out_ids, out_scores, out_counts);
+        return 0;
+    } catch (...) {
+        return -1;
+    }
 }
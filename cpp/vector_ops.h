@@ -12,10 +12,35 @@ extern "C" {
 int cpp_add(int a, int b);
 float dot_product(const float* vec_a, const float* vec_b, int len);
 
+/// 当前 CPU 上选用的 SIMD 内核名称 ("avx512" / "avx2" / "neon" / "scalar")，用于诊断
+const char* vector_ops_simd_backend(void);
+
+/// 固定维度空间 (space_fixed.h) 的批量距离与逐个距离不逐位相等的次数，
+/// 对 CPU 支持的每一档内核 (标量 / AVX2 / AVX-512) 分别检查，用于测试。-1 表示失败
+int vector_ops_fixed_kernel_mismatches(void);
+
+/// 在 path 上检查预写日志的截断: 切分点之后、drop_prefix 之前追加的记录在重放时保留。
+/// 用于测试，返回重放的记录数 (应为 6)，-1 表示失败或结果不符
+int vector_ops_mutation_log_check(const char* path);
+
 // ============================================================================
 // HNSW 索引操作 (HNSW Index Operations)
 // ============================================================================
 
+/// 索引内部的向量存储格式
+/// - FLOAT32: 原始 float 向量 (4 * dim 字节/元素)
+/// - INT8:    int8 标量量化 + 每向量一个缩放因子 (dim + 4 字节/元素)，内积为近似值，
+///            可配合 hnsw_index_search_knn_rescore 用原始向量对候选做精确重排序
+/// - PQ:      乘积量化，每元素 pq_m + 1 字节 (pq_m 个子空间编码 + 1 字节标记)，
+///            需要先用样本训练码本 (hnsw_index_new_pq)，码本保存在索引文件旁的 "<path>.pq"
+/// 接口始终接收 float 向量，量化在 C++ 内部完成。
+/// 索引文件不记录存储格式，加载时必须传入与保存时相同的格式 (不一致时加载失败)。
+enum {
+    HNSW_STORAGE_FLOAT32 = 0,
+    HNSW_STORAGE_INT8 = 1,
+    HNSW_STORAGE_PQ = 2,
+};
+
 /// 初始化 HNSW 索引
 /// 
 /// @param dim              向量维度
@@ -29,12 +54,19 @@ float dot_product(const float* vec_a, const float* vec_b, int len);
 /// @return                 0 成功, -1 失败
 int hnsw_init(int dim, int max_elements, int M, int ef_construction);
 
+/// 初始化指定存储格式 (HNSW_STORAGE_*) 的 HNSW 索引，其余参数同 hnsw_init
+int hnsw_init_with_storage(int dim, int max_elements, int M, int ef_construction, int storage);
+
 /// 向索引添加单个向量
 /// @param id      向量的唯一标识符
 /// @param vector  向量数据指针 (长度为 dim)
 /// @return        0 成功, -1 失败
 int hnsw_add_item(int id, const float* vector);
 
+/// 向默认索引并行批量添加 n 个向量 (见 hnsw_index_add_items_batch)
+/// @return  成功插入的数量, -1 表示失败
+int hnsw_add_items_batch(const int* ids, const float* vectors, int n);
+
 /// 设置查询时的搜索深度
 /// @param ef  查询时的搜索深度 (必须 >= k)
 ///            - 推荐值: 50-100
@@ -49,6 +81,11 @@ void hnsw_set_ef(int ef);
 /// @return            实际返回的数量, -1 表示失败
 int hnsw_search_knn(const float* query, int k, int* out_ids, float* out_scores);
 
+/// 使用指定的 ef 搜索最近邻 (不修改索引的默认 ef)
+/// @param ef  本次查询的搜索深度, <= 0 表示使用默认 ef; 实际使用 max(ef, k)
+/// @return    实际返回的数量, -1 表示失败
+int hnsw_search_knn_ef(const float* query, int k, int ef, int* out_ids, float* out_scores);
+
 /// 销毁索引并释放内存
 void hnsw_destroy();
 
@@ -67,10 +104,460 @@ int hnsw_save_index(const char* path);
 /// @return              0 成功加载, 1 创建了新索引, -1 失败
 int hnsw_load_index(const char* path, int dim, int max_elements);
 
+/// 按指定存储格式 (HNSW_STORAGE_*) 加载索引，其余同 hnsw_load_index
+int hnsw_load_index_with_storage(const char* path, int dim, int max_elements, int storage);
+
+/// 以 mmap 格式保存索引 (见 hnsw_index_save_mmap)
+int hnsw_save_index_mmap(const char* path);
+
+/// 映射 mmap 格式的索引文件 (见 hnsw_index_load_mmap)，返回值同 hnsw_load_index
+int hnsw_load_index_mmap(const char* path, int dim, int max_elements);
+
+// ============================================================================
+// 句柄式 HNSW 索引 (Handle-based HNSW Index)
+// ============================================================================
+//
+// 与上面的全局接口不同，每个索引都是一个独立的不透明句柄:
+// - 搜索只持有读锁 (共享锁)，多个线程可以同时在同一个索引上搜索
+// - hnswlib 的 addPoint 本身通过 per-node 锁支持并发插入，因此插入同样只持有读锁
+// - 只有需要整张图保持静止的操作 (save) 才持有写锁 (独占锁)
+// - 默认 ef 是原子变量，hnsw_index_set_ef 不会阻塞或干扰正在进行的搜索；
+//   也可以通过 *_ef 变体为每次查询单独指定 ef
+//
+// 句柄由 C++ 分配，必须通过 hnsw_index_free 释放 ("Who allocates, must free")。
+
+typedef struct hnsw_index hnsw_index_t;
+
+/// 创建新的空索引
+/// @return  索引句柄, 失败返回 NULL
+hnsw_index_t* hnsw_index_new(int dim, int max_elements, int M, int ef_construction);
+
+/// 创建指定存储格式 (HNSW_STORAGE_*) 的空索引
+/// HNSW_STORAGE_PQ 需要训练数据，不能通过此函数创建 (返回 NULL)，请使用 hnsw_index_new_pq
+hnsw_index_t* hnsw_index_new_with_storage(int dim, int max_elements, int M, int ef_construction, int storage);
+
+/// 用训练样本学习 PQ 码本，并创建空的 PQ 索引
+///
+/// @param pq_m       子空间数 = 每元素编码字节数 (推荐 32-64)，dim 必须是它的整数倍
+/// @param train      行优先的 num_train x dim 样本矩阵 (通常取物品向量的随机子集)
+/// @param num_train  样本数，至少 256；超过 8192 时内部随机抽样
+/// @return           索引句柄, 参数不合法或训练失败返回 NULL
+hnsw_index_t* hnsw_index_new_pq(
+    int dim,
+    int max_elements,
+    int M,
+    int ef_construction,
+    int pq_m,
+    const float* train,
+    int num_train
+);
+
+/// 从文件加载索引 (若文件不存在则创建新索引)
+/// @param out_index  输出: 索引句柄 (仅在返回值 >= 0 时有效)
+/// @return           0 成功加载, 1 创建了新索引, -1 失败
+int hnsw_index_load(const char* path, int dim, int max_elements, hnsw_index_t** out_index);
+
+/// 按指定存储格式 (HNSW_STORAGE_*) 加载索引，其余同 hnsw_index_load
+/// 文件中的向量大小与该格式不一致时返回 -1
+/// HNSW_STORAGE_PQ 同时读取 "<path>.pq" 码本；索引或码本不存在时返回 -1 (无法在没有训练数据时新建)
+int hnsw_index_load_with_storage(
+    const char* path, int dim, int max_elements, int storage, hnsw_index_t** out_index);
+
+/// 映射由 hnsw_index_save_mmap 写出的索引文件 (若文件不存在则创建新索引)
+///
+/// level-0 数据和上层链表直接使用映射内存，不解析、不拷贝，启动耗时主要是之后访问时的缺页；
+/// 同一主机上映射同一文件的多个进程共享 page cache (MAP_PRIVATE，写入时按页复制，不会改动文件)。
+/// 仍可继续插入: max_elements 大于文件中的元素数时，多出的容量预留为匿名内存。
+/// 文件不是 mmap 格式 (例如 hnsw_index_save 写出的原生格式) 或元素大小与 storage 不一致时返回 -1。
+/// @return  0 成功映射, 1 创建了新索引, -1 失败
+int hnsw_index_load_mmap(
+    const char* path, int dim, int max_elements, int storage, hnsw_index_t** out_index);
+
+/// 释放索引句柄 (NULL 安全)
+void hnsw_index_free(hnsw_index_t* index);
+
+/// 向索引添加单个向量 (可与搜索并发调用)
+///
+/// id 已存在时原地更新它的向量 (已删除的 id 会被恢复)；
+/// 新 id 优先复用已删除元素的槽位，索引容量不会因频繁的删除 / 新增而耗尽。
+/// 没有空余槽位时自动扩容 (几何增长，扩容期间短暂持有写锁)，max_elements 只是初始容量。
+/// @return  0 成功, -1 失败
+int hnsw_index_add_item(hnsw_index_t* index, int id, const float* vector);
+
+/// 删除一个元素 (标记删除: 不再出现在搜索结果中，槽位留给之后的新增元素复用)
+/// @return  0 成功, -1 id 不存在或已删除
+int hnsw_index_mark_deleted(hnsw_index_t* index, int id);
+
+/// 批量插入的进度回调: 已处理 done 个 (共 total 个)
+/// 只在调用 hnsw_index_add_items_batch 的线程上同步调用
+typedef void (*hnsw_progress_fn)(int done, int total, void* ctx);
+
+/// 在共享线程池上并行批量插入 n 个向量 (用于启动时重建索引)
+///
+/// hnswlib 的 addPoint 通过 per-label / per-node 锁支持并发插入，
+/// 整个批次只持有一次读锁，与搜索互不阻塞。
+/// 单个元素插入失败 (如超出容量) 不会中止批次，只是不计入返回值。
+/// @param ids       n 个物品 ID
+/// @param vectors   行优先的 n x dim 矩阵
+/// @param progress  可为 NULL；非 NULL 时每完成约 1% (至少 1024 个) 回调一次
+/// @return          成功插入的数量, -1 表示参数不合法
+int hnsw_index_add_items_batch(
+    hnsw_index_t* index,
+    const int* ids,
+    const float* vectors,
+    int n,
+    hnsw_progress_fn progress,
+    void* ctx
+);
+
+/// 设置查询时的默认搜索深度 (不影响显式指定 ef 的查询)
+void hnsw_index_set_ef(hnsw_index_t* index, int ef);
+
+/// 搜索最近邻 (可与其他搜索及插入并发调用)
+/// @return  实际返回的数量, -1 表示失败
+int hnsw_index_search_knn(const hnsw_index_t* index, const float* query, int k, int* out_ids, float* out_scores);
+
+/// 使用指定的 ef 搜索最近邻
+/// @param ef  本次查询的搜索深度, <= 0 表示使用默认 ef; 实际使用 max(ef, k)
+/// @return    实际返回的数量, -1 表示失败
+int hnsw_index_search_knn_ef(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 过滤回调: 返回非 0 表示允许该 id 出现在结果中
+/// @param id   候选物品的 ID
+/// @param ctx  调用方传入的上下文指针，C++ 侧只负责原样转交
+typedef int (*hnsw_filter_fn)(int id, void* ctx);
+
+/// 带过滤条件的最近邻搜索
+///
+/// 过滤在图遍历过程中生效 (hnswlib 的 BaseFilterFunctor):
+/// 被拒绝的节点仍会被用来导航，但不会进入结果集，因此一次遍历即可返回
+/// k 个满足条件的结果，无需先多取再过滤、不足时再重试。
+///
+/// 回调只会在调用线程上同步执行，每个候选 id 最多被询问一次 (入口点除外)。
+///
+/// @param filter  过滤回调, 为 NULL 时等价于 hnsw_index_search_knn_ef
+/// @param ctx     转交给回调的上下文
+/// @return        实际返回的数量, -1 表示失败
+int hnsw_index_search_knn_filtered(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    hnsw_filter_fn filter,
+    void* ctx,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 多兴趣召回: 用户的 n_queries 个兴趣向量共同召回 Top-K，结果按物品去重
+///
+/// 物品得分为它与各兴趣向量内积的最大值。所有兴趣在同一把读锁下依次遍历，
+/// 每个兴趣的召回与一次独立的 ef 搜索相同；合并时距离超过当前第 k 名的新物品直接丢弃，
+/// 省去 n_queries 次加锁、结果拷贝与重复的过滤回调。
+///
+/// 过滤语义与 hnsw_index_search_knn_filtered 相同，跨兴趣共享判定结果，
+/// 每个候选 id 仍最多被询问一次。
+///
+/// @param queries    行优先展开的 n_queries x dim 矩阵
+/// @param ef         每个兴趣的候选集大小 (<= 0 表示默认 ef，不小于 k)
+/// @param filter     过滤回调, 可为 NULL
+/// @param out_ids    输出物品 id, 预分配 k 个元素，按得分降序
+/// @param out_scores 输出得分, 预分配 k 个元素
+/// @return           实际返回的数量, -1 表示失败
+int hnsw_index_search_knn_multi(
+    const hnsw_index_t* index,
+    const float* queries,
+    int n_queries,
+    int k,
+    int ef,
+    hnsw_filter_fn filter,
+    void* ctx,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 设置 (或更新) 物品的过滤属性
+///
+/// 属性独立于向量存储，可以在 add_item 之前或之后设置。
+/// 未设置属性的物品不会出现在任何带属性条件的查询结果中。
+///
+/// @param category  类别编号 (>= 0, 由调用方负责类别名到编号的映射)
+/// @param price     价格
+/// @return          0 成功, -1 失败
+int hnsw_index_set_attributes(hnsw_index_t* index, int id, int category, float price);
+
+/// 属性过滤条件: "category in {...} and min_price <= price < max_price"
+typedef struct {
+    const int* categories;  // 允许的类别编号数组
+    int num_categories;     // categories 长度, <= 0 表示不限类别
+    float min_price;        // 价格下界 (含), 不限时传 -INFINITY
+    float max_price;        // 价格上界 (不含), 不限时传 INFINITY
+} hnsw_attr_filter_t;
+
+/// 带属性过滤的最近邻搜索
+///
+/// 根据条件的选择性自动选择执行方式:
+/// - 满足条件的物品较多: HNSW 图遍历，通过 BaseFilterFunctor 逐个判定 (O(1))
+/// - 满足条件的物品很少: 直接枚举全部候选并精确计算距离 (暴力搜索)，
+///   避免图遍历为凑够 k 个结果而几乎走遍整张图
+///
+/// @return  实际返回的数量, -1 表示失败
+int hnsw_index_search_knn_attr(
+    const hnsw_index_t* index,
+    const float* query,
+    int k,
+    int ef,
+    const hnsw_attr_filter_t* filter,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 批量搜索最近邻: 一次 FFI 调用处理 n 个查询
+///
+/// 查询在进程级线程池上并行执行，每个并发 worker 从 hnswlib 的
+/// VisitedListPool 中取得自己的 VisitedList，彼此之间不共享搜索状态。
+///
+/// 内存布局 (均为行优先展开的一维数组):
+///   queries     [n * dim]   第 i 个查询位于 queries[i * dim .. (i + 1) * dim)
+///   out_ids     [n * k]     第 i 个查询的结果位于 out_ids[i * k .. (i + 1) * k)
+///   out_scores  [n * k]     同上
+///   out_counts  [n]         第 i 个查询实际返回的数量 (可能小于 k)
+/// 不足 k 个结果的位置填充 id = -1, score = 0。
+///
+/// @param ef  所有查询共用的搜索深度, <= 0 表示使用默认 ef
+/// @return    0 成功, -1 失败
+int hnsw_index_search_knn_batch(
+    const hnsw_index_t* index,
+    const float* queries,
+    int n,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+);
+
+/// 分片索引的 scatter-gather 搜索: 在线程池上并行搜索每个分片的 top-k，再用容量为 k 的堆合并
+///
+/// 各分片是互相独立的句柄 (dim 必须相同)，每个 id 只能出现在一个分片中 (由调用方路由，
+/// 例如按 id 取模)，合并时不去重。每个分片各自加读锁并使用自己的默认 ef。
+/// 分片的搜索在线程池上执行，跳数统计不计入调用线程 (同 hnsw_index_search_knn_batch)。
+///
+/// @param shards    n_shards 个索引句柄
+/// @param ef        每个分片的搜索深度, <= 0 表示使用各分片的默认 ef
+/// @param out_ids   输出数组, 至少 k 个元素, 按相似度降序
+/// @return          实际返回的结果数量, -1 表示失败
+int hnsw_index_search_knn_sharded(
+    const hnsw_index_t* const* shards,
+    int n_shards,
+    const float* query,
+    int k,
+    int ef,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 获取索引中的元素数量 (不含已标记删除的元素)
+int hnsw_index_get_count(const hnsw_index_t* index);
+
+/// 索引的占用与自动扩容统计
+typedef struct {
+    int count;                 // 可搜索的元素数
+    int deleted;               // 已标记删除、等待复用的槽位数
+    int capacity;              // 当前容量 (已分配的槽位数)
+    int resizes;               // 自动扩容次数
+    double resize_total_ms;    // 扩容累计耗时 (期间搜索与插入被阻塞)
+    double resize_max_ms;      // 单次扩容的最长耗时
+    long long mutations;       // 成功的插入 / 更新 / 删除总数 (用于按写入量触发快照)
+    int snapshots;             // hnsw_index_save_mmap 成功次数
+    double snapshot_pause_ms;  // 最近一次快照暂停写者的时间 (搜索不暂停)
+    double snapshot_write_ms;  // 最近一次快照写文件 + fsync 的时间 (不持有索引的锁)
+    int log_trim_failures;     // 快照已落盘但截断预写日志失败的次数 (下一次快照重试)
+    long long memory_bytes;    // 图与向量占用的内存 (含 level-0 的空闲槽位，不含属性与 PQ 码本)
+} hnsw_index_stats_t;
+
+/// @return  0 成功, -1 失败
+int hnsw_index_get_stats(const hnsw_index_t* index, hnsw_index_stats_t* out_stats);
+
+/// 当前线程累计的搜索统计 (线程本地计数，单调递增，所有索引合计)
+typedef struct {
+    long long hops;                   // 图遍历访问的节点数 (各层合计)
+    long long distance_computations;  // 遍历中计算距离的邻居数
+    long long lock_waits;             // 搜索读锁未能立即获得的次数 (写者在扩容 / 保存)
+    double lock_wait_ms;              // 在搜索读锁上等待的累计时间
+} hnsw_search_metrics_t;
+
+/// 读取当前线程的搜索统计。在同一线程上于一次搜索前后各读一次，差值即该次搜索的开销。
+/// hnsw_index_search_knn_batch 的查询在线程池上执行，只有读锁等待计入调用线程
+void hnsw_thread_search_metrics(hnsw_search_metrics_t* out_metrics);
+
+/// 以可直接映射的格式保存索引 (对齐的 level-0 块 + 上层链表偏移表)，供 hnsw_index_load_mmap 使用
+/// PQ 索引同时写出 "<path>.pq" 码本
+///
+/// 可以在服务运行期间作为后台快照调用:
+/// - 只在内存拷贝索引期间暂停插入 / 删除，搜索全程不受影响
+/// - 写临时文件 -> fsync -> rename，任何时刻崩溃 path 上都是完整的旧快照或新快照
+/// - 开启了预写日志时，快照落盘后丢弃日志中已包含在快照里的记录
+///   (因此开启日志后应始终保存到同一个 path)
+/// @return  0 成功, -1 失败
+int hnsw_index_save_mmap(hnsw_index_t* index, const char* path);
+
+/// 保存索引到文件 (PQ 索引同时写出 "<path>.pq" 码本)
+/// @return  0 成功, -1 失败
+int hnsw_index_save(hnsw_index_t* index, const char* path);
+
+// ============================================================================
+// 物品向量存储 (Embedding Store)
+// ============================================================================
+//
+// 启动时注册一次的连续向量矩阵 (64 字节对齐，每行按缓存行填充)，
+// 暴力搜索和重排序直接在其上计算，调用方无需每次传入整张矩阵。
+//
+// 线程安全: 读操作 (find / search / score) 可以并发执行；
+// 写操作 (put / remove) 需要调用方保证与其他任何操作互斥。
+
+typedef struct embedding_store embedding_store_t;
+
+/// 创建向量存储
+/// @param capacity  初始容量 (行数)，不足时自动扩容
+/// @return          存储指针, 失败返回 NULL
+embedding_store_t* embedding_store_new(int dim, int capacity);
+
+/// 释放向量存储 (传入 NULL 是安全的)
+void embedding_store_free(embedding_store_t* store);
+
+/// 插入或覆盖一个物品的向量 (复制 dim 个 float)
+/// @return  0 成功, -1 失败
+int embedding_store_put(embedding_store_t* store, int id, const float* vector);
+
+/// 删除一个物品的向量
+/// @return  0 成功, -1 不存在
+int embedding_store_remove(embedding_store_t* store, int id);
+
+/// 存储中的物品数量
+int embedding_store_count(const embedding_store_t* store);
+
+/// 第 row 行的物品 id (row 范围 [0, count))，越界返回 -1
+int embedding_store_id_at(const embedding_store_t* store, int row);
+
+/// 第 row 行的向量指针，越界返回 NULL
+/// 指针在下一次 put / remove 之前有效
+const float* embedding_store_row_at(const embedding_store_t* store, int row);
+
+/// 按 id 查找向量指针，不存在返回 NULL (有效期同上)
+const float* embedding_store_find(const embedding_store_t* store, int id);
+
+/// 在全部已注册向量上做精确 Top-K (内积)
+/// @return  实际返回的数量, -1 表示失败
+int embedding_store_search_top_k(
+    const embedding_store_t* store,
+    const float* query,
+    int k,
+    int* out_ids,
+    float* out_scores
+);
+
+/// 批量精确 Top-K，输出布局同 search_top_k_batch
+/// @return  0 成功, -1 失败
+int embedding_store_search_top_k_batch(
+    const embedding_store_t* store,
+    const float* queries,
+    int num_queries,
+    int k,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+);
+
+/// 对给定的一组候选 id 计算与查询的精确内积 (用于重排序)
+/// 不存在的 id 得分为 -INFINITY
+/// @return  找到的 id 数量, -1 表示失败
+int embedding_store_score(
+    const embedding_store_t* store,
+    const float* query,
+    const int* ids,
+    int n,
+    float* out_scores
+);
+
+/// 把 store 中的全部向量并行批量插入索引 (不拷贝矩阵)，其余同 hnsw_index_add_items_batch
+/// 调用期间 store 不能被修改
+int hnsw_index_add_items_from_store(
+    hnsw_index_t* index,
+    const embedding_store_t* store,
+    hnsw_progress_fn progress,
+    void* ctx
+);
+
+/// hnsw_index_reconcile_with_store 的统计结果
+typedef struct {
+    int added;      // store 中有、索引中没有 (或已标记删除) 的元素
+    int updated;    // 两边都有但向量不同的元素 (原地更新)
+    int deleted;    // 索引中有、store 中没有的元素 (标记删除)
+    int unchanged;  // 两边一致的元素
+    int failed;     // 插入或更新失败的元素 (如超出容量)
+} hnsw_reconcile_stats_t;
+
+/// 让索引与 store 的内容保持一致，只处理差异部分 (用于启动时修复加载的索引)
+///
+/// 按 label 比较两边: 缺失的元素插入，多余的元素 markDelete，
+/// 已存在的元素比较存储格式下的向量 (量化存储比较编码)，不同时原地更新。
+/// 新增与更新在线程池上并行执行，progress 只覆盖这一阶段。
+/// 对账期间持有索引的写锁，搜索与插入会被阻塞；调用期间 store 不能被修改。
+///
+/// @param out_stats  可为 NULL
+/// @return           0 成功, -1 失败
+int hnsw_index_reconcile_with_store(
+    hnsw_index_t* index,
+    const embedding_store_t* store,
+    hnsw_progress_fn progress,
+    void* ctx,
+    hnsw_reconcile_stats_t* out_stats
+);
+
+/// 开启预写日志: 先把 path 上已有的日志重放到索引中，之后的每次插入 / 更新 / 删除
+/// 在修改索引成功之后、返回之前追加到日志 (失败的修改不写日志)
+///
+/// 用法: 加载 hnsw_index_save_mmap 写出的快照后立即调用，恢复到崩溃前的最新状态，
+/// 不需要重新计算向量。日志中的向量是原始 float，与索引的存储格式无关。
+/// - 进程崩溃不丢失已返回的修改；fsync 每 20ms 批量执行一次，断电最多丢失这段时间的修改
+/// - 日志末尾写了一半的记录在重放时被截掉
+/// - 同一 id 的并发写入在日志中的先后顺序不确定，需要确定结果时由调用方串行化
+/// - 每个句柄只能开启一次；重放期间阻塞所有插入与删除
+///
+/// @return  重放的日志记录数 (文件不存在时为 0), -1 表示失败 (含维度不一致)
+int hnsw_index_open_log(hnsw_index_t* index, const char* path);
+
+/// 先在索引上取 num_candidates 个候选，再用 store 中的原始 float 向量精确重排序，返回前 k 个
+///
+/// 主要配合 HNSW_STORAGE_INT8 使用: 图遍历读取紧凑的量化向量，
+/// 只有少量候选需要访问完整精度的向量。store 中缺失的候选保留索引给出的近似分数。
+///
+/// @param num_candidates  重排序的候选数 (小于 k 时按 k 处理)，通常取 k 的 2-4 倍
+/// @return                实际返回的数量, -1 表示失败
+int hnsw_index_search_knn_rescore(
+    const hnsw_index_t* index,
+    const embedding_store_t* store,
+    const float* query,
+    int k,
+    int ef,
+    int num_candidates,
+    int* out_ids,
+    float* out_scores
+);
+
 // ============================================================================
 // 旧版接口 (Legacy Interface - 保持向后兼容)
 // ============================================================================
 
+/// 单查询精确 Top-K (内积)，返回实际写入的数量 (min(k, rows))，-1 表示失败
 int search_top_k(
     const float* query_vec,
     const float* item_matrix,
@@ -82,6 +569,31 @@ int search_top_k(
     float* out_scores
 );
 
+/// 批量精确 Top-K (内积): 多个查询一起分块扫描物品矩阵，在线程池上并行
+///
+/// 用于召回率审计 (HNSW 结果的 ground truth) 和小规模物品库。
+///
+/// @param queries      n x cols 的查询矩阵 (行优先)
+/// @param item_matrix  rows x cols 的物品矩阵 (行优先)
+/// @param item_ids     每行对应的物品 id
+/// @param out_ids      输出缓冲区，至少 n * k 个元素，第 i 个查询写入 [i*k, (i+1)*k)
+/// @param out_scores   输出缓冲区，布局同 out_ids
+/// @param out_counts   输出缓冲区，n 个元素，第 i 个查询实际返回的数量
+///                     (不足 k 的槽位填 id = -1, score = 0)
+/// @return             0 成功, -1 失败
+int search_top_k_batch(
+    const float* queries,
+    int num_queries,
+    const float* item_matrix,
+    const int* item_ids,
+    int rows,
+    int cols,
+    int k,
+    int* out_ids,
+    float* out_scores,
+    int* out_counts
+);
+
 #ifdef __cplusplus
 }
 #endif
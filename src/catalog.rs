@@ -0,0 +1,137 @@
+//! 物品目录 - 运行时的物品元数据、向量与类别编号
+//!
+//! 物品可以在线新增 / 更新 / 删除，因此这几份数据放在一起，由 `AppState` 中的
+//! 同一把读写锁保护，保证 handler 看到的 `items`、`item_map` 与向量存储总是一致的。
+
+use crate::ffi::EmbeddingStore;
+use crate::model::Item;
+use std::cmp::Ordering;
+use std::collections::HashMap;
+
+pub struct Catalog {
+    items: Vec<Item>,
+    item_map: HashMap<u64, usize>,
+    /// 全部物品向量 (C++ 侧连续存储)；`items` 中的 embedding 已移入这里
+    embeddings: EmbeddingStore,
+    /// 类别名 -> 类别编号 (C++ 属性索引只存编号)
+    category_ids: HashMap<String, u32>,
+    /// (popularity, id)，热度降序、同热度按 id 升序；随 upsert / remove 增量维护
+    by_popularity: Vec<(f32, u64)>,
+}
+
+impl Catalog {
+    /// `items` 的 embedding 必须已经移入 `embeddings`
+    pub fn new(items: Vec<Item>, embeddings: EmbeddingStore, category_ids: HashMap<String, u32>) -> Self {
+        let item_map = items.iter().enumerate().map(|(i, item)| (item.id, i)).collect();
+        let mut by_popularity: Vec<(f32, u64)> = items.iter().map(|item| (item.popularity, item.id)).collect();
+        by_popularity.sort_unstable_by(popularity_order);
+        Self { items, item_map, embeddings, category_ids, by_popularity }
+    }
+
+    pub fn len(&self) -> usize {
+        self.items.len()
+    }
+
+    pub fn items(&self) -> &[Item] {
+        &self.items
+    }
+
+    pub fn get(&self, id: u64) -> Option<&Item> {
+        self.item_map.get(&id).map(|&idx| &self.items[idx])
+    }
+
+    /// 按热度从高到低遍历物品，只访问实际取用的部分
+    pub fn popular(&self) -> impl Iterator<Item = &Item> + '_ {
+        self.by_popularity.iter().map(move |&(_, id)| &self.items[self.item_map[&id]])
+    }
+
+    pub fn embeddings(&self) -> &EmbeddingStore {
+        &self.embeddings
+    }
+
+    pub fn category_ids(&self) -> &HashMap<String, u32> {
+        &self.category_ids
+    }
+
+    /// 类别编号，新类别分配下一个编号
+    pub fn category_id(&mut self, name: &str) -> u32 {
+        let next = self.category_ids.len() as u32;
+        *self.category_ids.entry(name.to_string()).or_insert(next)
+    }
+
+    /// 插入或替换一个物品，`item.embedding` 会被移入向量存储。返回是否为新物品
+    pub fn upsert(&mut self, mut item: Item) -> Result<bool, String> {
+        self.embeddings.put(item.id, &item.embedding)?;
+        item.embedding = Vec::new();
+
+        match self.item_map.get(&item.id) {
+            Some(&idx) => {
+                self.remove_popularity(self.items[idx].popularity, item.id);
+                self.insert_popularity(item.popularity, item.id);
+                self.items[idx] = item;
+                Ok(false)
+            }
+            None => {
+                self.insert_popularity(item.popularity, item.id);
+                self.item_map.insert(item.id, self.items.len());
+                self.items.push(item);
+                Ok(true)
+            }
+        }
+    }
+
+    /// 删除一个物品，返回被删除的物品
+    pub fn remove(&mut self, id: u64) -> Option<Item> {
+        let idx = self.item_map.remove(&id)?;
+        self.embeddings.remove(id);
+        let item = self.items.swap_remove(idx);
+        // 末尾的物品被移到了 idx
+        if let Some(moved) = self.items.get(idx) {
+            self.item_map.insert(moved.id, idx);
+        }
+        self.remove_popularity(item.popularity, item.id);
+        Some(item)
+    }
+
+    // 有序数组上二分定位后插入 / 删除: 写入很少，遍历时是连续内存
+    fn insert_popularity(&mut self, popularity: f32, id: u64) {
+        let key = (popularity, id);
+        if let Err(pos) = self.by_popularity.binary_search_by(|probe| popularity_order(probe, &key)) {
+            self.by_popularity.insert(pos, key);
+        }
+    }
+
+    fn remove_popularity(&mut self, popularity: f32, id: u64) {
+        let key = (popularity, id);
+        if let Ok(pos) = self.by_popularity.binary_search_by(|probe| popularity_order(probe, &key)) {
+            self.by_popularity.remove(pos);
+        }
+    }
+}
+
+fn popularity_order(a: &(f32, u64), b: &(f32, u64)) -> Ordering {
+    b.0.total_cmp(&a.0).then(a.1.cmp(&b.1))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_catalog_popularity_index() {
+        let item = |id: u64, popularity: f32| Item { popularity, ..Item::new(id, format!("item {}", id), vec![id as f32, 1.0]) };
+        let mut items = vec![item(1, 0.2), item(2, 0.9), item(3, 0.5)];
+        let embeddings = EmbeddingStore::from_items(2, &mut items).unwrap();
+        let mut catalog = Catalog::new(items, embeddings, HashMap::new());
+        let order = |c: &Catalog| c.popular().map(|item| item.id).collect::<Vec<_>>();
+        assert_eq!(order(&catalog), vec![2, 3, 1]);
+
+        catalog.upsert(item(1, 0.95)).unwrap();
+        catalog.upsert(item(4, 0.5)).unwrap();
+        assert_eq!(order(&catalog), vec![1, 2, 3, 4]);
+
+        catalog.remove(2);
+        catalog.upsert(item(3, 0.1)).unwrap();
+        assert_eq!(order(&catalog), vec![1, 4, 3]);
+    }
+}
@@ -1,92 +1,382 @@
 //! Embedding 模块 - 使用 ONNX Runtime 进行语义向量化
+//!
+//! 多条文本合并为一次 `[B, L]` 推理: 按 token 数排序后分批，每批只补齐到批内最长的句子
+//! (dynamic padding)，批内的 masked mean pooling 与 L2 归一化在一次扫描中完成。
+//!
+//! 模型持有一组 Session，每个 Session 同一时刻只执行一次推理 (ort 的 run 需要 &mut)。
+//! 在线请求经由 `EncodeQueue` 分发给每个 Session 各自的工作线程，推理不占用 Tokio 的线程。
 
 use anyhow::{Context, Result};
-use ndarray::{Array1, Array2};
 use ort::session::Session;
 use ort::value::Value;
 use ort::inputs;
-use std::sync::Mutex;
-use tokenizers::Tokenizer;
+use std::fmt;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{mpsc, Arc, Mutex, MutexGuard};
+use tokenizers::{Encoding, Tokenizer};
+use tokio::sync::oneshot;
 
 const MODEL_PATH: &str = "models/all-MiniLM-L6-v2.onnx";
 const TOKENIZER_PATH: &str = "models/tokenizer.json";
 const EMBEDDING_DIM: usize = 384;
+/// 一次推理的最大句子数: 批越大吞吐越高，但单批耗时 (排在同一批里的请求的延迟) 也越长
+const MAX_BATCH: usize = 32;
+
+/// 推理资源的划分
+#[derive(Debug, Clone)]
+pub struct EmbeddingConfig {
+    /// Session 数，即可以同时进行的推理数 (每个 Session 各加载一份模型权重，约 90MB)
+    pub sessions: usize,
+    /// 每个 Session 的算子内线程数；sessions * intra_threads 不宜超过 CPU 核数
+    pub intra_threads: usize,
+    /// 每个 Session 的算子间线程数，1 表示按顺序执行计算图
+    pub inter_threads: usize,
+    /// 在线请求排队的上限，队列满时新请求立即失败 (`QueueFull`)，而不是无限排队
+    pub queue_capacity: usize,
+}
+
+impl Default for EmbeddingConfig {
+    /// 每个 Session 约 4 个算子内线程，Session 数随核数增加 (最多 4 个)
+    fn default() -> Self {
+        let cores = std::thread::available_parallelism().map(|n| n.get()).unwrap_or(4);
+        let sessions = (cores / 4).clamp(1, 4);
+        Self {
+            sessions,
+            intra_threads: (cores / sessions).max(1),
+            inter_threads: 1,
+            queue_capacity: 256,
+        }
+    }
+}
 
 pub struct EmbeddingModel {
-    session: Mutex<Session>,
+    sessions: Vec<Mutex<Session>>,
     tokenizer: Tokenizer,
+    config: EmbeddingConfig,
 }
 
 impl EmbeddingModel {
     pub fn new() -> Result<Self> {
+        Self::with_config(&EmbeddingConfig::default())
+    }
+
+    pub fn with_config(config: &EmbeddingConfig) -> Result<Self> {
         // 初始化 Session
-        let session = Session::builder()?
-            .with_intra_threads(4)?
-            .commit_from_file(MODEL_PATH)
-            .context("Failed to load ONNX model")?;
+        let sessions = (0..config.sessions.max(1))
+            .map(|_| {
+                let session = Session::builder()?
+                    .with_intra_threads(config.intra_threads.max(1))?
+                    .with_inter_threads(config.inter_threads.max(1))?
+                    .with_parallel_execution(config.inter_threads > 1)?
+                    .commit_from_file(MODEL_PATH)
+                    .context("Failed to load ONNX model")?;
+                Ok(Mutex::new(session))
+            })
+            .collect::<Result<Vec<_>>>()?;
 
         let tokenizer = Tokenizer::from_file(TOKENIZER_PATH)
             .map_err(|e| anyhow::anyhow!("Failed to load tokenizer: {}", e))?;
 
-        Ok(Self { session: Mutex::new(session), tokenizer })
+        Ok(Self { sessions, tokenizer, config: config.clone() })
+    }
+
+    pub fn sessions(&self) -> usize {
+        self.sessions.len()
+    }
+
+    pub fn config(&self) -> &EmbeddingConfig {
+        &self.config
     }
 
     /// 将文本编码为语义向量 (384 维)
     pub fn encode(&self, text: &str) -> Result<Vec<f32>> {
-        // Step A: Tokenize
-        let encoding = self.tokenizer
-            .encode(text, true)
-            .map_err(|e| anyhow::anyhow!("Tokenization failed: {}", e))?;
+        self.encode_batch(&[text])?
+            .pop()
+            .context("Empty embedding batch")
+    }
+
+    /// 批量编码，结果顺序与 texts 一致
+    ///
+    /// 按 token 数排序后每 MAX_BATCH 条一批，长度相近的句子在同一批，补齐的浪费最小。
+    /// 多个批次时分摊到所有 Session 上并行推理 (用于启动时的批量编码)
+    pub fn encode_batch(&self, texts: &[&str]) -> Result<Vec<Vec<f32>>> {
+        let encodings = self.tokenize(texts)?;
+        let order = length_order(&encodings);
+        let batches: Vec<&[usize]> = order.chunks(MAX_BATCH).collect();
 
-        let input_ids: Vec<i64> = encoding.get_ids().iter().map(|&x| x as i64).collect();
-        let attention_mask: Vec<i64> = encoding.get_attention_mask().iter().map(|&x| x as i64).collect();
-        let token_type_ids: Vec<i64> = encoding.get_type_ids().iter().map(|&x| x as i64).collect();
+        let workers = self.sessions.len().min(batches.len()).max(1);
+        let parts = if workers == 1 {
+            vec![self.encode_sorted(0, &encodings, &batches)?]
+        } else {
+            // Session s 处理第 s, s + workers, ... 个批次
+            let encodings = &encodings;
+            std::thread::scope(|scope| {
+                let handles: Vec<_> = (0..workers)
+                    .map(|s| {
+                        let mine: Vec<&[usize]> = batches.iter().skip(s).step_by(workers).copied().collect();
+                        scope.spawn(move || self.encode_sorted(s, encodings, &mine))
+                    })
+                    .collect();
+                handles.into_iter()
+                    .map(|h| h.join().map_err(|_| anyhow::anyhow!("Embedding worker panicked"))?)
+                    .collect::<Result<Vec<_>>>()
+            })?
+        };
 
-        let seq_len = input_ids.len();
+        let mut embeddings = vec![Vec::new(); encodings.len()];
+        for (i, embedding) in parts.into_iter().flatten() {
+            embeddings[i] = embedding;
+        }
+        Ok(embeddings)
+    }
+
+    /// 在一个 Session 上编码 (不再分摊到其他 Session)，编码队列的工作线程使用
+    fn encode_on(&self, session: usize, texts: &[&str]) -> Result<Vec<Vec<f32>>> {
+        let encodings = self.tokenize(texts)?;
+        let order = length_order(&encodings);
+        let batches: Vec<&[usize]> = order.chunks(MAX_BATCH).collect();
+        let mut embeddings = vec![Vec::new(); encodings.len()];
+        for (i, embedding) in self.encode_sorted(session, &encodings, &batches)? {
+            embeddings[i] = embedding;
+        }
+        Ok(embeddings)
+    }
+
+    fn tokenize(&self, texts: &[&str]) -> Result<Vec<Encoding>> {
+        self.tokenizer
+            .encode_batch(texts.to_vec(), true)
+            .map_err(|e| anyhow::anyhow!("Tokenization failed: {}", e))
+    }
+
+    /// 依次推理 batches 中的每一批 (元素为 encodings 的下标)，返回 (下标, 向量)
+    fn encode_sorted(
+        &self,
+        preferred: usize,
+        encodings: &[Encoding],
+        batches: &[&[usize]],
+    ) -> Result<Vec<(usize, Vec<f32>)>> {
+        let mut session = self.acquire(preferred)?;
+        let mut embeddings = Vec::with_capacity(batches.iter().map(|b| b.len()).sum());
+        for batch in batches {
+            let inputs: Vec<&Encoding> = batch.iter().map(|&i| &encodings[i]).collect();
+            embeddings.extend(batch.iter().copied().zip(Self::run_batch(&mut session, &inputs)?));
+        }
+        Ok(embeddings)
+    }
+
+    /// 优先取空闲的 Session (从 preferred 开始找)，都在忙时等待 preferred
+    fn acquire(&self, preferred: usize) -> Result<MutexGuard<'_, Session>> {
+        let n = self.sessions.len();
+        for k in 0..n {
+            if let Ok(session) = self.sessions[(preferred + k) % n].try_lock() {
+                return Ok(session);
+            }
+        }
+        self.sessions[preferred % n]
+            .lock()
+            .map_err(|_| anyhow::anyhow!("Failed to lock ONNX session"))
+    }
+
+    /// 一次 `[B, L]` 推理，L 为批内最长的 token 序列
+    fn run_batch(session: &mut Session, batch: &[&Encoding]) -> Result<Vec<Vec<f32>>> {
+        let batch_size = batch.len();
+        let seq_len = batch.iter().map(|e| e.get_ids().len()).max().unwrap_or(0);
+
+        // Step A: 构建补齐后的输入 (补齐位置 input_ids = 0 即 [PAD]，attention_mask = 0)
+        let mut input_ids = vec![0i64; batch_size * seq_len];
+        let mut attention_mask = vec![0i64; batch_size * seq_len];
+        let mut token_type_ids = vec![0i64; batch_size * seq_len];
+        for (b, encoding) in batch.iter().enumerate() {
+            let row = b * seq_len;
+            let tokens = encoding.get_ids().iter()
+                .zip(encoding.get_attention_mask())
+                .zip(encoding.get_type_ids());
+            for (t, ((&id, &mask), &type_id)) in tokens.enumerate() {
+                input_ids[row + t] = id as i64;
+                attention_mask[row + t] = mask as i64;
+                token_type_ids[row + t] = type_id as i64;
+            }
+        }
 
         // Step B: 构建输入张量
-        let input_ids_val = Value::from_array((vec![1usize, seq_len], input_ids))?;
-        let attention_mask_val = Value::from_array((vec![1usize, seq_len], attention_mask.clone()))?;
-        let token_type_ids_val = Value::from_array((vec![1usize, seq_len], token_type_ids))?;
+        let shape = vec![batch_size, seq_len];
+        let input_ids_val = Value::from_array((shape.clone(), input_ids))?;
+        let attention_mask_val = Value::from_array((shape.clone(), attention_mask.clone()))?;
+        let token_type_ids_val = Value::from_array((shape, token_type_ids))?;
 
         // Step C: 运行推理
-        let mut session = self.session.lock().map_err(|_| anyhow::anyhow!("Failed to lock ONNX session"))?;
         let outputs = session.run(inputs![
             "input_ids" => input_ids_val,
             "attention_mask" => attention_mask_val,
             "token_type_ids" => token_type_ids_val,
         ])?;
 
-        // Step D: Mean Pooling
-        // ort 2.0 rc.9 try_extract_tensor 返回 (Shape, &[T])
-        let (_, output_data) = outputs[0]
+        // ort 2.0 try_extract_tensor 返回 (Shape, &[T])，数据按 [B, L, 384] 行优先排列
+        let (_, hidden_states) = outputs[0]
             .try_extract_tensor::<f32>()
             .context("Failed to extract output tensor")?;
-        
-        let hidden_states = Array2::from_shape_vec(
-            (seq_len, EMBEDDING_DIM),
-            output_data.to_vec()
-        )?;
-
-        let mask: Array1<f32> = attention_mask.iter().map(|&x| x as f32).collect();
-        let mask_sum = mask.sum();
-
-        let mut pooled = Array1::<f32>::zeros(EMBEDDING_DIM);
-        for (i, &m) in mask.iter().enumerate() {
-            if m > 0.0 {
-                pooled = pooled + &hidden_states.row(i).to_owned();
-            }
-        }
-        pooled = pooled / mask_sum;
+        anyhow::ensure!(
+            hidden_states.len() == batch_size * seq_len * EMBEDDING_DIM,
+            "Unexpected output size {} for batch [{}, {}]", hidden_states.len(), batch_size, seq_len
+        );
 
-        // Step E: L2 归一化
-        let norm: f32 = pooled.iter().map(|x| x * x).sum::<f32>().sqrt();
-        let normalized: Vec<f32> = pooled.iter().map(|x| x / norm).collect();
+        // Step D: Masked mean pooling + L2 归一化
+        // 每句顺序扫描一遍自己的 hidden states，直接累加到输出向量，不为每个 token 分配临时数组。
+        // 均值只是对和向量的缩放，归一化后结果相同，因此省去除以 token 数
+        let pooled = (0..batch_size)
+            .map(|b| {
+                let mut pooled = vec![0.0f32; EMBEDDING_DIM];
+                for t in 0..seq_len {
+                    let pos = b * seq_len + t;
+                    if attention_mask[pos] == 0 {
+                        continue;
+                    }
+                    let token = &hidden_states[pos * EMBEDDING_DIM..(pos + 1) * EMBEDDING_DIM];
+                    for (p, &h) in pooled.iter_mut().zip(token) {
+                        *p += h;
+                    }
+                }
+                let norm = pooled.iter().map(|x| x * x).sum::<f32>().sqrt();
+                if norm > 0.0 {
+                    let inv = 1.0 / norm;
+                    pooled.iter_mut().for_each(|x| *x *= inv);
+                }
+                pooled
+            })
+            .collect();
 
-        Ok(normalized)
+        Ok(pooled)
     }
 
     pub fn dimension(&self) -> usize {
         EMBEDDING_DIM
     }
 }
+
+/// 按 token 数升序排列的下标
+fn length_order(encodings: &[Encoding]) -> Vec<usize> {
+    let mut order: Vec<usize> = (0..encodings.len()).collect();
+    order.sort_by_key(|&i| encodings[i].get_ids().len());
+    order
+}
+
+// ============================================================================
+// 在线请求的编码队列
+// ============================================================================
+
+struct EncodeJob {
+    text: String,
+    reply: oneshot::Sender<Result<Vec<f32>, String>>,
+}
+
+/// 编码队列已满: 推理跟不上请求速度，调用方应快速失败 (如返回 503)
+#[derive(Debug)]
+pub struct QueueFull;
+
+impl fmt::Display for QueueFull {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        write!(f, "Embedding queue is full")
+    }
+}
+
+impl std::error::Error for QueueFull {}
+
+/// 把并发请求的文本合并成批次推理
+///
+/// 每个 Session 一个工作线程，轮流从有界队列中取出当前排队的所有文本 (最多 MAX_BATCH 条)
+/// 一起编码: 空闲时单个请求立即执行，不额外等待；推理进行期间到达的请求在下一批中一起执行。
+/// 推理不在 Tokio 的工作线程上运行，请求只是 await 结果，搜索突发不会拖慢其他接口。
+pub struct EncodeQueue {
+    sender: mpsc::SyncSender<EncodeJob>,
+    /// 已入队、尚未被工作线程取走的任务数
+    queued: Arc<AtomicUsize>,
+    capacity: usize,
+}
+
+impl EncodeQueue {
+    pub fn new(model: Arc<EmbeddingModel>) -> Result<Self> {
+        let capacity = model.config().queue_capacity.max(1);
+        let (sender, receiver) = mpsc::sync_channel::<EncodeJob>(capacity);
+        let receiver = Arc::new(Mutex::new(receiver));
+        let queued = Arc::new(AtomicUsize::new(0));
+        for session in 0..model.sessions() {
+            let model = Arc::clone(&model);
+            let receiver = Arc::clone(&receiver);
+            let queued = Arc::clone(&queued);
+            std::thread::Builder::new()
+                .name(format!("embedding-{}", session))
+                .spawn(move || run_encode_worker(&model, session, &receiver, &queued))
+                .context("Failed to start embedding thread")?;
+        }
+        Ok(Self { sender, queued, capacity })
+    }
+
+    /// 排队等待推理的请求数 (不含正在推理的批次)
+    pub fn depth(&self) -> usize {
+        self.queued.load(Ordering::Relaxed)
+    }
+
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// 队列已满时立即返回 `QueueFull` 错误
+    pub async fn encode(&self, text: String) -> Result<Vec<f32>> {
+        let (reply, result) = oneshot::channel();
+        // 先计数再入队: 工作线程取走任务时减一，计数不会先减后加
+        self.queued.fetch_add(1, Ordering::Relaxed);
+        self.sender
+            .try_send(EncodeJob { text, reply })
+            .map_err(|e| {
+                self.queued.fetch_sub(1, Ordering::Relaxed);
+                match e {
+                    mpsc::TrySendError::Full(_) => anyhow::Error::new(QueueFull),
+                    mpsc::TrySendError::Disconnected(_) => anyhow::anyhow!("Embedding thread stopped"),
+                }
+            })?;
+        result.await
+            .map_err(|_| anyhow::anyhow!("Embedding thread stopped"))?
+            .map_err(|e| anyhow::anyhow!(e))
+    }
+}
+
+fn run_encode_worker(
+    model: &EmbeddingModel,
+    session: usize,
+    receiver: &Mutex<mpsc::Receiver<EncodeJob>>,
+    queued: &AtomicUsize,
+) {
+    loop {
+        // 取任务期间持有接收端: 第一条阻塞等待，其余为当前已排队的。取完即释放，
+        // 推理期间到达的任务由下一个空闲的工作线程取走
+        let jobs = {
+            let Ok(receiver) = receiver.lock() else { return };
+            let Ok(first) = receiver.recv() else { return };
+            let mut jobs = vec![first];
+            while jobs.len() < MAX_BATCH {
+                match receiver.try_recv() {
+                    Ok(job) => jobs.push(job),
+                    Err(_) => break,
+                }
+            }
+            jobs
+        };
+        queued.fetch_sub(jobs.len(), Ordering::Relaxed);
+
+        let texts: Vec<&str> = jobs.iter().map(|job| job.text.as_str()).collect();
+        let results: Vec<Result<Vec<f32>, String>> = match model.encode_on(session, &texts) {
+            Ok(embeddings) => embeddings.into_iter().map(Ok).collect(),
+            // 整批失败时逐条重试，一条异常输入不连累同批的其他请求
+            Err(_) => texts.iter()
+                .map(|&text| {
+                    model.encode_on(session, &[text])
+                        .and_then(|mut e| e.pop().context("Empty embedding batch"))
+                        .map_err(|e| e.to_string())
+                })
+                .collect(),
+        };
+        for (job, result) in jobs.into_iter().zip(results) {
+            let _ = job.reply.send(result);
+        }
+    }
+}
@@ -4,37 +4,260 @@
 //! 所有的 `unsafe` 代码都集中在这里，业务层不应该直接接触 unsafe。
 
 use crate::model::Item;
-use libc::{c_float, c_int};
+use libc::{c_char, c_float, c_int, c_void};
+use std::collections::HashMap;
+use std::ffi::{CStr, CString};
+use std::ptr::NonNull;
+use std::sync::{Arc, RwLock};
 
 // ============================================================================
 // 外部 C 函数声明 (Raw FFI Bindings)
 // ============================================================================
 
+/// C++ 侧 `hnsw_index_t` 的不透明类型，Rust 只持有其指针，从不解引用
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct hnsw_index_t {
+    _private: [u8; 0],
+}
+
+/// C++ 侧 `embedding_store_t` 的不透明类型
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct embedding_store_t {
+    _private: [u8; 0],
+}
+
+// ============================================================================
+
+/// 对应 C 侧的 `hnsw_filter_fn`: 返回非 0 表示允许该 id
+type HnswFilterFn = extern "C" fn(id: c_int, ctx: *mut c_void) -> c_int;
+
+/// 对应 C 侧的 `hnsw_progress_fn`
+type HnswProgressFn = extern "C" fn(done: c_int, total: c_int, ctx: *mut c_void);
+
+/// 对应 C 侧的 `hnsw_attr_filter_t`
+#[repr(C)]
+struct HnswAttrFilter {
+    categories: *const c_int,
+    num_categories: c_int,
+    min_price: c_float,
+    max_price: c_float,
+}
+
+/// 对应 C 侧的 `hnsw_index_stats_t`
+#[repr(C)]
+#[derive(Default)]
+struct HnswIndexStats {
+    count: c_int,
+    deleted: c_int,
+    capacity: c_int,
+    resizes: c_int,
+    resize_total_ms: f64,
+    resize_max_ms: f64,
+    mutations: libc::c_longlong,
+    snapshots: c_int,
+    snapshot_pause_ms: f64,
+    snapshot_write_ms: f64,
+    log_trim_failures: c_int,
+    memory_bytes: libc::c_longlong,
+}
+
+/// 对应 C 侧的 `hnsw_search_metrics_t`
+#[repr(C)]
+#[derive(Default)]
+struct HnswSearchMetrics {
+    hops: libc::c_longlong,
+    distance_computations: libc::c_longlong,
+    lock_waits: libc::c_longlong,
+    lock_wait_ms: f64,
+}
+
+/// 对应 C 侧的 `hnsw_reconcile_stats_t`
+#[repr(C)]
+#[derive(Default)]
+struct HnswReconcileStats {
+    added: c_int,
+    updated: c_int,
+    deleted: c_int,
+    unchanged: c_int,
+    failed: c_int,
+}
+
+// ============================================================================
+
 extern "C" {
     // 基础运算
     fn cpp_add(a: c_int, b: c_int) -> c_int;
     fn dot_product(vec_a: *const c_float, vec_b: *const c_float, len: c_int) -> c_float;
+    fn vector_ops_simd_backend() -> *const c_char;
 
     // HNSW 索引操作
-    fn hnsw_init(dim: c_int, max_elements: c_int, M: c_int, ef_construction: c_int) -> c_int;
+    fn hnsw_init_with_storage(dim: c_int, max_elements: c_int, M: c_int, ef_construction: c_int, storage: c_int) -> c_int;
     fn hnsw_add_item(id: c_int, vector: *const c_float) -> c_int;
     fn hnsw_set_ef(ef: c_int);
     fn hnsw_search_knn(query: *const c_float, k: c_int, out_ids: *mut c_int, out_scores: *mut c_float) -> c_int;
+    fn hnsw_search_knn_ef(query: *const c_float, k: c_int, ef: c_int, out_ids: *mut c_int, out_scores: *mut c_float) -> c_int;
     fn hnsw_destroy();
     fn hnsw_get_count() -> c_int;
     fn hnsw_save_index(path: *const libc::c_char) -> c_int;
     fn hnsw_load_index(path: *const libc::c_char, dim: c_int, max_elements: c_int) -> c_int;
 
-    // 旧版暴力搜索
-    fn search_top_k(
-        query_vec: *const c_float,
-        item_matrix: *const c_float,
-        item_ids: *const c_int,
-        rows: c_int,
-        cols: c_int,
+    // 句柄式 HNSW 索引
+    fn hnsw_index_new_with_storage(
+        dim: c_int,
+        max_elements: c_int,
+        M: c_int,
+        ef_construction: c_int,
+        storage: c_int,
+    ) -> *mut hnsw_index_t;
+    fn hnsw_index_new_pq(
+        dim: c_int,
+        max_elements: c_int,
+        M: c_int,
+        ef_construction: c_int,
+        pq_m: c_int,
+        train: *const c_float,
+        num_train: c_int,
+    ) -> *mut hnsw_index_t;
+    fn hnsw_index_load_with_storage(
+        path: *const c_char,
+        dim: c_int,
+        max_elements: c_int,
+        storage: c_int,
+        out_index: *mut *mut hnsw_index_t,
+    ) -> c_int;
+    fn hnsw_index_free(index: *mut hnsw_index_t);
+    fn hnsw_index_add_item(index: *mut hnsw_index_t, id: c_int, vector: *const c_float) -> c_int;
+    fn hnsw_index_mark_deleted(index: *mut hnsw_index_t, id: c_int) -> c_int;
+    fn hnsw_index_add_items_batch(
+        index: *mut hnsw_index_t,
+        ids: *const c_int,
+        vectors: *const c_float,
+        n: c_int,
+        progress: Option<HnswProgressFn>,
+        ctx: *mut c_void,
+    ) -> c_int;
+    fn hnsw_index_set_ef(index: *mut hnsw_index_t, ef: c_int);
+    fn hnsw_index_search_knn_ef(
+        index: *const hnsw_index_t,
+        query: *const c_float,
+        k: c_int,
+        ef: c_int,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_search_knn_filtered(
+        index: *const hnsw_index_t,
+        query: *const c_float,
+        k: c_int,
+        ef: c_int,
+        filter: Option<HnswFilterFn>,
+        ctx: *mut c_void,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_search_knn_multi(
+        index: *const hnsw_index_t,
+        queries: *const c_float,
+        n_queries: c_int,
+        k: c_int,
+        ef: c_int,
+        filter: Option<HnswFilterFn>,
+        ctx: *mut c_void,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_set_attributes(index: *mut hnsw_index_t, id: c_int, category: c_int, price: c_float) -> c_int;
+    fn hnsw_index_search_knn_attr(
+        index: *const hnsw_index_t,
+        query: *const c_float,
+        k: c_int,
+        ef: c_int,
+        filter: *const HnswAttrFilter,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_search_knn_batch(
+        index: *const hnsw_index_t,
+        queries: *const c_float,
+        n: c_int,
+        k: c_int,
+        ef: c_int,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+        out_counts: *mut c_int,
+    ) -> c_int;
+    fn hnsw_index_search_knn_sharded(
+        shards: *const *const hnsw_index_t,
+        n_shards: c_int,
+        query: *const c_float,
+        k: c_int,
+        ef: c_int,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_add_items_from_store(
+        index: *mut hnsw_index_t,
+        store: *const embedding_store_t,
+        progress: Option<HnswProgressFn>,
+        ctx: *mut c_void,
+    ) -> c_int;
+    fn hnsw_index_reconcile_with_store(
+        index: *mut hnsw_index_t,
+        store: *const embedding_store_t,
+        progress: Option<HnswProgressFn>,
+        ctx: *mut c_void,
+        out_stats: *mut HnswReconcileStats,
+    ) -> c_int;
+    fn hnsw_index_search_knn_rescore(
+        index: *const hnsw_index_t,
+        store: *const embedding_store_t,
+        query: *const c_float,
+        k: c_int,
+        ef: c_int,
+        num_candidates: c_int,
+        out_ids: *mut c_int,
+        out_scores: *mut c_float,
+    ) -> c_int;
+    fn hnsw_index_get_count(index: *const hnsw_index_t) -> c_int;
+    fn hnsw_index_get_stats(index: *const hnsw_index_t, out_stats: *mut HnswIndexStats) -> c_int;
+    fn hnsw_thread_search_metrics(out_metrics: *mut HnswSearchMetrics);
+    fn hnsw_index_save(index: *mut hnsw_index_t, path: *const c_char) -> c_int;
+    fn hnsw_index_save_mmap(index: *mut hnsw_index_t, path: *const c_char) -> c_int;
+    fn hnsw_index_open_log(index: *mut hnsw_index_t, path: *const c_char) -> c_int;
+    fn hnsw_index_load_mmap(
+        path: *const c_char,
+        dim: c_int,
+        max_elements: c_int,
+        storage: c_int,
+        out_index: *mut *mut hnsw_index_t,
+    ) -> c_int;
+
+    // 物品向量存储
+    fn embedding_store_new(dim: c_int, capacity: c_int) -> *mut embedding_store_t;
+    fn embedding_store_free(store: *mut embedding_store_t);
+    fn embedding_store_put(store: *mut embedding_store_t, id: c_int, vector: *const c_float) -> c_int;
+    fn embedding_store_remove(store: *mut embedding_store_t, id: c_int) -> c_int;
+    fn embedding_store_count(store: *const embedding_store_t) -> c_int;
+    fn embedding_store_id_at(store: *const embedding_store_t, row: c_int) -> c_int;
+    fn embedding_store_row_at(store: *const embedding_store_t, row: c_int) -> *const c_float;
+    fn embedding_store_find(store: *const embedding_store_t, id: c_int) -> *const c_float;
+    fn embedding_store_search_top_k_batch(
+        store: *const embedding_store_t,
+        queries: *const c_float,
+        num_queries: c_int,
         k: c_int,
         out_ids: *mut c_int,
         out_scores: *mut c_float,
+        out_counts: *mut c_int,
+    ) -> c_int;
+    fn embedding_store_score(
+        store: *const embedding_store_t,
+        query: *const c_float,
+        ids: *const c_int,
+        n: c_int,
+        out_scores: *mut c_float,
     ) -> c_int;
 }
 
@@ -57,10 +280,94 @@ pub fn compute_dot_product(vec_a: &[f32], vec_b: &[f32]) -> Option<f32> {
     Some(result)
 }
 
+/// C++ 侧在当前 CPU 上选用的 SIMD 内核名称 ("avx512" / "avx2" / "neon" / "scalar")
+pub fn simd_backend() -> &'static str {
+    // SAFETY: 返回指向 C++ 静态字符串常量的指针，进程生命周期内有效且以 NUL 结尾
+    unsafe { CStr::from_ptr(vector_ops_simd_backend()) }
+        .to_str()
+        .unwrap_or("unknown")
+}
+
+/// 当前线程累计的搜索开销 (C++ 侧的线程本地计数，所有索引合计)，见 `thread_search_metrics`
+#[derive(Debug, Clone, Copy, PartialEq, Default)]
+pub struct SearchMetrics {
+    /// 图遍历访问的节点数
+    pub hops: u64,
+    /// 遍历中计算距离的邻居数
+    pub distance_computations: u64,
+    /// 搜索读锁未能立即获得的次数 (写者在扩容 / 保存)
+    pub lock_waits: u64,
+    /// 在搜索读锁上等待的累计时间 (毫秒)
+    pub lock_wait_ms: f64,
+}
+
+impl SearchMetrics {
+    /// 与同一线程上较早读取的值之差，即两次读取之间的搜索开销
+    pub fn since(&self, earlier: &SearchMetrics) -> SearchMetrics {
+        SearchMetrics {
+            hops: self.hops - earlier.hops,
+            distance_computations: self.distance_computations - earlier.distance_computations,
+            lock_waits: self.lock_waits - earlier.lock_waits,
+            lock_wait_ms: self.lock_wait_ms - earlier.lock_wait_ms,
+        }
+    }
+}
+
+/// 读取当前线程的搜索计数。在一次搜索前后各读一次 (同一线程、中间没有 await)，
+/// 差值即该次搜索的开销；`search_batch*` 的查询在 C++ 线程池上执行，不计入调用线程
+pub fn thread_search_metrics() -> SearchMetrics {
+    let mut raw = HnswSearchMetrics::default();
+    // SAFETY: raw 是 #[repr(C)] 的局部变量，与 C 侧布局一致；函数只写入当前线程的计数
+    unsafe { hnsw_thread_search_metrics(&mut raw) };
+    SearchMetrics {
+        hops: raw.hops as u64,
+        distance_computations: raw.distance_computations as u64,
+        lock_waits: raw.lock_waits as u64,
+        lock_wait_ms: raw.lock_wait_ms,
+    }
+}
+
 // ============================================================================
 // HNSW 索引 Safe Wrapper
 // ============================================================================
 
+/// 属性过滤条件: 类别 in categories 且 min_price <= price < max_price
+///
+/// 各字段为 `None` 表示不限制该属性。
+#[derive(Debug, Clone, Default)]
+pub struct AttributeFilter {
+    /// 允许的类别编号
+    pub categories: Option<Vec<u32>>,
+    /// 价格下界 (含)
+    pub min_price: Option<f32>,
+    /// 价格上界 (不含)
+    pub max_price: Option<f32>,
+}
+
+/// 索引内部的向量存储格式 (对应 C 侧的 `HNSW_STORAGE_*`)
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub enum VectorStorage {
+    /// 原始 float32 向量
+    #[default]
+    Float32,
+    /// int8 标量量化: 向量内存约为 float32 的 1/4，内积为近似值，
+    /// 可通过 `HnswIndex::search_rescored` 用原始向量精确重排序
+    Int8,
+    /// 乘积量化: 每个物品 `subspaces + 1` 字节 (推荐 32-64 个子空间，dim 必须是其整数倍)。
+    /// 码本需要用样本训练，只能通过 `HnswIndex::train_pq` 创建，保存时写出 `<path>.pq`
+    Pq { subspaces: usize },
+}
+
+impl VectorStorage {
+    fn as_raw(self) -> c_int {
+        match self {
+            VectorStorage::Float32 => 0,
+            VectorStorage::Int8 => 1,
+            VectorStorage::Pq { .. } => 2,
+        }
+    }
+}
+
 /// HNSW 索引配置
 pub struct HnswConfig {
     /// 向量维度
@@ -76,6 +383,11 @@ pub struct HnswConfig {
     /// 查询时的搜索深度 (影响召回率)
     /// 推荐值: 50-100, 必须 >= k
     pub ef_search: usize,
+    /// 向量存储格式
+    pub storage: VectorStorage,
+    /// 分片数 (只对 `ShardedIndex` 有效，`HnswIndex` 忽略此项)。
+    /// 物品按 `id % shards` 分到各分片，每个分片是一张独立的图，`max_elements` 在分片间均分
+    pub shards: usize,
 }
 
 impl Default for HnswConfig {
@@ -86,6 +398,8 @@ impl Default for HnswConfig {
             m: 16,
             ef_construction: 200,
             ef_search: 50,
+            storage: VectorStorage::Float32,
+            shards: 1,
         }
     }
 }
@@ -101,11 +415,12 @@ impl Default for HnswConfig {
 pub fn init_hnsw_index(config: &HnswConfig) -> Result<(), String> {
     // SAFETY: 所有参数都是基本类型，无指针操作
     let result = unsafe {
-        hnsw_init(
+        hnsw_init_with_storage(
             config.dim as c_int,
             config.max_elements as c_int,
             config.m as c_int,
             config.ef_construction as c_int,
+            config.storage.as_raw(),
         )
     };
 
@@ -175,6 +490,37 @@ pub fn hnsw_search(query: &[f32], k: usize) -> Vec<(u64, f32)> {
         .collect()
 }
 
+/// 使用指定的 ef 搜索最近邻 (不修改全局索引的默认 ef，不影响其他并发查询)
+pub fn hnsw_search_with_ef(query: &[f32], k: usize, ef: usize) -> Vec<(u64, f32)> {
+    if k == 0 {
+        return Vec::new();
+    }
+
+    let mut out_ids: Vec<c_int> = vec![0; k];
+    let mut out_scores: Vec<f32> = vec![0.0; k];
+
+    // SAFETY:
+    // 1. query 是有效切片，在调用期间有效
+    // 2. out_ids/out_scores 已预分配足够空间
+    let count = unsafe {
+        hnsw_search_knn_ef(
+            query.as_ptr(),
+            k as c_int,
+            ef as c_int,
+            out_ids.as_mut_ptr(),
+            out_scores.as_mut_ptr(),
+        )
+    };
+
+    if count < 0 {
+        return Vec::new();
+    }
+
+    (0..count as usize)
+        .map(|i| (out_ids[i] as u64, out_scores[i]))
+        .collect()
+}
+
 /// 销毁 HNSW 索引并释放内存
 pub fn destroy_hnsw_index() {
     // SAFETY: 无需传递参数，仅释放全局索引
@@ -189,7 +535,6 @@ pub fn get_hnsw_count() -> usize {
 
 /// 保存索引到文件
 pub fn save_hnsw_index(path: &str) -> Result<(), String> {
-    use std::ffi::CString;
     let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
     
     // SAFETY: c_path 是有效的以 null 结尾的 C 字符串
@@ -205,7 +550,6 @@ pub fn save_hnsw_index(path: &str) -> Result<(), String> {
 /// 加载索引 (若文件不存在则创建新索引)
 /// 返回: Ok(true) = 已加载, Ok(false) = 创建了新索引, Err = 失败
 pub fn load_hnsw_index(path: &str, dim: usize, max_elements: usize, ef_search: usize) -> Result<bool, String> {
-    use std::ffi::CString;
     let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
     
     // SAFETY: c_path 是有效的以 null 结尾的 C 字符串
@@ -229,113 +573,2194 @@ pub fn load_hnsw_index(path: &str, dim: usize, max_elements: usize, ef_search: u
 }
 
 // ============================================================================
-// 旧版暴力搜索 (Legacy)
+// 句柄式 HNSW 索引 Safe Wrapper
 // ============================================================================
 
-/// 召回阶段：从物品库中找出与用户最相似的 Top K 物品 (暴力搜索)
-pub fn recommend_recall(user_embedding: &[f32], items: &[Item], k: usize) -> Vec<(u64, f32)> {
-    if items.is_empty() || k == 0 {
-        return Vec::new();
+/// 索引的占用与自动扩容统计，见 `HnswIndex::stats`
+#[derive(Debug, Clone, Copy, PartialEq, Default)]
+pub struct IndexStats {
+    /// 可搜索的元素数
+    pub count: usize,
+    /// 已删除、等待新元素复用的槽位数
+    pub deleted: usize,
+    /// 已分配的槽位数 (写满后按几何级数自动扩容)
+    pub capacity: usize,
+    /// 自动扩容次数
+    pub resizes: usize,
+    /// 扩容累计耗时 (毫秒)，期间搜索与插入被阻塞
+    pub resize_total_ms: f64,
+    /// 单次扩容的最长耗时 (毫秒)
+    pub resize_max_ms: f64,
+    /// 成功的插入 / 更新 / 删除总数 (单调递增，用于按写入量触发快照)
+    pub mutations: u64,
+    /// `save_mmap` 成功次数
+    pub snapshots: usize,
+    /// 最近一次快照暂停写者的时间 (毫秒)，搜索不暂停
+    pub snapshot_pause_ms: f64,
+    /// 最近一次快照写文件 + fsync 的时间 (毫秒)，期间不持有索引的锁
+    pub snapshot_write_ms: f64,
+    /// 快照已落盘但截断预写日志失败的次数 (快照本身仍然有效，下一次快照重试截断)
+    pub log_trim_failures: usize,
+    /// 图与向量占用的内存 (字节)，含 level-0 中尚未使用的槽位
+    pub memory_bytes: usize,
+}
+
+impl IndexStats {
+    /// 槽位占用率 (含已删除的槽位)
+    pub fn occupancy(&self) -> f64 {
+        if self.capacity == 0 {
+            0.0
+        } else {
+            (self.count + self.deleted) as f64 / self.capacity as f64
+        }
     }
+}
 
-    let rows = items.len();
-    let cols = user_embedding.len();
+/// `HnswIndex::reconcile_with_store` 的统计结果
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub struct ReconcileStats {
+    /// 新插入的元素 (索引中缺失)
+    pub added: usize,
+    /// 向量变化、原地更新的元素
+    pub updated: usize,
+    /// 存储中已不存在、标记删除的元素
+    pub deleted: usize,
+    /// 两边一致的元素
+    pub unchanged: usize,
+    /// 插入或更新失败的元素 (如超出容量)
+    pub failed: usize,
+}
 
-    let flat_matrix: Vec<f32> = items
-        .iter()
-        .flat_map(|item| item.embedding.iter().copied())
-        .collect();
+/// 拥有一个 C++ `hnsw_index_t` 句柄的安全封装
+///
+/// 与全局接口不同，搜索和插入在 C++ 侧只持有读锁，
+/// 因此可以把 `HnswIndex` 放进 `Arc` 中，在多个 Axum worker 线程间并发搜索。
+pub struct HnswIndex {
+    raw: NonNull<hnsw_index_t>,
+    dim: usize,
+    storage: VectorStorage,
+}
 
-    let item_ids: Vec<c_int> = items.iter().map(|item| item.id as c_int).collect();
+// SAFETY: hnsw_index_t 内部通过 std::shared_mutex + hnswlib 的细粒度锁保证线程安全，
+// 所有 C 接口都可以从任意线程并发调用；Rust 侧不持有任何非线程安全的状态。
+unsafe impl Send for HnswIndex {}
+unsafe impl Sync for HnswIndex {}
 
-    let actual_k = k.min(rows);
-    let mut out_ids: Vec<c_int> = vec![0; actual_k];
-    let mut out_scores: Vec<f32> = vec![0.0; actual_k];
+impl HnswIndex {
+    /// 创建新的空索引
+    ///
+    /// PQ 索引需要训练数据，请改用 `train_pq`。
+    pub fn new(config: &HnswConfig) -> Result<Self, String> {
+        if let VectorStorage::Pq { .. } = config.storage {
+            return Err("PQ index requires training data, use HnswIndex::train_pq".to_string());
+        }
+        // SAFETY: 所有参数都是基本类型，无指针操作
+        let raw = unsafe {
+            hnsw_index_new_with_storage(
+                config.dim as c_int,
+                config.max_elements as c_int,
+                config.m as c_int,
+                config.ef_construction as c_int,
+                config.storage.as_raw(),
+            )
+        };
+        let raw = NonNull::new(raw).ok_or_else(|| "Failed to initialize HNSW index".to_string())?;
+        let index = Self { raw, dim: config.dim, storage: config.storage };
+        index.set_ef(config.ef_search);
+        Ok(index)
+    }
 
-    // SAFETY: 所有指针和长度参数都经过验证
-    let count = unsafe {
-        search_top_k(
-            user_embedding.as_ptr(),
-            flat_matrix.as_ptr(),
-            item_ids.as_ptr(),
-            rows as c_int,
-            cols as c_int,
-            actual_k as c_int,
-            out_ids.as_mut_ptr(),
-            out_scores.as_mut_ptr(),
-        )
-    };
+    /// 用样本 (行优先展开的 `n x dim` 矩阵，n >= 256) 训练 PQ 码本，并创建空的 PQ 索引
+    ///
+    /// `config.storage` 必须是 `VectorStorage::Pq`。样本通常取物品向量的随机子集，
+    /// 超过 8192 个时 C++ 侧会再随机抽样。
+    pub fn train_pq(config: &HnswConfig, samples: &[f32]) -> Result<Self, String> {
+        let subspaces = match config.storage {
+            VectorStorage::Pq { subspaces } => subspaces,
+            _ => return Err("train_pq requires VectorStorage::Pq".to_string()),
+        };
+        if config.dim == 0 || samples.len() % config.dim != 0 {
+            return Err(format!("PQ samples length {} is not a multiple of dim {}", samples.len(), config.dim));
+        }
 
-    (0..count as usize)
-        .map(|i| (out_ids[i] as u64, out_scores[i]))
-        .collect()
-}
+        // SAFETY: samples 是有效切片，长度为 (samples.len() / dim) * dim，C++ 只在调用期间读取
+        let raw = unsafe {
+            hnsw_index_new_pq(
+                config.dim as c_int,
+                config.max_elements as c_int,
+                config.m as c_int,
+                config.ef_construction as c_int,
+                subspaces as c_int,
+                samples.as_ptr(),
+                (samples.len() / config.dim) as c_int,
+            )
+        };
+        let raw = NonNull::new(raw).ok_or_else(|| "Failed to train PQ index".to_string())?;
+        let index = Self { raw, dim: config.dim, storage: config.storage };
+        index.set_ef(config.ef_search);
+        Ok(index)
+    }
 
-// ============================================================================
-// 单元测试
-// ============================================================================
+    /// 加载索引 (若文件不存在则创建新索引)
+    /// 返回: (索引, true = 已加载 / false = 创建了新索引)
+    ///
+    /// 文件中的向量格式与 `storage` 不一致时返回 Err，调用方应重建索引。
+    /// PQ 索引同时读取 `<path>.pq` 码本，文件不存在时返回 Err (需要调用方用 `train_pq` 新建)。
+    pub fn load(
+        path: &str,
+        dim: usize,
+        max_elements: usize,
+        ef_search: usize,
+        storage: VectorStorage,
+    ) -> Result<(Self, bool), String> {
+        Self::load_via(hnsw_index_load_with_storage, path, dim, max_elements, ef_search, storage)
+    }
 
-#[cfg(test)]
-mod tests {
-    use super::*;
+    /// 映射由 `save_mmap` 写出的索引文件 (若文件不存在则创建新索引)
+    ///
+    /// 图数据直接使用映射内存，不解析也不拷贝，启动耗时与索引大小基本无关；
+    /// 同一主机上的多个进程共享 page cache。`max_elements` 超出文件元素数的部分预留给后续插入。
+    /// 文件不是 mmap 格式时返回 Err，其余同 `load`。
+    pub fn load_mmap(
+        path: &str,
+        dim: usize,
+        max_elements: usize,
+        ef_search: usize,
+        storage: VectorStorage,
+    ) -> Result<(Self, bool), String> {
+        Self::load_via(hnsw_index_load_mmap, path, dim, max_elements, ef_search, storage)
+    }
 
-    #[test]
-    fn test_cpp_add() {
-        assert_eq!(add(2, 3), 5);
-        assert_eq!(add(-1, 1), 0);
+    fn load_via(
+        loader: unsafe extern "C" fn(*const c_char, c_int, c_int, c_int, *mut *mut hnsw_index_t) -> c_int,
+        path: &str,
+        dim: usize,
+        max_elements: usize,
+        ef_search: usize,
+        storage: VectorStorage,
+    ) -> Result<(Self, bool), String> {
+        let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
+        let mut raw: *mut hnsw_index_t = std::ptr::null_mut();
+
+        // SAFETY: c_path 是有效的以 null 结尾的 C 字符串，raw 是有效的输出指针
+        let result = unsafe {
+            loader(
+                c_path.as_ptr(),
+                dim as c_int,
+                max_elements as c_int,
+                storage.as_raw(),
+                &mut raw,
+            )
+        };
+
+        let loaded = match result {
+            0 => true,
+            1 => false,
+            _ => return Err("Failed to load HNSW index".to_string()),
+        };
+        let raw = NonNull::new(raw).ok_or_else(|| "Failed to load HNSW index".to_string())?;
+        let index = Self { raw, dim, storage };
+        index.set_ef(ef_search);
+        Ok((index, loaded))
     }
 
-    #[test]
-    fn test_dot_product() {
-        let a = vec![1.0, 2.0, 3.0];
-        let b = vec![4.0, 5.0, 6.0];
-        let result = compute_dot_product(&a, &b);
-        assert!(result.is_some());
-        assert!((result.unwrap() - 32.0).abs() < 1e-6);
+    /// 向量维度
+    pub fn dim(&self) -> usize {
+        self.dim
     }
 
-    #[test]
-    fn test_hnsw_lifecycle() {
-        // 初始化
-        let config = HnswConfig {
-            dim: 3,
-            max_elements: 100,
-            m: 16,
-            ef_construction: 100,
-            ef_search: 50,
+    /// 索引内部的向量存储格式
+    pub fn storage(&self) -> VectorStorage {
+        self.storage
+    }
+
+    /// 设置查询时的默认搜索深度 (原子更新，不会阻塞正在进行的搜索)
+    pub fn set_ef(&self, ef: usize) {
+        // SAFETY: raw 在 self 生命周期内有效
+        unsafe { hnsw_index_set_ef(self.raw.as_ptr(), ef as c_int) };
+    }
+
+    /// 向索引添加或更新单个物品 (可与搜索并发)
+    ///
+    /// 新物品优先复用已删除物品的槽位；已删除的 id 再次添加时恢复。
+    pub fn add_item(&self, id: u64, embedding: &[f32]) -> Result<(), String> {
+        if embedding.len() != self.dim {
+            return Err(format!("Item {} has dimension {}, expected {}", id, embedding.len(), self.dim));
+        }
+        // SAFETY: raw 有效；embedding 长度已检查为 dim，在调用期间不会被释放
+        let result = unsafe { hnsw_index_add_item(self.raw.as_ptr(), id as c_int, embedding.as_ptr()) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err(format!("Failed to add item {} to HNSW index", id))
+        }
+    }
+
+    /// 从索引中删除一个物品 (标记删除，之后的搜索不再返回它)
+    pub fn remove(&self, id: u64) -> Result<(), String> {
+        // SAFETY: raw 在 self 生命周期内有效，参数均为值传递
+        let result = unsafe { hnsw_index_mark_deleted(self.raw.as_ptr(), id as c_int) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err(format!("Item {} is not in the HNSW index", id))
+        }
+    }
+
+    /// 在 C++ 线程池上并行批量插入 (用于重建索引)，返回成功插入的数量
+    ///
+    /// `vectors` 是行优先展开的 `ids.len() x dim` 矩阵。
+    /// `progress(done, total)` 每完成约 1% 在当前线程上调用一次。
+    pub fn add_items_batch<P>(&self, ids: &[u64], vectors: &[f32], mut progress: P) -> Result<usize, String>
+    where
+        P: FnMut(usize, usize),
+    {
+        if vectors.len() != ids.len() * self.dim {
+            return Err(format!("Expected {} floats for {} items, got {}", ids.len() * self.dim, ids.len(), vectors.len()));
+        }
+        let c_ids: Vec<c_int> = ids.iter().map(|&id| id as c_int).collect();
+
+        // SAFETY:
+        // 1. raw 有效；c_ids 与 vectors 的长度已检查，调用期间不会被释放
+        // 2. progress_trampoline::<P> 与 ctx 的实际类型 P 一致，只在当前线程上被同步调用
+        let result = unsafe {
+            hnsw_index_add_items_batch(
+                self.raw.as_ptr(),
+                c_ids.as_ptr(),
+                vectors.as_ptr(),
+                c_ids.len() as c_int,
+                Some(progress_trampoline::<P>),
+                &mut progress as *mut P as *mut c_void,
+            )
         };
-        assert!(init_hnsw_index(&config).is_ok());
 
-        // 添加向量
-        assert!(add_item_to_hnsw(1, &[1.0, 0.0, 0.0]).is_ok());
-        assert!(add_item_to_hnsw(2, &[0.0, 1.0, 0.0]).is_ok());
-        assert!(add_item_to_hnsw(3, &[0.5, 0.5, 0.0]).is_ok());
+        if result < 0 {
+            Err("Failed to add items to HNSW index".to_string())
+        } else {
+            Ok(result as usize)
+        }
+    }
 
-        assert_eq!(get_hnsw_count(), 3);
+    /// 把 `store` 中的全部向量并行插入索引 (直接读取 C++ 侧的矩阵，不拷贝)，其余同 `add_items_batch`
+    pub fn add_from_store<P>(&self, store: &EmbeddingStore, mut progress: P) -> Result<usize, String>
+    where
+        P: FnMut(usize, usize),
+    {
+        if store.dim() != self.dim {
+            return Err(format!("Store has dimension {}, expected {}", store.dim(), self.dim));
+        }
 
-        // 搜索
-        let results = hnsw_search(&[1.0, 0.0, 0.0], 2);
-        assert_eq!(results.len(), 2);
-        // 第一个结果应该是 ID=1 (完全匹配)
-        assert_eq!(results[0].0, 1);
+        // SAFETY:
+        // 1. raw 与 store.raw 有效，`&EmbeddingStore` 保证调用期间没有写入
+        // 2. progress_trampoline::<P> 与 ctx 的实际类型 P 一致，只在当前线程上被同步调用
+        let result = unsafe {
+            hnsw_index_add_items_from_store(
+                self.raw.as_ptr(),
+                store.raw.as_ptr(),
+                Some(progress_trampoline::<P>),
+                &mut progress as *mut P as *mut c_void,
+            )
+        };
 
-        // 销毁
-        destroy_hnsw_index();
-        assert_eq!(get_hnsw_count(), 0);
+        if result < 0 {
+            Err("Failed to add items to HNSW index".to_string())
+        } else {
+            Ok(result as usize)
+        }
     }
 
-    #[test]
-    fn test_recommend_recall() {
-        let user_emb = vec![1.0, 0.0, 0.0];
-        let items = vec![
-            Item::new(1, "A", vec![1.0, 0.0, 0.0]),
-            Item::new(2, "B", vec![0.0, 1.0, 0.0]),
-            Item::new(3, "C", vec![0.5, 0.5, 0.0]),
-        ];
+    /// 只按差异让索引与 `store` 一致: 插入缺失的元素、标记删除多余的元素、更新向量变化的元素
+    ///
+    /// 对账期间 C++ 侧持有写锁，只适合在启动时调用。`progress` 只覆盖插入 / 更新阶段。
+    pub fn reconcile_with_store<P>(&self, store: &EmbeddingStore, mut progress: P) -> Result<ReconcileStats, String>
+    where
+        P: FnMut(usize, usize),
+    {
+        if store.dim() != self.dim {
+            return Err(format!("Store has dimension {}, expected {}", store.dim(), self.dim));
+        }
 
-        let results = recommend_recall(&user_emb, &items, 2);
-        assert_eq!(results.len(), 2);
-        assert_eq!(results[0].0, 1);
-        assert!((results[0].1 - 1.0).abs() < 1e-6);
+        let mut raw_stats = HnswReconcileStats::default();
+        // SAFETY:
+        // 1. raw 与 store.raw 有效，`&EmbeddingStore` 保证调用期间没有写入
+        // 2. progress_trampoline::<P> 与 ctx 的实际类型 P 一致，只在当前线程上被同步调用
+        // 3. raw_stats 是 #[repr(C)] 的局部变量，与 C 侧布局一致
+        let result = unsafe {
+            hnsw_index_reconcile_with_store(
+                self.raw.as_ptr(),
+                store.raw.as_ptr(),
+                Some(progress_trampoline::<P>),
+                &mut progress as *mut P as *mut c_void,
+                &mut raw_stats,
+            )
+        };
+
+        if result != 0 {
+            return Err("Failed to reconcile HNSW index with embedding store".to_string());
+        }
+        Ok(ReconcileStats {
+            added: raw_stats.added as usize,
+            updated: raw_stats.updated as usize,
+            deleted: raw_stats.deleted as usize,
+            unchanged: raw_stats.unchanged as usize,
+            failed: raw_stats.failed as usize,
+        })
+    }
+
+    /// 搜索最近邻，返回 (item_id, similarity_score)，按相似度降序排列
+    pub fn search(&self, query: &[f32], k: usize) -> Vec<(u64, f32)> {
+        self.search_with_ef(query, k, 0)
+    }
+
+    /// 使用指定的 ef 搜索最近邻 (`ef = 0` 表示使用默认 ef)
+    ///
+    /// ef 只作用于本次查询，不同接口可以各自选择召回率与延迟的平衡点。
+    pub fn search_with_ef(&self, query: &[f32], k: usize, ef: usize) -> Vec<(u64, f32)> {
+        if k == 0 || query.len() != self.dim {
+            return Vec::new();
+        }
+
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 有效；query 长度已检查为 dim
+        // 2. out_ids/out_scores 已预分配 k 个元素
+        let count = unsafe {
+            hnsw_index_search_knn_ef(
+                self.raw.as_ptr(),
+                query.as_ptr(),
+                k as c_int,
+                ef as c_int,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 带过滤条件的最近邻搜索 (`ef = 0` 表示使用默认 ef)
+    ///
+    /// `allow(id)` 返回 false 的物品不会出现在结果中。过滤发生在 C++ 图遍历内部，
+    /// 因此只要满足条件的物品足够多，总能一次返回 k 个结果。
+    /// `allow` 只会在当前线程上被同步调用。
+    pub fn search_filtered<F>(&self, query: &[f32], k: usize, ef: usize, mut allow: F) -> Vec<(u64, f32)>
+    where
+        F: FnMut(u64) -> bool,
+    {
+        if k == 0 || query.len() != self.dim {
+            return Vec::new();
+        }
+
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 有效；query 长度已检查为 dim；输出缓冲区预分配 k 个元素
+        // 2. ctx 指向栈上的 allow，C++ 只在本次调用期间同步回调，调用返回后不再使用
+        // 3. filter_trampoline::<F> 与 ctx 的实际类型 F 一致
+        let count = unsafe {
+            hnsw_index_search_knn_filtered(
+                self.raw.as_ptr(),
+                query.as_ptr(),
+                k as c_int,
+                ef as c_int,
+                Some(filter_trampoline::<F>),
+                &mut allow as *mut F as *mut c_void,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 多兴趣召回: `queries` 是行优先展开的 `n x dim` 矩阵 (每行一个兴趣向量)，
+    /// 一次调用返回按物品去重的 Top-K (item_id, 最大内积)，按分数降序
+    ///
+    /// 过滤语义与 `search_filtered` 相同，每个候选 id 最多询问 `allow` 一次。
+    pub fn search_multi<F>(&self, queries: &[f32], k: usize, ef: usize, mut allow: F) -> Vec<(u64, f32)>
+    where
+        F: FnMut(u64) -> bool,
+    {
+        if k == 0 || self.dim == 0 || queries.is_empty() || queries.len() % self.dim != 0 {
+            return Vec::new();
+        }
+        let n = queries.len() / self.dim;
+
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 有效；queries 长度恰为 n * dim；输出缓冲区预分配 k 个元素
+        // 2. ctx 指向栈上的 allow，C++ 只在本次调用期间同步回调，调用返回后不再使用
+        // 3. filter_trampoline::<F> 与 ctx 的实际类型 F 一致
+        let count = unsafe {
+            hnsw_index_search_knn_multi(
+                self.raw.as_ptr(),
+                queries.as_ptr(),
+                n as c_int,
+                k as c_int,
+                ef as c_int,
+                Some(filter_trampoline::<F>),
+                &mut allow as *mut F as *mut c_void,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 设置物品的过滤属性 (类别编号与价格)，供 `search_with_attributes` 使用
+    pub fn set_attributes(&self, id: u64, category: u32, price: f32) -> Result<(), String> {
+        // SAFETY: raw 在 self 生命周期内有效，其余参数均为值传递
+        let result = unsafe { hnsw_index_set_attributes(self.raw.as_ptr(), id as c_int, category as c_int, price) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err(format!("Failed to set attributes for item {}", id))
+        }
+    }
+
+    /// 带属性过滤的最近邻搜索 (类别 / 价格区间)
+    ///
+    /// 过滤在 C++ 侧完成: 条件宽松时在图遍历中逐个判定，条件严格时直接精确枚举候选，
+    /// 不会出现先取 Top-K 再过滤导致结果不足的问题。
+    pub fn search_with_attributes(
+        &self,
+        query: &[f32],
+        k: usize,
+        ef: usize,
+        filter: &AttributeFilter,
+    ) -> Vec<(u64, f32)> {
+        if k == 0 || query.len() != self.dim {
+            return Vec::new();
+        }
+
+        let categories: Vec<c_int> = match &filter.categories {
+            // 显式给出空的类别列表: 没有物品能满足
+            Some(list) if list.is_empty() => return Vec::new(),
+            Some(list) => list.iter().map(|&c| c as c_int).collect(),
+            None => Vec::new(),
+        };
+        let raw_filter = HnswAttrFilter {
+            categories: categories.as_ptr(),
+            num_categories: categories.len() as c_int,
+            min_price: filter.min_price.unwrap_or(f32::NEG_INFINITY),
+            max_price: filter.max_price.unwrap_or(f32::INFINITY),
+        };
+
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 有效；query 长度已检查为 dim；输出缓冲区预分配 k 个元素
+        // 2. raw_filter 及其引用的 categories 在调用期间存活，C++ 不保留指针
+        let count = unsafe {
+            hnsw_index_search_knn_attr(
+                self.raw.as_ptr(),
+                query.as_ptr(),
+                k as c_int,
+                ef as c_int,
+                &raw_filter,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 先取 `num_candidates` 个候选，再用 `store` 中的原始向量精确重排序，返回前 k 个
+    ///
+    /// 主要配合量化存储 (`Int8` / `Pq`) 使用: 返回的分数是精确内积而不是量化近似值。
+    /// `num_candidates` 小于 k 时按 k 处理。
+    pub fn search_rescored(
+        &self,
+        query: &[f32],
+        k: usize,
+        ef: usize,
+        num_candidates: usize,
+        store: &EmbeddingStore,
+    ) -> Vec<(u64, f32)> {
+        if k == 0 || query.len() != self.dim || store.dim() != self.dim {
+            return Vec::new();
+        }
+
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 与 store.raw 在各自生命周期内有效，`&EmbeddingStore` 保证调用期间没有写入
+        // 2. query 长度已检查为 dim；输出缓冲区预分配 k 个元素
+        let count = unsafe {
+            hnsw_index_search_knn_rescore(
+                self.raw.as_ptr(),
+                store.raw.as_ptr(),
+                query.as_ptr(),
+                k as c_int,
+                ef as c_int,
+                num_candidates as c_int,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 批量搜索最近邻: 一次 FFI 调用处理多个查询，C++ 侧在线程池上并行执行
+    ///
+    /// `queries` 是行优先展开的 `n x dim` 矩阵 (n 个查询首尾相接)。
+    /// 返回第 i 个元素即第 i 个查询的 (item_id, similarity_score) 列表。
+    pub fn search_batch(&self, queries: &[f32], k: usize) -> Vec<Vec<(u64, f32)>> {
+        self.search_batch_with_ef(queries, k, 0)
+    }
+
+    /// 批量搜索，所有查询共用指定的 ef (`ef = 0` 表示使用默认 ef)
+    pub fn search_batch_with_ef(&self, queries: &[f32], k: usize, ef: usize) -> Vec<Vec<(u64, f32)>> {
+        if self.dim == 0 || queries.len() % self.dim != 0 {
+            return Vec::new();
+        }
+        let n = queries.len() / self.dim;
+        if k == 0 || n == 0 {
+            return vec![Vec::new(); n];
+        }
+
+        let mut out_ids: Vec<c_int> = vec![0; n * k];
+        let mut out_scores: Vec<f32> = vec![0.0; n * k];
+        let mut out_counts: Vec<c_int> = vec![0; n];
+
+        // SAFETY:
+        // 1. raw 有效；queries 长度恰为 n * dim
+        // 2. out_ids/out_scores 预分配 n * k 个元素，out_counts 预分配 n 个元素
+        let result = unsafe {
+            hnsw_index_search_knn_batch(
+                self.raw.as_ptr(),
+                queries.as_ptr(),
+                n as c_int,
+                k as c_int,
+                ef as c_int,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+                out_counts.as_mut_ptr(),
+            )
+        };
+
+        if result != 0 {
+            return vec![Vec::new(); n];
+        }
+
+        (0..n)
+            .map(|q| {
+                let row = q * k;
+                (0..out_counts[q] as usize)
+                    .map(|i| (out_ids[row + i] as u64, out_scores[row + i]))
+                    .collect()
+            })
+            .collect()
+    }
+
+    /// 获取索引中的元素数量
+    pub fn count(&self) -> usize {
+        // SAFETY: raw 在 self 生命周期内有效
+        unsafe { hnsw_index_get_count(self.raw.as_ptr()) as usize }
+    }
+
+    /// 占用与自动扩容统计
+    pub fn stats(&self) -> IndexStats {
+        let mut raw_stats = HnswIndexStats::default();
+        // SAFETY: raw 有效；raw_stats 是 #[repr(C)] 的局部变量，与 C 侧布局一致
+        unsafe { hnsw_index_get_stats(self.raw.as_ptr(), &mut raw_stats) };
+        IndexStats {
+            count: raw_stats.count as usize,
+            deleted: raw_stats.deleted as usize,
+            capacity: raw_stats.capacity as usize,
+            resizes: raw_stats.resizes as usize,
+            resize_total_ms: raw_stats.resize_total_ms,
+            resize_max_ms: raw_stats.resize_max_ms,
+            mutations: raw_stats.mutations as u64,
+            snapshots: raw_stats.snapshots as usize,
+            snapshot_pause_ms: raw_stats.snapshot_pause_ms,
+            snapshot_write_ms: raw_stats.snapshot_write_ms,
+            log_trim_failures: raw_stats.log_trim_failures as usize,
+            memory_bytes: raw_stats.memory_bytes as usize,
+        }
+    }
+
+    /// 保存索引到文件
+    pub fn save(&self, path: &str) -> Result<(), String> {
+        let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
+
+        // SAFETY: raw 有效；c_path 是有效的以 null 结尾的 C 字符串
+        let result = unsafe { hnsw_index_save(self.raw.as_ptr(), c_path.as_ptr()) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err("Failed to save HNSW index".to_string())
+        }
+    }
+
+    /// 以可直接映射的格式保存索引，供 `load_mmap` 使用
+    pub fn save_mmap(&self, path: &str) -> Result<(), String> {
+        let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
+
+        // SAFETY: raw 有效；c_path 是有效的以 null 结尾的 C 字符串
+        let result = unsafe { hnsw_index_save_mmap(self.raw.as_ptr(), c_path.as_ptr()) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err("Failed to save HNSW index".to_string())
+        }
+    }
+
+    /// 开启预写日志: 先把 `path` 上已有的日志重放到索引中，返回重放的记录数；
+    /// 之后的每次修改在写入索引成功之后 (返回之前) 追加到日志，`save_mmap` 落盘后截掉快照已包含的部分
+    ///
+    /// 加载快照后立即调用，即可恢复到上次退出 (包括崩溃) 前的状态。每个索引只能开启一次
+    pub fn open_log(&self, path: &str) -> Result<usize, String> {
+        let c_path = CString::new(path).map_err(|_| "Invalid path".to_string())?;
+
+        // SAFETY: raw 有效；c_path 是有效的以 null 结尾的 C 字符串
+        let result = unsafe { hnsw_index_open_log(self.raw.as_ptr(), c_path.as_ptr()) };
+
+        if result >= 0 {
+            Ok(result as usize)
+        } else {
+            Err(format!("Failed to open mutation log {}", path))
+        }
+    }
+}
+
+/// C 过滤回调与 Rust 闭包之间的桥接函数
+///
+/// 闭包中的 panic 不能跨越 FFI 边界展开到 C++ 栈上，这里捕获后视为"不允许"。
+extern "C" fn filter_trampoline<F>(id: c_int, ctx: *mut c_void) -> c_int
+where
+    F: FnMut(u64) -> bool,
+{
+    // SAFETY: ctx 由 search_filtered / search_multi 从 &mut F 转换而来，在回调期间独占有效
+    let allow = unsafe { &mut *(ctx as *mut F) };
+    match std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| allow(id as u64))) {
+        Ok(true) => 1,
+        _ => 0,
+    }
+}
+
+/// C 进度回调与 Rust 闭包之间的桥接函数
+extern "C" fn progress_trampoline<P>(done: c_int, total: c_int, ctx: *mut c_void)
+where
+    P: FnMut(usize, usize),
+{
+    // SAFETY: ctx 由 add_items_batch / add_from_store 从 &mut P 转换而来，在回调期间独占有效
+    let progress = unsafe { &mut *(ctx as *mut P) };
+    // 进度回调只用于展示，panic 不应跨越 FFI 边界
+    let _ = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| progress(done as usize, total as usize)));
+}
+
+impl Drop for HnswIndex {
+    fn drop(&mut self) {
+        // SAFETY: raw 由 hnsw_index_new/hnsw_index_load 分配，且只在这里释放一次
+        unsafe { hnsw_index_free(self.raw.as_ptr()) };
+    }
+}
+
+// ============================================================================
+// 分片索引与多索引注册表
+// ============================================================================
+//
+// 供后续按类目 / 租户拆分索引时使用的库接口: 目前的服务进程仍只有一个 `HnswIndex`
+// (main.rs 的 hnsw_config 使用 shards = 1)，这里的类型只有单元测试会构造，因此显式允许 dead_code。
+
+/// 由多张独立的 HNSW 图组成的索引: 物品按 `id % shards` 路由到分片，
+/// 搜索时并行查询所有分片再合并各分片的 top-k (见 `hnsw_index_search_knn_sharded`)
+///
+/// 每个分片的图只有 1/shards 大小，单个分片的重建、扩容与快照都更快，
+/// 一个分片扩容时其余分片照常搜索。代价是每次查询都要遍历所有分片的上层图。
+#[allow(dead_code)]
+pub struct ShardedIndex {
+    shards: Vec<HnswIndex>,
+    dim: usize,
+}
+
+#[allow(dead_code)]
+impl ShardedIndex {
+    /// 按 `config.shards` 创建空的分片索引，`max_elements` 在分片间均分
+    pub fn new(config: &HnswConfig) -> Result<Self, String> {
+        let shards = (0..config.shards.max(1))
+            .map(|_| HnswIndex::new(&Self::shard_config(config)))
+            .collect::<Result<Vec<_>, _>>()?;
+        Self::from_shards(shards)
+    }
+
+    /// 用同一组样本为每个分片训练 PQ 码本 (见 `HnswIndex::train_pq`)
+    pub fn train_pq(config: &HnswConfig, samples: &[f32]) -> Result<Self, String> {
+        let shards = (0..config.shards.max(1))
+            .map(|_| HnswIndex::train_pq(&Self::shard_config(config), samples))
+            .collect::<Result<Vec<_>, _>>()?;
+        Self::from_shards(shards)
+    }
+
+    /// 由已有的分片组成索引 (例如分别加载或构建的各分片)，各分片的维度必须相同
+    ///
+    /// 分片的顺序决定路由: 第 i 个分片必须只包含 `id % shards.len() == i` 的物品。
+    pub fn from_shards(shards: Vec<HnswIndex>) -> Result<Self, String> {
+        let dim = shards.first().ok_or_else(|| "Sharded index needs at least one shard".to_string())?.dim();
+        if shards.iter().any(|shard| shard.dim() != dim) {
+            return Err("All shards must have the same dimension".to_string());
+        }
+        Ok(Self { shards, dim })
+    }
+
+    /// 映射由 `save_mmap` 写出的各分片文件 (`<path>.<i>`)，返回值中的 bool 表示是否所有分片都从文件加载
+    pub fn load_mmap(path: &str, config: &HnswConfig) -> Result<(Self, bool), String> {
+        let shard_config = Self::shard_config(config);
+        let mut loaded_all = true;
+        let mut shards = Vec::with_capacity(config.shards.max(1));
+        for i in 0..config.shards.max(1) {
+            let (shard, loaded) = HnswIndex::load_mmap(
+                &Self::shard_path(path, i),
+                shard_config.dim,
+                shard_config.max_elements,
+                shard_config.ef_search,
+                shard_config.storage,
+            )?;
+            loaded_all &= loaded;
+            shards.push(shard);
+        }
+        Ok((Self::from_shards(shards)?, loaded_all))
+    }
+
+    fn shard_config(config: &HnswConfig) -> HnswConfig {
+        HnswConfig {
+            max_elements: config.max_elements.div_ceil(config.shards.max(1)).max(1),
+            shards: 1,
+            ..*config
+        }
+    }
+
+    fn shard_path(path: &str, shard: usize) -> String {
+        format!("{}.{}", path, shard)
+    }
+
+    /// 向量维度
+    pub fn dim(&self) -> usize {
+        self.dim
+    }
+
+    /// 各分片 (按路由顺序)
+    pub fn shards(&self) -> &[HnswIndex] {
+        &self.shards
+    }
+
+    /// 物品所在的分片
+    pub fn shard_of(&self, id: u64) -> usize {
+        (id % self.shards.len() as u64) as usize
+    }
+
+    /// 设置所有分片的默认 ef
+    pub fn set_ef(&self, ef: usize) {
+        for shard in &self.shards {
+            shard.set_ef(ef);
+        }
+    }
+
+    /// 向物品所在的分片添加或更新一个物品
+    pub fn add_item(&self, id: u64, embedding: &[f32]) -> Result<(), String> {
+        self.shards[self.shard_of(id)].add_item(id, embedding)
+    }
+
+    /// 从物品所在的分片中删除一个物品
+    pub fn remove(&self, id: u64) -> Result<(), String> {
+        self.shards[self.shard_of(id)].remove(id)
+    }
+
+    /// 按分片拆分后逐个分片批量插入，返回成功插入的总数
+    ///
+    /// 每个分片的插入本身已在 C++ 线程池上并行执行并占满所有核，分片之间依次构建即可。
+    /// `progress(done, total)` 按全部物品计数。
+    pub fn add_items_batch<P>(&self, ids: &[u64], vectors: &[f32], mut progress: P) -> Result<usize, String>
+    where
+        P: FnMut(usize, usize),
+    {
+        if vectors.len() != ids.len() * self.dim {
+            return Err(format!("Expected {} floats for {} items, got {}", ids.len() * self.dim, ids.len(), vectors.len()));
+        }
+        let mut shard_ids: Vec<Vec<u64>> = vec![Vec::new(); self.shards.len()];
+        let mut shard_vectors: Vec<Vec<f32>> = vec![Vec::new(); self.shards.len()];
+        for (&id, vector) in ids.iter().zip(vectors.chunks_exact(self.dim.max(1))) {
+            let shard = self.shard_of(id);
+            shard_ids[shard].push(id);
+            shard_vectors[shard].extend_from_slice(vector);
+        }
+
+        let mut added = 0;
+        let mut done_before = 0;
+        for (shard, (ids_in_shard, vectors_in_shard)) in self.shards.iter().zip(shard_ids.iter().zip(&shard_vectors)) {
+            added += shard.add_items_batch(ids_in_shard, vectors_in_shard, |done, _| {
+                progress(done_before + done, ids.len())
+            })?;
+            done_before += ids_in_shard.len();
+        }
+        Ok(added)
+    }
+
+    /// 使用默认 ef 搜索 k 个最近邻
+    pub fn search(&self, query: &[f32], k: usize) -> Vec<(u64, f32)> {
+        self.search_with_ef(query, k, 0)
+    }
+
+    /// 并行搜索所有分片并合并为全局 top-k (`ef = 0` 表示使用各分片的默认 ef)
+    ///
+    /// ef 作用于每个分片: 每个分片各自返回 k 个候选，合并时只保留最相似的 k 个。
+    pub fn search_with_ef(&self, query: &[f32], k: usize, ef: usize) -> Vec<(u64, f32)> {
+        if let [shard] = self.shards.as_slice() {
+            return shard.search_with_ef(query, k, ef);
+        }
+        if k == 0 || query.len() != self.dim {
+            return Vec::new();
+        }
+
+        let raw: Vec<*const hnsw_index_t> = self.shards.iter().map(|shard| shard.raw.as_ptr() as *const _).collect();
+        let mut out_ids: Vec<c_int> = vec![0; k];
+        let mut out_scores: Vec<f32> = vec![0.0; k];
+
+        // SAFETY:
+        // 1. raw 中的句柄在 self 生命周期内有效，C++ 只在调用期间读取该数组
+        // 2. query 长度已检查为 dim；out_ids/out_scores 已预分配 k 个元素
+        let count = unsafe {
+            hnsw_index_search_knn_sharded(
+                raw.as_ptr(),
+                raw.len() as c_int,
+                query.as_ptr(),
+                k as c_int,
+                ef as c_int,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+            )
+        };
+
+        if count < 0 {
+            return Vec::new();
+        }
+
+        (0..count as usize)
+            .map(|i| (out_ids[i] as u64, out_scores[i]))
+            .collect()
+    }
+
+    /// 所有分片的元素总数
+    pub fn count(&self) -> usize {
+        self.shards.iter().map(HnswIndex::count).sum()
+    }
+
+    /// 所有分片的合计统计 (耗时类的最大值取各分片的最大值)
+    pub fn stats(&self) -> IndexStats {
+        self.shards.iter().map(HnswIndex::stats).fold(IndexStats::default(), |total, s| IndexStats {
+            count: total.count + s.count,
+            deleted: total.deleted + s.deleted,
+            capacity: total.capacity + s.capacity,
+            resizes: total.resizes + s.resizes,
+            resize_total_ms: total.resize_total_ms + s.resize_total_ms,
+            resize_max_ms: total.resize_max_ms.max(s.resize_max_ms),
+            mutations: total.mutations + s.mutations,
+            snapshots: total.snapshots + s.snapshots,
+            snapshot_pause_ms: total.snapshot_pause_ms.max(s.snapshot_pause_ms),
+            snapshot_write_ms: total.snapshot_write_ms.max(s.snapshot_write_ms),
+            log_trim_failures: total.log_trim_failures + s.log_trim_failures,
+            memory_bytes: total.memory_bytes + s.memory_bytes,
+        })
+    }
+
+    /// 把每个分片以 mmap 格式保存到 `<path>.<i>`，供 `load_mmap` 使用
+    pub fn save_mmap(&self, path: &str) -> Result<(), String> {
+        for (i, shard) in self.shards.iter().enumerate() {
+            shard.save_mmap(&Self::shard_path(path, i))?;
+        }
+        Ok(())
+    }
+}
+
+/// 按名字管理多个互相独立的索引 (例如每个类目、租户或嵌入模型一个)，
+/// 各索引的维度、存储格式与分片数互不相关
+#[allow(dead_code)]
+#[derive(Default)]
+pub struct IndexRegistry {
+    indexes: RwLock<HashMap<String, Arc<ShardedIndex>>>,
+}
+
+#[allow(dead_code)]
+impl IndexRegistry {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// 按配置创建并注册一个空索引，同名索引已存在时返回 Err
+    pub fn create(&self, name: &str, config: &HnswConfig) -> Result<Arc<ShardedIndex>, String> {
+        let mut indexes = self.indexes.write().unwrap_or_else(|e| e.into_inner());
+        if indexes.contains_key(name) {
+            return Err(format!("Index {} already exists", name));
+        }
+        let index = Arc::new(ShardedIndex::new(config)?);
+        indexes.insert(name.to_string(), Arc::clone(&index));
+        Ok(index)
+    }
+
+    /// 注册 (或替换) 一个已构建好的索引，返回被替换的旧索引。
+    /// 正在使用旧索引的请求持有各自的 `Arc`，不受替换影响
+    pub fn insert(&self, name: &str, index: ShardedIndex) -> Option<Arc<ShardedIndex>> {
+        self.indexes.write().unwrap_or_else(|e| e.into_inner()).insert(name.to_string(), Arc::new(index))
+    }
+
+    pub fn get(&self, name: &str) -> Option<Arc<ShardedIndex>> {
+        self.indexes.read().unwrap_or_else(|e| e.into_inner()).get(name).cloned()
+    }
+
+    pub fn remove(&self, name: &str) -> Option<Arc<ShardedIndex>> {
+        self.indexes.write().unwrap_or_else(|e| e.into_inner()).remove(name)
+    }
+
+    /// 已注册的索引名 (按字典序)
+    pub fn names(&self) -> Vec<String> {
+        let mut names: Vec<String> = self.indexes.read().unwrap_or_else(|e| e.into_inner()).keys().cloned().collect();
+        names.sort();
+        names
+    }
+}
+
+// ============================================================================
+// 物品向量存储 Safe Wrapper
+// ============================================================================
+
+/// C++ 侧持有的连续物品向量矩阵 (64 字节对齐，每行按缓存行填充)
+///
+/// 启动时一次性注册全部物品向量，暴力召回与重排序直接在其上计算，
+/// 每次调用不再拼接矩阵；`Item` 也因此不必各自持有一份堆上的 `Vec<f32>`。
+///
+/// 写操作需要 `&mut self`，读操作返回的切片借用 `&self`:
+/// 借用检查保证切片存活期间底层矩阵不会因扩容或删除而移动。
+pub struct EmbeddingStore {
+    raw: NonNull<embedding_store_t>,
+    dim: usize,
+}
+
+// SAFETY: C++ 侧的只读操作可以从任意线程并发调用；
+// 写操作要求 &mut self，由 Rust 的借用规则保证与其他访问互斥。
+unsafe impl Send for EmbeddingStore {}
+unsafe impl Sync for EmbeddingStore {}
+
+impl EmbeddingStore {
+    /// 创建空的向量存储，`capacity` 为初始行数 (不足时自动扩容)
+    pub fn new(dim: usize, capacity: usize) -> Result<Self, String> {
+        // SAFETY: 参数均为值传递，返回值在下面检查是否为 NULL
+        let raw = unsafe { embedding_store_new(dim as c_int, capacity as c_int) };
+        NonNull::new(raw)
+            .map(|raw| Self { raw, dim })
+            .ok_or_else(|| format!("Failed to create embedding store (dim {})", dim))
+    }
+
+    /// 由物品列表构建，并把每个物品的 embedding 移入存储 (`Item.embedding` 被置空并释放)
+    pub fn from_items(dim: usize, items: &mut [Item]) -> Result<Self, String> {
+        let mut store = Self::new(dim, items.len())?;
+        for item in items.iter_mut() {
+            store.put(item.id, &item.embedding)?;
+            item.embedding = Vec::new();
+        }
+        Ok(store)
+    }
+
+    /// 向量维度
+    pub fn dim(&self) -> usize {
+        self.dim
+    }
+
+    /// 已注册的物品数量
+    pub fn len(&self) -> usize {
+        // SAFETY: raw 在 self 生命周期内有效
+        unsafe { embedding_store_count(self.raw.as_ptr()) as usize }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// 插入或覆盖一个物品的向量
+    pub fn put(&mut self, id: u64, embedding: &[f32]) -> Result<(), String> {
+        if embedding.len() != self.dim {
+            return Err(format!("Item {} has dimension {}, expected {}", id, embedding.len(), self.dim));
+        }
+        // SAFETY: raw 有效且 &mut self 保证独占；embedding 长度已检查为 dim
+        let result = unsafe { embedding_store_put(self.raw.as_ptr(), id as c_int, embedding.as_ptr()) };
+
+        if result == 0 {
+            Ok(())
+        } else {
+            Err(format!("Failed to store embedding of item {}", id))
+        }
+    }
+
+    /// 删除一个物品的向量，返回它是否存在
+    pub fn remove(&mut self, id: u64) -> bool {
+        // SAFETY: raw 有效且 &mut self 保证独占
+        unsafe { embedding_store_remove(self.raw.as_ptr(), id as c_int) == 0 }
+    }
+
+    /// 按 id 借用向量 (不复制)
+    pub fn get(&self, id: u64) -> Option<&[f32]> {
+        // SAFETY: raw 有效；返回的指针指向 dim 个 float，在下一次写操作之前有效，
+        // 而写操作需要 &mut self，不可能与这里返回的 &self 借用同时存在
+        unsafe {
+            let ptr = embedding_store_find(self.raw.as_ptr(), id as c_int);
+            (!ptr.is_null()).then(|| std::slice::from_raw_parts(ptr, self.dim))
+        }
+    }
+
+    /// 按行遍历全部 (item_id, 向量)，不复制
+    pub fn iter(&self) -> impl Iterator<Item = (u64, &[f32])> + '_ {
+        (0..self.len()).map(move |row| {
+            // SAFETY: row < len；指针有效期论证同 get
+            unsafe {
+                let id = embedding_store_id_at(self.raw.as_ptr(), row as c_int);
+                let ptr = embedding_store_row_at(self.raw.as_ptr(), row as c_int);
+                (id as u64, std::slice::from_raw_parts(ptr, self.dim))
+            }
+        })
+    }
+
+    /// 精确 Top-K 搜索，返回 (item_id, 内积)，按分数降序
+    pub fn search(&self, query: &[f32], k: usize) -> Vec<(u64, f32)> {
+        self.search_batch(query, k).pop().unwrap_or_default()
+    }
+
+    /// 批量精确 Top-K 搜索，`queries` 是行优先展开的 `n x dim` 矩阵
+    pub fn search_batch(&self, queries: &[f32], k: usize) -> Vec<Vec<(u64, f32)>> {
+        if k == 0 || queries.is_empty() || queries.len() % self.dim != 0 {
+            return Vec::new();
+        }
+        let n = queries.len() / self.dim;
+
+        let mut out_ids: Vec<c_int> = vec![-1; n * k];
+        let mut out_scores: Vec<f32> = vec![0.0; n * k];
+        let mut out_counts: Vec<c_int> = vec![0; n];
+
+        // SAFETY: raw 有效；queries 长度为 n * dim；输出缓冲区分别预分配 n * k、n * k、n 个元素
+        let result = unsafe {
+            embedding_store_search_top_k_batch(
+                self.raw.as_ptr(),
+                queries.as_ptr(),
+                n as c_int,
+                k as c_int,
+                out_ids.as_mut_ptr(),
+                out_scores.as_mut_ptr(),
+                out_counts.as_mut_ptr(),
+            )
+        };
+
+        if result != 0 {
+            return Vec::new();
+        }
+
+        (0..n)
+            .map(|q| {
+                let base = q * k;
+                (0..out_counts[q] as usize)
+                    .map(|i| (out_ids[base + i] as u64, out_scores[base + i]))
+                    .collect()
+            })
+            .collect()
+    }
+
+    /// 对一组候选计算与查询的精确内积 (重排序)，不存在的 id 得分为 `f32::NEG_INFINITY`
+    pub fn score(&self, query: &[f32], ids: &[u64]) -> Vec<f32> {
+        if query.len() != self.dim {
+            return vec![f32::NEG_INFINITY; ids.len()];
+        }
+        let raw_ids: Vec<c_int> = ids.iter().map(|&id| id as c_int).collect();
+        let mut out_scores: Vec<f32> = vec![f32::NEG_INFINITY; ids.len()];
+
+        // SAFETY: raw 有效；query 长度为 dim；raw_ids 与 out_scores 长度均为 ids.len()
+        unsafe {
+            embedding_store_score(
+                self.raw.as_ptr(),
+                query.as_ptr(),
+                raw_ids.as_ptr(),
+                raw_ids.len() as c_int,
+                out_scores.as_mut_ptr(),
+            );
+        }
+        out_scores
+    }
+}
+
+impl Drop for EmbeddingStore {
+    fn drop(&mut self) {
+        // SAFETY: raw 由 embedding_store_new 分配，且只在这里释放一次
+        unsafe { embedding_store_free(self.raw.as_ptr()) };
+    }
+}
+
+// ============================================================================
+// 暴力召回
+// ============================================================================
+
+/// 召回阶段：从物品库中找出与用户最相似的 Top K 物品 (精确搜索)
+pub fn recommend_recall(user_embedding: &[f32], store: &EmbeddingStore, k: usize) -> Vec<(u64, f32)> {
+    if user_embedding.len() != store.dim() {
+        return Vec::new();
+    }
+    store.search(user_embedding, k)
+}
+
+/// 批量精确召回: 多个查询一次扫描物品库 (用于召回率审计，作为 HNSW 结果的 ground truth)
+///
+/// `queries` 是行优先展开的 `n x dim` 矩阵，返回第 i 个元素即第 i 个查询的 Top K。
+pub fn recommend_recall_batch(queries: &[f32], store: &EmbeddingStore, k: usize) -> Vec<Vec<(u64, f32)>> {
+    store.search_batch(queries, k)
+}
+
+// ============================================================================
+// 单元测试
+// ============================================================================
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_cpp_add() {
+        assert_eq!(add(2, 3), 5);
+        assert_eq!(add(-1, 1), 0);
+    }
+
+    #[test]
+    fn test_dot_product() {
+        let a = vec![1.0, 2.0, 3.0];
+        let b = vec![4.0, 5.0, 6.0];
+        let result = compute_dot_product(&a, &b);
+        assert!(result.is_some());
+        assert!((result.unwrap() - 32.0).abs() < 1e-6);
+    }
+
+    #[test]
+    fn test_hnsw_lifecycle() {
+        // 初始化
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 100,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 50,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        assert!(init_hnsw_index(&config).is_ok());
+
+        // 添加向量
+        assert!(add_item_to_hnsw(1, &[1.0, 0.0, 0.0]).is_ok());
+        assert!(add_item_to_hnsw(2, &[0.0, 1.0, 0.0]).is_ok());
+        assert!(add_item_to_hnsw(3, &[0.5, 0.5, 0.0]).is_ok());
+
+        assert_eq!(get_hnsw_count(), 3);
+
+        // 搜索
+        let results = hnsw_search(&[1.0, 0.0, 0.0], 2);
+        assert_eq!(results.len(), 2);
+        // 第一个结果应该是 ID=1 (完全匹配)
+        assert_eq!(results[0].0, 1);
+
+        // 销毁
+        destroy_hnsw_index();
+        assert_eq!(get_hnsw_count(), 0);
+    }
+
+    #[test]
+    fn test_hnsw_index_handle() {
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 100,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 50,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create index");
+
+        assert!(index.add_item(1, &[1.0, 0.0, 0.0]).is_ok());
+        assert!(index.add_item(2, &[0.0, 1.0, 0.0]).is_ok());
+        assert!(index.add_item(3, &[0.5, 0.5, 0.0]).is_ok());
+        // 维度不匹配应被拒绝，而不是越界读取
+        assert!(index.add_item(4, &[1.0, 0.0]).is_err());
+        assert_eq!(index.count(), 3);
+
+        // 单次查询的 ef 小于 k 时按 max(ef, k) 搜索，仍返回 k 个结果
+        let results = index.search_with_ef(&[0.0, 1.0, 0.0], 3, 1);
+        assert_eq!(results.len(), 3);
+        assert_eq!(results[0].0, 2);
+
+        // 多个线程同时在同一个句柄上搜索
+        let index = std::sync::Arc::new(index);
+        let handles: Vec<_> = (0..4)
+            .map(|_| {
+                let index = std::sync::Arc::clone(&index);
+                std::thread::spawn(move || index.search(&[1.0, 0.0, 0.0], 2))
+            })
+            .collect();
+        for handle in handles {
+            let results = handle.join().unwrap();
+            assert_eq!(results.len(), 2);
+            assert_eq!(results[0].0, 1);
+        }
+    }
+
+    #[test]
+    fn test_hnsw_search_batch() {
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 100,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 50,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create index");
+        index.add_item(1, &[1.0, 0.0, 0.0]).unwrap();
+        index.add_item(2, &[0.0, 1.0, 0.0]).unwrap();
+        index.add_item(3, &[0.0, 0.0, 1.0]).unwrap();
+
+        let queries = [
+            1.0, 0.0, 0.0, //
+            0.0, 1.0, 0.0, //
+            0.0, 0.0, 1.0,
+        ];
+        let results = index.search_batch(&queries, 5);
+        assert_eq!(results.len(), 3);
+        for (q, result) in results.iter().enumerate() {
+            // 只有 3 个元素，k = 5 时每个查询最多返回 3 个
+            assert_eq!(result.len(), 3);
+            assert_eq!(result[0].0, q as u64 + 1);
+            assert!((result[0].1 - 1.0).abs() < 1e-6);
+        }
+
+        // 非 dim 整数倍的输入被拒绝
+        assert!(index.search_batch(&[1.0, 0.0], 1).is_empty());
+    }
+
+    #[test]
+    fn test_hnsw_search_filtered() {
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 100,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 10,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create index");
+        for id in 0..50u64 {
+            let t = id as f32 / 50.0;
+            index.add_item(id, &[1.0 - t, t, 0.0]).unwrap();
+        }
+
+        // 排除所有偶数 id: 仍应一次返回 k 个奇数 id
+        let mut rejected = 0;
+        let results = index.search_filtered(&[1.0, 0.0, 0.0], 10, 0, |id| {
+            let ok = id % 2 == 1;
+            if !ok {
+                rejected += 1;
+            }
+            ok
+        });
+        assert_eq!(results.len(), 10);
+        assert!(results.iter().all(|(id, _)| id % 2 == 1));
+        assert!(rejected > 0);
+
+        // 闭包 panic 不会跨越 FFI 边界，只是该候选被视为不允许
+        let results = index.search_filtered(&[1.0, 0.0, 0.0], 5, 0, |id| {
+            if id == 1 {
+                panic!("boom");
+            }
+            true
+        });
+        assert!(results.iter().all(|(id, _)| *id != 1));
+    }
+
+    #[test]
+    fn test_hnsw_search_multi() {
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 200,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 10,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create index");
+        // 两簇物品: 0..100 靠近 x 轴，100..200 靠近 y 轴
+        for id in 0..200u64 {
+            let t = (id % 100) as f32 / 1000.0;
+            let v = if id < 100 { [1.0 - t, t, 0.0] } else { [t, 1.0 - t, 0.0] };
+            index.add_item(id, &v).unwrap();
+        }
+
+        // 两个兴趣各自附近的物品都应召回，得分取最大内积且无重复
+        let interests = [1.0, 0.0, 0.0, 0.0, 1.0, 0.0];
+        let mut asked = std::collections::HashSet::new();
+        let mut repeated = 0;
+        let results = index.search_multi(&interests, 20, 50, |id| {
+            if !asked.insert(id) {
+                repeated += 1;
+            }
+            id != 0
+        });
+        assert_eq!(results.len(), 20);
+        assert_eq!(repeated, 0);
+        assert!(results.iter().all(|(id, _)| *id != 0));
+        assert!(results.iter().any(|(id, _)| *id < 100));
+        assert!(results.iter().any(|(id, _)| *id >= 100));
+        let unique: std::collections::HashSet<u64> = results.iter().map(|(id, _)| *id).collect();
+        assert_eq!(unique.len(), results.len());
+        assert!(results.windows(2).all(|w| w[0].1 >= w[1].1));
+        assert_eq!(results[0].0, 100);
+        assert!((results[0].1 - 1.0).abs() < 1e-5);
+
+        // 单个兴趣等价于普通搜索
+        let single = index.search_multi(&[1.0, 0.0, 0.0], 10, 50, |_| true);
+        let plain: Vec<u64> = index.search_with_ef(&[1.0, 0.0, 0.0], 10, 50).iter().map(|(id, _)| *id).collect();
+        assert_eq!(single.iter().map(|(id, _)| *id).collect::<Vec<_>>(), plain);
+        assert!(index.search_multi(&[1.0, 0.0], 10, 0, |_| true).is_empty());
+
+        // 多簇数据: 召回率不低于各兴趣独立搜索再按最大内积合并。
+        // 后面的兴趣入口点离此前合并的第 k 名很远，不能因此提前结束遍历
+        let dim = 32;
+        let mut seed = 0x2545_f491_4f6c_dd1du64;
+        let mut noise = move || {
+            seed = seed.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+            ((seed >> 40) as f32 / (1u64 << 24) as f32) - 0.5
+        };
+        let centers: Vec<Vec<f32>> = (0..40).map(|_| (0..dim).map(|_| noise()).collect()).collect();
+        let normalize = |v: Vec<f32>| -> Vec<f32> {
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 4000, ..Default::default() }).unwrap();
+        let mut store = EmbeddingStore::new(dim, 4000).unwrap();
+        for id in 0..4000u64 {
+            let center = &centers[id as usize % centers.len()];
+            let v = normalize(center.iter().map(|c| c + 0.3 * noise()).collect());
+            index.add_item(id, &v).unwrap();
+            store.put(id, &v).unwrap();
+        }
+
+        let (k, ef) = (50, 50);
+        let mut multi_recall = 0.0;
+        let mut separate_recall = 0.0;
+        for user in 0..10 {
+            let interests: Vec<f32> = (0..3)
+                .flat_map(|i| normalize(centers[(user * 3 + i * 7) % centers.len()].iter().map(|c| c + 0.2 * noise()).collect()))
+                .collect();
+            let merge = |lists: Vec<Vec<(u64, f32)>>| -> Vec<u64> {
+                let mut best = std::collections::HashMap::new();
+                for (id, score) in lists.into_iter().flatten() {
+                    let entry = best.entry(id).or_insert(score);
+                    *entry = entry.max(score);
+                }
+                let mut merged: Vec<(u64, f32)> = best.into_iter().collect();
+                merged.sort_unstable_by(|a, b| b.1.total_cmp(&a.1));
+                merged.into_iter().take(k).map(|(id, _)| id).collect()
+            };
+            let truth = merge(interests.chunks(dim).map(|q| store.search(q, k)).collect());
+            let separate = merge(interests.chunks(dim).map(|q| index.search_with_ef(q, k, ef)).collect());
+            let multi: Vec<u64> = index.search_multi(&interests, k, ef, |_| true).into_iter().map(|(id, _)| id).collect();
+            let hits = |found: &[u64]| found.iter().filter(|id| truth.contains(id)).count() as f64 / k as f64;
+            multi_recall += hits(&multi) / 10.0;
+            separate_recall += hits(&separate) / 10.0;
+        }
+        assert!(
+            multi_recall + 0.01 >= separate_recall,
+            "search_multi recall {:.3} vs separate searches {:.3}",
+            multi_recall,
+            separate_recall
+        );
+    }
+
+    #[test]
+    fn test_thread_search_metrics() {
+        let config = HnswConfig { dim: 3, max_elements: 200, ..Default::default() };
+        let index = HnswIndex::new(&config).expect("create index");
+        for id in 0..200u64 {
+            let t = id as f32 / 200.0;
+            index.add_item(id, &[1.0 - t, t, 0.0]).unwrap();
+        }
+
+        let before = thread_search_metrics();
+        index.search_with_ef(&[1.0, 0.0, 0.0], 10, 50);
+        let one = thread_search_metrics().since(&before);
+        assert!(one.hops > 0);
+        assert!(one.distance_computations >= one.hops);
+        assert_eq!(one.lock_waits, 0);
+
+        // 计数是线程本地的: 其他线程上的搜索不计入当前线程
+        let before = thread_search_metrics();
+        std::thread::scope(|scope| {
+            scope.spawn(|| index.search_with_ef(&[0.0, 1.0, 0.0], 10, 50));
+        });
+        assert_eq!(thread_search_metrics().since(&before).hops, 0);
+    }
+
+    #[test]
+    fn test_hnsw_search_with_attributes() {
+        let config = HnswConfig {
+            dim: 3,
+            max_elements: 200,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 10,
+            storage: VectorStorage::Float32,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create index");
+        for id in 0..200u64 {
+            let t = id as f32 / 200.0;
+            index.add_item(id, &[1.0 - t, t, 0.0]).unwrap();
+            index.set_attributes(id, (id % 4) as u32, id as f32).unwrap();
+        }
+
+        // 类别 + 价格区间: 只有 id 在 [100, 140) 且 id % 4 == 1 的物品满足
+        let filter = AttributeFilter {
+            categories: Some(vec![1]),
+            min_price: Some(100.0),
+            max_price: Some(140.0),
+        };
+        let results = index.search_with_attributes(&[1.0, 0.0, 0.0], 20, 0, &filter);
+        assert_eq!(results.len(), 10);
+        assert!(results.iter().all(|(id, _)| id % 4 == 1 && (100..140).contains(id)));
+        // 精确枚举时结果按相似度降序，最接近 [1,0,0] 的是 id 最小者
+        assert_eq!(results[0].0, 101);
+
+        // 更新属性后立即生效
+        index.set_attributes(101, 2, 101.0).unwrap();
+        let results = index.search_with_attributes(&[1.0, 0.0, 0.0], 20, 0, &filter);
+        assert_eq!(results.len(), 9);
+        assert!(results.iter().all(|(id, _)| *id != 101));
+
+        // 删除时清除属性: 重新添加但未设置属性的物品不满足任何属性条件
+        index.remove(105).unwrap();
+        index.add_item(105, &[1.0 - 105.0 / 200.0, 105.0 / 200.0, 0.0]).unwrap();
+        let results = index.search_with_attributes(&[1.0, 0.0, 0.0], 20, 0, &filter);
+        assert_eq!(results.len(), 8);
+        assert!(results.iter().all(|(id, _)| *id != 105));
+
+        // 空类别列表不匹配任何物品
+        let none = AttributeFilter { categories: Some(vec![]), ..Default::default() };
+        assert!(index.search_with_attributes(&[1.0, 0.0, 0.0], 5, 0, &none).is_empty());
+    }
+
+    #[test]
+    fn test_recommend_recall() {
+        let user_emb = vec![1.0, 0.0, 0.0];
+        let mut items = vec![
+            Item::new(1, "A", vec![1.0, 0.0, 0.0]),
+            Item::new(2, "B", vec![0.0, 1.0, 0.0]),
+            Item::new(3, "C", vec![0.5, 0.5, 0.0]),
+        ];
+        let store = EmbeddingStore::from_items(3, &mut items).expect("build store");
+        // 向量已移入存储，物品自身不再持有
+        assert!(items.iter().all(|item| item.embedding.is_empty()));
+
+        let results = recommend_recall(&user_emb, &store, 2);
+        assert_eq!(results.len(), 2);
+        assert_eq!(results[0].0, 1);
+        assert!((results[0].1 - 1.0).abs() < 1e-6);
+    }
+
+    #[test]
+    fn test_recommend_recall_batch() {
+        // 维度 37 不是任何 SIMD 宽度的整数倍，覆盖尾部处理
+        let dim = 37;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            (0..dim).map(|j| ((id as usize * 31 + j * 17) % 101) as f32 / 101.0 - 0.5).collect()
+        };
+        let mut items: Vec<Item> = (0..3000u64).map(|id| Item::new(id + 1, "item", embedding_of(id))).collect();
+        let queries: Vec<f32> = (0..7u64).flat_map(embedding_of).collect();
+        let store = EmbeddingStore::from_items(dim, &mut items).expect("build store");
+
+        let batch = recommend_recall_batch(&queries, &store, 10);
+        assert_eq!(batch.len(), 7);
+        for (q, results) in batch.iter().enumerate() {
+            // 与单查询路径结果一致
+            let single = recommend_recall(&queries[q * dim..(q + 1) * dim], &store, 10);
+            assert_eq!(results.len(), 10);
+            for (a, b) in results.iter().zip(single.iter()) {
+                assert!((a.1 - b.1).abs() < 1e-4);
+            }
+            // 分数降序
+            assert!(results.windows(2).all(|w| w[0].1 >= w[1].1));
+        }
+
+        assert!(["avx512", "avx2", "neon", "scalar"].contains(&simd_backend()));
+    }
+
+    #[test]
+    fn test_embedding_store() {
+        let mut store = EmbeddingStore::new(3, 1).expect("create store");
+        assert!(store.is_empty());
+
+        // 超过初始容量后自动扩容，已有数据保持不变
+        for id in 0..100u64 {
+            store.put(id, &[id as f32, 1.0, 0.0]).unwrap();
+        }
+        assert_eq!(store.len(), 100);
+        assert_eq!(store.get(42), Some(&[42.0, 1.0, 0.0][..]));
+        assert!(store.put(100, &[1.0, 0.0]).is_err());
+
+        // 覆盖与删除
+        store.put(42, &[0.0, 0.0, 1.0]).unwrap();
+        assert_eq!(store.len(), 100);
+        assert!(store.remove(0));
+        assert!(!store.remove(0));
+        assert_eq!(store.get(0), None);
+        assert_eq!(store.len(), 99);
+        assert_eq!(store.iter().count(), 99);
+        assert!(store.iter().all(|(id, v)| id != 0 && v.len() == 3));
+
+        // 重排序打分
+        let scores = store.score(&[0.0, 0.0, 1.0], &[42, 0, 7]);
+        assert!((scores[0] - 1.0).abs() < 1e-6);
+        assert_eq!(scores[1], f32::NEG_INFINITY);
+        assert!(scores[2].abs() < 1e-6);
+
+        let top = store.search(&[1.0, 0.0, 0.0], 3);
+        assert_eq!(top.iter().map(|r| r.0).collect::<Vec<_>>(), vec![99, 98, 97]);
+    }
+
+    #[test]
+    fn test_hnsw_int8_rescored() {
+        let dim = 32;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            (0..dim).map(|j| ((id as usize * 37 + j * 11) % 97) as f32 / 97.0 - 0.5).collect()
+        };
+        let config = HnswConfig {
+            dim,
+            max_elements: 1000,
+            m: 16,
+            ef_construction: 100,
+            ef_search: 50,
+            storage: VectorStorage::Int8,
+            shards: 1,
+        };
+        let index = HnswIndex::new(&config).expect("create int8 index");
+        assert_eq!(index.storage(), VectorStorage::Int8);
+
+        let mut store = EmbeddingStore::new(dim, 1000).unwrap();
+        for id in 0..1000u64 {
+            let v = embedding_of(id);
+            index.add_item(id, &v).unwrap();
+            store.put(id, &v).unwrap();
+        }
+
+        let query = embedding_of(123);
+        let exact = store.search(&query, 10);
+        let rescored = index.search_rescored(&query, 10, 100, 40, &store);
+        assert_eq!(rescored.len(), 10);
+        // 重排序后的分数是原始向量上的精确内积
+        assert_eq!(rescored[0].0, exact[0].0);
+        assert!((rescored[0].1 - exact[0].1).abs() < 1e-4);
+        let hits = rescored.iter().filter(|r| exact.iter().any(|e| e.0 == r.0)).count();
+        assert!(hits >= 9, "recall@10 too low: {}", hits);
+
+        // 量化索引直接搜索也能返回近似结果
+        let approx = index.search_with_ef(&query, 10, 100);
+        assert_eq!(approx.len(), 10);
+    }
+
+    #[test]
+    fn test_hnsw_add_items_batch() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.11 + j as f32 * 0.7).cos()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let config = HnswConfig { dim, max_elements: 3000, ..Default::default() };
+
+        // 矩阵批量插入: 进度单调递增并以 total 结束
+        let index = HnswIndex::new(&config).unwrap();
+        let ids: Vec<u64> = (0..2500).collect();
+        let vectors: Vec<f32> = ids.iter().flat_map(|&id| embedding_of(id)).collect();
+        let mut reports = Vec::new();
+        let inserted = index.add_items_batch(&ids, &vectors, |done, total| reports.push((done, total))).unwrap();
+        assert_eq!(inserted, 2500);
+        assert_eq!(index.count(), 2500);
+        assert_eq!(reports.last(), Some(&(2500, 2500)));
+        assert!(reports.windows(2).all(|w| w[0].0 < w[1].0));
+        assert!(index.add_items_batch(&ids, &vectors[1..], |_, _| {}).is_err());
+
+        // 从向量存储插入，超出初始容量时自动扩容
+        let small = HnswIndex::new(&HnswConfig { dim, max_elements: 100, ..Default::default() }).unwrap();
+        let mut store = EmbeddingStore::new(dim, 150).unwrap();
+        for id in 0..150u64 {
+            store.put(id, &embedding_of(id)).unwrap();
+        }
+        assert_eq!(small.add_from_store(&store, |_, _| {}).unwrap(), 150);
+        assert_eq!(small.count(), 150);
+
+        let query = embedding_of(1234);
+        assert_eq!(index.search_with_ef(&query, 1, 100)[0].0, 1234);
+    }
+
+    #[test]
+    fn test_hnsw_remove_and_slot_reuse() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.29 + j as f32 * 1.1).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 100, ..Default::default() }).unwrap();
+        for id in 0..100u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+
+        for id in 0..10u64 {
+            index.remove(id).unwrap();
+        }
+        assert!(index.remove(3).is_err()); // 重复删除
+        assert!(index.remove(1000).is_err());
+        assert_eq!(index.count(), 90);
+        let hits = index.search_with_ef(&embedding_of(3), 100, 200);
+        assert!(hits.iter().all(|&(id, _)| id >= 10));
+
+        // 新物品复用已删除的槽位
+        for id in 100..108u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        assert_eq!(index.count(), 98);
+        assert_eq!(index.stats().capacity, 100);
+        assert_eq!(index.search_with_ef(&embedding_of(105), 1, 200)[0].0, 105);
+
+        // 已删除的 id 再次添加时恢复，已存在的 id 原地更新
+        index.add_item(9, &embedding_of(9)).unwrap();
+        index.add_item(50, &embedding_of(7)).unwrap();
+        assert_eq!(index.count(), 99);
+        assert_eq!(index.search_with_ef(&embedding_of(9), 1, 200)[0].0, 9);
+        let hits = index.search_with_ef(&embedding_of(7), 5, 200);
+        assert!(hits.iter().any(|&(id, score)| id == 50 && (score - 1.0).abs() < 1e-4));
+        let hits = index.search_with_ef(&embedding_of(0), 100, 200);
+        assert_eq!(hits.len(), 99);
+        assert!(!hits.iter().any(|&(id, _)| id < 9));
+    }
+
+    #[test]
+    fn test_hnsw_update_races_remove() {
+        // C API 不依赖调用方串行化: 更新与删除同一 id 并发时，更新必须成功
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.31 + j as f32 * 0.9).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 100, ..Default::default() }).unwrap();
+        for id in 0..50u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+
+        // 删除线程与更新线程交替作用在同一批 id 上，已删除槽位数在 0 与非 0 之间来回切换
+        std::thread::scope(|scope| {
+            scope.spawn(|| {
+                for round in 0..20000u64 {
+                    let _ = index.remove(round % 50);
+                }
+            });
+            for round in 0..20000u64 {
+                let id = round % 50;
+                index.add_item(id, &embedding_of(id)).unwrap();
+            }
+        });
+        for id in 0..50u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        assert_eq!(index.count(), 50);
+    }
+
+    #[test]
+    fn test_hnsw_auto_resize() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.017 + j as f32 * 0.8).cos()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 10, ..Default::default() }).unwrap();
+
+        // 单条插入超出初始容量
+        for id in 0..300u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        let stats = index.stats();
+        assert_eq!(stats.count, 300);
+        assert!(stats.capacity >= 300);
+        assert!(stats.resizes >= 1);
+        assert!(stats.occupancy() > 0.0 && stats.occupancy() <= 1.0);
+
+        // 批量插入一次性扩容
+        let ids: Vec<u64> = (300..3000).collect();
+        let vectors: Vec<f32> = ids.iter().flat_map(|&id| embedding_of(id)).collect();
+        assert_eq!(index.add_items_batch(&ids, &vectors, |_, _| {}).unwrap(), ids.len());
+        assert_eq!(index.count(), 3000);
+        assert!(index.stats().capacity >= 3000);
+
+        let query = embedding_of(2024);
+        let hits = index.search_with_ef(&query, 1, 100);
+        assert!((hits[0].1 - 1.0).abs() < 1e-4);
+    }
+
+    #[test]
+    fn test_hnsw_reconcile_with_store() {
+        let dim = 8;
+        let embedding_of = |id: u64, phase: f32| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.13 + j as f32 * 0.9 + phase).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let config = HnswConfig { dim, max_elements: 1000, ..Default::default() };
+        let index = HnswIndex::new(&config).unwrap();
+        for id in 0..500u64 {
+            index.add_item(id, &embedding_of(id, 0.0)).unwrap();
+        }
+
+        // 存储: 删除 0..50，修改 50..60，新增 500..600
+        let mut store = EmbeddingStore::new(dim, 600).unwrap();
+        for id in 50..600u64 {
+            let phase = if id < 60 { 1.5 } else { 0.0 };
+            store.put(id, &embedding_of(id, phase)).unwrap();
+        }
+
+        let stats = index.reconcile_with_store(&store, |_, _| {}).unwrap();
+        assert_eq!(stats, ReconcileStats { added: 100, updated: 10, deleted: 50, unchanged: 440, failed: 0 });
+        assert_eq!(index.count(), store.len());
+
+        // 已删除的 id 不再出现，修改后的向量可以被精确找回
+        let hits = index.search_with_ef(&embedding_of(10, 0.0), 10, 200);
+        assert!(hits.iter().all(|&(id, _)| id >= 50));
+        let hits = index.search_with_ef(&embedding_of(55, 1.5), 1, 200);
+        assert!((hits[0].1 - 1.0).abs() < 1e-4);
+
+        // 再次对账没有差异
+        let stats = index.reconcile_with_store(&store, |_, _| {}).unwrap();
+        assert_eq!(stats.unchanged, store.len());
+        assert_eq!(stats.added + stats.updated + stats.deleted, 0);
+
+        // 已删除的 id 重新出现时恢复
+        store.put(5, &embedding_of(5, 0.0)).unwrap();
+        let stats = index.reconcile_with_store(&store, |_, _| {}).unwrap();
+        assert_eq!(stats.added, 1);
+        assert_eq!(index.search_with_ef(&embedding_of(5, 0.0), 1, 200)[0].0, 5);
+    }
+
+    #[test]
+    fn test_hnsw_mmap_roundtrip() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.37 + j as f32 * 1.3).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let config = HnswConfig { dim, max_elements: 300, ..Default::default() };
+        let index = HnswIndex::new(&config).unwrap();
+        for id in 0..300u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+
+        let path = std::env::temp_dir().join(format!("mmap_index_test_{}.bin", std::process::id()));
+        let path = path.to_str().unwrap();
+        index.save_mmap(path).unwrap();
+
+        // 映射后的索引与原索引搜索结果完全一致，预留容量内仍可插入
+        let (mapped, loaded) = HnswIndex::load_mmap(path, dim, 400, 50, VectorStorage::Float32).unwrap();
+        assert!(loaded);
+        assert_eq!(mapped.count(), 300);
+        let query = embedding_of(42);
+        assert_eq!(mapped.search_with_ef(&query, 10, 50), index.search_with_ef(&query, 10, 50));
+        mapped.add_item(1000, &query).unwrap();
+        assert_eq!(mapped.count(), 301);
+
+        // 可以覆盖保存到自身正在映射的文件
+        mapped.save_mmap(path).unwrap();
+        drop(mapped);
+        let (reloaded, _) = HnswIndex::load_mmap(path, dim, 0, 50, VectorStorage::Float32).unwrap();
+        assert_eq!(reloaded.count(), 301);
+        let top = reloaded.search_with_ef(&query, 2, 50);
+        assert!(top.iter().all(|(id, _)| *id == 42 || *id == 1000));
+
+        // 原生格式的文件不能按 mmap 格式加载
+        index.save(path).unwrap();
+        assert!(HnswIndex::load_mmap(path, dim, 400, 50, VectorStorage::Float32).is_err());
+        let _ = std::fs::remove_file(path);
+    }
+
+    #[test]
+    fn test_hnsw_snapshot_while_serving() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.23 + j as f32 * 1.7).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 1000, ..Default::default() }).unwrap();
+        for id in 0..500u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        index.remove(0).unwrap();
+        assert_eq!(index.stats().mutations, 501);
+
+        let path = std::env::temp_dir().join(format!("snapshot_test_{}.bin", std::process::id()));
+        let path = path.to_str().unwrap();
+
+        // 快照与插入、搜索并发进行，每个快照都是某一时刻的完整状态
+        std::thread::scope(|scope| {
+            scope.spawn(|| {
+                for id in 500..1500u64 {
+                    index.add_item(id, &embedding_of(id)).unwrap();
+                }
+            });
+            scope.spawn(|| {
+                for id in 0..500u64 {
+                    assert!(!index.search_with_ef(&embedding_of(id), 5, 50).is_empty());
+                }
+            });
+            for _ in 0..5 {
+                index.save_mmap(path).unwrap();
+                let (snapshot, loaded) = HnswIndex::load_mmap(path, dim, 0, 50, VectorStorage::Float32).unwrap();
+                assert!(loaded);
+                assert!((499..=1499).contains(&snapshot.count()));
+            }
+        });
+
+        let stats = index.stats();
+        assert_eq!(stats.snapshots, 5);
+        assert_eq!(stats.mutations, 1501);
+        index.save_mmap(path).unwrap();
+        let (snapshot, _) = HnswIndex::load_mmap(path, dim, 0, 50, VectorStorage::Float32).unwrap();
+        assert_eq!(snapshot.count(), 1499);
+        assert!(!std::path::Path::new(&format!("{}.tmp", path)).exists());
+        let _ = std::fs::remove_file(path);
+    }
+
+    #[test]
+    fn test_hnsw_mutation_log_replay() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.37 + j as f32 * 1.3).cos()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let dir = std::env::temp_dir();
+        let snapshot = dir.join(format!("wal_test_{}.bin", std::process::id()));
+        let snapshot = snapshot.to_str().unwrap();
+        let log = dir.join(format!("wal_test_{}.wal", std::process::id()));
+        let log = log.to_str().unwrap();
+        let _ = std::fs::remove_file(log);
+
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 100, ..Default::default() }).unwrap();
+        assert_eq!(index.open_log(log).unwrap(), 0);
+        assert!(index.open_log(log).is_err());
+        for id in 0..100u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        // 快照之后日志只剩快照之后的修改
+        index.save_mmap(snapshot).unwrap();
+        for id in 100..150u64 {
+            index.add_item(id, &embedding_of(id)).unwrap();
+        }
+        for id in 0..5u64 {
+            index.remove(id).unwrap();
+        }
+        assert!(index.remove(0).is_err());
+        let moved = embedding_of(1000);
+        index.add_item(7, &moved).unwrap();
+        drop(index);
+
+        // 模拟断电: 末尾留下写了一半的记录
+        {
+            use std::io::Write;
+            let mut f = std::fs::OpenOptions::new().append(true).open(log).unwrap();
+            f.write_all(&[40, 0, 0, 0, 1, 2, 3]).unwrap();
+        }
+
+        let (recovered, loaded) = HnswIndex::load_mmap(snapshot, dim, 0, 50, VectorStorage::Float32).unwrap();
+        assert!(loaded);
+        assert_eq!(recovered.count(), 100);
+        assert_eq!(recovered.open_log(log).unwrap(), 56);
+        assert_eq!(recovered.count(), 145);
+        let top = recovered.search_with_ef(&moved, 1, 50);
+        assert_eq!(top[0].0, 7);
+        assert!((top[0].1 - 1.0).abs() < 1e-4);
+        assert!(recovered.search_with_ef(&embedding_of(3), 10, 50).iter().all(|(id, _)| *id >= 5));
+
+        // 截掉坏尾巴之后可以继续追加，再次重放得到同样的结果
+        recovered.add_item(200, &embedding_of(200)).unwrap();
+        drop(recovered);
+        let (again, _) = HnswIndex::load_mmap(snapshot, dim, 0, 50, VectorStorage::Float32).unwrap();
+        assert_eq!(again.open_log(log).unwrap(), 57);
+        assert_eq!(again.count(), 146);
+
+        let _ = std::fs::remove_file(snapshot);
+        let _ = std::fs::remove_file(log);
+    }
+
+    #[test]
+    fn test_hnsw_mutation_log_snapshot_under_writes() {
+        let dim = 8;
+        // 由 id 派生的伪随机向量，不同 id 之间不会出现近似重复
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let mut x = id.wrapping_mul(0x9e37_79b9_7f4a_7c15) | 1;
+            let v: Vec<f32> = (0..dim)
+                .map(|_| {
+                    x = x.wrapping_mul(6364136223846793005).wrapping_add(1442695040888963407);
+                    (x >> 40) as f32 / (1u64 << 24) as f32 - 0.5
+                })
+                .collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let dir = std::env::temp_dir();
+        let snapshot = dir.join(format!("wal_load_test_{}.bin", std::process::id()));
+        let snapshot = snapshot.to_str().unwrap();
+        let log = dir.join(format!("wal_load_test_{}.wal", std::process::id()));
+        let log = log.to_str().unwrap();
+        let _ = std::fs::remove_file(log);
+
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 100, ..Default::default() }).unwrap();
+        assert_eq!(index.open_log(log).unwrap(), 0);
+
+        // 快照与多个写线程并发: 快照取切分点之后的写入都要留在截短后的日志里
+        std::thread::scope(|scope| {
+            for t in 0..4u64 {
+                let index = &index;
+                scope.spawn(move || {
+                    for id in (t * 500)..(t * 500 + 500) {
+                        index.add_item(id, &embedding_of(id)).unwrap();
+                    }
+                });
+            }
+            for _ in 0..10 {
+                index.save_mmap(snapshot).unwrap();
+            }
+        });
+        let stats = index.stats();
+        assert_eq!(stats.snapshots, 10);
+        assert_eq!(stats.log_trim_failures, 0);
+        drop(index);
+
+        // 最后一次快照 + 截短后的日志 = 全部写入
+        let (recovered, loaded) = HnswIndex::load_mmap(snapshot, dim, 0, 50, VectorStorage::Float32).unwrap();
+        assert!(loaded);
+        recovered.open_log(log).unwrap();
+        assert_eq!(recovered.count(), 2000);
+        for id in (0..2000u64).step_by(97) {
+            assert_eq!(recovered.search_with_ef(&embedding_of(id), 1, 100)[0].0, id);
+        }
+
+        let _ = std::fs::remove_file(snapshot);
+        let _ = std::fs::remove_file(log);
+    }
+
+    #[test]
+    fn test_hnsw_pq_index() {
+        let dim = 16;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            (0..dim).map(|j| ((id as usize * 13 + j * 7) % 61) as f32 / 61.0 - 0.5).collect()
+        };
+        let embeddings: Vec<f32> = (0..400u64).flat_map(embedding_of).collect();
+        let config = HnswConfig {
+            dim,
+            max_elements: 400,
+            ef_search: 50,
+            storage: VectorStorage::Pq { subspaces: 4 },
+            ..Default::default()
+        };
+
+        // PQ 索引必须先训练码本
+        assert!(HnswIndex::new(&config).is_err());
+        assert!(HnswIndex::train_pq(&config, &embeddings[..100 * dim]).is_err());
+        let index = HnswIndex::train_pq(&config, &embeddings).expect("train pq index");
+
+        let mut store = EmbeddingStore::new(dim, 400).unwrap();
+        for id in 0..400u64 {
+            let v = embedding_of(id);
+            index.add_item(id, &v).unwrap();
+            store.put(id, &v).unwrap();
+        }
+
+        let query = embedding_of(77);
+        let exact = store.search(&query, 5);
+        let rescored = index.search_rescored(&query, 5, 100, 50, &store);
+        assert_eq!(rescored.len(), 5);
+        // 样本按 61 周期重复，比较分数而不是 id (相同向量的 id 可以互换)
+        assert!((rescored[0].1 - exact[0].1).abs() < 1e-4);
+
+        // 索引与码本一起保存 / 加载，加载后的结果与原索引一致
+        let path = std::env::temp_dir().join(format!("pq_index_test_{}.bin", std::process::id()));
+        let path = path.to_str().unwrap();
+        index.save(path).unwrap();
+        let (loaded, was_loaded) = HnswIndex::load(path, dim, 400, 50, config.storage).unwrap();
+        assert!(was_loaded);
+        assert_eq!(loaded.count(), 400);
+        assert_eq!(loaded.search_with_ef(&query, 5, 100), index.search_with_ef(&query, 5, 100));
+        assert!(HnswIndex::load(path, dim, 400, 50, VectorStorage::Float32).is_err());
+        let _ = std::fs::remove_file(path);
+        let _ = std::fs::remove_file(format!("{}.pq", path));
+    }
+
+    #[test]
+    fn test_sharded_index() {
+        let dim = 8;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.13 + j as f32 * 0.9).sin()).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let config = HnswConfig { dim, max_elements: 2000, shards: 4, ..Default::default() };
+        let index = ShardedIndex::new(&config).unwrap();
+        assert_eq!(index.shards().len(), 4);
+
+        // 批量插入按 id % 4 路由，进度按全部物品计数
+        let ids: Vec<u64> = (0..2000).collect();
+        let vectors: Vec<f32> = ids.iter().flat_map(|&id| embedding_of(id)).collect();
+        let mut last = (0, 0);
+        assert_eq!(index.add_items_batch(&ids, &vectors, |done, total| last = (done, total)).unwrap(), 2000);
+        assert_eq!(last, (2000, 2000));
+        assert_eq!(index.count(), 2000);
+        assert!(index.shards().iter().all(|shard| shard.count() == 500));
+        assert_eq!(index.stats().count, 2000);
+
+        // 合并后的 top-k 与精确搜索一致: 按相似度降序、id 不重复
+        let mut store = EmbeddingStore::new(dim, 2000).unwrap();
+        for &id in &ids {
+            store.put(id, &embedding_of(id)).unwrap();
+        }
+        let query = embedding_of(777);
+        let results = index.search_with_ef(&query, 10, 100);
+        assert_eq!(results[0].0, 777);
+        assert!(results.windows(2).all(|w| w[0].1 >= w[1].1));
+        let exact: Vec<u64> = store.search(&query, 10).into_iter().map(|(id, _)| id).collect();
+        let found = results.iter().filter(|(id, _)| exact.contains(id)).count();
+        assert!(found >= 9, "sharded search found {} of the exact top-10", found);
+
+        // 单个物品的增删也路由到所在分片
+        index.remove(777).unwrap();
+        assert_eq!(index.shards()[1].count(), 499);
+        assert!(index.search_with_ef(&query, 10, 100).iter().all(|(id, _)| *id != 777));
+        index.add_item(777, &query).unwrap();
+        assert_eq!(index.search_with_ef(&query, 1, 100)[0].0, 777);
+        assert!(index.search(&query[1..], 10).is_empty());
+
+        // 注册表中的索引维度与分片数互相独立
+        let registry = IndexRegistry::new();
+        registry.create("books", &HnswConfig { dim: 3, max_elements: 10, ..Default::default() }).unwrap();
+        assert!(registry.create("books", &HnswConfig::default()).is_err());
+        assert!(registry.insert("catalog", index).is_none());
+        assert_eq!(registry.names(), vec!["books".to_string(), "catalog".to_string()]);
+        let books = registry.get("books").unwrap();
+        books.add_item(1, &[1.0, 0.0, 0.0]).unwrap();
+        assert_eq!(books.search(&[1.0, 0.0, 0.0], 1)[0].0, 1);
+        assert_eq!(registry.get("catalog").unwrap().dim(), dim);
+        assert!(registry.remove("books").is_some());
+        assert!(registry.get("books").is_none());
+    }
+
+    extern "C" {
+        fn vector_ops_fixed_kernel_mismatches() -> c_int;
+        fn vector_ops_mutation_log_check(path: *const c_char) -> c_int;
+    }
+
+    #[test]
+    fn test_mutation_log_keeps_records_after_cut() {
+        // 快照取切分点之后仍有写入追加，drop_prefix 必须保留这些记录
+        let path = std::env::temp_dir().join(format!("wal_cut_test_{}.wal", std::process::id()));
+        let c_path = CString::new(path.to_str().unwrap()).unwrap();
+        // SAFETY: c_path 是有效的以 null 结尾的 C 字符串，调用期间保持存活
+        assert_eq!(unsafe { vector_ops_mutation_log_check(c_path.as_ptr()) }, 6);
+    }
+
+    #[test]
+    fn test_fixed_dim_batch_distances_match_single() {
+        // 搜索中批量与逐个计算的距离必须逐位一致，否则两条路径的候选顺序与并列处理会不同
+        // SAFETY: 无参数，C++ 侧只读写自己的局部缓冲区
+        assert_eq!(unsafe { vector_ops_fixed_kernel_mismatches() }, 0);
+    }
+
+    #[test]
+    fn test_hnsw_fixed_dim_space() {
+        // 384 维走固定维度的空间 (展开的内核 + 按邻居表批量计算距离)，分数与精确搜索一致
+        let dim = 384;
+        let embedding_of = |id: u64| -> Vec<f32> {
+            let v: Vec<f32> = (0..dim).map(|j| (id as f32 * 0.37 + j as f32 * 0.05).sin() + (j % 7) as f32 * 0.01).collect();
+            let norm = v.iter().map(|x| x * x).sum::<f32>().sqrt();
+            v.into_iter().map(|x| x / norm).collect()
+        };
+        let index = HnswIndex::new(&HnswConfig { dim, max_elements: 600, ef_search: 100, ..Default::default() }).unwrap();
+        let mut store = EmbeddingStore::new(dim, 600).unwrap();
+        let ids: Vec<u64> = (0..600).collect();
+        let vectors: Vec<f32> = ids.iter().flat_map(|&id| embedding_of(id)).collect();
+        index.add_items_batch(&ids, &vectors, |_, _| {}).unwrap();
+        for &id in &ids {
+            store.put(id, &embedding_of(id)).unwrap();
+        }
+
+        for &id in &[0u64, 123, 599] {
+            let query = embedding_of(id);
+            let hits = index.search_with_ef(&query, 10, 200);
+            assert_eq!(hits[0].0, id);
+            let exact = store.score(&query, &hits.iter().map(|&(id, _)| id).collect::<Vec<_>>());
+            for (&(_, score), expected) in hits.iter().zip(exact) {
+                assert!((score - expected).abs() < 1e-4, "score {} vs exact {}", score, expected);
+            }
+        }
+
+        // 删除后走非 bare-bone 的批量路径
+        index.remove(123).unwrap();
+        assert!(index.search_with_ef(&embedding_of(123), 10, 200).iter().all(|&(id, _)| id != 123));
     }
 }
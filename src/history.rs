@@ -0,0 +1,358 @@
+//! 用户浏览历史 ("已看过") - 内存缓存 + 批量回写 Sled
+//!
+//! 每次 /recommend 都要查询用户的过滤器，每次 /mark_seen 都要修改它。热门用户的过滤器常驻内存
+//! (按 uid 分片，每个用户一把读写锁)，修改只让用户的版本号前进，由后台任务定期把所有未持久化的
+//! 过滤器合并为一个 Sled batch 写回。请求路径上没有 Sled I/O，也没有过滤器的整块拷贝；
+//! 同一用户的并发 mark_seen 在该用户的写锁上依次合并，不会互相覆盖。
+//! 进程崩溃最多丢失最近一个回写周期内的 mark_seen。
+//!
+//! 过滤器的大小随用户的历史增长 (可扩展 Bloom Filter): 从容纳 64 个物品的小层开始，
+//! 当前层写满后追加一层容量为 4 倍、误判率减半的新层，各层误判率之和不超过 BLOOM_FPR。
+
+use anyhow::{bail, Context, Result};
+use fastbloom_rs::{BloomFilter, FilterBuilder, Membership};
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex, MutexGuard, RwLock, RwLockReadGuard};
+use crate::storage::Storage;
+
+/// 所有层的误判率之和的上限
+const BLOOM_FPR: f64 = 0.01;
+const FIRST_LAYER_CAPACITY: u32 = 64;
+const LAYER_GROWTH: u32 = 4;
+/// 第 i 层 (从 0 开始) 的误判率为 BLOOM_FPR * LAYER_FPR_RATIO^(i+1)
+const LAYER_FPR_RATIO: f64 = 0.5;
+
+/// 旧版格式: 整个 blob 是一个按 10000 个物品设计的过滤器，hash 函数数量固定为 7
+const LEGACY_EXPECTED_ITEMS: u32 = 10000;
+const LEGACY_HASHES: u32 = 7;
+const FORMAT_MAGIC: &[u8; 4] = b"SBF1";
+
+struct Layer {
+    filter: BloomFilter,
+    capacity: u32,
+    count: u32,
+}
+
+/// 单个用户的 "已看过" 集合 (可扩展 Bloom Filter)
+pub struct SeenFilter {
+    layers: Vec<Layer>,
+}
+
+impl SeenFilter {
+    /// 空过滤器不占用位数组，第一次 add 时才分配第一层
+    pub fn new() -> Self {
+        Self { layers: Vec::new() }
+    }
+
+    pub fn contains(&self, item_id: u64) -> bool {
+        let key = item_id.to_le_bytes();
+        self.layers.iter().any(|layer| layer.filter.contains(&key))
+    }
+
+    /// 返回是否为新记录 (已存在或误判为已存在时不占用容量)
+    pub fn add(&mut self, item_id: u64) -> bool {
+        if self.contains(item_id) {
+            return false;
+        }
+        if self.layers.last().map_or(true, |layer| layer.count >= layer.capacity) {
+            self.push_layer();
+        }
+        let layer = self.layers.last_mut().expect("layer just ensured");
+        layer.filter.add(&item_id.to_le_bytes());
+        layer.count += 1;
+        true
+    }
+
+    /// 位数组占用的字节数
+    pub fn size_bytes(&self) -> usize {
+        self.layers.iter().map(|layer| layer.filter.get_u8_array().len()).sum()
+    }
+
+    fn push_layer(&mut self) {
+        let n = self.layers.len() as u32;
+        let capacity = FIRST_LAYER_CAPACITY.saturating_mul(LAYER_GROWTH.saturating_pow(n));
+        let fpr = BLOOM_FPR * LAYER_FPR_RATIO.powi(n as i32 + 1);
+        let filter = FilterBuilder::new(capacity as u64, fpr).build_bloom_filter();
+        self.layers.push(Layer { filter, capacity, count: 0 });
+    }
+
+    /// 序列化: [magic][层数 u32]，每层 [capacity u32][count u32][hashes u32][字节数 u32][位数组]，小端
+    pub fn encode(&self) -> Vec<u8> {
+        let mut out = Vec::with_capacity(8 + self.size_bytes() + self.layers.len() * 16);
+        out.extend_from_slice(FORMAT_MAGIC);
+        out.extend_from_slice(&(self.layers.len() as u32).to_le_bytes());
+        for layer in &self.layers {
+            let bits = layer.filter.get_u8_array();
+            for field in [layer.capacity, layer.count, layer.filter.hashes(), bits.len() as u32] {
+                out.extend_from_slice(&field.to_le_bytes());
+            }
+            out.extend_from_slice(bits);
+        }
+        out
+    }
+
+    /// 反序列化；不带 magic 的旧版单层过滤器按一个已写满的层载入，之后的记录写入新层
+    pub fn decode(bytes: &[u8]) -> Result<Self> {
+        if !bytes.starts_with(FORMAT_MAGIC) {
+            let filter = BloomFilter::from_u8_array(bytes, LEGACY_HASHES);
+            let capacity = LEGACY_EXPECTED_ITEMS;
+            return Ok(Self { layers: vec![Layer { filter, capacity, count: capacity }] });
+        }
+
+        fn read_u32(rest: &mut &[u8]) -> Result<u32> {
+            if rest.len() < 4 {
+                bail!("truncated seen-history filter");
+            }
+            let (head, tail) = rest.split_at(4);
+            *rest = tail;
+            Ok(u32::from_le_bytes(head.try_into().expect("4 bytes")))
+        }
+
+        let mut rest = &bytes[FORMAT_MAGIC.len()..];
+        let n = read_u32(&mut rest)?;
+        let mut layers = Vec::with_capacity(n.min(32) as usize);
+        for _ in 0..n {
+            let capacity = read_u32(&mut rest)?;
+            let count = read_u32(&mut rest)?;
+            let hashes = read_u32(&mut rest)?;
+            let len = read_u32(&mut rest)? as usize;
+            if rest.len() < len || hashes == 0 {
+                bail!("corrupt seen-history filter");
+            }
+            let (bits, tail) = rest.split_at(len);
+            rest = tail;
+            layers.push(Layer { filter: BloomFilter::from_u8_array(bits, hashes), capacity, count });
+        }
+        Ok(Self { layers })
+    }
+}
+
+struct Entry {
+    filter: RwLock<SeenFilter>,
+    /// 每次修改 +1 (持有写锁时)；等于 persisted 时表示 Sled 中已是最新内容
+    version: AtomicU64,
+    persisted: AtomicU64,
+    last_used: AtomicU64,
+}
+
+impl Entry {
+    fn is_clean(&self) -> bool {
+        self.version.load(Ordering::Acquire) == self.persisted.load(Ordering::Acquire)
+    }
+}
+
+/// 某个用户的过滤器句柄，持有期间该用户不会被淘汰出缓存
+pub struct UserHistory(Arc<Entry>);
+
+impl UserHistory {
+    /// 读锁期间同一用户的 mark_seen 会等待，不要跨 await 持有
+    pub fn read(&self) -> RwLockReadGuard<'_, SeenFilter> {
+        // 修改过滤器的代码不会中途 panic 留下不一致的状态
+        self.0.filter.read().unwrap_or_else(|e| e.into_inner())
+    }
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct HistoryStats {
+    pub cached_users: usize,
+    pub dirty_users: usize,
+    pub filter_bytes: usize,
+}
+
+pub struct SeenHistory {
+    storage: Arc<Storage>,
+    shards: Vec<Mutex<HashMap<u64, Arc<Entry>>>>,
+    per_shard: usize,
+    /// 逻辑时钟，记录每个用户最近一次访问的先后
+    clock: AtomicU64,
+}
+
+impl SeenHistory {
+    /// 最多缓存约 capacity 个用户；只淘汰已持久化且没有被请求持有的用户，
+    /// 因此脏用户较多时缓存可能暂时超出容量，下一次 flush 之后恢复
+    pub fn new(storage: Arc<Storage>, capacity: usize, shards: usize) -> Self {
+        let shards = shards.clamp(1, capacity.max(1));
+        Self {
+            storage,
+            shards: (0..shards).map(|_| Mutex::new(HashMap::new())).collect(),
+            per_shard: capacity.div_ceil(shards).max(1),
+            clock: AtomicU64::new(0),
+        }
+    }
+
+    /// 用户的过滤器 (未缓存时从 Sled 载入一次)
+    pub fn user(&self, uid: u64) -> Result<UserHistory> {
+        Ok(UserHistory(self.entry(uid)?))
+    }
+
+    /// 把物品记为已看过，返回新记录的数量。只修改内存，由 flush 批量写回
+    pub fn mark_seen(&self, uid: u64, item_ids: &[u64]) -> Result<usize> {
+        let entry = self.entry(uid)?;
+        let mut filter = entry.filter.write().unwrap_or_else(|e| e.into_inner());
+        let added = item_ids.iter().filter(|&&id| filter.add(id)).count();
+        if added > 0 {
+            entry.version.fetch_add(1, Ordering::AcqRel);
+        }
+        Ok(added)
+    }
+
+    /// 把所有未持久化的过滤器作为一个 batch 写回 Sled，返回写回的用户数
+    pub fn flush(&self) -> Result<usize> {
+        let mut dirty = Vec::new();
+        for shard in &self.shards {
+            dirty.extend(lock(shard).iter().filter(|(_, e)| !e.is_clean()).map(|(&uid, e)| (uid, Arc::clone(e))));
+        }
+        if dirty.is_empty() {
+            return Ok(0);
+        }
+
+        // 在读锁下同时记下内容与版本号: 之后的修改会让版本号超过记下的值，留给下一次 flush
+        let mut batch = Vec::with_capacity(dirty.len());
+        let mut versions = Vec::with_capacity(dirty.len());
+        for (uid, entry) in &dirty {
+            let filter = entry.filter.read().unwrap_or_else(|e| e.into_inner());
+            versions.push(entry.version.load(Ordering::Acquire));
+            batch.push((*uid, filter.encode()));
+        }
+        self.storage.save_user_histories(batch)?;
+
+        for ((_, entry), version) in dirty.iter().zip(versions) {
+            entry.persisted.fetch_max(version, Ordering::AcqRel);
+        }
+        Ok(dirty.len())
+    }
+
+    pub fn stats(&self) -> HistoryStats {
+        let mut stats = HistoryStats::default();
+        for shard in &self.shards {
+            for entry in lock(shard).values() {
+                stats.cached_users += 1;
+                stats.dirty_users += usize::from(!entry.is_clean());
+                stats.filter_bytes += entry.filter.read().unwrap_or_else(|e| e.into_inner()).size_bytes();
+            }
+        }
+        stats
+    }
+
+    fn entry(&self, uid: u64) -> Result<Arc<Entry>> {
+        let shard = &self.shards[(uid % self.shards.len() as u64) as usize];
+        let now = self.clock.fetch_add(1, Ordering::Relaxed);
+        if let Some(entry) = lock(shard).get(&uid) {
+            entry.last_used.store(now, Ordering::Relaxed);
+            return Ok(Arc::clone(entry));
+        }
+
+        // 载入时不持有分片锁；并发载入同一用户时只保留先插入的那份 (此时两份都还未被修改)
+        let filter = match self.storage.get_user_history(uid)? {
+            Some(bytes) => SeenFilter::decode(&bytes).with_context(|| format!("Invalid history of user {}", uid))?,
+            None => SeenFilter::new(),
+        };
+        let mut map = lock(shard);
+        let entry = Arc::clone(map.entry(uid).or_insert_with(|| {
+            Arc::new(Entry {
+                filter: RwLock::new(filter),
+                version: AtomicU64::new(0),
+                persisted: AtomicU64::new(0),
+                last_used: AtomicU64::new(now),
+            })
+        }));
+        entry.last_used.store(now, Ordering::Relaxed);
+        if map.len() > self.per_shard {
+            evict_one(&mut map);
+        }
+        Ok(entry)
+    }
+}
+
+/// 淘汰最久未访问的一个可淘汰用户: 已持久化，且除缓存外没有其他持有者
+/// (新的句柄只在分片锁下产生，因此检查 strong_count 之后不会有人再拿到它)
+fn evict_one(map: &mut HashMap<u64, Arc<Entry>>) {
+    let victim = map.iter()
+        .filter(|(_, e)| Arc::strong_count(e) == 1 && e.is_clean())
+        .min_by_key(|(_, e)| e.last_used.load(Ordering::Relaxed))
+        .map(|(&uid, _)| uid);
+    if let Some(uid) = victim {
+        map.remove(&uid);
+    }
+}
+
+fn lock(shard: &Mutex<HashMap<u64, Arc<Entry>>>) -> MutexGuard<'_, HashMap<u64, Arc<Entry>>> {
+    // 分片内只做插入 / 删除 / 查找，中毒后可以继续使用
+    shard.lock().unwrap_or_else(|e| e.into_inner())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_seen_filter_grows_and_round_trips() {
+        let mut filter = SeenFilter::new();
+        assert_eq!(filter.size_bytes(), 0);
+        assert!(filter.add(1));
+        assert!(!filter.add(1));
+        let small = filter.size_bytes();
+        assert!(small > 0 && small < 256, "a tiny user should not pay for 12 KB: {}", small);
+
+        for id in 0..5000u64 {
+            filter.add(id);
+        }
+        assert!((0..5000u64).all(|id| filter.contains(id)));
+        assert!(filter.size_bytes() > small);
+        let false_positives = (1_000_000..1_010_000u64).filter(|&id| filter.contains(id)).count();
+        assert!(false_positives < 200, "false positive rate too high: {}", false_positives);
+
+        let decoded = SeenFilter::decode(&filter.encode()).unwrap();
+        assert!((0..5000u64).all(|id| decoded.contains(id)));
+        assert_eq!(decoded.size_bytes(), filter.size_bytes());
+        assert!(SeenFilter::decode(&filter.encode()[..20]).is_err());
+
+        // 旧版单层格式按已写满的层载入，新记录进入新层
+        let mut legacy = FilterBuilder::new(LEGACY_EXPECTED_ITEMS as u64, 0.01).build_bloom_filter();
+        legacy.add(&42u64.to_le_bytes());
+        let mut upgraded = SeenFilter::decode(legacy.get_u8_array()).unwrap();
+        assert!(upgraded.contains(42));
+        assert!(upgraded.add(43));
+        assert_eq!(upgraded.layers.len(), 2);
+    }
+
+    #[test]
+    fn test_seen_history_write_behind() {
+        let dir = std::env::temp_dir().join(format!("seen_history_{}", std::process::id()));
+        let storage = Arc::new(Storage::new(dir.to_str().unwrap()).unwrap());
+        let history = SeenHistory::new(Arc::clone(&storage), 2, 1);
+
+        // 同一用户的并发 mark_seen 全部合并
+        std::thread::scope(|scope| {
+            for t in 0..4u64 {
+                let history = &history;
+                scope.spawn(move || {
+                    for i in 0..50u64 {
+                        history.mark_seen(7, &[t * 1000 + i]).unwrap();
+                    }
+                });
+            }
+        });
+        assert_eq!(storage.get_user_history(7).unwrap(), None);
+        assert_eq!(history.stats().dirty_users, 1);
+
+        // 脏用户不会被淘汰
+        history.user(1).unwrap();
+        history.user(2).unwrap();
+        assert!(history.user(7).unwrap().read().contains(3049));
+
+        assert_eq!(history.flush().unwrap(), 1);
+        assert_eq!(history.flush().unwrap(), 0);
+        history.user(3).unwrap();
+        history.user(4).unwrap();
+        assert_eq!(history.stats().cached_users, 2);
+
+        // 淘汰后从 Sled 重新载入
+        let reloaded = history.user(7).unwrap();
+        let filter = reloaded.read();
+        assert!((0..4u64).all(|t| (0..50u64).all(|i| filter.contains(t * 1000 + i))));
+        drop(filter);
+        let _ = std::fs::remove_dir_all(dir);
+    }
+}
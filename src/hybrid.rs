@@ -1,41 +1,321 @@
-use std::collections::HashMap;
+//! 混合检索的多路结果融合
+//!
+//! 每一路召回 (向量、关键词、之后的热度等) 是一个按相关性降序排列的列表，
+//! 融合后只需要前 k 个结果。为此:
+//! - 候选的累积分数放在线程本地、跨请求复用的开放寻址表中 (按代号清空，不逐项清零)
+//! - 最后用 select_nth 选出前 k 个再排序，不对全部候选排序
+//! - RRF 下按排名逐层扫描各路列表，前 k 名已经不可能改变时停止插入新候选
+
+use std::cell::RefCell;
+use std::cmp::Ordering;
 
 /// Reciprocal Rank Fusion
-/// Score = 1 / (k + rank)
-const RRF_K: f32 = 60.0;
+/// Score = Σ weight / (k + rank)
+pub const RRF_K: f32 = 60.0;
 
 #[derive(Debug, Clone)]
 pub struct SearchResult {
     pub id: u32,
-    pub score: f32, // RRF score
+    pub score: f32, // 融合后的分数
+}
+
+/// 一路召回结果 (按相关性降序)
+#[derive(Debug, Clone, Copy)]
+pub enum Hits<'a> {
+    /// 带相似度分数，如向量召回
+    Scored(&'a [(u32, f32)]),
+    /// 只有排名，如关键词召回
+    Ranked(&'a [u32]),
 }
 
-pub fn rrf_merge(
-    vector_results: Vec<(u32, f32)>, // (id, similarity)
-    keyword_results: Vec<u32>,       // id only, rank implies score
-) -> Vec<SearchResult> {
-    let mut scores: HashMap<u32, f32> = HashMap::new();
+#[derive(Debug, Clone, Copy)]
+pub struct Stream<'a> {
+    pub hits: Hits<'a>,
+    pub weight: f32,
+}
+
+impl<'a> Stream<'a> {
+    pub fn scored(hits: &'a [(u32, f32)], weight: f32) -> Self {
+        Self { hits: Hits::Scored(hits), weight }
+    }
+
+    pub fn ranked(ids: &'a [u32], weight: f32) -> Self {
+        Self { hits: Hits::Ranked(ids), weight }
+    }
+
+    fn len(&self) -> usize {
+        match self.hits {
+            Hits::Scored(hits) => hits.len(),
+            Hits::Ranked(ids) => ids.len(),
+        }
+    }
+
+    fn id(&self, rank: usize) -> u32 {
+        match self.hits {
+            Hits::Scored(hits) => hits[rank].0,
+            Hits::Ranked(ids) => ids[rank],
+        }
+    }
+
+    fn rrf(&self, rank: usize) -> f32 {
+        self.weight / (RRF_K + rank as f32 + 1.0)
+    }
 
-    // 1. Process Vector Results
-    for (rank, (id, _sim)) in vector_results.iter().enumerate() {
-        let rrf_score = 1.0 / (RRF_K + rank as f32 + 1.0);
-        *scores.entry(*id).or_insert(0.0) += rrf_score;
+    /// 线性融合用的 [0, 1] 分数: 有分数时按本路的最小 / 最大值归一化，只有排名时按名次线性递减
+    fn normalized(&self, rank: usize, range: (f32, f32)) -> f32 {
+        match self.hits {
+            Hits::Scored(hits) => {
+                let (lo, hi) = range;
+                if hi - lo > f32::EPSILON { (hits[rank].1 - lo) / (hi - lo) } else { 1.0 }
+            }
+            Hits::Ranked(ids) => 1.0 - rank as f32 / ids.len() as f32,
+        }
     }
 
-    // 2. Process Keyword Results
-    for (rank, id) in keyword_results.iter().enumerate() {
-        let rrf_score = 1.0 / (RRF_K + rank as f32 + 1.0);
-        *scores.entry(*id).or_insert(0.0) += rrf_score;
+    fn score_range(&self) -> (f32, f32) {
+        match self.hits {
+            Hits::Scored(hits) => hits.iter().fold((f32::INFINITY, f32::NEG_INFINITY), |(lo, hi), &(_, s)| {
+                (lo.min(s), hi.max(s))
+            }),
+            Hits::Ranked(_) => (0.0, 1.0),
+        }
     }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Fusion {
+    /// 加权 RRF: 只看名次，不受各路分数尺度不同的影响
+    Rrf,
+    /// 各路分数归一化到 [0, 1] 后加权求和
+    Linear,
+}
 
-    // 3. Convert to Vec and Sort
-    let mut results: Vec<SearchResult> = scores
-        .into_iter()
-        .map(|(id, score)| SearchResult { id, score })
-        .collect();
+/// 融合多路召回结果，返回分数最高的 k 个 (分数降序，同分按 id 升序)
+pub fn fuse_top_k(streams: &[Stream], fusion: Fusion, k: usize) -> Vec<SearchResult> {
+    SCRATCH.with(|scratch| scratch.borrow_mut().fuse(streams, fusion, k))
+}
+
+thread_local! {
+    static SCRATCH: RefCell<FusionScratch> = RefCell::new(FusionScratch::default());
+}
 
-    // Sort descending by score
-    results.sort_by(|a, b| b.score.partial_cmp(&a.score).unwrap_or(std::cmp::Ordering::Equal));
+/// RRF 每扫描这么多层排名检查一次能否提前结束 (检查本身是一次 O(候选数) 的选择)
+const EARLY_STOP_CHECK: usize = 8;
+
+/// 跨请求复用的融合缓冲区
+#[derive(Default)]
+struct FusionScratch {
+    // 开放寻址表 (线性探测)，stamps[slot] == generation 表示本次融合占用了该槽位
+    keys: Vec<u32>,
+    scores: Vec<f32>,
+    stamps: Vec<u32>,
+    top_stamps: Vec<u32>, // 提前结束后标记已确定的前 k 名
+    generation: u32,
+    mask: usize,
+    occupied: Vec<usize>,
+    // (分数, id, 槽位)，用于选出前 k 名
+    ranked: Vec<(f32, u32, usize)>,
+}
+
+impl FusionScratch {
+    fn fuse(&mut self, streams: &[Stream], fusion: Fusion, k: usize) -> Vec<SearchResult> {
+        let total: usize = streams.iter().map(Stream::len).sum();
+        if k == 0 || total == 0 {
+            return Vec::new();
+        }
+        self.reset(total);
+
+        match fusion {
+            Fusion::Rrf => self.accumulate_rrf(streams, k),
+            Fusion::Linear => {
+                for stream in streams {
+                    let range = stream.score_range();
+                    for rank in 0..stream.len() {
+                        let slot = self.slot(stream.id(rank));
+                        self.scores[slot] += stream.weight * stream.normalized(rank, range);
+                    }
+                }
+            }
+        }
+
+        self.collect_ranked();
+        let k = k.min(self.ranked.len());
+        if self.ranked.len() > k {
+            self.ranked.select_nth_unstable_by(k - 1, by_score_desc);
+            self.ranked.truncate(k);
+        }
+        self.ranked.sort_unstable_by(by_score_desc);
+        self.ranked.iter().map(|&(score, id, _)| SearchResult { id, score }).collect()
+    }
 
-    results
+    /// 按排名逐层累加 (第 r 层是各路的第 r 名)。
+    /// 扫完 r 层后，任何候选还能增加的分数不超过 Σ weight / (RRF_K + r + 1)；
+    /// 当第 k 名的分数超过第 k + 1 名的分数加上这个上界时，前 k 名的集合不会再变，
+    /// 剩余排名只需给这 k 个候选补上分数 (查表，不再插入新候选)
+    fn accumulate_rrf(&mut self, streams: &[Stream], k: usize) {
+        let depth = streams.iter().map(Stream::len).max().unwrap_or(0);
+        for rank in 0..depth {
+            for stream in streams.iter().filter(|s| rank < s.len()) {
+                let slot = self.slot(stream.id(rank));
+                self.scores[slot] += stream.rrf(rank);
+            }
+
+            let scanned = rank + 1;
+            if scanned % EARLY_STOP_CHECK == 0 && scanned < depth && self.top_k_settled(streams, scanned, k) {
+                for stream in streams {
+                    for deeper in scanned..stream.len() {
+                        if let Some(slot) = self.find(stream.id(deeper)) {
+                            if self.top_stamps[slot] == self.generation {
+                                self.scores[slot] += stream.rrf(deeper);
+                            }
+                        }
+                    }
+                }
+                return;
+            }
+        }
+    }
+
+    fn top_k_settled(&mut self, streams: &[Stream], scanned: usize, k: usize) -> bool {
+        if self.occupied.len() <= k {
+            return false;
+        }
+        let remaining: f32 = streams.iter()
+            .filter(|s| scanned < s.len())
+            .map(|s| s.rrf(scanned))
+            .sum();
+
+        self.collect_ranked();
+        self.ranked.select_nth_unstable_by(k, by_score_desc);
+        let outside = self.ranked[k].0;
+        let kth = self.ranked[..k].iter().map(|r| r.0).fold(f32::INFINITY, f32::min);
+        if kth <= outside + remaining {
+            return false;
+        }
+        for &(_, _, slot) in &self.ranked[..k] {
+            self.top_stamps[slot] = self.generation;
+        }
+        true
+    }
+
+    fn reset(&mut self, entries: usize) {
+        // 负载因子不超过 1/2
+        let capacity = (entries * 2).next_power_of_two().max(64);
+        if self.keys.len() < capacity {
+            self.keys = vec![0; capacity];
+            self.scores = vec![0.0; capacity];
+            self.stamps = vec![0; capacity];
+            self.top_stamps = vec![0; capacity];
+            self.generation = 0;
+        }
+        self.mask = capacity - 1;
+        self.generation = self.generation.wrapping_add(1);
+        if self.generation == 0 {
+            // 代号回绕: 旧的标记可能与新代号相同，只有这时才真正清零
+            self.stamps.fill(0);
+            self.top_stamps.fill(0);
+            self.generation = 1;
+        }
+        self.occupied.clear();
+    }
+
+    fn home(&self, id: u32) -> usize {
+        ((id as u64).wrapping_mul(0x9E37_79B9_7F4A_7C15) >> 32) as usize & self.mask
+    }
+
+    /// id 所在的槽位，不存在时插入 (分数为 0)
+    fn slot(&mut self, id: u32) -> usize {
+        let mut slot = self.home(id);
+        loop {
+            if self.stamps[slot] != self.generation {
+                self.stamps[slot] = self.generation;
+                self.keys[slot] = id;
+                self.scores[slot] = 0.0;
+                self.occupied.push(slot);
+                return slot;
+            }
+            if self.keys[slot] == id {
+                return slot;
+            }
+            slot = (slot + 1) & self.mask;
+        }
+    }
+
+    fn find(&self, id: u32) -> Option<usize> {
+        let mut slot = self.home(id);
+        while self.stamps[slot] == self.generation {
+            if self.keys[slot] == id {
+                return Some(slot);
+            }
+            slot = (slot + 1) & self.mask;
+        }
+        None
+    }
+
+    fn collect_ranked(&mut self) {
+        self.ranked.clear();
+        self.ranked.extend(self.occupied.iter().map(|&slot| (self.scores[slot], self.keys[slot], slot)));
+    }
+}
+
+fn by_score_desc(a: &(f32, u32, usize), b: &(f32, u32, usize)) -> Ordering {
+    b.0.partial_cmp(&a.0).unwrap_or(Ordering::Equal).then(a.1.cmp(&b.1))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::collections::HashMap;
+
+    /// 直接按定义计算的加权 RRF (全部候选排序)
+    fn naive_rrf(streams: &[Stream], k: usize) -> Vec<(u32, f32)> {
+        let mut scores: HashMap<u32, f32> = HashMap::new();
+        for stream in streams {
+            for rank in 0..stream.len() {
+                *scores.entry(stream.id(rank)).or_insert(0.0) += stream.rrf(rank);
+            }
+        }
+        let mut all: Vec<(u32, f32)> = scores.into_iter().collect();
+        all.sort_by(|a, b| b.1.partial_cmp(&a.1).unwrap().then(a.0.cmp(&b.0)));
+        all.truncate(k);
+        all
+    }
+
+    #[test]
+    fn test_fuse_top_k_matches_full_rrf() {
+        // 第一路与第二路头部高度重合，深层互不相同: 会触发提前结束
+        let vector: Vec<(u32, f32)> = (0..200u32).map(|i| (i, 1.0 - i as f32 / 200.0)).collect();
+        let keyword: Vec<u32> = (0..10u32).chain(1000..1190).collect();
+        let popular: Vec<u32> = vec![3, 150, 7];
+        for streams in [
+            vec![Stream::scored(&vector, 1.0), Stream::ranked(&keyword, 1.0)],
+            vec![Stream::scored(&vector, 0.5), Stream::ranked(&keyword, 2.0), Stream::ranked(&popular, 1.0)],
+            vec![Stream::ranked(&keyword, 1.0)],
+        ] {
+            for k in [1, 5, 10, 20, 500] {
+                let fused: Vec<(u32, f32)> = fuse_top_k(&streams, Fusion::Rrf, k)
+                    .into_iter()
+                    .map(|r| (r.id, r.score))
+                    .collect();
+                let expected = naive_rrf(&streams, k);
+                assert_eq!(fused.len(), expected.len());
+                for (got, want) in fused.iter().zip(&expected) {
+                    assert_eq!(got.0, want.0);
+                    assert!((got.1 - want.1).abs() < 1e-6);
+                }
+            }
+        }
+        assert!(fuse_top_k(&[], Fusion::Rrf, 10).is_empty());
+    }
+
+    #[test]
+    fn test_fuse_top_k_linear() {
+        let vector = [(1u32, 0.9f32), (2, 0.5), (3, 0.1)];
+        let keyword = [3u32, 4];
+        let fused = fuse_top_k(&[Stream::scored(&vector, 1.0), Stream::ranked(&keyword, 1.0)], Fusion::Linear, 3);
+        // 1: 1.0；3: 0.0 + 1.0；2: 0.5；4: 0.5 —— 同分按 id 升序
+        let ids: Vec<u32> = fused.iter().map(|r| r.id).collect();
+        assert_eq!(ids, vec![1, 3, 2]);
+        assert!((fused[0].score - 1.0).abs() < 1e-6 && (fused[2].score - 0.5).abs() < 1e-6);
+    }
 }
@@ -0,0 +1,340 @@
+//! 物品批量导入 - 流水线: 流式解析 → 批量编码 → 并行写入各个存储
+//!
+//! 每个阶段 (以及每个写入端) 在独立线程上运行，之间用有界 channel 连接:
+//!
+//!   parse ──▶ encode ──┬──▶ Sled (一批一个 sled::Batch)
+//!                      ├──▶ Tantivy (IndexWriter 内部多线程建索引，输入结束后一次 commit)
+//!                      ├──▶ HNSW (C++ 线程池并行插入)
+//!                      └──▶ catalog / 冷启动时收集物品
+//!
+//! channel 满时上游阻塞 (背压)，整体速度由最慢的阶段决定，同时在内存中的批次数有上限，
+//! 与输入大小无关。编码与各个写入互相重叠: 第 n 批在写入时第 n+1 批已经在推理。
+//!
+//! 输入为 JSON 数组 (assets/products.json 的格式) 或 JSONL，逐个物品解析，不把整个输入读入内存。
+
+use anyhow::{bail, Result};
+use serde::de::{Deserializer as _, SeqAccess, Visitor};
+use std::collections::HashMap;
+use std::fmt;
+use std::io::BufRead;
+use std::sync::{mpsc, Arc};
+use std::time::{Duration, Instant};
+use crate::embedding::EmbeddingModel;
+use crate::ffi::{EmbeddingStore, HnswIndex};
+use crate::model::{generate_category_embedding, Item, ItemJson};
+use crate::storage::Storage;
+use crate::text_search::TextSearch;
+
+/// 每批物品数: 既是一次批量推理的规模，也是每个写入端一次写入的规模
+pub const INGEST_BATCH: usize = 256;
+/// 每个 channel 最多缓冲的批次数
+const CHANNEL_DEPTH: usize = 4;
+
+/// 流水线的一个写入端，在独立线程上依次收到每一批物品
+pub trait Sink: Send {
+    fn write(&mut self, batch: &[Item]) -> Result<()>;
+
+    /// 输入全部写完后调用一次
+    fn finish(&mut self) -> Result<()> {
+        Ok(())
+    }
+}
+
+pub struct StorageSink<'a>(pub &'a Storage);
+
+impl Sink for StorageSink<'_> {
+    fn write(&mut self, batch: &[Item]) -> Result<()> {
+        self.0.save_items(batch)
+    }
+}
+
+pub struct TextSink<'a>(pub &'a TextSearch);
+
+impl Sink for TextSink<'_> {
+    fn write(&mut self, batch: &[Item]) -> Result<()> {
+        self.0.upsert_items(batch)
+    }
+
+    fn finish(&mut self) -> Result<()> {
+        self.0.commit()
+    }
+}
+
+pub struct IndexSink<'a>(pub &'a HnswIndex);
+
+impl Sink for IndexSink<'_> {
+    fn write(&mut self, batch: &[Item]) -> Result<()> {
+        let ids: Vec<u64> = batch.iter().map(|item| item.id).collect();
+        let vectors: Vec<f32> = batch.iter().flat_map(|item| item.embedding.iter().copied()).collect();
+        let added = self.0.add_items_batch(&ids, &vectors, |_, _| {}).map_err(|e| anyhow::anyhow!(e))?;
+        if added != ids.len() {
+            bail!("{} of {} items failed to insert into the HNSW index", ids.len() - added, ids.len());
+        }
+        Ok(())
+    }
+}
+
+/// 以闭包作为写入端 (例如在线导入时更新 catalog)
+pub struct FnSink<F>(pub F);
+
+impl<F: FnMut(&[Item]) -> Result<()> + Send> Sink for FnSink<F> {
+    fn write(&mut self, batch: &[Item]) -> Result<()> {
+        (self.0)(batch)
+    }
+}
+
+/// 收集导入的物品 (冷启动时用来构建 catalog): 向量直接写入连续存储，物品只保留元数据。
+/// 同一 id 出现多次时以最后一次为准
+pub struct CollectSink {
+    items: Vec<Item>,
+    positions: HashMap<u64, usize>,
+    embeddings: EmbeddingStore,
+}
+
+impl CollectSink {
+    pub fn new(dim: usize) -> Result<Self> {
+        let embeddings = EmbeddingStore::new(dim, INGEST_BATCH).map_err(|e| anyhow::anyhow!(e))?;
+        Ok(Self { items: Vec::new(), positions: HashMap::new(), embeddings })
+    }
+
+    pub fn into_parts(self) -> (Vec<Item>, EmbeddingStore) {
+        (self.items, self.embeddings)
+    }
+}
+
+impl Sink for CollectSink {
+    fn write(&mut self, batch: &[Item]) -> Result<()> {
+        for item in batch {
+            self.embeddings.put(item.id, &item.embedding).map_err(|e| anyhow::anyhow!(e))?;
+            let meta = Item {
+                id: item.id,
+                name: item.name.clone(),
+                category: item.category.clone(),
+                image_url: item.image_url.clone(),
+                price: item.price,
+                embedding: Vec::new(),
+                popularity: item.popularity,
+            };
+            match self.positions.get(&item.id) {
+                Some(&pos) => self.items[pos] = meta,
+                None => {
+                    self.positions.insert(item.id, self.items.len());
+                    self.items.push(meta);
+                }
+            }
+        }
+        Ok(())
+    }
+}
+
+#[derive(Debug, Clone, Copy)]
+pub struct IngestStats {
+    pub items: usize,
+    pub elapsed: Duration,
+}
+
+/// 运行导入流水线，所有写入端都处理完最后一批后返回
+///
+/// - `model` 为 None (或某批推理失败) 时使用基于类别的向量
+/// - `popularity(id)` 给出物品的热度 (在编码线程上调用)
+/// - `progress(done)` 每编码完一批在当前线程上调用一次
+///
+/// 任何一个阶段失败都会让整条流水线停止，返回最先出错的写入端 (或解析) 的错误；
+/// 此前已写入的批次不会回滚。
+pub fn run<R, P>(
+    reader: R,
+    model: Option<&EmbeddingModel>,
+    popularity: &dyn Fn(u64) -> f32,
+    sinks: &mut [&mut dyn Sink],
+    mut progress: P,
+) -> Result<IngestStats>
+where
+    R: BufRead + Send,
+    P: FnMut(usize),
+{
+    let start = Instant::now();
+    std::thread::scope(|scope| {
+        let (parsed_tx, parsed_rx) = mpsc::sync_channel::<Vec<ItemJson>>(CHANNEL_DEPTH);
+        let parser = scope.spawn(move || parse_items(reader, |batch| parsed_tx.send(batch).is_ok()));
+
+        let mut senders = Vec::with_capacity(sinks.len());
+        let mut writers = Vec::with_capacity(sinks.len());
+        for sink in sinks.iter_mut() {
+            let (tx, rx) = mpsc::sync_channel::<Arc<Vec<Item>>>(CHANNEL_DEPTH);
+            senders.push(tx);
+            writers.push(scope.spawn(move || -> Result<()> {
+                for batch in rx {
+                    sink.write(&batch)?;
+                }
+                sink.finish()
+            }));
+        }
+
+        // 编码在当前线程上进行 (EmbeddingModel 内部已把一批分摊到所有 Session)，
+        // 结果以 Arc 共享给所有写入端，不拷贝
+        let mut items = 0;
+        'batches: for batch in parsed_rx.iter() {
+            let encoded = Arc::new(encode_items(batch, model, popularity));
+            items += encoded.len();
+            progress(items);
+            for tx in &senders {
+                if tx.send(Arc::clone(&encoded)).is_err() {
+                    // 该写入端已失败退出，错误在下面 join 时取得
+                    break 'batches;
+                }
+            }
+        }
+        drop(parsed_rx);
+        drop(senders);
+
+        // 写入端先于解析: 写入端失败时解析会因下游关闭而中途停止，它的错误只是结果
+        let mut result = Ok(());
+        for handle in writers.into_iter().chain(std::iter::once(parser)) {
+            let outcome = handle.join().unwrap_or_else(|_| Err(anyhow::anyhow!("ingest stage panicked")));
+            if result.is_ok() {
+                result = outcome;
+            }
+        }
+        result.map(|()| IngestStats { items, elapsed: start.elapsed() })
+    })
+}
+
+fn encode_items(batch: Vec<ItemJson>, model: Option<&EmbeddingModel>, popularity: &dyn Fn(u64) -> f32) -> Vec<Item> {
+    let embeddings = model.and_then(|model| {
+        let names: Vec<&str> = batch.iter().map(|json| json.name.as_str()).collect();
+        model.encode_batch(&names)
+            .map_err(|e| eprintln!("⚠️  Batch encoding failed ({}), using category-based vectors", e))
+            .ok()
+    });
+    let embeddings = embeddings
+        .unwrap_or_else(|| batch.iter().map(|json| generate_category_embedding(&json.category)).collect());
+
+    batch.into_iter()
+        .zip(embeddings)
+        .map(|(json, embedding)| {
+            let popularity = popularity(json.id);
+            Item::from_json(json, embedding, popularity)
+        })
+        .collect()
+}
+
+/// 流式解析 JSON 数组或 JSONL (以第一个非空白字符区分)，每 INGEST_BATCH 个物品交给 emit 一次。
+/// emit 返回 false 表示下游已停止，解析随之结束
+fn parse_items<R: BufRead>(mut reader: R, mut emit: impl FnMut(Vec<ItemJson>) -> bool) -> Result<()> {
+    let is_array = loop {
+        let buf = reader.fill_buf()?;
+        if buf.is_empty() {
+            return Ok(());
+        }
+        match buf.iter().position(|b| !b.is_ascii_whitespace()) {
+            Some(pos) => {
+                let first = buf[pos];
+                reader.consume(pos);
+                break first == b'[';
+            }
+            None => {
+                let len = buf.len();
+                reader.consume(len);
+            }
+        }
+    };
+
+    let mut batch = Vec::with_capacity(INGEST_BATCH);
+    let mut stopped = false;
+    let mut push = |item: ItemJson| -> bool {
+        batch.push(item);
+        if batch.len() == INGEST_BATCH && !emit(std::mem::replace(&mut batch, Vec::with_capacity(INGEST_BATCH))) {
+            stopped = true;
+        }
+        !stopped
+    };
+
+    let mut de = serde_json::Deserializer::from_reader(reader);
+    if is_array {
+        let result = (&mut de).deserialize_seq(ItemSeqVisitor(&mut push));
+        // 下游停止时数组没有读完，此时的 "trailing characters" 之类错误没有意义
+        if !stopped {
+            result?;
+            de.end()?;
+        }
+    } else {
+        for item in de.into_iter::<ItemJson>() {
+            if !push(item?) {
+                break;
+            }
+        }
+    }
+
+    if !stopped && !batch.is_empty() {
+        emit(batch);
+    }
+    Ok(())
+}
+
+/// 逐个元素反序列化 JSON 数组，不构造整个 Vec
+struct ItemSeqVisitor<F>(F);
+
+impl<'de, F: FnMut(ItemJson) -> bool> Visitor<'de> for ItemSeqVisitor<F> {
+    type Value = ();
+
+    fn expecting(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.write_str("an array of items")
+    }
+
+    fn visit_seq<A: SeqAccess<'de>>(mut self, mut seq: A) -> Result<(), A::Error> {
+        while let Some(item) = seq.next_element::<ItemJson>()? {
+            if !(self.0)(item) {
+                break;
+            }
+        }
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn products(n: u64) -> Vec<String> {
+        (0..n)
+            .map(|id| format!(
+                r#"{{"id": {}, "title": "Item {}", "category": "Books", "image_url": "", "price": 9.5}}"#,
+                id, id
+            ))
+            .collect()
+    }
+
+    #[test]
+    fn test_ingest_pipeline_streams_into_every_sink() {
+        let lines = products(INGEST_BATCH as u64 * 2 + 10);
+        let array = format!("  [{}]", lines.join(",\n"));
+        let jsonl = lines.join("\n");
+
+        for input in [array.as_str(), jsonl.as_str()] {
+            let mut batches = Vec::new();
+            let mut collect = CollectSink::new(crate::model::DIM).unwrap();
+            let mut record = FnSink(|batch: &[Item]| -> Result<()> {
+                batches.push(batch.len());
+                Ok(())
+            });
+            let stats = run(input.as_bytes(), None, &|id| id as f32, &mut [&mut collect, &mut record], |_| {}).unwrap();
+            drop(record);
+
+            assert_eq!(stats.items, lines.len());
+            assert_eq!(batches, vec![INGEST_BATCH, INGEST_BATCH, 10]);
+            let (items, embeddings) = collect.into_parts();
+            assert_eq!(items.len(), lines.len());
+            assert_eq!(embeddings.len(), lines.len());
+            assert!(items.iter().all(|item| item.embedding.is_empty() && item.popularity == item.id as f32));
+        }
+
+        // 写入端失败: 流水线停止并返回它的错误，而不是解析被中断的错误
+        let mut failing = FnSink(|_: &[Item]| -> Result<()> { bail!("disk full") });
+        let err = run(array.as_bytes(), None, &|_| 0.5, &mut [&mut failing], |_| {}).unwrap_err();
+        assert!(err.to_string().contains("disk full"));
+
+        // 格式错误
+        let mut ignore = FnSink(|_: &[Item]| -> Result<()> { Ok(()) });
+        assert!(run(&b"[{\"id\": 1}]"[..], None, &|_| 0.5, &mut [&mut ignore], |_| {}).is_err());
+    }
+}
@@ -1,34 +1,84 @@
 //! Mini-RecSys - 混合 Rust/C++ 推荐系统 Demo
 
+mod catalog;
 mod ffi;
 mod model;
 mod storage;
 mod embedding;
 mod text_search;
 mod hybrid;
+mod query_cache;
+mod history;
+mod ingest;
+mod metrics;
 
 use anyhow::Result;
 use axum::{
-    extract::{Query, State},
-    http::StatusCode,
-    response::Json,
+    body::Bytes,
+    extract::{DefaultBodyLimit, Query, State},
+    http::{header, StatusCode},
+    response::{IntoResponse, Json, Response},
     routing::{get, post},
     Router,
 };
-use fastbloom_rs::Membership;
-use ffi::{add_item_to_hnsw, get_hnsw_count, hnsw_search, load_hnsw_index, save_hnsw_index};
-use model::{generate_category_embedding, generate_user_embedding, generate_random_embedding, Item, ItemJson, User, DIM};
+use catalog::Catalog;
+use ffi::{AttributeFilter, EmbeddingStore, HnswConfig, HnswIndex, VectorStorage};
+use history::SeenHistory;
+use metrics::{write_counter, write_gauge, Metrics, Stage};
+use model::{generate_category_embedding, generate_user_interests, generate_random_embedding, Item, User, DIM};
+use query_cache::QueryCache;
 use serde::{Deserialize, Serialize};
 use std::collections::HashMap;
-use std::sync::{Arc, Mutex};
+use std::sync::{Arc, Mutex, RwLock, RwLockReadGuard, RwLockWriteGuard};
+use std::time::{Duration, Instant};
 use storage::Storage;
 use text_search::TextSearch;
 use tower_http::cors::CorsLayer;
 use axum::http::{Method, HeaderValue};
 
 const INDEX_PATH: &str = "data/index.bin";
+/// 索引的预写日志: 记录上次快照之后的修改，启动时在快照上重放
+const INDEX_LOG_PATH: &str = "data/index.wal";
 const DB_PATH: &str = "data/db";
+/// 数据库为空时导入的物品文件 (JSON 数组或 JSONL)
+const PRODUCTS_PATH: &str = "assets/products.json";
+/// /items/bulk 的请求体上限
+const BULK_LOAD_MAX_BYTES: usize = 256 * 1024 * 1024;
 const MIN_RECOMMENDATIONS: usize = 5;
+/// /recommend 返回的推荐数
+const RECOMMEND_RESULTS: usize = 10;
+
+/// 各接口的召回数量 (k) 与搜索深度 (ef)
+/// ef 随每次查询传入 C++，不会修改索引的共享状态，因此各接口可以独立调优
+const RECOMMEND_K: usize = 100;
+const RECOMMEND_EF: usize = 200;
+const SEARCH_K: usize = 50;
+const SEARCH_EF: usize = 80;
+/// /search 返回的融合结果数
+const SEARCH_RESULTS: usize = 20;
+/// 物品数不超过该值时 /search 的向量召回直接走精确搜索 (开销约 1ms，召回率 100%)
+const EXACT_SEARCH_MAX_ITEMS: usize = 10_000;
+/// 索引的向量存储格式。物品规模大到索引内存成为瓶颈时改为 `Int8` (约为 float32 的 1/4)
+/// 或 `Pq { subspaces: 48 }` (每物品 49 字节)，修改后已有的索引文件会在启动时被重建
+const INDEX_STORAGE: VectorStorage = VectorStorage::Float32;
+/// 量化索引上 /search 取的候选数，再用原始向量精确重排序
+const SEARCH_RESCORE_CANDIDATES: usize = SEARCH_K * 3;
+/// 训练 PQ 码本时从物品向量中均匀抽取的样本数上限
+const PQ_TRAIN_SAMPLES: usize = 65_536;
+/// /search 的查询向量缓存: 每项约 1.5KB (384 个 f32)，1 万项约 16MB
+const QUERY_CACHE_CAPACITY: usize = 10_000;
+const QUERY_CACHE_SHARDS: usize = 16;
+/// 常驻内存的用户浏览历史: 过滤器随用户历史增长，轻度用户只有几百字节
+const SEEN_CACHE_USERS: usize = 10_000;
+const SEEN_CACHE_SHARDS: usize = 16;
+/// 浏览历史批量回写 Sled 的周期，也是进程崩溃时最多丢失的 mark_seen 时间窗口
+const SEEN_FLUSH_INTERVAL: Duration = Duration::from_secs(1);
+/// 后台快照: 自上次快照以来累计 SNAPSHOT_MUTATIONS 次修改，或距上次快照超过
+/// SNAPSHOT_INTERVAL 且有修改时写一次索引文件。两次快照之间的修改由预写日志保证不丢，
+/// 快照间隔决定的是日志长度 (即启动时的重放耗时)
+const SNAPSHOT_INTERVAL: Duration = Duration::from_secs(300);
+const SNAPSHOT_MUTATIONS: u64 = 10_000;
+const SNAPSHOT_CHECK_TICK: Duration = Duration::from_secs(5);
 
 // ============================================================================
 // AppState
@@ -36,11 +86,41 @@ const MIN_RECOMMENDATIONS: usize = 5;
 
 pub struct AppState {
     pub storage: Arc<Storage>,
+    /// 用户 "已看过" 过滤器的内存缓存，修改由后台任务批量写回 Sled
+    pub seen: SeenHistory,
     pub users: Vec<User>,
-    pub items: Vec<Item>,
-    pub item_map: HashMap<u64, usize>,
+    /// uid -> users 中的下标
+    pub user_index: HashMap<u64, usize>,
+    /// 在线请求的文本编码队列: 并发请求合并为批次推理 (模型未加载时为 None)
+    pub encoder: Option<embedding::EncodeQueue>,
+    /// 批量导入直接按批推理，不经过在线请求的编码队列
     pub embedding_model: Option<Arc<embedding::EmbeddingModel>>,
+    /// 规范化查询文本 -> 归一化的查询向量
+    pub query_cache: QueryCache<Arc<[f32]>>,
     pub text_search: Arc<TextSearch>,
+    /// 向量索引句柄: 搜索只持有 C++ 侧的读锁，多个请求可以并发检索
+    pub hnsw: HnswIndex,
+    /// 物品元数据、向量与类别编号；读请求持有读锁，物品的在线更新持有写锁
+    pub catalog: RwLock<Catalog>,
+    /// 串行化物品的新增 / 更新 / 删除 (跨越 Sled、Tantivy、HNSW 与 catalog 的多步写入)
+    pub item_writes: Mutex<()>,
+    /// 各阶段耗时与检索开销，见 /metrics
+    pub metrics: Metrics,
+}
+
+impl AppState {
+    fn user(&self, uid: u64) -> Option<&User> {
+        self.user_index.get(&uid).map(|&idx| &self.users[idx])
+    }
+
+    fn catalog(&self) -> RwLockReadGuard<'_, Catalog> {
+        // 写者 panic 时 catalog 的每一步修改都是完整的，继续使用即可
+        self.catalog.read().unwrap_or_else(|e| e.into_inner())
+    }
+
+    fn catalog_mut(&self) -> RwLockWriteGuard<'_, Catalog> {
+        self.catalog.write().unwrap_or_else(|e| e.into_inner())
+    }
 }
 
 // ============================================================================
@@ -50,29 +130,45 @@ pub struct AppState {
 #[derive(Deserialize)]
 struct RecommendQuery { uid: u64 }
 
+/// 字段借用自 catalog，响应在持有 catalog 读锁期间直接序列化，不拷贝字符串
 #[derive(Serialize)]
-struct RecommendItem {
+struct RecommendItem<'a> {
     item_id: u64,
-    name: String,
-    category: String,
-    image_url: String,
+    name: &'a str,
+    category: &'a str,
+    image_url: &'a str,
     price: f32,
     sim_score: f32,
     popularity: f32,
     final_score: f32,
 }
 
+impl<'a> RecommendItem<'a> {
+    fn new(item: &'a Item, sim_score: f32) -> Self {
+        Self {
+            item_id: item.id,
+            name: &item.name,
+            category: &item.category,
+            image_url: &item.image_url,
+            price: item.price,
+            sim_score,
+            popularity: item.popularity,
+            final_score: sim_score * 0.7 + item.popularity * 0.3,
+        }
+    }
+}
+
 #[derive(Serialize)]
-struct UserInfo { id: u64, name: String }
+struct UserInfo<'a> { id: u64, name: &'a str }
 
 #[derive(Serialize)]
-struct RecommendResponse { user: UserInfo, recommendations: Vec<RecommendItem>, filtered_count: usize }
+struct RecommendResponse<'a> { user: UserInfo<'a>, recommendations: Vec<RecommendItem<'a>>, filtered_count: usize }
 
 #[derive(Serialize)]
 struct ErrorResponse { error: String }
 
 #[derive(Serialize)]
-struct UsersResponse { users: Vec<UserInfo> }
+struct UsersResponse<'a> { users: Vec<UserInfo<'a>> }
 
 #[derive(Deserialize)]
 struct MarkSeenRequest { uid: u64, item_ids: Vec<u64> }
@@ -81,10 +177,57 @@ struct MarkSeenRequest { uid: u64, item_ids: Vec<u64> }
 struct MarkSeenResponse { marked: usize }
 
 #[derive(Deserialize)]
-struct SearchQuery { q: String }
+struct SearchQuery {
+    q: String,
+    /// 逗号分隔的类别名，例如 `Electronics,Books`
+    category: Option<String>,
+    /// 价格区间 [min_price, max_price)
+    min_price: Option<f32>,
+    max_price: Option<f32>,
+}
+
+impl SearchQuery {
+    /// 把查询参数转换为属性过滤条件，未指定任何属性时返回 None
+    fn attribute_filter(&self, category_ids: &HashMap<String, u32>) -> Option<AttributeFilter> {
+        if self.category.is_none() && self.min_price.is_none() && self.max_price.is_none() {
+            return None;
+        }
+        // 未知的类别名不匹配任何物品
+        let categories = self.category.as_ref().map(|list| {
+            list.split(',')
+                .filter_map(|name| category_ids.get(name.trim()).copied())
+                .collect()
+        });
+        Some(AttributeFilter { categories, min_price: self.min_price, max_price: self.max_price })
+    }
+}
+
+#[derive(Serialize)]
+struct SearchResponse<'a> { query: String, results: Vec<RecommendItem<'a>> }
+
+#[derive(Deserialize)]
+struct UpsertItemRequest {
+    id: u64,
+    #[serde(rename = "title")]
+    name: String,
+    category: String,
+    #[serde(default)]
+    image_url: String,
+    price: f32,
+    /// 缺省时保留原值，新物品为 0.5
+    popularity: Option<f32>,
+    /// 缺省时由 ONNX 模型根据标题生成
+    embedding: Option<Vec<f32>>,
+}
+
+#[derive(Deserialize)]
+struct DeleteItemRequest { id: u64 }
+
+#[derive(Serialize)]
+struct ItemWriteResponse { item_id: u64, created: bool }
 
 #[derive(Serialize)]
-struct SearchResponse { query: String, results: Vec<RecommendItem> }
+struct BulkLoadResponse { loaded: usize, elapsed_ms: u64 }
 
 // ============================================================================
 // Handlers
@@ -93,154 +236,176 @@ struct SearchResponse { query: String, results: Vec<RecommendItem> }
 async fn recommend_handler(
     State(state): State<Arc<AppState>>,
     Query(params): Query<RecommendQuery>,
-) -> Result<Json<RecommendResponse>, (StatusCode, Json<ErrorResponse>)> {
-    let user = state.users.iter()
-        .find(|u| u.id == params.uid)
+) -> Result<Response, (StatusCode, Json<ErrorResponse>)> {
+    let user = state.user(params.uid)
         .ok_or_else(|| (StatusCode::NOT_FOUND, Json(ErrorResponse {
             error: format!("User {} not found", params.uid),
         })))?;
 
-    // Step A: 召回 Top-100
-    let candidates = hnsw_search(&user.embedding, 100);
-
-    // Step B: 获取用户的 Bloom Filter
-    let filter = state.storage.get_user_filter(params.uid)
+    // Step A: 获取用户的 "已看过" 过滤器 (常驻内存，只在第一次访问时从 Sled 载入)
+    let started = Instant::now();
+    let history = state.seen.user(params.uid)
         .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
             error: format!("Failed to get filter: {}", e),
         })))?;
+    let filter = history.read();
+    state.metrics.observe(Stage::RecommendHistoryLoad, started.elapsed());
 
-    // Step C: 过滤已看过的商品
+    // Step B: 带过滤的多兴趣召回 Top-100
+    // 用户的每个兴趣向量都参与召回，C++ 侧按物品去重并取各兴趣中的最高相似度。
+    // "已看过" 的判断下推到 HNSW 图遍历中: 被过滤的商品仍用于导航但不进入结果，
+    // 因此重度用户也能一次拿到 100 个新鲜候选，而不是先取 100 个再被过滤掉大半
+    let started = Instant::now();
+    let before = ffi::thread_search_metrics();
     let mut filtered_count = 0;
+    let candidates = state.hnsw.search_multi(&user.interests, RECOMMEND_K, RECOMMEND_EF, |item_id| {
+        let seen = filter.contains(item_id);
+        if seen {
+            filtered_count += 1;
+        }
+        !seen
+    });
+    state.metrics.record_search(&ffi::thread_search_metrics().since(&before));
+    state.metrics.observe(Stage::RecommendHnswSearch, started.elapsed());
+
+    // Step C: 组装候选并按最终分数选出前 RECOMMEND_RESULTS 个
+    let started = Instant::now();
+    let catalog = state.catalog();
     let mut recommendations: Vec<RecommendItem> = candidates.into_iter()
-        .filter_map(|(item_id, sim_score)| {
-            // 检查是否已看过
-            if filter.contains(&item_id.to_le_bytes()) {
-                filtered_count += 1;
-                return None;
-            }
-            
-            let idx = *state.item_map.get(&item_id)?;
-            let item = &state.items[idx];
-            let final_score = sim_score * 0.7 + item.popularity * 0.3;
-            Some(RecommendItem {
-                item_id,
-                name: item.name.clone(),
-                category: item.category.clone(),
-                image_url: item.image_url.clone(),
-                price: item.price,
-                sim_score,
-                popularity: item.popularity,
-                final_score,
-            })
-        })
+        .filter_map(|(item_id, sim_score)| Some(RecommendItem::new(catalog.get(item_id)?, sim_score)))
         .collect();
+    recommendations.sort_unstable_by(|a, b| b.final_score.total_cmp(&a.final_score));
+    recommendations.truncate(RECOMMEND_RESULTS);
 
-    recommendations.sort_by(|a, b| b.final_score.partial_cmp(&a.final_score).unwrap());
-    
     // Step D: 降级填充 (Fallback)
+    // 按热度从高到低补充未看过的物品；热度索引由 catalog 维护，补满即停止遍历
     if recommendations.len() < MIN_RECOMMENDATIONS {
-        // 从热门商品中随机补充
-        let mut popular_items: Vec<_> = state.items.iter()
-            .filter(|item| !filter.contains(&item.id.to_le_bytes()))
+        let fill: Vec<RecommendItem> = catalog.popular()
+            .filter(|item| !filter.contains(item.id) && !recommendations.iter().any(|r| r.item_id == item.id))
+            .take(MIN_RECOMMENDATIONS - recommendations.len())
+            .map(|item| RecommendItem::new(item, 0.0))
             .collect();
-        popular_items.sort_by(|a, b| b.popularity.partial_cmp(&a.popularity).unwrap());
-        
-        for item in popular_items.into_iter().take(MIN_RECOMMENDATIONS - recommendations.len()) {
-            if !recommendations.iter().any(|r| r.item_id == item.id) {
-                recommendations.push(RecommendItem {
-                    item_id: item.id,
-                    name: item.name.clone(),
-                    category: item.category.clone(),
-                    image_url: item.image_url.clone(),
-                    price: item.price,
-                    sim_score: 0.0,
-                    popularity: item.popularity,
-                    final_score: item.popularity * 0.3,
-                });
-            }
-        }
+        recommendations.extend(fill);
     }
-    
-    recommendations.truncate(10);
 
-    Ok(Json(RecommendResponse {
-        user: UserInfo { id: user.id, name: user.name.clone() },
+    let response = Json(RecommendResponse {
+        user: UserInfo { id: user.id, name: &user.name },
         recommendations,
         filtered_count,
-    }))
+    })
+    .into_response();
+    state.metrics.observe(Stage::RecommendResponseBuild, started.elapsed());
+    Ok(response)
 }
 
 async fn mark_seen_handler(
     State(state): State<Arc<AppState>>,
     Json(payload): Json<MarkSeenRequest>,
 ) -> Result<Json<MarkSeenResponse>, (StatusCode, Json<ErrorResponse>)> {
-    // 加载用户的 Filter
-    let mut filter = state.storage.get_user_filter(payload.uid)
+    // 只修改内存中的过滤器 (同一用户的并发请求在其写锁上合并)，由后台任务批量写回 Sled
+    state.seen.mark_seen(payload.uid, &payload.item_ids)
         .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
-            error: format!("Failed to get filter: {}", e),
-        })))?;
-    
-    // 插入所有 item_id
-    for item_id in &payload.item_ids {
-        filter.add(&item_id.to_le_bytes());
-    }
-    
-    // 保存回 Sled
-    state.storage.save_user_filter(payload.uid, &filter)
-        .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
-            error: format!("Failed to save filter: {}", e),
+            error: format!("Failed to update filter: {}", e),
         })))?;
-    
+
     Ok(Json(MarkSeenResponse { marked: payload.item_ids.len() }))
 }
 
-async fn users_handler(State(state): State<Arc<AppState>>) -> Json<UsersResponse> {
+async fn users_handler(State(state): State<Arc<AppState>>) -> Response {
     let users = state.users.iter()
-        .map(|u| UserInfo { id: u.id, name: u.name.clone() })
+        .map(|u| UserInfo { id: u.id, name: &u.name })
         .collect();
-    Json(UsersResponse { users })
+    Json(UsersResponse { users }).into_response()
+}
+
+/// 编码队列已满时返回 503 (推理跟不上，客户端稍后重试)，其他编码错误返回 500
+fn encoding_error(e: anyhow::Error) -> (StatusCode, Json<ErrorResponse>) {
+    let status = if e.is::<embedding::QueueFull>() {
+        StatusCode::SERVICE_UNAVAILABLE
+    } else {
+        StatusCode::INTERNAL_SERVER_ERROR
+    };
+    (status, Json(ErrorResponse { error: format!("Encoding failed: {}", e) }))
 }
 
 async fn search_handler(
     State(state): State<Arc<AppState>>,
     Query(params): Query<SearchQuery>,
-) -> Result<Json<SearchResponse>, (StatusCode, Json<ErrorResponse>)> {
-    let model = state.embedding_model.as_ref()
+) -> Result<Response, (StatusCode, Json<ErrorResponse>)> {
+    let encoder = state.encoder.as_ref()
         .ok_or_else(|| (StatusCode::SERVICE_UNAVAILABLE, Json(ErrorResponse {
             error: "Embedding model not loaded".to_string(),
         })))?;
 
-    // 1. Semantic Search (Vector)
-    let query_vec = model.encode(&params.q)
-        .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
-            error: format!("Encoding failed: {}", e),
-        })))?;
-    
-    let vec_candidates = hnsw_search(&query_vec, 50); // Top 50 vector results
+    // 1. Semantic Search (Vector): 热门查询直接命中缓存，跳过分词与推理
+    let started = Instant::now();
+    let cache_key = query_cache::normalize_query(&params.q);
+    let query_vec = match state.query_cache.get(&cache_key) {
+        Some(query_vec) => query_vec,
+        None => {
+            let query_vec: Arc<[f32]> = encoder.encode(cache_key.clone())
+                .await
+                .map_err(encoding_error)?
+                .into();
+            state.query_cache.insert(cache_key, Arc::clone(&query_vec));
+            query_vec
+        }
+    };
+    state.metrics.observe(Stage::SearchEmbed, started.elapsed());
+
+    let catalog = state.catalog();
+    let attr_filter = params.attribute_filter(catalog.category_ids());
+    let started = Instant::now();
+    let before = ffi::thread_search_metrics();
+    let vec_candidates = match &attr_filter {
+        // 过滤条件下推到 C++，保证过滤后仍能召回足够的结果
+        Some(filter) => state.hnsw.search_with_attributes(&query_vec, SEARCH_K, SEARCH_EF, filter),
+        None if catalog.len() <= EXACT_SEARCH_MAX_ITEMS => catalog.embeddings().search(&query_vec, SEARCH_K),
+        None if state.hnsw.storage() != VectorStorage::Float32 => state.hnsw.search_rescored(
+            &query_vec, SEARCH_K, SEARCH_EF, SEARCH_RESCORE_CANDIDATES, catalog.embeddings(),
+        ),
+        None => state.hnsw.search_with_ef(&query_vec, SEARCH_K, SEARCH_EF), // Top 50 vector results
+    };
+    state.metrics.record_search(&ffi::thread_search_metrics().since(&before));
+    state.metrics.observe(Stage::SearchHnswSearch, started.elapsed());
     let vec_results: Vec<(u32, f32)> = vec_candidates.into_iter()
         .map(|(id, score)| (id as u32, score))
         .collect();
 
     // 2. Keyword Search (Tantivy)
-    let kw_results = state.text_search.search(&params.q, 50)
+    let started = Instant::now();
+    let mut kw_results = state.text_search.search(&params.q, SEARCH_K)
         .map_err(|e| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
             error: format!("Text search failed: {}", e),
         })))?;
+    if let Some(filter) = &attr_filter {
+        kw_results.retain(|&id| {
+            catalog.get(id as u64)
+                .map(|item| item_matches_filter(item, filter, catalog.category_ids()))
+                .unwrap_or(false)
+        });
+    }
+    state.metrics.observe(Stage::SearchTextSearch, started.elapsed());
 
-    // 3. RRF Merge
-    let merged_results = hybrid::rrf_merge(vec_results, kw_results);
+    // 3. RRF Merge (只选出前 SEARCH_RESULTS 个)
+    let started = Instant::now();
+    let streams = [
+        hybrid::Stream::scored(&vec_results, 1.0),
+        hybrid::Stream::ranked(&kw_results, 1.0),
+    ];
+    let merged_results = hybrid::fuse_top_k(&streams, hybrid::Fusion::Rrf, SEARCH_RESULTS);
+    state.metrics.observe(Stage::SearchFusion, started.elapsed());
 
     // 4. Transform to Response
+    let started = Instant::now();
     let results: Vec<RecommendItem> = merged_results.into_iter()
-        .take(20)
         .filter_map(|res| {
-            let idx = *state.item_map.get(&(res.id as u64))?;
-            let item = &state.items[idx];
+            let item = catalog.get(res.id as u64)?;
             Some(RecommendItem {
                 item_id: res.id as u64,
-                name: item.name.clone(),
-                category: item.category.clone(),
-                image_url: item.image_url.clone(),
+                name: &item.name,
+                category: &item.category,
+                image_url: &item.image_url,
                 price: item.price,
                 sim_score: res.score, // RRF Score
                 popularity: item.popularity,
@@ -249,11 +414,213 @@ async fn search_handler(
         })
         .collect();
 
-    Ok(Json(SearchResponse { query: params.q, results }))
+    let response = Json(SearchResponse { query: params.q, results }).into_response();
+    state.metrics.observe(Stage::SearchResponseBuild, started.elapsed());
+    Ok(response)
+}
+
+/// 关键词召回结果的属性过滤 (与 C++ 侧的判定规则一致)
+fn item_matches_filter(item: &Item, filter: &AttributeFilter, category_ids: &HashMap<String, u32>) -> bool {
+    if let Some(categories) = &filter.categories {
+        match category_ids.get(&item.category) {
+            Some(c) if categories.contains(c) => {}
+            _ => return false,
+        }
+    }
+    let price = item.price;
+    filter.min_price.map_or(true, |min| price >= min) && filter.max_price.map_or(true, |max| price < max)
+}
+
+/// 新增或更新一个物品: 依次写入 HNSW 索引、Sled、Tantivy 与内存中的 catalog
+///
+/// 先写索引: 索引已满等失败时不留下任何副作用。后续步骤失败时，
+/// 下次启动的对账会以 Sled 为准修正索引。
+async fn upsert_item_handler(
+    State(state): State<Arc<AppState>>,
+    Json(payload): Json<UpsertItemRequest>,
+) -> Result<Json<ItemWriteResponse>, (StatusCode, Json<ErrorResponse>)> {
+    let internal_error = |e: String| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse { error: e }));
+
+    // 编码在写锁之外进行 (ONNX 推理是整个请求中最慢的一步)
+    let embedding = match payload.embedding {
+        Some(embedding) if embedding.len() != DIM => {
+            return Err((StatusCode::BAD_REQUEST, Json(ErrorResponse {
+                error: format!("Embedding has dimension {}, expected {}", embedding.len(), DIM),
+            })));
+        }
+        Some(embedding) => embedding,
+        None => match &state.encoder {
+            Some(encoder) => encoder.encode(payload.name.clone())
+                .await
+                .map_err(encoding_error)?,
+            None => generate_category_embedding(&payload.category),
+        },
+    };
+
+    let _writes = state.item_writes.lock().unwrap_or_else(|e| e.into_inner());
+    let popularity = payload.popularity
+        .or_else(|| state.catalog().get(payload.id).map(|item| item.popularity))
+        .unwrap_or(0.5);
+    let item = Item {
+        id: payload.id,
+        name: payload.name,
+        category: payload.category,
+        image_url: payload.image_url,
+        price: payload.price,
+        embedding,
+        popularity,
+    };
+
+    state.hnsw.add_item(item.id, &item.embedding).map_err(internal_error)?;
+    state.storage.save_item(&item).map_err(|e| internal_error(format!("Failed to save item: {}", e)))?;
+    state.text_search.upsert_item(&item).map_err(|e| internal_error(format!("Failed to index item: {}", e)))?;
+
+    let mut catalog = state.catalog_mut();
+    let category = catalog.category_id(&item.category);
+    state.hnsw.set_attributes(item.id, category, item.price).map_err(internal_error)?;
+    let item_id = item.id;
+    let created = catalog.upsert(item).map_err(internal_error)?;
+
+    Ok(Json(ItemWriteResponse { item_id, created }))
+}
+
+/// 删除一个物品: 从 HNSW 索引 (标记删除)、Sled、Tantivy 与 catalog 中移除
+async fn delete_item_handler(
+    State(state): State<Arc<AppState>>,
+    Json(payload): Json<DeleteItemRequest>,
+) -> Result<Json<ItemWriteResponse>, (StatusCode, Json<ErrorResponse>)> {
+    let internal_error = |e: String| (StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse { error: e }));
+
+    let _writes = state.item_writes.lock().unwrap_or_else(|e| e.into_inner());
+    if state.catalog().get(payload.id).is_none() {
+        return Err((StatusCode::NOT_FOUND, Json(ErrorResponse {
+            error: format!("Item {} not found", payload.id),
+        })));
+    }
+
+    // 索引中缺失 (例如上一次删除在中途失败) 不影响其余步骤
+    if let Err(e) = state.hnsw.remove(payload.id) {
+        eprintln!("⚠️  {}", e);
+    }
+    state.storage.delete_item(payload.id).map_err(|e| internal_error(format!("Failed to delete item: {}", e)))?;
+    state.text_search.delete_item(payload.id).map_err(|e| internal_error(format!("Failed to unindex item: {}", e)))?;
+    state.catalog_mut().remove(payload.id);
+
+    Ok(Json(ItemWriteResponse { item_id: payload.id, created: false }))
+}
+
+/// 批量导入物品: 请求体为 JSON 数组或 JSONL (格式同 products.json)，
+/// 经导入流水线并行写入 Sled、Tantivy、HNSW 与 catalog
+///
+/// 与 /items/upsert 不同，各存储的写入互相重叠，中途失败时已写入的批次不回滚:
+/// 重试同一请求即可 (写入都是按 id 覆盖)，下次启动的对账也会以 Sled 为准修正索引。
+async fn bulk_load_handler(
+    State(state): State<Arc<AppState>>,
+    body: Bytes,
+) -> Result<Json<BulkLoadResponse>, (StatusCode, Json<ErrorResponse>)> {
+    // 解析、推理与写入都是阻塞操作，整个导入放到阻塞线程池
+    let result = tokio::task::spawn_blocking(move || bulk_load(&state, &body)).await;
+    match result {
+        Ok(Ok(stats)) => Ok(Json(BulkLoadResponse {
+            loaded: stats.items,
+            elapsed_ms: stats.elapsed.as_millis() as u64,
+        })),
+        Ok(Err(e)) => {
+            let status = if e.is::<serde_json::Error>() {
+                StatusCode::BAD_REQUEST
+            } else {
+                StatusCode::INTERNAL_SERVER_ERROR
+            };
+            Err((status, Json(ErrorResponse { error: format!("Bulk load failed: {}", e) })))
+        }
+        Err(e) => Err((StatusCode::INTERNAL_SERVER_ERROR, Json(ErrorResponse {
+            error: format!("Bulk load task panicked: {}", e),
+        }))),
+    }
+}
+
+fn bulk_load(state: &AppState, body: &[u8]) -> Result<ingest::IngestStats> {
+    let _writes = state.item_writes.lock().unwrap_or_else(|e| e.into_inner());
+
+    // 已有物品沿用原来的热度
+    let popularity = |id: u64| state.catalog().get(id).map_or_else(rand::random::<f32>, |item| item.popularity);
+    let mut sled_sink = ingest::StorageSink(&state.storage);
+    let mut text_sink = ingest::TextSink(&state.text_search);
+    let mut index_sink = ingest::IndexSink(&state.hnsw);
+    let mut catalog_sink = ingest::FnSink(|batch: &[Item]| -> Result<()> {
+        let mut catalog = state.catalog_mut();
+        for item in batch {
+            let category = catalog.category_id(&item.category);
+            state.hnsw.set_attributes(item.id, category, item.price).map_err(|e| anyhow::anyhow!(e))?;
+            catalog.upsert(item.clone()).map_err(|e| anyhow::anyhow!(e))?;
+        }
+        Ok(())
+    });
+
+    ingest::run(
+        body,
+        state.embedding_model.as_deref(),
+        &popularity,
+        &mut [&mut sled_sink, &mut text_sink, &mut index_sink, &mut catalog_sink],
+        |_| {},
+    )
 }
 
 async fn health_handler() -> &'static str { "OK" }
 
+/// Prometheus 文本格式的指标: 各阶段耗时直方图、检索开销、索引占用、缓存与编码队列
+async fn metrics_handler(State(state): State<Arc<AppState>>) -> Response {
+    let mut out = String::with_capacity(16 * 1024);
+    state.metrics.render(&mut out);
+
+    let index = state.hnsw.stats();
+    write_gauge(&mut out, "recsys_index_items", "Searchable items in the HNSW index", index.count as f64);
+    write_gauge(&mut out, "recsys_index_deleted_slots", "Deleted slots waiting for reuse", index.deleted as f64);
+    write_gauge(&mut out, "recsys_index_capacity", "Allocated index slots (max_elements)", index.capacity as f64);
+    write_gauge(&mut out, "recsys_index_occupancy_ratio", "Used slots (live + deleted) / capacity", index.occupancy());
+    write_gauge(&mut out, "recsys_index_memory_bytes", "Memory used by the graph and vectors", index.memory_bytes as f64);
+    write_counter(&mut out, "recsys_index_resizes_total", "Automatic index resizes", index.resizes as f64);
+    write_counter(
+        &mut out,
+        "recsys_index_resize_seconds_total",
+        "Time spent resizing (searches and inserts blocked)",
+        index.resize_total_ms / 1e3,
+    );
+    write_counter(&mut out, "recsys_index_mutations_total", "Index inserts, updates and deletes", index.mutations as f64);
+    write_counter(&mut out, "recsys_index_snapshots_total", "Background index snapshots", index.snapshots as f64);
+    write_counter(
+        &mut out,
+        "recsys_index_log_trim_failures_total",
+        "Snapshots whose mutation log trim failed",
+        index.log_trim_failures as f64,
+    );
+    write_gauge(
+        &mut out,
+        "recsys_index_snapshot_pause_seconds",
+        "Writer pause during the last snapshot",
+        index.snapshot_pause_ms / 1e3,
+    );
+
+    let cache = state.query_cache.stats();
+    write_counter(&mut out, "recsys_query_cache_hits_total", "Query vector cache hits", cache.hits as f64);
+    write_counter(&mut out, "recsys_query_cache_misses_total", "Query vector cache misses", cache.misses as f64);
+    write_counter(&mut out, "recsys_query_cache_evictions_total", "Query vector cache evictions", cache.evictions as f64);
+    write_gauge(&mut out, "recsys_query_cache_entries", "Cached query vectors", cache.len as f64);
+
+    let history = state.seen.stats();
+    write_gauge(&mut out, "recsys_seen_cached_users", "Users with an in-memory seen filter", history.cached_users as f64);
+    write_gauge(&mut out, "recsys_seen_dirty_users", "Seen filters not yet written back", history.dirty_users as f64);
+    write_gauge(&mut out, "recsys_seen_filter_bytes", "Memory used by cached seen filters", history.filter_bytes as f64);
+
+    if let Some(encoder) = &state.encoder {
+        write_gauge(&mut out, "recsys_encode_queue_depth", "Texts waiting for an ONNX session", encoder.depth() as f64);
+        write_gauge(&mut out, "recsys_encode_queue_capacity", "Encode queue capacity", encoder.capacity() as f64);
+    }
+    write_gauge(&mut out, "recsys_catalog_items", "Items in the catalog", state.catalog().len() as f64);
+
+    ([(header::CONTENT_TYPE, "text/plain; version=0.0.4")], out).into_response()
+}
+
 // ============================================================================
 // 数据初始化
 // ============================================================================
@@ -261,63 +628,65 @@ async fn health_handler() -> &'static str { "OK" }
 fn init_users() -> Vec<User> {
     vec![
         // 明确单一兴趣的用户
-        User { id: 1, name: "程序员小明 (Electronics + Books)".into(), embedding: generate_user_embedding(&["Electronics", "Books"]) },
-        User { id: 2, name: "居家达人小红 (Home)".into(), embedding: generate_user_embedding(&["Home"]) },
-        User { id: 3, name: "时尚达人小美 (Clothing)".into(), embedding: generate_user_embedding(&["Clothing"]) },
+        User { id: 1, name: "程序员小明 (Electronics + Books)".into(), interests: generate_user_interests(&["Electronics", "Books"]) },
+        User { id: 2, name: "居家达人小红 (Home)".into(), interests: generate_user_interests(&["Home"]) },
+        User { id: 3, name: "时尚达人小美 (Clothing)".into(), interests: generate_user_interests(&["Clothing"]) },
         
         // 双兴趣用户
-        User { id: 4, name: "极客玩家 (Electronics)".into(), embedding: generate_user_embedding(&["Electronics"]) },
-        User { id: 5, name: "书虫 (Books)".into(), embedding: generate_user_embedding(&["Books"]) },
-        User { id: 6, name: "生活家 (Home + Clothing)".into(), embedding: generate_user_embedding(&["Home", "Clothing"]) },
+        User { id: 4, name: "极客玩家 (Electronics)".into(), interests: generate_user_interests(&["Electronics"]) },
+        User { id: 5, name: "书虫 (Books)".into(), interests: generate_user_interests(&["Books"]) },
+        User { id: 6, name: "生活家 (Home + Clothing)".into(), interests: generate_user_interests(&["Home", "Clothing"]) },
         
         // 混合兴趣用户
-        User { id: 7, name: "全能选手 (All Categories)".into(), embedding: generate_user_embedding(&["Electronics", "Books", "Home", "Clothing"]) },
-        User { id: 8, name: "科技宅 (Electronics + Home)".into(), embedding: generate_user_embedding(&["Electronics", "Home"]) },
+        User { id: 7, name: "全能选手 (All Categories)".into(), interests: generate_user_interests(&["Electronics", "Books", "Home", "Clothing"]) },
+        User { id: 8, name: "科技宅 (Electronics + Home)".into(), interests: generate_user_interests(&["Electronics", "Home"]) },
         
         // 噪声用户 - 使用随机embedding
-        User { id: 9, name: "新用户A (Random)".into(), embedding: generate_random_embedding() },
-        User { id: 10, name: "新用户B (Random)".into(), embedding: generate_random_embedding() },
+        User { id: 9, name: "新用户A (Random)".into(), interests: generate_random_embedding() },
+        User { id: 10, name: "新用户B (Random)".into(), interests: generate_random_embedding() },
     ]
 }
 
-fn load_items_from_json(embedding_model: &embedding::EmbeddingModel) -> Result<Vec<Item>> {
-    use rand::Rng;
-    let json_str = std::fs::read_to_string("assets/products.json")?;
-    let items_json: Vec<ItemJson> = serde_json::from_str(&json_str)?;
-    let mut rng = rand::thread_rng();
-    let total = items_json.len();
-    println!("🧠 Encoding {} items with ONNX model...", total);
-    
-    let items: Vec<Item> = items_json.into_iter()
-        .enumerate()
-        .map(|(i, json)| {
-            // 使用 ONNX 模型生成真实语义向量
-            let embedding = embedding_model.encode(&json.name)
-                .unwrap_or_else(|_| generate_category_embedding(&json.category));
-            let popularity = rng.gen::<f32>();
-            if (i + 1) % 50 == 0 {
-                println!("   Encoded {}/{} items", i + 1, total);
-            }
-            Item::from_json(json, embedding, popularity)
-        })
-        .collect();
-    
-    println!("✅ All {} items encoded with semantic vectors", total);
-    Ok(items)
-}
+/// 冷启动: 把 products.json 流式导入 Sled 与 Tantivy，同时收集 catalog 的物品与向量。
+/// 非 PQ 格式的索引在同一条流水线中建好；PQ 码本需要先见到全部样本，返回 None 由调用方随后建索引
+fn ingest_products(
+    storage: &Storage,
+    embedding_model: Option<&embedding::EmbeddingModel>,
+    text_search: &TextSearch,
+) -> Result<(Vec<Item>, EmbeddingStore, Option<HnswIndex>)> {
+    let reader = std::io::BufReader::new(std::fs::File::open(PRODUCTS_PATH)?);
+    let index = match INDEX_STORAGE {
+        VectorStorage::Pq { .. } => None,
+        // 物品总数事先未知，写满后 C++ 侧按几何级数自动扩容
+        _ => Some(HnswIndex::new(&hnsw_config(1000)).map_err(|e| anyhow::anyhow!(e))?),
+    };
 
-fn load_items_from_json_fallback() -> Result<Vec<Item>> {
-    use rand::Rng;
-    let json_str = std::fs::read_to_string("assets/products.json")?;
-    let items_json: Vec<ItemJson> = serde_json::from_str(&json_str)?;
-    let mut rng = rand::thread_rng();
-    Ok(items_json.into_iter()
-        .map(|json| {
-            let embedding = generate_category_embedding(&json.category);
-            let popularity = rng.gen::<f32>();
-            Item::from_json(json, embedding, popularity)
-        })
-        .collect())
+    let mut sled_sink = ingest::StorageSink(storage);
+    let mut text_sink = ingest::TextSink(text_search);
+    let mut collect = ingest::CollectSink::new(DIM)?;
+    let mut index_sink = index.as_ref().map(ingest::IndexSink);
+    let mut sinks: Vec<&mut dyn ingest::Sink> = vec![&mut sled_sink, &mut text_sink, &mut collect];
+    if let Some(sink) = index_sink.as_mut() {
+        sinks.push(sink);
+    }
+
+    let mut reported = 0;
+    let stats = ingest::run(reader, embedding_model, &|_| rand::random::<f32>(), &mut sinks, |done| {
+        if done >= reported + 10 * ingest::INGEST_BATCH {
+            reported = done;
+            println!("   ... {} items", done);
+        }
+    })?;
+    drop(sinks);
+    println!(
+        "✅ Ingested {} items into database, text index{} in {:.1}s",
+        stats.items,
+        if index.is_some() { " and HNSW index" } else { "" },
+        stats.elapsed.as_secs_f64()
+    );
+
+    let (items, embeddings) = collect.into_parts();
+    Ok((items, embeddings, index))
 }
 
 fn init_data_with_storage(
@@ -325,33 +694,31 @@ fn init_data_with_storage(
     embedding_model: Option<Arc<embedding::EmbeddingModel>>,
     text_search: Arc<TextSearch>
 ) -> Result<Arc<AppState>> {
-    let items = if storage.items_count() == 0 {
-        println!("📂 Database empty, loading from products.json...");
-        let items = match &embedding_model {
-            Some(model) => load_items_from_json(model)?,
-            None => {
-                println!("⚠️  No embedding model, using category-based vectors");
-                load_items_from_json_fallback()?
-            }
-        };
-        for item in &items { storage.save_item(item)?; }
-        println!("💾 Saved {} items to database", items.len());
-        
-        // Hydrate Tantivy
-        println!("🔍 Building text search index...");
-        for item in &items {
-            text_search.index_item(item)?;
+    let (items, embeddings, prebuilt) = if storage.items_count() == 0 {
+        println!("📂 Database empty, ingesting {}...", PRODUCTS_PATH);
+        if embedding_model.is_none() {
+            println!("⚠️  No embedding model, using category-based vectors");
         }
-        text_search.commit()?;
-        println!("✅ Text index built");
-
-        items
+        ingest_products(&storage, embedding_model.as_deref(), &text_search)?
     } else {
         println!("📂 Loading items from database...");
-        let items: Vec<Item> = storage.iter_items().filter_map(|r| r.ok()).collect();
+        let mut items: Vec<Item> = storage.iter_items().filter_map(|r| r.ok()).collect();
         println!("📦 Loaded {} items from database", items.len());
-        items
+        if text_search.num_docs() != items.len() as u64 {
+            // 文本索引被重建 (schema 升级) 或与数据库不同步: 从数据库重新写入
+            println!("🔍 Rebuilding text search index...");
+            text_search.clear()?;
+            for item in &items {
+                text_search.index_item(item)?;
+            }
+            text_search.commit()?;
+            println!("✅ Text index rebuilt");
+        }
+        // 向量移入 C++ 侧的连续存储，运行时每个 Item 不再单独持有一块堆内存
+        let embeddings = EmbeddingStore::from_items(DIM, &mut items).map_err(|e| anyhow::anyhow!(e))?;
+        (items, embeddings, None)
     };
+    println!("🧮 Registered {} embeddings", embeddings.len());
 
     let users = if storage.users_count() == 0 {
         let users = init_users();
@@ -362,61 +729,276 @@ fn init_data_with_storage(
         storage.get_all_users()?
     };
 
-    let item_map: HashMap<u64, usize> = items.iter().enumerate().map(|(i, item)| (item.id, i)).collect();
+    let hnsw = match prebuilt {
+        Some(index) => {
+            // 导入时建好的索引与数据库一致，旧的日志只对应之前的快照
+            discard_index_log()?;
+            index.open_log(INDEX_LOG_PATH).map_err(|e| anyhow::anyhow!(e))?;
+            index
+        }
+        None => init_hnsw_with_hydration(&embeddings)?,
+    };
+    let stats = hnsw.stats();
+    println!(
+        "📈 Index occupancy: {} live + {} deleted / {} slots ({:.0}%)",
+        stats.count, stats.deleted, stats.capacity, stats.occupancy() * 100.0
+    );
+    let category_ids = register_item_attributes(&hnsw, &items);
+    println!();
 
-    Ok(Arc::new(AppState { storage, users, items, item_map, embedding_model, text_search }))
+    let encoder = embedding_model.clone().map(embedding::EncodeQueue::new).transpose()?;
+    let catalog = RwLock::new(Catalog::new(items, embeddings, category_ids));
+    let seen = SeenHistory::new(Arc::clone(&storage), SEEN_CACHE_USERS, SEEN_CACHE_SHARDS);
+    let user_index = users.iter().enumerate().map(|(i, user)| (user.id, i)).collect();
+    Ok(Arc::new(AppState {
+        storage,
+        seen,
+        users,
+        user_index,
+        encoder,
+        embedding_model,
+        query_cache: QueryCache::new(QUERY_CACHE_CAPACITY, QUERY_CACHE_SHARDS),
+        text_search,
+        hnsw,
+        catalog,
+        item_writes: Mutex::new(()),
+        metrics: Metrics::new(),
+    }))
 }
 
 // ============================================================================
 // 索引初始化 (Hydration)
 // ============================================================================
 
-fn init_hnsw_with_hydration(items: &[Item]) -> Result<()> {
-    let max_elements = items.len() + 1000;
+fn init_hnsw_with_hydration(embeddings: &EmbeddingStore) -> Result<HnswIndex> {
+    // 初始容量；在线新增写满后 C++ 侧按几何级数自动扩容
+    let max_elements = embeddings.len() + 1000;
     
     println!("🔧 Loading HNSW index from {}...", INDEX_PATH);
-    let loaded = load_hnsw_index(INDEX_PATH, DIM, max_elements, 100)
-        .map_err(|e| anyhow::anyhow!(e))?;
-    
-    let index_count = get_hnsw_count();
-    let db_count = items.len();
+    // 索引文件以 mmap 格式保存，启动时直接映射，不需要解析整张图
+    let (index, loaded) = match HnswIndex::load_mmap(INDEX_PATH, DIM, max_elements, 100, INDEX_STORAGE) {
+        Ok(result) => result,
+        Err(e) => {
+            // 旧的原生格式文件、INDEX_STORAGE 与文件格式不一致，或 PQ 索引尚无码本: 按当前格式新建
+            println!("⚠️  {}, creating new {:?} index", e, INDEX_STORAGE);
+            (create_hnsw_index(embeddings, max_elements)?, false)
+        }
+    };
+
+    if loaded {
+        // 快照之后的修改在日志里: 重放后索引回到上次退出 (包括崩溃) 前的状态
+        match index.open_log(INDEX_LOG_PATH) {
+            Ok(0) => {}
+            Ok(replayed) => println!("📜 Replayed {} index mutations from {}", replayed, INDEX_LOG_PATH),
+            Err(e) => {
+                eprintln!("⚠️  {}, discarding it (the DB reconcile below covers the difference)", e);
+                discard_index_log()?;
+                index.open_log(INDEX_LOG_PATH).map_err(|e| anyhow::anyhow!(e))?;
+            }
+        }
+    } else {
+        // 日志只对应之前的快照，对重建的索引没有意义
+        discard_index_log()?;
+    }
+
+    let index_count = index.count();
+    let db_count = embeddings.len();
     
     if loaded && index_count == db_count {
         println!("✅ HNSW index loaded: {} items (consistent with DB)", index_count);
-        return Ok(());
+        return Ok(index);
     }
     
-    if !loaded {
-        println!("📝 Index file not found, created new empty index");
-    } else {
-        println!("⚠️  Index count ({}) != DB count ({}), rebuilding...", index_count, db_count);
+    let mut reported = 0;
+    let mut report_progress = |done: usize, total: usize| {
+        // 每 10% 打印一次
+        let percent = done * 100 / total.max(1);
+        if percent >= reported + 10 || done == total {
+            reported = percent;
+            println!("   ... {}/{} ({}%)", done, total, percent);
+        }
+    };
+
+    if loaded {
+        // 只处理差异: 上次写入中断等情况下，重启代价与差异大小成正比，而不是与物品总数成正比
+        println!("⚠️  Index count ({}) != DB count ({}), reconciling...", index_count, db_count);
+        let stats = index.reconcile_with_store(embeddings, &mut report_progress)
+            .map_err(|e| anyhow::anyhow!(e))?;
+        println!(
+            "✅ HNSW index reconciled: {} added, {} updated, {} deleted, {} unchanged, {} failed",
+            stats.added, stats.updated, stats.deleted, stats.unchanged, stats.failed
+        );
+        return Ok(index);
     }
-    
+
+    println!("📝 Index file not found, created new empty index");
     println!("🔄 Hydrating index from database...");
-    let mut success = 0;
+    let success = index.add_from_store(embeddings, &mut report_progress)
+        .map_err(|e| anyhow::anyhow!(e))?;
+    println!("✅ HNSW index rebuilt with {} items", success);
+
+    // 从数据库重建的部分不写日志 (崩溃后同样可以重建)，之后的在线修改才需要
+    index.open_log(INDEX_LOG_PATH).map_err(|e| anyhow::anyhow!(e))?;
+    Ok(index)
+}
+
+fn discard_index_log() -> Result<()> {
+    match std::fs::remove_file(INDEX_LOG_PATH) {
+        Err(e) if e.kind() != std::io::ErrorKind::NotFound => Err(e.into()),
+        _ => Ok(()),
+    }
+}
+
+fn hnsw_config(max_elements: usize) -> HnswConfig {
+    HnswConfig {
+        dim: DIM,
+        max_elements,
+        ef_search: 100,
+        storage: INDEX_STORAGE,
+        ..Default::default()
+    }
+}
+
+/// 按 INDEX_STORAGE 新建空索引 (PQ 格式先从物品向量中抽样训练码本)
+fn create_hnsw_index(embeddings: &EmbeddingStore, max_elements: usize) -> Result<HnswIndex> {
+    let config = hnsw_config(max_elements);
+    let index = match INDEX_STORAGE {
+        VectorStorage::Pq { .. } => {
+            let step = (embeddings.len() / PQ_TRAIN_SAMPLES).max(1);
+            let samples: Vec<f32> = embeddings.iter()
+                .step_by(step)
+                .take(PQ_TRAIN_SAMPLES)
+                .flat_map(|(_, embedding)| embedding.iter().copied())
+                .collect();
+            println!("🎓 Training PQ codebook on {} samples...", samples.len() / DIM);
+            HnswIndex::train_pq(&config, &samples)
+        }
+        _ => HnswIndex::new(&config),
+    };
+    index.map_err(|e| anyhow::anyhow!(e))
+}
+
+/// 为所有物品设置类别与价格属性，返回类别名到编号的映射
+///
+/// 属性不随索引文件持久化，每次启动由数据库中的物品重新生成 (内存中完成，开销很小)。
+fn register_item_attributes(index: &HnswIndex, items: &[Item]) -> HashMap<String, u32> {
+    let mut names: Vec<&str> = items.iter().map(|item| item.category.as_str()).collect();
+    names.sort_unstable();
+    names.dedup();
+    let category_ids: HashMap<String, u32> = names.iter()
+        .enumerate()
+        .map(|(i, name)| (name.to_string(), i as u32))
+        .collect();
+
     for item in items {
-        if add_item_to_hnsw(item.id, &item.embedding).is_ok() {
-            success += 1;
+        let category = category_ids[&item.category];
+        if let Err(e) = index.set_attributes(item.id, category, item.price) {
+            eprintln!("⚠️  {}", e);
         }
     }
-    println!("✅ HNSW index rebuilt with {} items", success);
-    
-    Ok(())
+    println!("🏷️  Registered attributes for {} items ({} categories)", items.len(), category_ids.len());
+
+    category_ids
+}
+
+// ============================================================================
+// 后台快照
+// ============================================================================
+
+/// 按修改次数 / 时间间隔定期保存索引。快照期间只暂停写者，搜索照常进行；
+/// 文件先写临时文件再原子替换，任何时刻崩溃都会留下一份完整的索引文件
+fn spawn_snapshot_task(state: Arc<AppState>) {
+    tokio::spawn(async move {
+        let mut last_mutations = state.hnsw.stats().mutations;
+        let mut last_trim_failures = state.hnsw.stats().log_trim_failures;
+        let mut last_snapshot = Instant::now();
+        let mut tick = tokio::time::interval(SNAPSHOT_CHECK_TICK);
+        tick.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
+
+        loop {
+            tick.tick().await;
+            let mutations = state.hnsw.stats().mutations;
+            let pending = mutations.saturating_sub(last_mutations);
+            let due = pending >= SNAPSHOT_MUTATIONS || (pending > 0 && last_snapshot.elapsed() >= SNAPSHOT_INTERVAL);
+            if !due {
+                continue;
+            }
+
+            // 拷贝与写文件都是阻塞操作，放到阻塞线程池，不占用 async 工作线程
+            let snapshot_state = Arc::clone(&state);
+            let result = tokio::task::spawn_blocking(move || snapshot_state.hnsw.save_mmap(INDEX_PATH)).await;
+            match result {
+                Ok(Ok(())) => {
+                    let stats = state.hnsw.stats();
+                    println!(
+                        "💾 Snapshot #{}: {} mutations, writers paused {:.1}ms, written in {:.1}ms",
+                        stats.snapshots, pending, stats.snapshot_pause_ms, stats.snapshot_write_ms
+                    );
+                    // 快照有效，只是日志没能截短: 下一次快照会重试
+                    if stats.log_trim_failures > last_trim_failures {
+                        eprintln!("⚠️  Snapshot written but the mutation log could not be trimmed, retrying next snapshot");
+                    }
+                    last_trim_failures = stats.log_trim_failures;
+                }
+                Ok(Err(e)) => eprintln!("❌ Background snapshot failed: {}", e),
+                Err(e) => eprintln!("❌ Background snapshot task panicked: {}", e),
+            }
+            // 失败时也推进计数，避免磁盘故障时每个 tick 都重试整份拷贝
+            last_mutations = mutations;
+            last_snapshot = Instant::now();
+        }
+    });
+}
+
+/// 定期把浏览历史的修改批量写回 Sled
+fn spawn_history_flush_task(state: Arc<AppState>) {
+    tokio::spawn(async move {
+        let mut tick = tokio::time::interval(SEEN_FLUSH_INTERVAL);
+        tick.set_missed_tick_behavior(tokio::time::MissedTickBehavior::Delay);
+
+        loop {
+            tick.tick().await;
+            let flush_state = Arc::clone(&state);
+            match tokio::task::spawn_blocking(move || flush_state.seen.flush()).await {
+                Ok(Ok(_)) => {}
+                // 失败的用户保持为脏，下一个周期重试
+                Ok(Err(e)) => eprintln!("❌ Failed to write back seen history: {}", e),
+                Err(e) => eprintln!("❌ Seen history write-back task panicked: {}", e),
+            }
+        }
+    });
 }
 
 // ============================================================================
 // 优雅退出
 // ============================================================================
 
-async fn graceful_shutdown(storage: Arc<Storage>) {
+async fn graceful_shutdown(state: Arc<AppState>) {
     println!("\n🛑 Shutting down...");
     
-    match save_hnsw_index(INDEX_PATH) {
+    let stats = state.hnsw.stats();
+    println!(
+        "📈 Index occupancy: {} live + {} deleted / {} slots, {} resizes ({:.1}ms total, {:.1}ms max stall)",
+        stats.count, stats.deleted, stats.capacity, stats.resizes, stats.resize_total_ms, stats.resize_max_ms
+    );
+
+    let cache = state.query_cache.stats();
+    println!(
+        "📈 Query cache: {} hits / {} misses ({:.0}% hit rate), {} evictions, {}/{} entries",
+        cache.hits, cache.misses, cache.hit_rate() * 100.0, cache.evictions, cache.len, cache.capacity
+    );
+
+    match state.hnsw.save_mmap(INDEX_PATH) {
         Ok(()) => println!("💾 HNSW index saved to {}", INDEX_PATH),
         Err(e) => eprintln!("❌ Failed to save index: {}", e),
     }
     
-    match storage.flush() {
+    match state.seen.flush() {
+        Ok(n) => println!("💾 Seen history written back ({} users)", n),
+        Err(e) => eprintln!("❌ Failed to write back seen history: {}", e),
+    }
+
+    match state.storage.flush() {
         Ok(()) => println!("💾 Sled database flushed"),
         Err(e) => eprintln!("❌ Failed to flush database: {}", e),
     }
@@ -431,11 +1013,16 @@ async fn graceful_shutdown(storage: Arc<Storage>) {
 #[tokio::main]
 async fn main() -> Result<()> {
     println!("🚀 Initializing Mini-RecSys...\n");
+    println!("🧮 SIMD kernels: {}", ffi::simd_backend());
 
     // 1. 初始化 ONNX 模型
     let embedding_model = match embedding::EmbeddingModel::new() {
         Ok(model) => {
-            println!("🧠 Embedding model loaded (dimension: {})\n", model.dimension());
+            let config = model.config();
+            println!(
+                "🧠 Embedding model loaded (dimension: {}, {} sessions x {} intra-op threads, queue {})\n",
+                model.dimension(), config.sessions, config.intra_threads, config.queue_capacity
+            );
             Some(Arc::new(model))
         }
         Err(e) => {
@@ -451,10 +1038,7 @@ async fn main() -> Result<()> {
     println!("🔍 Text search index initialized at data/tantivy_index\n");
 
     let state = init_data_with_storage(Arc::clone(&storage), embedding_model, text_search)?;
-    println!("📊 Loaded {} users, {} items", state.users.len(), state.items.len());
-
-    init_hnsw_with_hydration(&state.items)?;
-    println!();
+    println!("📊 Loaded {} users, {} items\n", state.users.len(), state.catalog().len());
 
     let cors = CorsLayer::new()
         .allow_origin("http://localhost:5173".parse::<HeaderValue>().unwrap())
@@ -463,27 +1047,42 @@ async fn main() -> Result<()> {
 
     let app = Router::new()
         .route("/health", get(health_handler))
+        .route("/metrics", get(metrics_handler))
         .route("/users", get(users_handler))
         .route("/recommend", get(recommend_handler))
         .route("/search", get(search_handler))
         .route("/mark_seen", post(mark_seen_handler))
+        .route("/items/upsert", post(upsert_item_handler))
+        .route("/items/delete", post(delete_item_handler))
+        .route("/items/bulk", post(bulk_load_handler).layer(DefaultBodyLimit::max(BULK_LOAD_MAX_BYTES)))
         .layer(cors)
         .with_state(Arc::clone(&state));
 
+    spawn_snapshot_task(Arc::clone(&state));
+    spawn_history_flush_task(Arc::clone(&state));
+
     let addr = "0.0.0.0:3000";
     println!("🌐 Server running at http://{}", addr);
     println!("   GET  /search?q=<query> - 语义搜索");
+    println!("   GET  /metrics - Prometheus 指标");
+    println!("   POST /items/upsert, /items/delete - 在线更新物品");
+    println!("   POST /items/bulk - 批量导入物品 (JSON 数组或 JSONL)");
+    println!(
+        "   Index snapshots every {} mutations or {}s, Ctrl+C also saves",
+        SNAPSHOT_MUTATIONS,
+        SNAPSHOT_INTERVAL.as_secs()
+    );
     println!("   Press Ctrl+C to shutdown gracefully\n");
 
     let listener = tokio::net::TcpListener::bind(addr).await?;
     
-    let storage_for_shutdown = Arc::clone(&storage);
+    let state_for_shutdown = Arc::clone(&state);
     tokio::select! {
         result = axum::serve(listener, app) => {
             result?;
         }
         _ = tokio::signal::ctrl_c() => {
-            graceful_shutdown(storage_for_shutdown).await;
+            graceful_shutdown(state_for_shutdown).await;
         }
     }
     
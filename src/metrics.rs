@@ -0,0 +1,268 @@
+//! 请求各阶段的耗时直方图与检索开销计数，以 Prometheus 文本格式导出 (/metrics)
+//!
+//! 记录一次观测只是几次 relaxed 原子加法 (找桶是在十几个常量边界上的线性扫描)，
+//! 不加锁、不分配内存，可以在生产环境常开。图遍历的逐跳计数在 C++ 侧的线程本地变量里累加，
+//! 每次搜索结束后才把差值记到这里 (见 `ffi::thread_search_metrics`)。
+
+use crate::ffi::SearchMetrics;
+use std::fmt::Write;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+/// 耗时直方图的桶上界 (纳秒): 10us .. 5s
+const DURATION_BOUNDS_NS: &[u64] = &[
+    10_000, 25_000, 50_000, 100_000, 250_000, 500_000,
+    1_000_000, 2_500_000, 5_000_000, 10_000_000, 25_000_000, 50_000_000,
+    100_000_000, 250_000_000, 500_000_000, 1_000_000_000, 5_000_000_000,
+];
+/// 单次搜索的跳数 / 距离计算次数的桶上界
+const COUNT_BOUNDS: &[u64] = &[
+    10, 25, 50, 100, 250, 500, 1_000, 2_500, 5_000, 10_000, 25_000, 50_000, 100_000,
+];
+
+/// 固定桶的累积直方图。观测值为整数 (纳秒或次数)，导出时除以 scale 换算单位
+pub struct Histogram {
+    bounds: &'static [u64],
+    scale: f64,
+    /// 第 i 个桶统计落在 (bounds[i-1], bounds[i]] 的观测，最后一个桶统计超过所有上界的观测
+    buckets: Box<[AtomicU64]>,
+    count: AtomicU64,
+    sum: AtomicU64,
+}
+
+impl Histogram {
+    fn new(bounds: &'static [u64], scale: f64) -> Self {
+        Self {
+            bounds,
+            scale,
+            buckets: (0..=bounds.len()).map(|_| AtomicU64::new(0)).collect(),
+            count: AtomicU64::new(0),
+            sum: AtomicU64::new(0),
+        }
+    }
+
+    /// 以秒为单位导出的耗时直方图
+    pub fn durations() -> Self {
+        Self::new(DURATION_BOUNDS_NS, 1e9)
+    }
+
+    /// 次数直方图
+    pub fn counts() -> Self {
+        Self::new(COUNT_BOUNDS, 1.0)
+    }
+
+    pub fn observe(&self, value: u64) {
+        let bucket = self.bounds.iter().position(|&bound| value <= bound).unwrap_or(self.bounds.len());
+        self.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        self.sum.fetch_add(value, Ordering::Relaxed);
+        self.count.fetch_add(1, Ordering::Relaxed);
+    }
+
+    pub fn observe_duration(&self, elapsed: Duration) {
+        self.observe(elapsed.as_nanos().min(u64::MAX as u128) as u64);
+    }
+
+    pub fn count(&self) -> u64 {
+        self.count.load(Ordering::Relaxed)
+    }
+
+    /// 写出一组 `_bucket` / `_sum` / `_count` 样本；labels 形如 `stage="embed"`
+    ///
+    /// 各计数分别读取，与并发的观测之间不是原子快照，偏差最多是正在进行的几次观测
+    fn write_samples(&self, out: &mut String, name: &str, labels: &str) {
+        let sep = if labels.is_empty() { "" } else { "," };
+        let mut cumulative = 0;
+        for (i, bucket) in self.buckets.iter().enumerate() {
+            cumulative += bucket.load(Ordering::Relaxed);
+            match self.bounds.get(i) {
+                Some(&bound) => {
+                    let le = bound as f64 / self.scale;
+                    let _ = writeln!(out, "{}_bucket{{{}{}le=\"{}\"}} {}", name, labels, sep, le, cumulative);
+                }
+                None => {
+                    let _ = writeln!(out, "{}_bucket{{{}{}le=\"+Inf\"}} {}", name, labels, sep, cumulative);
+                }
+            }
+        }
+        let braced = if labels.is_empty() { String::new() } else { format!("{{{}}}", labels) };
+        let _ = writeln!(out, "{}_sum{} {}", name, braced, self.sum.load(Ordering::Relaxed) as f64 / self.scale);
+        let _ = writeln!(out, "{}_count{} {}", name, braced, self.count());
+    }
+}
+
+/// 有耗时直方图的请求阶段
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Stage {
+    /// /recommend: 载入用户的 "已看过" 过滤器 (未缓存时从 Sled 读取并解码)
+    RecommendHistoryLoad,
+    /// /recommend: 多兴趣 HNSW 召回
+    RecommendHnswSearch,
+    /// /recommend: 组装候选、排序、降级填充与 JSON 序列化
+    RecommendResponseBuild,
+    /// /search: 查询向量 (缓存或推理)
+    SearchEmbed,
+    /// /search: 向量召回 (HNSW 或精确搜索)
+    SearchHnswSearch,
+    /// /search: Tantivy 关键词召回
+    SearchTextSearch,
+    /// /search: 多路融合
+    SearchFusion,
+    /// /search: 组装结果与 JSON 序列化
+    SearchResponseBuild,
+}
+
+impl Stage {
+    const ALL: [Stage; 8] = [
+        Stage::RecommendHistoryLoad,
+        Stage::RecommendHnswSearch,
+        Stage::RecommendResponseBuild,
+        Stage::SearchEmbed,
+        Stage::SearchHnswSearch,
+        Stage::SearchTextSearch,
+        Stage::SearchFusion,
+        Stage::SearchResponseBuild,
+    ];
+
+    /// (handler, stage) 标签
+    fn labels(self) -> (&'static str, &'static str) {
+        match self {
+            Stage::RecommendHistoryLoad => ("recommend", "history_load"),
+            Stage::RecommendHnswSearch => ("recommend", "hnsw_search"),
+            Stage::RecommendResponseBuild => ("recommend", "response_build"),
+            Stage::SearchEmbed => ("search", "embed"),
+            Stage::SearchHnswSearch => ("search", "hnsw_search"),
+            Stage::SearchTextSearch => ("search", "text_search"),
+            Stage::SearchFusion => ("search", "fusion"),
+            Stage::SearchResponseBuild => ("search", "response_build"),
+        }
+    }
+}
+
+pub struct Metrics {
+    stages: Vec<Histogram>,
+    hops: Histogram,
+    distance_computations: Histogram,
+    lock_waits: AtomicU64,
+    lock_wait_ns: AtomicU64,
+}
+
+impl Default for Metrics {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl Metrics {
+    pub fn new() -> Self {
+        Self {
+            stages: Stage::ALL.iter().map(|_| Histogram::durations()).collect(),
+            hops: Histogram::counts(),
+            distance_computations: Histogram::counts(),
+            lock_waits: AtomicU64::new(0),
+            lock_wait_ns: AtomicU64::new(0),
+        }
+    }
+
+    pub fn observe(&self, stage: Stage, elapsed: Duration) {
+        self.stages[stage as usize].observe_duration(elapsed);
+    }
+
+    pub fn stage(&self, stage: Stage) -> &Histogram {
+        &self.stages[stage as usize]
+    }
+
+    /// 记录一次 HNSW 搜索的开销 (`thread_search_metrics` 在搜索前后的差值)。
+    /// 没有遍历图的搜索 (精确搜索路径) 不计入跳数直方图
+    pub fn record_search(&self, search: &SearchMetrics) {
+        if search.hops > 0 {
+            self.hops.observe(search.hops);
+            self.distance_computations.observe(search.distance_computations);
+        }
+        if search.lock_waits > 0 {
+            self.lock_waits.fetch_add(search.lock_waits, Ordering::Relaxed);
+            self.lock_wait_ns.fetch_add((search.lock_wait_ms * 1e6) as u64, Ordering::Relaxed);
+        }
+    }
+
+    /// 以 Prometheus 文本格式写出本模块维护的所有指标
+    pub fn render(&self, out: &mut String) {
+        write_header(out, "recsys_stage_duration_seconds", "histogram", "Time spent in each request stage");
+        for stage in Stage::ALL {
+            let (handler, name) = stage.labels();
+            let labels = format!("handler=\"{}\",stage=\"{}\"", handler, name);
+            self.stage(stage).write_samples(out, "recsys_stage_duration_seconds", &labels);
+        }
+
+        write_header(out, "recsys_hnsw_search_hops", "histogram", "Graph nodes visited per HNSW search");
+        self.hops.write_samples(out, "recsys_hnsw_search_hops", "");
+        write_header(
+            out,
+            "recsys_hnsw_search_distance_computations",
+            "histogram",
+            "Distance computations per HNSW search",
+        );
+        self.distance_computations.write_samples(out, "recsys_hnsw_search_distance_computations", "");
+
+        write_counter(
+            out,
+            "recsys_hnsw_search_lock_waits_total",
+            "Searches that had to wait for the index lock (resize or save in progress)",
+            self.lock_waits.load(Ordering::Relaxed) as f64,
+        );
+        write_counter(
+            out,
+            "recsys_hnsw_search_lock_wait_seconds_total",
+            "Time searches spent waiting for the index lock",
+            self.lock_wait_ns.load(Ordering::Relaxed) as f64 / 1e9,
+        );
+    }
+}
+
+fn write_header(out: &mut String, name: &str, kind: &str, help: &str) {
+    let _ = writeln!(out, "# HELP {} {}", name, help);
+    let _ = writeln!(out, "# TYPE {} {}", name, kind);
+}
+
+pub fn write_gauge(out: &mut String, name: &str, help: &str, value: f64) {
+    write_header(out, name, "gauge", help);
+    let _ = writeln!(out, "{} {}", name, value);
+}
+
+pub fn write_counter(out: &mut String, name: &str, help: &str, value: f64) {
+    write_header(out, name, "counter", help);
+    let _ = writeln!(out, "{} {}", name, value);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_histogram_exposition() {
+        let metrics = Metrics::new();
+        metrics.observe(Stage::SearchEmbed, Duration::from_micros(5));
+        metrics.observe(Stage::SearchEmbed, Duration::from_millis(3));
+        metrics.observe(Stage::SearchEmbed, Duration::from_secs(10));
+        metrics.record_search(&SearchMetrics { hops: 40, distance_computations: 600, lock_waits: 1, lock_wait_ms: 2.0 });
+        metrics.record_search(&SearchMetrics::default());
+
+        let mut out = String::new();
+        metrics.render(&mut out);
+        let sample = |line: &str| out.lines().any(|l| l == line);
+
+        // 累积计数: <= 10us 1 个，<= 5ms 2 个，+Inf 3 个
+        assert!(sample(r#"recsys_stage_duration_seconds_bucket{handler="search",stage="embed",le="0.00001"} 1"#));
+        assert!(sample(r#"recsys_stage_duration_seconds_bucket{handler="search",stage="embed",le="0.005"} 2"#));
+        assert!(sample(r#"recsys_stage_duration_seconds_bucket{handler="search",stage="embed",le="+Inf"} 3"#));
+        assert!(sample(r#"recsys_stage_duration_seconds_count{handler="search",stage="embed"} 3"#));
+        assert!(sample(r#"recsys_stage_duration_seconds_count{handler="recommend",stage="hnsw_search"} 0"#));
+
+        // 没有遍历图的搜索不计入跳数
+        assert!(sample("recsys_hnsw_search_hops_count 1"));
+        assert!(sample("recsys_hnsw_search_hops_sum 40"));
+        assert!(sample(r#"recsys_hnsw_search_hops_bucket{le="50"} 1"#));
+        assert!(sample("recsys_hnsw_search_distance_computations_sum 600"));
+        assert!(sample("recsys_hnsw_search_lock_waits_total 1"));
+        assert!(sample("recsys_hnsw_search_lock_wait_seconds_total 0.002"));
+    }
+}
@@ -9,7 +9,15 @@ pub const DIM: usize = 384;
 pub struct User {
     pub id: u64,
     pub name: String,
-    pub embedding: Vec<f32>,
+    /// 兴趣向量: 每个兴趣一个 DIM 维向量，行优先首尾相接 (`interests.len() == n * DIM`)。
+    /// 与旧版单个平均向量的存储格式兼容，旧数据即只有一个兴趣的用户
+    pub interests: Vec<f32>,
+}
+
+impl User {
+    pub fn interest_count(&self) -> usize {
+        self.interests.len() / DIM
+    }
 }
 
 /// 用于从 JSON 加载的临时结构（不含 embedding 和 popularity）
@@ -31,6 +39,7 @@ pub struct Item {
     pub category: String,
     pub image_url: String,
     pub price: f32,
+    /// 仅在加载与持久化时使用: 启动后移入 `ffi::EmbeddingStore`，运行时为空
     pub embedding: Vec<f32>,
     pub popularity: f32,
 }
@@ -104,6 +113,13 @@ pub fn generate_user_embedding(categories: &[&str]) -> Vec<f32> {
     vec.into_iter().map(|x| x / norm).collect()
 }
 
+/// 每个类别生成一个兴趣向量，按 `User.interests` 的布局首尾相接
+pub fn generate_user_interests(categories: &[&str]) -> Vec<f32> {
+    categories.iter()
+        .flat_map(|&cat| generate_user_embedding(&[cat]))
+        .collect()
+}
+
 /// 生成完全随机的向量 (用于噪声用户)
 pub fn generate_random_embedding() -> Vec<f32> {
     let mut rng = rand::thread_rng();
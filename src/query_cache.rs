@@ -0,0 +1,235 @@
+//! 查询向量缓存 - 分片的并发 LRU
+//!
+//! /search 的查询分布高度集中 (少数热门查询占大部分流量)，缓存查询文本对应的向量后，
+//! 命中的请求不再经过分词与 BERT 推理。
+//!
+//! 按 key 的哈希分到多个分片，每个分片一把互斥锁 + 一个严格 LRU (哈希表 + 侵入式双向链表，
+//! 节点存放在 Vec 中按下标链接)，查找、插入、淘汰都是 O(1)，不同分片之间互不阻塞。
+
+use std::collections::hash_map::RandomState;
+use std::collections::HashMap;
+use std::hash::BuildHasher;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+
+/// 查询文本的规范化: 去掉首尾空白、合并连续空白、转小写
+///
+/// 所用模型 (all-MiniLM-L6-v2) 的分词器不区分大小写且忽略空白的数量，
+/// 规范化前后的文本得到相同的向量，只是让更多请求共享同一个缓存项
+pub fn normalize_query(query: &str) -> String {
+    let mut normalized = String::with_capacity(query.len());
+    for word in query.split_whitespace() {
+        if !normalized.is_empty() {
+            normalized.push(' ');
+        }
+        normalized.extend(word.chars().flat_map(char::to_lowercase));
+    }
+    normalized
+}
+
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct CacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+    pub len: usize,
+    pub capacity: usize,
+}
+
+impl CacheStats {
+    pub fn hit_rate(&self) -> f64 {
+        let lookups = self.hits + self.misses;
+        if lookups == 0 { 0.0 } else { self.hits as f64 / lookups as f64 }
+    }
+}
+
+pub struct QueryCache<V> {
+    shards: Vec<Mutex<LruShard<V>>>,
+    hasher: RandomState,
+    capacity: usize,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+}
+
+impl<V: Clone> QueryCache<V> {
+    /// 最多缓存 capacity 项，平均分到 shards 个分片 (每个分片独立淘汰)
+    pub fn new(capacity: usize, shards: usize) -> Self {
+        let shards = shards.clamp(1, capacity.max(1));
+        let per_shard = capacity.div_ceil(shards).max(1);
+        Self {
+            shards: (0..shards).map(|_| Mutex::new(LruShard::new(per_shard))).collect(),
+            hasher: RandomState::new(),
+            capacity: per_shard * shards,
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+        }
+    }
+
+    /// 命中时返回值的副本，并把该项移到最近使用的位置
+    pub fn get(&self, key: &str) -> Option<V> {
+        let value = self.shard(key).get(key);
+        let counter = if value.is_some() { &self.hits } else { &self.misses };
+        counter.fetch_add(1, Ordering::Relaxed);
+        value
+    }
+
+    /// 插入或替换一项，分片已满时淘汰最久未使用的一项
+    pub fn insert(&self, key: String, value: V) {
+        if self.shard(&key).insert(key, value) {
+            self.evictions.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    pub fn stats(&self) -> CacheStats {
+        CacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+            len: self.shards.iter().map(|s| s.lock().unwrap_or_else(|e| e.into_inner()).len()).sum(),
+            capacity: self.capacity,
+        }
+    }
+
+    fn shard(&self, key: &str) -> std::sync::MutexGuard<'_, LruShard<V>> {
+        let index = (self.hasher.hash_one(key) % self.shards.len() as u64) as usize;
+        // 分片内的操作不会在中途 panic 留下不一致的链表，中毒后可以继续使用
+        self.shards[index].lock().unwrap_or_else(|e| e.into_inner())
+    }
+}
+
+const NIL: usize = usize::MAX;
+
+struct Node<V> {
+    key: String,
+    value: V,
+    prev: usize,
+    next: usize,
+}
+
+/// 单个分片: head 为最近使用，tail 为最久未使用
+struct LruShard<V> {
+    map: HashMap<String, usize>,
+    nodes: Vec<Node<V>>,
+    head: usize,
+    tail: usize,
+    capacity: usize,
+}
+
+impl<V: Clone> LruShard<V> {
+    fn new(capacity: usize) -> Self {
+        Self { map: HashMap::with_capacity(capacity), nodes: Vec::with_capacity(capacity), head: NIL, tail: NIL, capacity }
+    }
+
+    fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    fn get(&mut self, key: &str) -> Option<V> {
+        let idx = *self.map.get(key)?;
+        self.move_to_front(idx);
+        Some(self.nodes[idx].value.clone())
+    }
+
+    /// 返回是否淘汰了一项
+    fn insert(&mut self, key: String, value: V) -> bool {
+        if let Some(&idx) = self.map.get(&key) {
+            self.nodes[idx].value = value;
+            self.move_to_front(idx);
+            return false;
+        }
+
+        if self.nodes.len() < self.capacity {
+            let idx = self.nodes.len();
+            self.map.insert(key.clone(), idx);
+            self.nodes.push(Node { key, value, prev: NIL, next: NIL });
+            self.push_front(idx);
+            return false;
+        }
+
+        // 已满: 复用最久未使用的节点
+        let idx = self.tail;
+        self.unlink(idx);
+        self.map.remove(&self.nodes[idx].key);
+        self.map.insert(key.clone(), idx);
+        self.nodes[idx].key = key;
+        self.nodes[idx].value = value;
+        self.push_front(idx);
+        true
+    }
+
+    fn move_to_front(&mut self, idx: usize) {
+        if self.head != idx {
+            self.unlink(idx);
+            self.push_front(idx);
+        }
+    }
+
+    fn unlink(&mut self, idx: usize) {
+        let (prev, next) = (self.nodes[idx].prev, self.nodes[idx].next);
+        if prev == NIL { self.head = next } else { self.nodes[prev].next = next }
+        if next == NIL { self.tail = prev } else { self.nodes[next].prev = prev }
+    }
+
+    fn push_front(&mut self, idx: usize) {
+        self.nodes[idx].prev = NIL;
+        self.nodes[idx].next = self.head;
+        if self.head != NIL {
+            self.nodes[self.head].prev = idx;
+        }
+        self.head = idx;
+        if self.tail == NIL {
+            self.tail = idx;
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_normalize_query() {
+        assert_eq!(normalize_query("  Wireless   HEADPHONES\t"), "wireless headphones");
+        assert_eq!(normalize_query(""), "");
+    }
+
+    #[test]
+    fn test_query_cache_lru_eviction() {
+        // 单分片才能精确验证淘汰顺序
+        let cache: QueryCache<u32> = QueryCache::new(3, 1);
+        cache.insert("a".into(), 1);
+        cache.insert("b".into(), 2);
+        cache.insert("c".into(), 3);
+        assert_eq!(cache.get("a"), Some(1)); // a 变为最近使用，b 成为最久未使用
+        cache.insert("d".into(), 4);
+        assert_eq!(cache.get("b"), None);
+        assert_eq!(cache.get("c"), Some(3));
+        cache.insert("a".into(), 10); // 替换不淘汰
+        assert_eq!(cache.get("a"), Some(10));
+        assert_eq!(cache.get("d"), Some(4));
+
+        let stats = cache.stats();
+        assert_eq!((stats.hits, stats.misses, stats.evictions, stats.len), (4, 1, 1, 3));
+
+        // 多分片并发读写，总量不超过容量
+        let cache: QueryCache<usize> = QueryCache::new(64, 8);
+        std::thread::scope(|scope| {
+            for t in 0..4 {
+                let cache = &cache;
+                scope.spawn(move || {
+                    for i in 0..1000 {
+                        let key = format!("q{}", (i * 7 + t) % 100);
+                        if cache.get(&key).is_none() {
+                            cache.insert(key, i);
+                        }
+                    }
+                });
+            }
+        });
+        let stats = cache.stats();
+        assert!(stats.len <= stats.capacity);
+        assert_eq!(stats.hits + stats.misses, 4000);
+    }
+}
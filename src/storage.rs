@@ -1,16 +1,9 @@
 //! 存储层 - Sled 嵌入式数据库封装
 
 use anyhow::{Context, Result};
-use fastbloom_rs::{BloomFilter, FilterBuilder, Membership};
 use sled::{Db, Tree};
 use crate::model::{User, Item};
 
-/// Bloom Filter 参数
-const BLOOM_EXPECTED_ITEMS: u32 = 10000;
-const BLOOM_FPR: f64 = 0.01;
-/// 固定 hash 函数数量 (根据 expected_items 和 fpr 计算: k = -ln(fpr) / ln(2) ≈ 7)
-const BLOOM_HASHES: u32 = 7;
-
 pub struct Storage {
     _db: Db,
     users_tree: Tree,
@@ -76,6 +69,17 @@ impl Storage {
         Ok(())
     }
 
+    /// 一次写入一批物品 (原子地应用为一个 batch)
+    pub fn save_items(&self, items: &[Item]) -> Result<()> {
+        let mut batch = sled::Batch::default();
+        for item in items {
+            let value = bincode::serialize(item).context("Failed to serialize item")?;
+            batch.insert(&Self::u64_to_key(item.id)[..], value);
+        }
+        self.items_tree.apply_batch(batch).context("Failed to save items")?;
+        Ok(())
+    }
+
     pub fn get_item(&self, id: u64) -> Result<Option<Item>> {
         let key = Self::u64_to_key(id);
         match self.items_tree.get(key).context("Failed to get item")? {
@@ -87,6 +91,13 @@ impl Storage {
         }
     }
 
+    /// 删除物品，返回它是否存在
+    pub fn delete_item(&self, id: u64) -> Result<bool> {
+        let key = Self::u64_to_key(id);
+        let old = self.items_tree.remove(key).context("Failed to delete item")?;
+        Ok(old.is_some())
+    }
+
     pub fn iter_items(&self) -> impl Iterator<Item = Result<Item>> + '_ {
         self.items_tree.iter().map(|result| {
             let (_, value) = result.context("Failed to iterate items")?;
@@ -102,30 +113,21 @@ impl Storage {
         self.users_tree.len()
     }
 
-    // ========== Bloom Filter (用户历史去重) ==========
+    // ========== 浏览历史 (用户 "已看过" 过滤器，格式见 history.rs) ==========
 
-    /// 创建一个新的空 Bloom Filter
-    fn new_bloom_filter() -> BloomFilter {
-        FilterBuilder::new(BLOOM_EXPECTED_ITEMS as u64, BLOOM_FPR).build_bloom_filter()
-    }
-
-    /// 获取用户的 Bloom Filter（若不存在则返回新空过滤器）
-    pub fn get_user_filter(&self, uid: u64) -> Result<BloomFilter> {
+    pub fn get_user_history(&self, uid: u64) -> Result<Option<Vec<u8>>> {
         let key = Self::u64_to_key(uid);
-        match self.history_tree.get(key).context("Failed to get history")? {
-            Some(bytes) => {
-                // 从字节数组还原 BloomFilter
-                Ok(BloomFilter::from_u8_array(&bytes, BLOOM_HASHES))
-            }
-            None => Ok(Self::new_bloom_filter()),
-        }
+        let bytes = self.history_tree.get(key).context("Failed to get history")?;
+        Ok(bytes.map(|b| b.to_vec()))
     }
 
-    /// 保存用户的 Bloom Filter
-    pub fn save_user_filter(&self, uid: u64, filter: &BloomFilter) -> Result<()> {
-        let key = Self::u64_to_key(uid);
-        let bytes = filter.get_u8_array();
-        self.history_tree.insert(key, bytes).context("Failed to save history")?;
+    /// 一次写入多个用户的过滤器 (原子地应用为一个 batch)
+    pub fn save_user_histories(&self, histories: Vec<(u64, Vec<u8>)>) -> Result<()> {
+        let mut batch = sled::Batch::default();
+        for (uid, bytes) in histories {
+            batch.insert(&Self::u64_to_key(uid)[..], bytes);
+        }
+        self.history_tree.apply_batch(batch).context("Failed to save history")?;
         Ok(())
     }
 
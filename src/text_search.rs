@@ -7,9 +7,10 @@ use anyhow::Result;
 use crate::model::Item;
 
 pub struct TextSearch {
-    index: Index,
     reader: IndexReader,
     writer: Arc<Mutex<IndexWriter>>,
+    /// 只依赖 schema 与分词器，构造一次后所有查询共用
+    query_parser: QueryParser,
     fields: SchemaFields,
 }
 
@@ -24,7 +25,9 @@ impl TextSearch {
     pub fn new(index_path: &str) -> Result<Self> {
         let mut schema_builder = Schema::builder();
         
-        let id = schema_builder.add_u64_field("id", STORED);
+        // id 需要建索引: 更新和删除物品时按 id 删除旧文档；
+        // FAST 让搜索直接从列式存储读取 id，而不必解压存储的文档
+        let id = schema_builder.add_u64_field("id", INDEXED | STORED | FAST);
         let title = schema_builder.add_text_field("title", TEXT | STORED);
         let category = schema_builder.add_text_field("category", STRING | STORED);
         
@@ -33,21 +36,31 @@ impl TextSearch {
 
         std::fs::create_dir_all(index_path)?;
         
-        let index = Index::open_or_create(
+        let index = match Index::open_or_create(
             tantivy::directory::MmapDirectory::open(index_path)?,
             schema.clone()
-        )?;
+        ) {
+            Ok(index) => index,
+            Err(tantivy::TantivyError::SchemaError(_)) => {
+                // 旧版本 schema 建立的索引: 丢弃重建，启动时会从数据库重新写入全部物品
+                std::fs::remove_dir_all(index_path)?;
+                std::fs::create_dir_all(index_path)?;
+                Index::create_in_dir(index_path, schema.clone())?
+            }
+            Err(e) => return Err(e.into()),
+        };
         let writer = index.writer(50_000_000)?;
 
         let reader = index
             .reader_builder()
             .reload_policy(ReloadPolicy::OnCommitWithDelay)
             .try_into()?;
+        let query_parser = QueryParser::for_index(&index, vec![fields.title]);
 
         Ok(Self {
-            index,
             reader,
             writer: Arc::new(Mutex::new(writer)),
+            query_parser,
             fields,
         })
     }
@@ -65,6 +78,54 @@ impl TextSearch {
         Ok(())
     }
 
+    /// 插入或替换一个物品的文档并立即提交
+    pub fn upsert_item(&self, item: &Item) -> Result<()> {
+        let mut writer = self.writer.lock().map_err(|_| anyhow::anyhow!("Poisoned lock"))?;
+
+        writer.delete_term(Term::from_field_u64(self.fields.id, item.id));
+        writer.add_document(doc!(
+            self.fields.id => item.id as u64,
+            self.fields.title => item.name.clone(),
+            self.fields.category => item.category.clone()
+        ))?;
+        writer.commit()?;
+        Ok(())
+    }
+
+    /// 插入或替换一批物品的文档 (在下一次 commit 时生效)
+    pub fn upsert_items(&self, items: &[Item]) -> Result<()> {
+        let mut writer = self.writer.lock().map_err(|_| anyhow::anyhow!("Poisoned lock"))?;
+        for item in items {
+            writer.delete_term(Term::from_field_u64(self.fields.id, item.id));
+            writer.add_document(doc!(
+                self.fields.id => item.id as u64,
+                self.fields.title => item.name.clone(),
+                self.fields.category => item.category.clone()
+            ))?;
+        }
+        Ok(())
+    }
+
+    /// 删除一个物品的文档并立即提交
+    pub fn delete_item(&self, id: u64) -> Result<()> {
+        let mut writer = self.writer.lock().map_err(|_| anyhow::anyhow!("Poisoned lock"))?;
+        writer.delete_term(Term::from_field_u64(self.fields.id, id));
+        writer.commit()?;
+        Ok(())
+    }
+
+    /// 删除全部文档 (在下一次 commit 时生效)
+    pub fn clear(&self) -> Result<()> {
+        let mut writer = self.writer.lock().map_err(|_| anyhow::anyhow!("Poisoned lock"))?;
+        writer.delete_all_documents()?;
+        Ok(())
+    }
+
+    /// 已提交的文档数量
+    pub fn num_docs(&self) -> u64 {
+        self.reader.searcher().num_docs()
+    }
+
     pub fn commit(&self) -> Result<()> {
         let mut writer = self.writer.lock().map_err(|_| anyhow::anyhow!("Poisoned lock"))?;
         writer.commit()?;
@@ -72,22 +133,28 @@ impl TextSearch {
     }
 
     pub fn search(&self, query_str: &str, limit: usize) -> Result<Vec<u32>> {
+        Ok(self.search_scored(query_str, limit)?.into_iter().map(|(id, _)| id).collect())
+    }
+
+    /// 返回 (id, BM25 分数)，按分数降序，供需要原始分数的融合方式使用
+    pub fn search_scored(&self, query_str: &str, limit: usize) -> Result<Vec<(u32, f32)>> {
         let searcher = self.reader.searcher();
-        let query_parser = QueryParser::for_index(&self.index, vec![self.fields.title]);
-        
-        let query = query_parser.parse_query(query_str)?;
+        let query = self.query_parser.parse_query(query_str)?;
         let top_docs = searcher.search(&query, &TopDocs::with_limit(limit))?;
-        
-        let mut results = Vec::new();
-        for (_score, doc_address) in top_docs {
-            let retrieved_doc: TantivyDocument = searcher.doc(doc_address)?;
-            if let Some(id_val) = retrieved_doc.get_first(self.fields.id) {
-                if let Some(id) = id_val.as_u64() {
-                    results.push(id as u32);
-                }
+
+        // 每个段的 id 列只在第一次命中该段时打开
+        let mut id_columns: Vec<Option<_>> = (0..searcher.segment_readers().len()).map(|_| None).collect();
+        let mut results = Vec::with_capacity(top_docs.len());
+        for (score, doc_address) in top_docs {
+            let segment = doc_address.segment_ord as usize;
+            if id_columns[segment].is_none() {
+                id_columns[segment] = Some(searcher.segment_reader(doc_address.segment_ord).fast_fields().u64("id")?);
+            }
+            if let Some(id) = id_columns[segment].as_ref().and_then(|column| column.first(doc_address.doc_id)) {
+                results.push((id as u32, score));
             }
         }
-        
+
         Ok(results)
     }
 }